@@ -238,6 +238,7 @@ testScripts = [ RpcTest(t) for t in [
     'mempoolsync',
     'mempool_push',
     'httpbasics',
+    'metrics',
     'multi_rpc',
     'zapwallettxes',
     'proxy_test',
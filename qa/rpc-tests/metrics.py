@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 The Bitcoin Unlimited developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+import test_framework.loginit
+#
+# Test the Prometheus /metrics endpoint
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import re
+import threading
+import time
+import urllib.parse
+
+TYPE_LINE = re.compile(r'# TYPE ([a-zA-Z_:][a-zA-Z0-9_:]*) gauge$')
+SAMPLE_LINE = re.compile(r'([a-zA-Z_:][a-zA-Z0-9_:]*)(\{[^}]*\})? (\S+)$')
+
+def scrape(node, method='GET'):
+    url = urllib.parse.urlparse(node.url)
+    conn = http.client.HTTPConnection(url.hostname, url.port)
+    conn.request(method, '/metrics')
+    response = conn.getresponse()
+    body = response.read().decode('utf-8')
+    conn.close()
+    return response, body
+
+def parse(body):
+    """Check the page is well formed and return its samples by metric and labels"""
+    samples = {}
+    metric = None
+    for line in body.splitlines():
+        match = TYPE_LINE.match(line)
+        if match:
+            metric = match.group(1)
+            continue
+        match = SAMPLE_LINE.match(line)
+        assert match, "malformed line: " + line
+        assert_equal(match.group(1), metric)
+        samples[(metric, match.group(2) or '')] = float(match.group(3))
+    return samples
+
+class MetricsTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(2, self.options.tmpdir, [["-metrics"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        # only served when asked for
+        response, _ = scrape(self.nodes[1])
+        assert_equal(response.status, 404)
+        response, _ = scrape(self.nodes[0], 'POST')
+        assert_equal(response.status, 405)
+
+        response, body = scrape(self.nodes[0])
+        assert_equal(response.status, 200)
+        assert(response.getheader('Content-Type').startswith('text/plain; version=0.0.4'))
+        samples = parse(body)
+        assert(('membercoin_net_send_total', '{series="now"}') in samples)
+        assert_equal(samples[('membercoin_tweak', '{name="debug.lockProfiling"}')], 0)
+
+        # scrape as fast as we can while the node mines and relays blocks
+        stop = threading.Event()
+        def load():
+            while not stop.is_set():
+                self.nodes[0].generate(1)
+        loader = threading.Thread(target=load)
+        loader.start()
+        scrapes = 0
+        sent = 0
+        start = time.time()
+        try:
+            while time.time() - start < 10:
+                response, body = scrape(self.nodes[0])
+                assert_equal(response.status, 200)
+                samples = parse(body)
+                total = samples[('membercoin_net_send_total', '{series="total"}')] + \
+                        samples[('membercoin_net_send_total', '{series="now"}')]
+                assert(total >= sent)
+                sent = total
+                scrapes += 1
+        finally:
+            stop.set()
+            loader.join()
+        print("%d scrapes in 10s, %d series" % (scrapes, len(samples)))
+        assert(scrapes > 10)
+        self.sync_all()
+        assert(sent > 0)
+
+if __name__ == '__main__':
+    MetricsTest().main()
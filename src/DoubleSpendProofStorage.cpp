@@ -9,6 +9,7 @@
 #include <primitives/transaction.h>
 #include <utiltime.h>
 
+#include <algorithm>
 #include <limits>
 
 static constexpr int64_t SECONDS_TO_KEEP_ORPHANS = 90;
@@ -24,24 +25,39 @@ DoubleSpendProofStorage::DoubleSpendProofStorage() : m_recentRejects(120000, 0.0
 DoubleSpendProofStorage::~DoubleSpendProofStorage() { m_timer.cancel(); }
 DoubleSpendProof DoubleSpendProofStorage::proof(int proof) const
 {
-    LOCK(m_lock);
-    auto iter = m_proofs.find(proof);
-    if (iter != m_proofs.end())
-        return iter->second;
-    return DoubleSpendProof();
+    std::shared_ptr<const DoubleSpendProof> dsp;
+    {
+        READLOCK(m_lock);
+        auto iter = m_proofs.find(proof);
+        if (iter == m_proofs.end())
+            return DoubleSpendProof();
+        dsp = iter->second;
+    }
+    return *dsp;
 }
 
 std::pair<bool, int32_t> DoubleSpendProofStorage::add(const DoubleSpendProof &proof)
 {
-    LOCK(m_lock);
+    WRITELOCK(m_lock);
+    return _add(proof);
+}
+
+std::pair<bool, int32_t> DoubleSpendProofStorage::_add(const DoubleSpendProof &proof)
+{
+    AssertWriteLockHeld(m_lock);
 
     uint256 hash = proof.GetHash();
     auto lookupIter = m_dspIdLookupTable.find(hash);
     if (lookupIter != m_dspIdLookupTable.end())
     {
-        claimOrphan(lookupIter->second);
+        _claimOrphan(lookupIter->second);
         return {false, lookupIter->second};
     }
+    if (m_proofs.size() >= MAX_DSPROOFS)
+    {
+        LOG(DSPROOF, "DSProof storage is full, dropping proof %s\n", hash.ToString());
+        return {false, -1};
+    }
 
     auto iter = m_proofs.find(m_nextId);
     while (iter != m_proofs.end())
@@ -50,7 +66,7 @@ std::pair<bool, int32_t> DoubleSpendProofStorage::add(const DoubleSpendProof &pr
             m_nextId = 1;
         iter = m_proofs.find(m_nextId);
     }
-    m_proofs.emplace(m_nextId, proof);
+    m_proofs.emplace(m_nextId, std::make_shared<const DoubleSpendProof>(proof));
     m_dspIdLookupTable.emplace(hash, m_nextId);
 
     return {true, m_nextId++};
@@ -58,128 +74,146 @@ std::pair<bool, int32_t> DoubleSpendProofStorage::add(const DoubleSpendProof &pr
 
 void DoubleSpendProofStorage::addOrphan(const DoubleSpendProof &proof, NodeId peerId)
 {
-    LOCK(m_lock);
-    const auto res = add(proof);
-    if (!res.first) // it was already in the storage
+    WRITELOCK(m_lock);
+    // make room by evicting the oldest orphan, which is the next one to expire anyway
+    _trimOrphanQueue();
+    if (m_orphans.size() >= MAX_DSPROOF_ORPHANS && !m_orphanQueue.empty())
+    {
+        LOG(DSPROOF, "Too many DSProof orphans, evicting orphan %d\n", m_orphanQueue.front());
+        _remove(m_orphanQueue.front());
+        _trimOrphanQueue();
+    }
+
+    const auto res = _add(proof);
+    if (!res.first) // it was already in the storage, or the storage is full
         return;
 
     const int32_t id = res.second;
-    m_orphans.emplace(id, std::make_pair(peerId, GetTime()));
-    m_prevTxIdLookupTable[proof.prevTxId().GetCheapHash()].push_back(id);
+    const COutPoint prevOut(proof.prevTxId(), proof.prevOutIndex());
+    m_orphans.emplace(id, OrphanInfo{peerId, GetTime(), prevOut});
+    m_orphanQueue.push_back(id);
+    m_orphansByPrevOut[prevOut].push_back(id);
+    m_nOrphans = m_orphans.size();
 }
 
 std::list<std::pair<int, int> > DoubleSpendProofStorage::findOrphans(const COutPoint &prevOut)
 {
     std::list<std::pair<int, int> > answer;
-    LOCK(m_lock);
-    auto iter = m_prevTxIdLookupTable.find(prevOut.hash.GetCheapHash());
-    if (iter == m_prevTxIdLookupTable.end())
+    // This is called for every input of every transaction we admit, and nearly always there are no orphans
+    // at all, in which case we don't need to take the lock.
+    if (m_nOrphans.load(std::memory_order_relaxed) == 0)
         return answer;
 
-    std::deque<int> &q = iter->second;
-    for (auto proofId = q.begin(); proofId != q.end(); ++proofId)
+    READLOCK(m_lock);
+    auto iter = m_orphansByPrevOut.find(prevOut);
+    if (iter == m_orphansByPrevOut.end())
+        return answer;
+
+    for (const int32_t proofId : iter->second)
     {
-        auto proofIter = m_proofs.find(*proofId);
-        DbgAssert(proofIter != m_proofs.end(), );
-        if (proofIter != m_proofs.end())
-        {
-            if (proofIter->second.prevOutIndex() != int(prevOut.n))
-                continue;
-            if (proofIter->second.prevTxId() == prevOut.hash)
-            {
-                auto orphanIter = m_orphans.find(*proofId);
-                if (orphanIter != m_orphans.end())
-                {
-                    answer.emplace_back(*proofId, orphanIter->second.first);
-                }
-            }
-        }
-        else
-            LOG(DSPROOF, "ERROR: no dsproofs found in m_proofs\n");
+        auto orphanIter = m_orphans.find(proofId);
+        DbgAssert(orphanIter != m_orphans.end(), continue);
+        answer.emplace_back(proofId, orphanIter->second.peerId);
     }
     return answer;
 }
 
-int DoubleSpendProofStorage::orphanCount(int proofId) { return m_orphans.count(proofId); }
+int DoubleSpendProofStorage::orphanCount(int proofId)
+{
+    READLOCK(m_lock);
+    return m_orphans.count(proofId);
+}
+
 void DoubleSpendProofStorage::claimOrphan(int proofId)
 {
-    LOCK(m_lock);
+    WRITELOCK(m_lock);
+    _claimOrphan(proofId);
+}
+
+void DoubleSpendProofStorage::_claimOrphan(int proofId)
+{
+    AssertWriteLockHeld(m_lock);
     auto orphan = m_orphans.find(proofId);
-    if (orphan != m_orphans.end())
+    if (orphan == m_orphans.end())
+        return;
+
+    auto lookup = m_orphansByPrevOut.find(orphan->second.prevOut);
+    DbgAssert(lookup != m_orphansByPrevOut.end(), );
+    if (lookup != m_orphansByPrevOut.end())
     {
-        m_orphans.erase(orphan);
+        std::vector<int32_t> &ids = lookup->second;
+        ids.erase(std::remove(ids.begin(), ids.end(), proofId), ids.end());
+        if (ids.empty())
+            m_orphansByPrevOut.erase(lookup);
+    }
+    m_orphans.erase(orphan);
+    m_nOrphans = m_orphans.size();
 
-        for (auto iter = m_prevTxIdLookupTable.begin(); iter != m_prevTxIdLookupTable.end(); ++iter)
+    // claimed orphans are normally found at random positions in the queue, so only compact it once
+    // it is mostly made up of them
+    if (m_orphanQueue.size() > 2 * m_orphans.size() + 64)
+    {
+        std::deque<int32_t> queue;
+        for (const int32_t id : m_orphanQueue)
         {
-            auto &list = iter->second;
-            for (auto i = list.begin(); i != list.end(); ++i)
-            {
-                if (*i == proofId)
-                {
-                    list.erase(i);
-                    if (list.size() == 0)
-                        m_prevTxIdLookupTable.erase(iter);
-                    return;
-                }
-            }
+            if (m_orphans.count(id))
+                queue.push_back(id);
         }
+        m_orphanQueue.swap(queue);
     }
 }
 
+void DoubleSpendProofStorage::_trimOrphanQueue()
+{
+    AssertWriteLockHeld(m_lock);
+    while (!m_orphanQueue.empty() && !m_orphans.count(m_orphanQueue.front()))
+        m_orphanQueue.pop_front();
+}
+
 void DoubleSpendProofStorage::remove(int proof)
 {
-    LOCK(m_lock);
+    WRITELOCK(m_lock);
+    _remove(proof);
+}
+
+void DoubleSpendProofStorage::_remove(int proof)
+{
+    AssertWriteLockHeld(m_lock);
     auto iter = m_proofs.find(proof);
     if (iter == m_proofs.end())
         return;
 
-    auto orphan = m_orphans.find(iter->first);
-    if (orphan != m_orphans.end())
-    {
-        m_orphans.erase(orphan);
-        auto orphanLookup = m_prevTxIdLookupTable.find(iter->second.prevTxId().GetCheapHash());
-        if (orphanLookup != m_prevTxIdLookupTable.end())
-        {
-            std::deque<int> &queue = orphanLookup->second;
-            if (queue.size() == 1)
-            {
-                DbgAssert(queue.front() == proof, );
-                if (queue.front() != proof)
-                    LOG(DSPROOF, "ERROR: queue front did not equal dsproof\n");
-                m_prevTxIdLookupTable.erase(orphanLookup);
-            }
-            else
-            {
-                for (auto i = queue.begin(); i != queue.end(); ++i)
-                {
-                    if (*i == proof)
-                    {
-                        i = queue.erase(i);
-                    }
-                }
-            }
-        }
-    }
-    auto hash = iter->second.GetHash();
-    m_dspIdLookupTable.erase(hash);
+    _claimOrphan(proof);
+    m_dspIdLookupTable.erase(iter->second->GetHash());
     m_proofs.erase(iter);
 }
 
 DoubleSpendProof DoubleSpendProofStorage::lookup(const uint256 &proofId) const
 {
-    LOCK(m_lock);
-    auto lookupIter = m_dspIdLookupTable.find(proofId);
-    if (lookupIter == m_dspIdLookupTable.end())
-        return DoubleSpendProof();
-    return m_proofs.at(lookupIter->second);
+    std::shared_ptr<const DoubleSpendProof> dsp;
+    {
+        READLOCK(m_lock);
+        auto lookupIter = m_dspIdLookupTable.find(proofId);
+        if (lookupIter == m_dspIdLookupTable.end())
+            return DoubleSpendProof();
+        dsp = m_proofs.at(lookupIter->second);
+    }
+    return *dsp;
 }
 
 bool DoubleSpendProofStorage::exists(const uint256 &proofId) const
 {
-    LOCK(m_lock);
+    READLOCK(m_lock);
     return m_dspIdLookupTable.find(proofId) != m_dspIdLookupTable.end();
 }
 
+size_t DoubleSpendProofStorage::size() const
+{
+    READLOCK(m_lock);
+    return m_proofs.size();
+}
+
+size_t DoubleSpendProofStorage::orphanSize() const { return m_nOrphans.load(); }
 void DoubleSpendProofStorage::periodicCleanup(const boost::system::error_code &error)
 {
     if (error)
@@ -187,43 +221,43 @@ void DoubleSpendProofStorage::periodicCleanup(const boost::system::error_code &e
     m_timer.expires_from_now(boost::posix_time::minutes(1));
     m_timer.async_wait(std::bind(&DoubleSpendProofStorage::periodicCleanup, this, std::placeholders::_1));
 
-    LOCK(m_lock);
-    auto expire = GetTime() - SECONDS_TO_KEEP_ORPHANS;
-    auto iter = m_orphans.begin();
-    while (iter != m_orphans.end())
+    // orphans expire in the order they arrived, so we only need to look at the front of the queue
+    std::vector<NodeId> vMisbehaving;
     {
-        if (iter->second.second <= expire)
+        WRITELOCK(m_lock);
+        auto expire = GetTime() - SECONDS_TO_KEEP_ORPHANS;
+        _trimOrphanQueue();
+        while (!m_orphanQueue.empty())
         {
-            const int peerId = iter->second.first;
-            const int proofId = iter->first;
-            iter = m_orphans.erase(iter);
-            remove(proofId);
-
-            dosMan.Misbehaving(peerId, 1);
-        }
-        else
-        {
-            ++iter;
+            auto orphan = m_orphans.find(m_orphanQueue.front());
+            if (orphan->second.nTime > expire)
+                break;
+            vMisbehaving.push_back(orphan->second.peerId);
+            _remove(orphan->first);
+            _trimOrphanQueue();
         }
+        LOG(DSPROOF, "DSP orphan count: %d DSProof count: %d\n", m_orphans.size(), m_proofs.size());
     }
-    LOG(DSPROOF, "DSP orphan count: %d DSProof count: %d\n", m_orphans.size(), m_proofs.size());
+
+    for (const NodeId peerId : vMisbehaving)
+        dosMan.Misbehaving(peerId, 1);
 }
 
 bool DoubleSpendProofStorage::isRecentlyRejectedProof(const uint256 &proofHash) const
 {
-    LOCK(m_lock);
+    READLOCK(m_lock);
     return m_recentRejects.contains(proofHash);
 }
 
 void DoubleSpendProofStorage::markProofRejected(const uint256 &proofHash)
 {
-    LOCK(m_lock);
+    WRITELOCK(m_lock);
     m_recentRejects.insert(proofHash);
 }
 
 void DoubleSpendProofStorage::newBlockFound()
 {
-    LOCK(m_lock);
+    WRITELOCK(m_lock);
     m_recentRejects.reset();
 }
 
@@ -6,19 +6,26 @@
 
 #include "DoubleSpendProof.h"
 #include "bloom.h"
+#include "coins.h"
 #include "net.h"
 
 #include <boost/asio.hpp>
 
+#include <atomic>
 #include <deque>
-#include <map>
-#include <mutex>
-#include <set>
+#include <list>
+#include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 class COutPoint;
 
+/** Most proofs we keep at any one time; anything beyond that is dropped rather than stored */
+static const size_t MAX_DSPROOFS = 50000;
+/** Most orphan proofs we keep; the oldest one is evicted to make room for a new one */
+static const size_t MAX_DSPROOF_ORPHANS = 5000;
+
 class DoubleSpendProofStorage
 {
 public:
@@ -57,13 +64,39 @@ public:
     void markProofRejected(const uint256 &proofHash);
     void newBlockFound();
 
+    //! Number of proofs and orphans currently held
+    size_t size() const;
+    size_t orphanSize() const;
+
 private:
-    // m_lock guards all the following data structures
-    mutable CCriticalSection m_lock;
+    std::pair<bool, int32_t> _add(const DoubleSpendProof &proof);
+    void _remove(int proof);
+    void _claimOrphan(int proofId);
+    /** Drop orphans that were claimed or removed from the front of the arrival queue */
+    void _trimOrphanQueue();
+
+    struct OrphanInfo
+    {
+        NodeId peerId;
+        int64_t nTime;
+        COutPoint prevOut;
+    };
+
+    // m_lock guards all the following data structures.  Lookups only take it shared so that admission
+    // threads checking for conflicts do not queue up behind each other during a respend flood.
+    mutable CSharedCriticalSection m_lock;
 
-    std::map<int32_t, DoubleSpendProof> m_proofs;
+    // proofs are immutable once stored, so readers take a reference and copy it outside of the lock
+    std::unordered_map<int32_t, std::shared_ptr<const DoubleSpendProof> > m_proofs;
     int m_nextId = 1;
-    std::map<int, std::pair<NodeId, int64_t> > m_orphans;
+    std::unordered_map<int32_t, OrphanInfo> m_orphans;
+    //! orphan ids in order of arrival, which is also the order in which they expire.  Claimed or removed
+    //! orphans are left behind and skipped when they reach the front.
+    std::deque<int32_t> m_orphanQueue;
+    //! orphans by the outpoint they double spend
+    std::unordered_map<COutPoint, std::vector<int32_t>, SaltedOutpointHasher> m_orphansByPrevOut;
+    //! copy of m_orphans.size() so the common case of there being no orphans needs no lock at all
+    std::atomic<size_t> m_nOrphans{0};
 
     //! A salted hasher for use with the uint256 type in the LookupTable below.
     //! This code is inspired by txmempool.h's SaltedTxidHasher
@@ -78,7 +111,6 @@ private:
     using LookupTable = std::unordered_map<uint256, int32_t, SaltedHasher>;
 
     LookupTable m_dspIdLookupTable;
-    std::map<uint64_t, std::deque<int> > m_prevTxIdLookupTable;
 
     CRollingBloomFilter m_recentRejects;
 
@@ -8,11 +8,13 @@
 #include "allowed_args.h"
 #include "bench/bench_constants.h"
 #include "blockstorage/blockstorage.h"
+#include "blockstorage/coldfiles.h"
 #include "chainparams.h"
 #include "dosman.h"
 #include "httpserver.h"
 #include "init.h"
 #include "main.h"
+#include "metrics.h"
 #include "miner.h"
 #include "netbase.h"
 #include "policy/policy.h"
@@ -271,14 +273,23 @@ static void addGeneralOptions(AllowedArgs &allowedArgs, HelpMessageMode mode)
             _("Execute command when the best block changes (%s in cmd is replaced by block hash)"))
         .addDebugArg("blocksonly", optionalBool,
             strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY))
-        .addArg("useblockdb", optionalBool,
-            strprintf(_("Which method to store blocks on disk (default: %u) 0 = sequential files, 1 = blockdb"),
+        .addArg("useblockdb=<n>", optionalInt,
+            strprintf(_("Which method to store blocks on disk (default: %u) 0 = sequential files, 1 = blockdb, "
+                        "2 = append-only block log"),
                     DEFAULT_BLOCK_DB_MODE))
         .addArg("checkblocks=<n>", requiredInt,
             strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS))
         .addArg("checklevel=<n>", requiredInt,
             strprintf(
                     _("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL))
+        .addArg("coldblocks=<n>", requiredInt,
+            strprintf(_("Compress block and undo files once all their blocks are more than <n> blocks deep. "
+                        "Blocks are decompressed when they are read, e.g. to serve them to peers "
+                        "(default: %u = disable, >=%u = depth in blocks)"),
+                    DEFAULT_COLD_BLOCK_DEPTH, MIN_BLOCKS_TO_KEEP))
+        .addArg("compactundo", optionalBool,
+            strprintf(_("Write undo data in the compact format, which versions without it can not read (default: %u)"),
+                    DEFAULT_COMPACT_UNDO))
         .addDebugArg("dumpforks", optionalBool, _("Dump built-in fork deployment data in CSV format and exit"));
 
 #ifndef WIN32
@@ -319,6 +330,13 @@ static void addGeneralOptions(AllowedArgs &allowedArgs, HelpMessageMode mode)
                         "Warning: Reverting this setting requires re-downloading the entire blockchain. "
                         "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"),
                     MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024))
+        .addArg("pruneage=<n>", requiredInt,
+            _("With -prune, also delete block files once all their blocks are more than <n> days older than the tip, "
+              "whatever their size (default: 0 = off)"))
+        .addArg("prunedepth=<n>", requiredInt,
+            strprintf(_("With -prune, also delete block files once all their blocks are more than <n> blocks below the "
+                        "tip, whatever their size (default: 0 = off, otherwise at least %u)"),
+                    MIN_BLOCKS_TO_KEEP))
         .addArg("reindex", optionalBool, _("Rebuild block chain index from current blk000??.dat files on startup"))
         .addArg("txindex", optionalBool,
             strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"),
@@ -571,6 +589,10 @@ static void addDebuggingOptions(AllowedArgs &allowedArgs, HelpMessageMode mode)
             strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool "
                       "descendants (default: %u).",
                          BU_DEFAULT_DESCENDANT_SIZE_LIMIT))
+        .addDebugArg("limitclustercount=<n>", requiredInt,
+            strprintf("Do not accept transactions that would make a group of more than <n> connected "
+                      "in-mempool transactions (default: %u)",
+                         DEFAULT_CLUSTER_LIMIT))
         .addArg("debug=<category>", optionalStr,
             strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
                 _("If <category> is not supplied or if <category> = 1, output all debugging information. ") +
@@ -580,6 +602,10 @@ static void addDebuggingOptions(AllowedArgs &allowedArgs, HelpMessageMode mode)
         .addArg("genproclimit=<n>", requiredInt,
             strprintf(_("Set the number of threads for coin generation if enabled (-1 = all cores, default: %d)"),
                     DEFAULT_GENERATE_THREADS))
+        .addArg("logasync", optionalBool,
+            strprintf(_("Write debug.log from a separate thread, dropping lines if it falls behind.  Lines not yet "
+                        "written are lost if the node crashes (default: %u)"),
+                    DEFAULT_LOGASYNC))
         .addArg(
             "logips", optionalBool, strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS))
         .addArg("logtimestamps", optionalBool,
@@ -701,6 +727,9 @@ static void addRpcServerOptions(AllowedArgs &allowedArgs)
     allowedArgs.addHeader(_("RPC server options:"))
         .addArg("server", optionalBool, _("Accept command line and JSON-RPC commands"), true)
         .addArg("rest", optionalBool, strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE))
+        .addArg("metrics", optionalBool,
+            strprintf(_("Serve statistics and tweaks to Prometheus at /metrics on the RPC port (default: %u)"),
+                     DEFAULT_METRICS_ENABLE))
         .addArg("rpcbind=<addr>", requiredStr,
             _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This "
               "option can be specified multiple times (default: bind to all interfaces)"))
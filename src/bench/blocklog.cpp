@@ -0,0 +1,138 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include "blockstorage/blockleveldb.h"
+#include "blockstorage/blocklog.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+
+#include <cassert>
+#include <memory>
+
+// Block storage during a reindex or IBD: every block is written once, and read back once to be connected.  The
+// block log appends each block to a segment file once; the block db hands it to leveldb, which writes it to its
+// journal, again into a table file and copies it around in compactions after that.
+
+static const int BLOCKS_PER_FLUSH = 16;
+static const int REINDEX_BLOCKS = 64;
+
+static fs::path BenchDir()
+{
+    fs::path dir = fs::temp_directory_path() /
+                   strprintf("bench_blocklog_%lu_%i", (unsigned long)GetTime(), GetRandInt(1 << 30));
+    fs::create_directories(dir);
+    // the block db can only live in the data dir
+    mapArgs["-datadir"] = dir.string();
+    ClearDatadirCache();
+    return dir;
+}
+
+// Copies of a ~1MB mainnet block that differ in their nonce, so they all get their own place in the store
+struct BenchBlocks
+{
+    CBlock block;
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex> indexes;
+
+    BenchBlocks()
+    {
+        CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+        stream >> block;
+    }
+    const CBlock &Next()
+    {
+        block.nNonce++;
+        indexes.emplace_back(block);
+        hashes.push_back(block.GetHash());
+        return block;
+    }
+    // the index entries point into hashes, which may have moved while we were adding to it
+    const CBlockIndex *Index(size_t i)
+    {
+        indexes[i].phashBlock = &hashes[i];
+        return &indexes[i];
+    }
+};
+
+template <typename DB>
+static void WriteBlocks(benchmark::State &state, DB &db)
+{
+    BenchBlocks blocks;
+    int n = 0;
+    while (state.KeepRunning())
+    {
+        bool fOk = db.WriteBlock(blocks.Next());
+        assert(fOk);
+        // where FlushStateToDisk would come by
+        if (++n % BLOCKS_PER_FLUSH == 0)
+            db.Flush();
+    }
+    db.Flush();
+}
+
+template <typename DB>
+static void ReindexBlocks(benchmark::State &state, DB &db)
+{
+    BenchBlocks blocks;
+    for (int i = 0; i < REINDEX_BLOCKS; i++)
+        db.WriteBlock(blocks.Next());
+    db.Flush();
+    size_t n = 0;
+    while (state.KeepRunning())
+    {
+        CBlock block;
+        bool fOk = db.ReadBlock(blocks.Index(n++ % REINDEX_BLOCKS), block);
+        assert(fOk);
+    }
+}
+
+static void BlockLogWrite(benchmark::State &state)
+{
+    fs::path dir = BenchDir();
+    {
+        CBlockLogDB db(dir / "log");
+        WriteBlocks(state, db);
+    }
+    fs::remove_all(dir);
+}
+
+static void BlockLogReindex(benchmark::State &state)
+{
+    fs::path dir = BenchDir();
+    {
+        CBlockLogDB db(dir / "log");
+        ReindexBlocks(state, db);
+    }
+    fs::remove_all(dir);
+}
+
+static void BlockLevelDBWrite(benchmark::State &state)
+{
+    fs::path dir = BenchDir();
+    {
+        CBlockLevelDB db(64 << 20, 8 << 20, false, false, false);
+        WriteBlocks(state, db);
+    }
+    fs::remove_all(dir);
+}
+
+static void BlockLevelDBReindex(benchmark::State &state)
+{
+    fs::path dir = BenchDir();
+    {
+        CBlockLevelDB db(64 << 20, 8 << 20, false, false, false);
+        ReindexBlocks(state, db);
+    }
+    fs::remove_all(dir);
+}
+
+BENCHMARK(BlockLogWrite, 200);
+BENCHMARK(BlockLogReindex, 500);
+BENCHMARK(BlockLevelDBWrite, 200);
+BENCHMARK(BlockLevelDBReindex, 500);
@@ -0,0 +1,141 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "DoubleSpendProof.h"
+#include "DoubleSpendProofStorage.h"
+#include "bench.h"
+#include "random.h"
+#include "respend/respendaction.h"
+#include "respend/respenddetector.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+class NullRespendAction : public respend::RespendAction
+{
+public:
+    bool AddOutpointConflict(const COutPoint &, const uint256, const CTransactionRef, bool, bool) override
+    {
+        return false;
+    }
+    bool IsInteresting() const override { return false; }
+    void SetValid(bool) override {}
+    void Trigger(CTxMemPool &) override {}
+};
+} // namespace
+
+// A proof for the given outpoint that is well formed but does not prove anything, which is all the storage
+// needs to know about it.
+static DoubleSpendProof MakeProof(const COutPoint &prevOut, uint32_t nonce)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << prevOut.hash << (int32_t)prevOut.n;
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        ss << (uint32_t)2 << (uint32_t)(nonce + i) << (uint32_t)0 << GetRandHash() << GetRandHash() << GetRandHash();
+        ss << std::vector<std::vector<uint8_t> >(1, std::vector<uint8_t>(72, (uint8_t)i));
+    }
+    DoubleSpendProof dsp;
+    ss >> dsp;
+    return dsp;
+}
+
+static void AddTx(const CTransactionRef &tx, CTxMemPool &pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(
+        tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 10.0, 1, pool.HasNoInputsOf(tx), tx->GetValueOut(), false, 4, lp));
+}
+
+// Orphan proofs arriving faster than the transactions they refer to: every round adds an orphan for a new
+// outpoint to a full orphan table, looks it up the way admission does and claims every other one.
+static void DspOrphanStorm(benchmark::State &state)
+{
+    CTxMemPool pool;
+    DoubleSpendProofStorage *storage = pool.doubleSpendProofStorage();
+    for (uint32_t i = 0; i < MAX_DSPROOF_ORPHANS; i++)
+        storage->addOrphan(MakeProof(COutPoint(GetRandHash(), i % 4), i), i % 8);
+
+    std::vector<DoubleSpendProof> vProofs;
+    for (uint32_t i = 0; i < 4096; i++)
+        vProofs.push_back(MakeProof(COutPoint(GetRandHash(), 0), i));
+
+    uint64_t n = 0;
+    while (state.KeepRunning())
+    {
+        const DoubleSpendProof &dsp = vProofs[n % vProofs.size()];
+        storage->addOrphan(dsp, n % 8);
+        auto orphans = storage->findOrphans(COutPoint(dsp.prevTxId(), dsp.prevOutIndex()));
+        if (n & 1)
+        {
+            for (const auto &orphan : orphans)
+                storage->claimOrphan(orphan.first);
+        }
+        n++;
+    }
+}
+
+// A flood of respends checked by the admission threads while proofs for other outpoints keep arriving from the
+// network, so that the conflict check has to go through the orphan table and compete with writers for the lock.
+static void RespendStorm(benchmark::State &state)
+{
+    CTxMemPool pool;
+    DoubleSpendProofStorage *storage = pool.doubleSpendProofStorage();
+
+    const size_t nTxs = 1000;
+    std::vector<CTransactionRef> vRespends;
+    for (size_t i = 0; i < nTxs; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        AddTx(MakeTransactionRef(tx), pool);
+
+        tx.vout[0].nValue = 9 * COIN;
+        vRespends.push_back(MakeTransactionRef(tx));
+    }
+    for (uint32_t i = 0; i < MAX_DSPROOF_ORPHANS / 2; i++)
+        storage->addOrphan(MakeProof(COutPoint(GetRandHash(), 0), i), 1);
+
+    std::atomic<bool> fStop{false};
+    std::vector<std::thread> vThreads;
+    for (int t = 0; t < 2; t++)
+    {
+        vThreads.emplace_back([storage, &fStop, t]() {
+            uint32_t i = 0;
+            while (!fStop)
+            {
+                DoubleSpendProof dsp = MakeProof(COutPoint(GetRandHash(), 0), i++);
+                if (t == 0)
+                    storage->addOrphan(dsp, 2);
+                else
+                    storage->exists(dsp.GetHash());
+            }
+        });
+    }
+
+    std::vector<respend::RespendActionPtr> vActions{std::make_shared<NullRespendAction>()};
+    uint64_t n = 0;
+    while (state.KeepRunning())
+    {
+        respend::RespendDetector detector(pool, vRespends[n % nTxs], vActions);
+        n++;
+    }
+
+    fStop = true;
+    for (std::thread &thread : vThreads)
+        thread.join();
+}
+
+BENCHMARK(DspOrphanStorm, 50 * 1000);
+BENCHMARK(RespendStorm, 50 * 1000);
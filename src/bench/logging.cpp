@@ -0,0 +1,106 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include "fs.h"
+#include "logwriter.h"
+#include "random.h"
+#include "tinyformat.h"
+#include "utiltime.h"
+
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Logging a -debug=net style line from the thread being measured alone and while three more threads log as fast
+// as they can.  The locked sink is how debug.log was written before the async writer: every line takes the log
+// mutex and is written to the unbuffered file by the thread that logs it.  The async sink only costs the logging
+// thread the formatting and a push; what it measures is the time a message handler spends logging.
+
+static const int LINES_PER_ITERATION = 100;
+static const int CONTENDING_THREADS = 3;
+
+class BenchLogFile
+{
+public:
+    fs::path path;
+    FILE *file;
+
+    BenchLogFile()
+    {
+        path = fs::temp_directory_path() /
+               strprintf("bench_logging_%lu_%i.log", (unsigned long)GetTime(), GetRandInt(1 << 30));
+        file = fsbridge::fopen(path, "a");
+        setbuf(file, nullptr);
+    }
+    ~BenchLogFile()
+    {
+        fclose(file);
+        fs::remove(path);
+    }
+};
+
+class LockedSink
+{
+    BenchLogFile log;
+    boost::mutex cs_log;
+
+public:
+    void Write(std::string &&str)
+    {
+        boost::mutex::scoped_lock lock(cs_log);
+        fwrite(str.data(), 1, str.size(), log.file);
+    }
+};
+
+class AsyncSink
+{
+    BenchLogFile log;
+    CAsyncLogWriter writer;
+
+public:
+    AsyncSink() : writer([this](const std::string &str) { fwrite(str.data(), 1, str.size(), log.file); }) {}
+    ~AsyncSink() { writer.Stop(); }
+    void Write(std::string &&str) { writer.Push(std::move(str)); }
+};
+
+static std::string FormatLine(int n)
+{
+    return tfm::format("2024-01-01 00:00:00 received: inv (%u bytes) peer=%d %s\n", 37 * n, n % 125,
+        "0000000000000000000b3f7a5c2d8e1f4a6b9c0d2e5f8a1b4c7d0e3f6a9b2c5d");
+}
+
+template <typename Sink>
+static void LogLines(benchmark::State &state, int nContending)
+{
+    Sink sink;
+    std::atomic<bool> fStop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nContending; i++)
+        threads.emplace_back([&sink, &fStop]() {
+            for (int n = 0; !fStop; n++)
+                sink.Write(FormatLine(n));
+        });
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < LINES_PER_ITERATION; i++)
+            sink.Write(FormatLine(i));
+    }
+    fStop = true;
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+static void LogWriteLocked(benchmark::State &state) { LogLines<LockedSink>(state, 0); }
+static void LogWriteAsync(benchmark::State &state) { LogLines<AsyncSink>(state, 0); }
+static void LogWriteLockedContended(benchmark::State &state) { LogLines<LockedSink>(state, CONTENDING_THREADS); }
+static void LogWriteAsyncContended(benchmark::State &state) { LogLines<AsyncSink>(state, CONTENDING_THREADS); }
+BENCHMARK(LogWriteLocked, 100);
+BENCHMARK(LogWriteAsync, 100);
+BENCHMARK(LogWriteLockedContended, 100);
+BENCHMARK(LogWriteAsyncContended, 100);
@@ -2,9 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "bench.h"
 #include "txmempool.h"
 
+#include <vector>
+
 static void AddTx(const CTransactionRef &tx, const CAmount &nFee, CTxMemPool &pool)
 {
     int64_t nTime = 0;
@@ -116,3 +119,86 @@ static void MempoolEviction(benchmark::State &state)
 }
 
 BENCHMARK(MempoolEviction, 41000);
+
+// Build a mempool sized set of transactions made up of short chains: each "root" spends a confirmed
+// outpoint and fans out into a few children, which is closer to real mempool shape than a handful of
+// independent transactions and exercises the parent/child links and the outpoint index.
+static std::vector<CTransactionRef> CreateChains(size_t nRoots, size_t nChildren, size_t nOffset)
+{
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(nRoots * (nChildren + 1));
+    for (size_t i = 0; i < nRoots; i++)
+    {
+        CMutableTransaction root;
+        root.vin.resize(1);
+        root.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(nOffset + i + 1)), 0);
+        root.vin[0].scriptSig = CScript() << OP_1;
+        root.vout.resize(nChildren);
+        for (size_t j = 0; j < nChildren; j++)
+        {
+            root.vout[j].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            root.vout[j].nValue = COIN;
+        }
+        const CTransactionRef root_r{MakeTransactionRef(root)};
+        vtx.push_back(root_r);
+
+        for (size_t j = 0; j < nChildren; j++)
+        {
+            CMutableTransaction child;
+            child.vin.resize(1);
+            child.vin[0].prevout = COutPoint(root_r->GetHash(), j);
+            child.vin[0].scriptSig = CScript() << OP_2;
+            child.vout.resize(1);
+            child.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            child.vout[0].nValue = COIN / 2;
+            vtx.push_back(MakeTransactionRef(child));
+        }
+    }
+    return vtx;
+}
+
+// Add and then remove 10000 transactions, measuring the throughput of the mempool indexes.
+static void MempoolAddRemove(benchmark::State &state)
+{
+    const size_t nRoots = 2000;
+    const size_t nChildren = 4;
+    std::vector<CTransactionRef> vtx = CreateChains(nRoots, nChildren, 0);
+
+    CTxMemPool pool;
+    while (state.KeepRunning())
+    {
+        for (size_t i = 0; i < vtx.size(); i++)
+            AddTx(vtx[i], 1000LL + i, pool);
+
+        // Removing a root also removes its children
+        for (size_t i = 0; i < vtx.size(); i += nChildren + 1)
+            pool.Remove(vtx[i]->GetHash());
+    }
+}
+
+// Eviction from a large mempool, which takes the lowest feerate chunk and only re-linearizes the clusters
+// touched since the last trim. Each iteration adds one new chain and then trims the pool back to its starting
+// size.
+static void MempoolTrimLarge(benchmark::State &state)
+{
+    const size_t nChildren = 4;
+    std::vector<CTransactionRef> vtx = CreateChains(10000, nChildren, 0);
+    std::vector<CTransactionRef> vtxRefill = CreateChains(10000, nChildren, 10000);
+
+    CTxMemPool pool;
+    for (size_t i = 0; i < vtx.size(); i++)
+        AddTx(vtx[i], 1000LL + i, pool);
+
+    const size_t nUsage = pool.DynamicMemoryUsage();
+    size_t nNext = 0;
+    while (state.KeepRunning())
+    {
+        for (size_t i = 0; i <= nChildren; i++)
+            AddTx(vtxRefill[(nNext + i) % vtxRefill.size()], 1000LL, pool);
+        nNext += nChildren + 1;
+        pool.TrimToSize(nUsage);
+    }
+}
+
+BENCHMARK(MempoolAddRemove, 10);
+BENCHMARK(MempoolTrimLarge, 2000);
@@ -0,0 +1,82 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include "stat.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counting into a summed statistic, such as the bytes sent and received, from the thread being measured alone and
+// while three more threads count into the same statistic.  LockedStat is how CStatHistory counted before its sums
+// were sharded: every update took the statistic's mutex.
+
+static const int UPDATES_PER_ITERATION = 1000;
+static const int CONTENDING_THREADS = 3;
+
+class LockedStat
+{
+    std::mutex cs_stat;
+    uint64_t value = 0;
+
+public:
+    LockedStat &operator<<(uint64_t rhs)
+    {
+        std::lock_guard<std::mutex> lock(cs_stat);
+        value += rhs;
+        return *this;
+    }
+};
+
+template <typename Stat>
+static void CountStat(benchmark::State &state, Stat &stat, int nContending)
+{
+    std::atomic<bool> fStop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nContending; i++)
+        threads.emplace_back([&stat, &fStop]() {
+            while (!fStop)
+                stat << 100;
+        });
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < UPDATES_PER_ITERATION; i++)
+            stat << 100;
+    }
+    fStop = true;
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+static void StatSumLocked(benchmark::State &state)
+{
+    LockedStat stat;
+    CountStat(state, stat, 0);
+}
+
+static void StatSumSharded(benchmark::State &state)
+{
+    CStatHistory<uint64_t> stat;
+    CountStat(state, stat, 0);
+}
+
+static void StatSumLockedContended(benchmark::State &state)
+{
+    LockedStat stat;
+    CountStat(state, stat, CONTENDING_THREADS);
+}
+
+static void StatSumShardedContended(benchmark::State &state)
+{
+    CStatHistory<uint64_t> stat;
+    CountStat(state, stat, CONTENDING_THREADS);
+}
+
+BENCHMARK(StatSumLocked, 1000);
+BENCHMARK(StatSumSharded, 1000);
+BENCHMARK(StatSumLockedContended, 1000);
+BENCHMARK(StatSumShardedContended, 1000);
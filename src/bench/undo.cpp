@@ -0,0 +1,107 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include "clientversion.h"
+#include "hashwrapper.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <cassert>
+
+// Writing and reading the undo data of a ~1MB mainnet block in the legacy and the compact format.  We do not ship
+// the coins its inputs spent, but most of their scripts can be recovered from the inputs themselves: a pay to pubkey
+// hash input ends with the pubkey, and a pay to script hash input with the redeem script.  Those are the exact
+// scripts that were spent, so scripts that are spent more than once in the block, which is what the compact format
+// saves on, are as in the real undo data.  Amounts are taken from the block's own outputs, in order, and heights
+// are a few hundred blocks back, as the spent coins of a block of that time typically have.
+
+//! The script that the input spent, if it is pay to pubkey hash or pay to script hash, or else an empty script
+static CScript SpentScript(const CTxIn &txin)
+{
+    std::vector<std::vector<unsigned char> > vPushes;
+    CScript::const_iterator pc = txin.scriptSig.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vch;
+    while (pc < txin.scriptSig.end())
+    {
+        if (!txin.scriptSig.GetOp(pc, opcode, vch) || opcode > OP_PUSHDATA4)
+            return CScript();
+        vPushes.push_back(vch);
+    }
+    if (vPushes.size() == 2 && (vPushes[1].size() == 33 || vPushes[1].size() == 65))
+        return GetScriptForDestination(CKeyID(Hash160(vPushes[1].begin(), vPushes[1].end())));
+    if (vPushes.size() >= 2 && vPushes[0].empty())
+        return GetScriptForDestination(CScriptID(CScript(vPushes.back().begin(), vPushes.back().end())));
+    return CScript();
+}
+
+static CBlockUndo BenchUndo(uint8_t nFormat)
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    std::vector<CTxOut> vout;
+    for (const auto &tx : block.vtx)
+        vout.insert(vout.end(), tx->vout.begin(), tx->vout.end());
+    CBlockUndo undo;
+    undo.nFormat = nFormat;
+    size_t n = 0;
+    for (size_t i = 1; i < block.vtx.size(); i++)
+    {
+        undo.vtxundo.emplace_back();
+        for (const CTxIn &txin : block.vtx[i]->vin)
+        {
+            // inputs whose script can not be recovered, mostly pay to pubkey, spend a stand in output of the block
+            CTxOut out(vout[n % vout.size()]);
+            CScript script = SpentScript(txin);
+            if (!script.empty())
+                out.scriptPubKey = script;
+            const int nHeight = 413567 - (n * 7919) % 1000;
+            undo.vtxundo.back().vprevout.emplace_back(std::move(out), nHeight, false);
+            n++;
+        }
+    }
+    return undo;
+}
+
+static void WriteUndo(benchmark::State &state, uint8_t nFormat)
+{
+    const CBlockUndo undo = BenchUndo(nFormat);
+    while (state.KeepRunning())
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << undo;
+        assert(!ss.empty());
+    }
+}
+
+static void ReadUndo(benchmark::State &state, uint8_t nFormat)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << BenchUndo(nFormat);
+    while (state.KeepRunning())
+    {
+        CDataStream copy(ss);
+        CBlockUndo undo;
+        copy >> undo;
+        assert(undo.nFormat == nFormat);
+    }
+}
+
+static void UndoWriteLegacy(benchmark::State &state) { WriteUndo(state, UNDO_FORMAT_LEGACY); }
+static void UndoWriteCompact(benchmark::State &state) { WriteUndo(state, UNDO_FORMAT_COMPACT); }
+static void UndoReadLegacy(benchmark::State &state) { ReadUndo(state, UNDO_FORMAT_LEGACY); }
+static void UndoReadCompact(benchmark::State &state) { ReadUndo(state, UNDO_FORMAT_COMPACT); }
+
+BENCHMARK(UndoWriteLegacy, 100);
+BENCHMARK(UndoWriteCompact, 100);
+BENCHMARK(UndoReadLegacy, 100);
+BENCHMARK(UndoReadCompact, 100);
@@ -24,6 +24,7 @@
 #include "main.h"
 #include "net.h"
 #include "parallel.h"
+#include "pipelinetrace.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "random.h"
@@ -575,6 +576,8 @@ static bool ReconstructBlock(CNode *pfrom,
     int &unnecessaryCount,
     std::shared_ptr<CBlockThinRelay> pblock)
 {
+    CPipelineTimer timer(PIPELINE_BLOCK_RECONSTRUCT, pblock->GetHash());
+
     // We must have all the full tx hashes by this point.  We first check for any duplicate
     // transaction ids.  This is a possible attack vector and has been used in the past.
     {
@@ -12,6 +12,7 @@
 #include "extversionkeys.h"
 #include "net.h"
 #include "parallel.h"
+#include "pipelinetrace.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "requestManager.h"
@@ -515,15 +516,13 @@ void CGrapheneBlock::FillTxMapFromPools(std::map<uint64_t, CTransactionRef> &map
         }
     }
 
-    std::vector<uint256> memPoolHashes;
-    mempool.queryHashes(memPoolHashes);
-
-    for (const uint256 &hash : memPoolHashes)
     {
-        uint64_t cheapHash = GetShortID(shorttxidk0, shorttxidk1, hash, version);
-        auto shTx = mempool.get(hash);
-        if (shTx != nullptr) // otherwise mempool got updated between the query and this iteration
-            mapTxFromPools.insert(std::make_pair(cheapHash, shTx));
+        READLOCK(mempool.cs_txmempool);
+        for (const CTxMemPoolEntry &e : mempool.mapTx)
+        {
+            uint64_t cheapHash = GetShortID(shorttxidk0, shorttxidk1, e.GetTx().GetHash(), version);
+            mapTxFromPools.insert(std::make_pair(cheapHash, e.GetSharedTx()));
+        }
     }
 }
 
@@ -779,6 +778,7 @@ static bool ReconstructBlock(CNode *pfrom,
     const std::map<uint64_t, CTransactionRef> &mapTxFromPools)
 {
     std::shared_ptr<CGrapheneBlock> grapheneBlock = pblock->grapheneblock;
+    CPipelineTimer timer(PIPELINE_BLOCK_RECONSTRUCT, grapheneBlock->header.GetHash());
 
     // We must have all the full tx hashes by this point.  We first check for any repeating
     // sequences in transaction id's.  This is a possible attack vector and has been used in the past.
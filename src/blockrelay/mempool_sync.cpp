@@ -57,6 +57,37 @@ CMempoolSync::CMempoolSync(std::vector<uint256> mempoolTxHashes,
 }
 
 CMempoolSync::~CMempoolSync() { pGrapheneSet = nullptr; }
+/** The most rateless symbols exchanged in one round before giving up.  Decoding needs about 1.35 to 1.7
+ *  symbols per differing transaction and the difference cannot exceed the size of both mempools. */
+static uint64_t MaxRatelessSymbols(uint64_t nSenderTxs, uint64_t nReceiverTxs)
+{
+    uint64_t nMaxTxs = maxMessageSizeMultiplier * excessiveBlockSize / MIN_TX_SIZE;
+    return std::min(2 * (std::min(nSenderTxs, nMaxTxs) + std::min(nReceiverTxs, nMaxTxs)) + MEMPOOLSYNC_MIN_SYMBOLS,
+        MEMPOOLSYNC_MAX_SYMBOLS);
+}
+
+/** Drop the encoders of rounds that were requested too long ago and return how many are still alive. */
+static size_t ExpireMempoolSyncEncoders()
+{
+    AssertLockHeld(cs_mempoolsync);
+    size_t nLive = 0;
+    int64_t nNow = GetStopwatchMicros();
+    for (auto &kv : mempoolSyncResponded)
+    {
+        CMempoolSyncState &state = kv.second;
+        if (!state.pEncoder)
+            continue;
+        if (nNow - (int64_t)state.lastUpdated > MEMPOOLSYNC_ENCODER_TIMEOUT_US)
+        {
+            state.completed = true;
+            state.pEncoder.reset();
+        }
+        else
+            nLive++;
+    }
+    return nLive;
+}
+
 bool HandleMempoolSyncRequest(CDataStream &vRecv, CNode *pfrom)
 {
     LOG(MPOOLSYNC, "Handling mempool sync request from peer %s\n", pfrom->GetLogName());
@@ -93,24 +124,22 @@ bool HandleMempoolSyncRequest(CDataStream &vRecv, CNode *pfrom)
     LOG(MPOOLSYNC, "Mempool currently holds %d transactions\n", mempool.size());
 
     std::vector<uint256> mempoolTxHashes;
-    // cycle through mempool txs in order of ancestor_score
+    // cycle through mempool txs in order of ancestor_score, which is the order of the snapshot
     {
-        READLOCK(mempool.cs_txmempool);
+        CTxMemPoolSnapshotRef snapshot = mempool.GetSnapshot();
 
         int64_t nRemainingMempoolBytes = mempoolinfo.nRemainingMempoolBytes;
-        typename CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator it =
-            mempool.mapTx.get<ancestor_score>().begin();
-        for (; it != mempool.mapTx.get<ancestor_score>().end() && nRemainingMempoolBytes > 0; ++it)
+        for (auto it = snapshot->vEntries.begin(); it != snapshot->vEntries.end() && nRemainingMempoolBytes > 0; ++it)
         {
-            size_t nTxSize = it->GetTx().GetTxSize();
-            int64_t nFee = it->GetFee();
+            size_t nTxSize = it->entry.GetTx().GetTxSize();
+            int64_t nFee = it->entry.GetFee();
             CFeeRate feeRate(nFee, nTxSize);
 
             // Skip tx if fee rate is too low
             if (feeRate.GetFeePerK() < (int)mempoolinfo.nSatoshiPerK)
                 continue;
 
-            mempoolTxHashes.push_back(it->GetTx().GetHash());
+            mempoolTxHashes.push_back(it->entry.GetTx().GetHash());
             nRemainingMempoolBytes -= nTxSize;
         }
     }
@@ -121,9 +150,58 @@ bool HandleMempoolSyncRequest(CDataStream &vRecv, CNode *pfrom)
         return true;
     }
 
+    uint64_t version = NegotiateMempoolSyncVersion(pfrom);
+    if (version >= RATELESS_MEMPOOL_SYNC_VERSION)
+    {
+        // Every round in progress keeps an encoder of our whole mempool alive, so only serve a few at a time
+        {
+            LOCK(cs_mempoolsync);
+            if (ExpireMempoolSyncEncoders() >= MEMPOOLSYNC_MAX_ENCODERS)
+            {
+                LOG(MPOOLSYNC, "Too many rateless mempool syncs in progress; not responding to peer %s\n",
+                    pfrom->GetLogName());
+                return true;
+            }
+        }
+
+        // Encode our mempool as a rateless symbol stream and send a first batch sized from the difference in
+        // mempool sizes.  If that is not enough the requester asks for more with getmemsymbol.
+        std::shared_ptr<CRibltEncoder> pEncoder = std::make_shared<CRibltEncoder>();
+        for (const uint256 &hash : mempoolTxHashes)
+            pEncoder->addKey(GetShortID(mempoolinfo.shorttxidk0, mempoolinfo.shorttxidk1, hash, SHORT_ID_VERSION));
+
+        // The requester's mempool size is only its claim, so budget for at most a small multiple of our own
+        uint64_t nReceiverTxs =
+            std::min(mempoolinfo.nTxInMempool, MEMPOOLSYNC_PEER_TX_MULTIPLE * (uint64_t)mempoolTxHashes.size());
+        uint64_t nMaxSymbols = MaxRatelessSymbols(mempoolTxHashes.size(), nReceiverTxs);
+        uint64_t nDiff = mempoolTxHashes.size() > nReceiverTxs ? mempoolTxHashes.size() - nReceiverTxs :
+                                                                 nReceiverTxs - mempoolTxHashes.size();
+        uint64_t nSymbols = std::min(
+            std::min(nMaxSymbols, MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG), std::max(MEMPOOLSYNC_MIN_SYMBOLS, nDiff * 3 / 2));
+
+        CMempoolSync mempoolSync(mempoolTxHashes.size(), 0, pEncoder->nextSymbols(nSymbols), version);
+        {
+            LOCK(cs_mempoolsync);
+            if (ExpireMempoolSyncEncoders() >= MEMPOOLSYNC_MAX_ENCODERS)
+            {
+                LOG(MPOOLSYNC, "Too many rateless mempool syncs in progress; not responding to peer %s\n",
+                    pfrom->GetLogName());
+                return true;
+            }
+            mempoolSyncResponded[nodeId].pEncoder = pEncoder;
+            mempoolSyncResponded[nodeId].nMaxSymbols = nMaxSymbols;
+        }
+
+        pfrom->PushMessage(NetMsgType::MEMPOOLSYNC, mempoolSync);
+        LOG(MPOOLSYNC, "Sent %d rateless mempool sync symbols to peer %s using version %d\n", nSymbols,
+            pfrom->GetLogName(), version);
+
+        return true;
+    }
+
     // Assemble mempool sync object
     CMempoolSync mempoolSync(mempoolTxHashes, mempoolinfo.nTxInMempool, mempoolTxHashes.size(), mempoolinfo.shorttxidk0,
-        mempoolinfo.shorttxidk1, NegotiateMempoolSyncVersion(pfrom));
+        mempoolinfo.shorttxidk1, version);
 
     pfrom->PushMessage(NetMsgType::MEMPOOLSYNC, mempoolSync);
     LOG(MPOOLSYNC, "Sent mempool sync to peer %s using version %d\n", pfrom->GetLogName(), mempoolSync.version);
@@ -131,12 +209,78 @@ bool HandleMempoolSyncRequest(CDataStream &vRecv, CNode *pfrom)
     return true;
 }
 
+bool CRequestMempoolSyncSymbols::HandleMessage(CDataStream &vRecv, CNode *pfrom)
+{
+    CRequestMempoolSyncSymbols req;
+    vRecv >> req;
+    NodeId nodeId = pfrom->GetId();
+
+    // Message consistency checking
+    if (req.nSymbols == 0 || req.nSymbols > MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG)
+    {
+        dosMan.Misbehaving(pfrom, 100);
+        return error("Incorrectly constructed getmemsymbol received.  Banning peer=%s", pfrom->GetLogName());
+    }
+
+    uint64_t nSenderMempoolTxs = 0;
+    std::vector<CRibltSymbol> vSymbols;
+    {
+        LOCK(cs_mempoolsync);
+
+        // A round that has gone on for too long loses its encoder.  That is not the requester's fault.
+        auto iter = mempoolSyncResponded.find(nodeId);
+        if (iter != mempoolSyncResponded.end() && iter->second.pEncoder &&
+            GetStopwatchMicros() - (int64_t)iter->second.lastUpdated > MEMPOOLSYNC_ENCODER_TIMEOUT_US)
+        {
+            iter->second.completed = true;
+            iter->second.pEncoder.reset();
+            return error("Rateless mempool sync with peer %s timed out", pfrom->GetLogName());
+        }
+        if (mempoolSyncResponded.count(nodeId) == 0 || mempoolSyncResponded[nodeId].completed ||
+            !mempoolSyncResponded[nodeId].pEncoder)
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error(
+                "Received getmemsymbol from peer %s but rateless mempool sync is not in progress", pfrom->GetLogName());
+        }
+
+        CMempoolSyncState &state = mempoolSyncResponded[nodeId];
+        if (req.nFirstSymbol != state.pEncoder->symbolsProduced())
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received getmemsymbol from peer %s starting at symbol %d but %d symbols were sent",
+                pfrom->GetLogName(), req.nFirstSymbol, state.pEncoder->symbolsProduced());
+        }
+
+        // The requester should have given up by now
+        if (req.nFirstSymbol >= state.nMaxSymbols)
+        {
+            state.completed = true;
+            state.pEncoder.reset();
+            return error("Rateless mempool sync with peer %s exceeded %d symbols", pfrom->GetLogName(),
+                state.nMaxSymbols);
+        }
+
+        nSenderMempoolTxs = state.pEncoder->size();
+        vSymbols = state.pEncoder->nextSymbols(std::min(req.nSymbols, state.nMaxSymbols - req.nFirstSymbol));
+    }
+
+    LOG(MPOOLSYNC, "Sending %d more rateless mempool sync symbols from position %d to peer %s\n", vSymbols.size(),
+        req.nFirstSymbol, pfrom->GetLogName());
+
+    CMempoolSync mempoolSync(nSenderMempoolTxs, req.nFirstSymbol, vSymbols, NegotiateMempoolSyncVersion(pfrom));
+    pfrom->PushMessage(NetMsgType::MEMPOOLSYNC, mempoolSync);
+
+    return true;
+}
+
 /**
  * Handle an incoming mempool synchronization payload
  */
 bool CMempoolSync::ReceiveMempoolSync(CDataStream &vRecv, CNode *pfrom, std::string strCommand)
 {
     // Deserialize mempool sync payload
+    uint64_t nBytes = vRecv.size();
     CMempoolSync mempoolSync;
     vRecv >> mempoolSync;
     NodeId nodeId = pfrom->GetId();
@@ -162,10 +306,12 @@ bool CMempoolSync::ReceiveMempoolSync(CDataStream &vRecv, CNode *pfrom, std::str
         }
     }
 
-    return mempoolSync.process(pfrom);
+    if (mempoolSync.version >= RATELESS_MEMPOOL_SYNC_VERSION)
+        return mempoolSync.processRateless(pfrom, nBytes);
+    return mempoolSync.process(pfrom, nBytes);
 }
 
-bool CMempoolSync::process(CNode *pfrom)
+bool CMempoolSync::process(CNode *pfrom, uint64_t nBytes)
 {
     NodeId nodeId = pfrom->GetId();
     std::set<uint256> passingTxHashes;
@@ -202,10 +348,15 @@ bool CMempoolSync::process(CNode *pfrom)
     {
         LOG(MPOOLSYNC, "Mempool sync failed for peer %s. Graphene set could not be reconciled: %s\n",
             pfrom->GetLogName(), e.what());
+        mempoolsyncdata.UpdateFailed(false, nBytes);
 
         return false;
     }
 
+    mempoolsyncdata.UpdateReconciled(false, nBytes, setHashesToRequest.size());
+    LOG(MPOOLSYNC, "Graphene mempool sync with %s reconciled using %d bytes: %d missing txs\n", pfrom->GetLogName(),
+        nBytes, setHashesToRequest.size());
+
     LOG(MPOOLSYNC, "Mempool sync received: %d total responder txns, requester waiting for %d txs from peer %s\n",
         nSenderMempoolTxs, setHashesToRequest.size(), pfrom->GetLogName());
 
@@ -230,6 +381,110 @@ bool CMempoolSync::process(CNode *pfrom)
     return true;
 }
 
+bool CMempoolSync::processRateless(CNode *pfrom, uint64_t nBytes)
+{
+    NodeId nodeId = pfrom->GetId();
+
+    if (vSymbols.empty())
+    {
+        dosMan.Misbehaving(pfrom, 100);
+        return error("Received rateless mempool sync without symbols from peer %s", pfrom->GetLogName());
+    }
+
+    // Our own short ids are only needed to set up the decoder when the first batch arrives
+    std::vector<uint256> mempoolTxHashes;
+    if (nFirstSymbol == 0)
+        GetMempoolTxHashes(mempoolTxHashes);
+
+    bool fDecoded = false;
+    std::set<uint64_t> setHashesToRequest;
+    uint64_t nLocalOnly = 0;
+    uint64_t nSymbolsReceived = 0;
+    uint64_t nMaxSymbols = 0;
+    uint64_t nReconcileBytes = 0;
+    {
+        LOCK(cs_mempoolsync);
+        CMempoolSyncState &state = mempoolSyncRequested[nodeId];
+
+        if (nFirstSymbol == 0 && !state.pDecoder)
+        {
+            state.pDecoder = std::make_shared<CRibltDecoder>();
+            for (const uint256 &hash : mempoolTxHashes)
+                state.pDecoder->addLocalKey(GetShortID(state.shorttxidk0, state.shorttxidk1, hash, SHORT_ID_VERSION));
+            state.nMaxSymbols = MaxRatelessSymbols(nSenderMempoolTxs, mempoolTxHashes.size());
+        }
+        else if (!state.pDecoder || nFirstSymbol != state.pDecoder->symbolCount())
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received rateless mempool sync symbols out of sequence from peer %s", pfrom->GetLogName());
+        }
+
+        for (const CRibltSymbol &symbol : vSymbols)
+            state.pDecoder->addSymbol(symbol);
+        state.nReconcileBytes += nBytes;
+
+        fDecoded = state.pDecoder->decoded();
+        nSymbolsReceived = state.pDecoder->symbolCount();
+        nMaxSymbols = state.nMaxSymbols;
+        nReconcileBytes = state.nReconcileBytes;
+        if (fDecoded)
+        {
+            const std::vector<uint64_t> &vRemoteOnly = state.pDecoder->remoteOnly();
+            setHashesToRequest.insert(vRemoteOnly.begin(), vRemoteOnly.end());
+            nLocalOnly = state.pDecoder->localOnly().size();
+            state.pDecoder.reset();
+            if (setHashesToRequest.empty())
+                state.completed = true;
+        }
+        else if (nSymbolsReceived >= nMaxSymbols)
+        {
+            state.pDecoder.reset();
+            state.completed = true;
+        }
+    }
+
+    if (!fDecoded)
+    {
+        if (nSymbolsReceived >= nMaxSymbols)
+        {
+            LOG(MPOOLSYNC, "Mempool sync failed for peer %s. Rateless symbols could not be decoded after %d symbols\n",
+                pfrom->GetLogName(), nSymbolsReceived);
+            mempoolsyncdata.UpdateFailed(true, nReconcileBytes);
+
+            return false;
+        }
+
+        // Not enough symbols yet, so ask for another batch half the size of what we already have.  This keeps the
+        // overshoot below 50% while needing only a logarithmic number of round trips.
+        uint64_t nSymbols = std::min(std::min(nMaxSymbols - nSymbolsReceived, MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG),
+            std::max(MEMPOOLSYNC_MIN_SYMBOLS, nSymbolsReceived / 2));
+        CRequestMempoolSyncSymbols req(nSymbolsReceived, nSymbols);
+        pfrom->PushMessage(NetMsgType::GET_MEMPOOLSYNCSYM, req);
+        LOG(MPOOLSYNC, "Rateless mempool sync with %s not decoded after %d symbols, requesting %d more\n",
+            pfrom->GetLogName(), nSymbolsReceived, nSymbols);
+
+        return true;
+    }
+
+    mempoolsyncdata.UpdateReconciled(true, nReconcileBytes, setHashesToRequest.size());
+    LOG(MPOOLSYNC,
+        "Rateless mempool sync with %s decoded after %d symbols using %d bytes: %d missing txs, %d txs held only locally\n",
+        pfrom->GetLogName(), nSymbolsReceived, nReconcileBytes, setHashesToRequest.size(), nLocalOnly);
+
+    if (setHashesToRequest.empty())
+    {
+        LOG(MPOOLSYNC, "Completeing mempool sync with %s; no missing transactions\n", pfrom->GetLogName());
+        return true;
+    }
+
+    CRequestMempoolSyncTx mempoolSyncTx(setHashesToRequest);
+    pfrom->PushMessage(NetMsgType::GET_MEMPOOLSYNCTX, mempoolSyncTx);
+    LOG(MPOOLSYNC, "Requesting to sync %d missing transactions from %s\n", setHashesToRequest.size(),
+        pfrom->GetLogName());
+
+    return true;
+}
+
 bool CRequestMempoolSyncTx::HandleMessage(CDataStream &vRecv, CNode *pfrom)
 {
     CRequestMempoolSyncTx reqMempoolSyncTx;
@@ -312,6 +567,7 @@ bool CRequestMempoolSyncTx::HandleMessage(CDataStream &vRecv, CNode *pfrom)
     {
         LOCK(cs_mempoolsync);
         mempoolSyncResponded[nodeId].completed = true;
+        mempoolSyncResponded[nodeId].pEncoder.reset();
     }
 
     return true;
@@ -385,12 +641,10 @@ void GetMempoolTxHashes(std::vector<uint256> &mempoolTxHashes)
         }
     }
 
-    std::vector<uint256> memPoolHashes;
-    mempool.queryHashes(memPoolHashes);
-
-    for (const uint256 &hash : memPoolHashes)
+    CTxMemPoolSnapshotRef snapshot = mempool.GetSnapshot();
+    for (const CTxMemPoolSnapshot::Entry &entry : snapshot->vEntries)
     {
-        mempoolTxHashes.push_back(hash);
+        mempoolTxHashes.push_back(entry.entry.GetTx().GetHash());
     }
 }
 
@@ -420,14 +674,7 @@ CMempoolSyncInfo GetMempoolSyncInfo()
     uint64_t shorttxidk1 = shorttxidhash.GetUint64(1);
 
     // Calculate how many bytes of space remain in the mempool
-    uint64_t nRemainingMempoolTxBytes = nMempoolMaxTxBytes;
-    {
-        READLOCK(mempool.cs_txmempool);
-        for (const CTxMemPoolEntry &e : mempool.mapTx)
-        {
-            nRemainingMempoolTxBytes += e.GetTx().GetTxSize();
-        }
-    }
+    uint64_t nRemainingMempoolTxBytes = nMempoolMaxTxBytes + mempool.GetTotalTxSize();
 
     return CMempoolSyncInfo(nTxInMempool, nRemainingMempoolTxBytes, shorttxidk0, shorttxidk1, nSatoshiPerK);
 }
@@ -448,9 +695,10 @@ uint64_t NegotiateMempoolSyncVersion(CNode *pfrom)
     return upper;
 }
 
-CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy)
+CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy, bool fPreferRateless)
 {
     std::vector<CNode *> vSyncableNodes;
+    std::vector<CNode *> vRatelessNodes;
 
     for (auto node : vNodesCopy)
     {
@@ -459,9 +707,10 @@ CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy)
             continue;
 
         // Skip if version cannot be negotiated
+        uint64_t version = 0;
         try
         {
-            NegotiateMempoolSyncVersion(node);
+            version = NegotiateMempoolSyncVersion(node);
         }
         catch (std::runtime_error &e)
         {
@@ -477,8 +726,14 @@ CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy)
             continue;
 
         vSyncableNodes.push_back(node);
+        if (version >= RATELESS_MEMPOOL_SYNC_VERSION)
+            vRatelessNodes.push_back(node);
     }
 
+    // Rateless reconciliation copes with any difference, so prefer it when the difference is unknown
+    if (fPreferRateless && vRatelessNodes.size() > 0)
+        return vRatelessNodes[GetRandInt(vRatelessNodes.size())];
+
     // Randomly select node with whom to request mempoolsync
     if (vSyncableNodes.size() > 0)
         return vSyncableNodes[GetRandInt(vSyncableNodes.size())];
@@ -492,3 +747,41 @@ void ClearDisconnectedFromMempoolSyncMaps(NodeId nodeid)
     mempoolSyncRequested.erase(nodeid);
     mempoolSyncResponded.erase(nodeid);
 }
+
+void CMempoolSyncData::UpdateReconciled(bool fRateless, uint64_t nReconcileBytes, uint64_t nMissingTx)
+{
+    LOCK(cs_mempoolsyncstats);
+    Totals &totals = fRateless ? rateless : graphene;
+    totals.nRounds++;
+    totals.nReconcileBytes += nReconcileBytes;
+    totals.nMissingTx += nMissingTx;
+}
+
+void CMempoolSyncData::UpdateFailed(bool fRateless, uint64_t nReconcileBytes)
+{
+    LOCK(cs_mempoolsyncstats);
+    Totals &totals = fRateless ? rateless : graphene;
+    totals.nRounds++;
+    totals.nFailures++;
+    totals.nReconcileBytes += nReconcileBytes;
+}
+
+double CMempoolSyncData::BytesPerMissingTx(bool fRateless)
+{
+    LOCK(cs_mempoolsyncstats);
+    const Totals &totals = fRateless ? rateless : graphene;
+    if (totals.nMissingTx == 0)
+        return -1;
+    return (double)totals.nReconcileBytes / totals.nMissingTx;
+}
+
+std::string CMempoolSyncData::ToString()
+{
+    double dGraphene = BytesPerMissingTx(false);
+    double dRateless = BytesPerMissingTx(true);
+
+    LOCK(cs_mempoolsyncstats);
+    return strprintf("graphene: %d rounds (%d failed) %.1f bytes per missing tx; "
+                     "rateless: %d rounds (%d failed) %.1f bytes per missing tx",
+        graphene.nRounds, graphene.nFailures, dGraphene, rateless.nRounds, rateless.nFailures, dRateless);
+}
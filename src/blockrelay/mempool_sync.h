@@ -9,10 +9,23 @@
 #include "blockrelay/graphene.h"
 #include "consensus/consensus.h"
 #include "net.h"
+#include "riblt.h"
 #include "utiltime.h"
 
 const uint64_t DEFAULT_MEMPOOL_SYNC_MIN_VERSION_SUPPORTED = 0;
-const uint64_t DEFAULT_MEMPOOL_SYNC_MAX_VERSION_SUPPORTED = 1;
+const uint64_t DEFAULT_MEMPOOL_SYNC_MAX_VERSION_SUPPORTED = 2;
+// first version that reconciles with a stream of rateless IBLT symbols rather than a graphene set
+const uint64_t RATELESS_MEMPOOL_SYNC_VERSION = 2;
+// smallest batch of rateless symbols sent in a single memsync message
+const uint64_t MEMPOOLSYNC_MIN_SYMBOLS = 64;
+// largest batch of rateless symbols sent in a single memsync message
+const uint64_t MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG = 100000;
+// most rateless symbols exchanged in one round, whatever the size of either mempool
+const uint64_t MEMPOOLSYNC_MAX_SYMBOLS = 10 * MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG;
+// a responder budgets its symbols for a requester mempool of at most this many times the size of its own
+const uint64_t MEMPOOLSYNC_PEER_TX_MULTIPLE = 2;
+// most rateless rounds a responder serves at once, each of which keeps an encoder of its mempool alive
+const size_t MEMPOOLSYNC_MAX_ENCODERS = 8;
 // arbitrary entropy passed to CGrapheneSet an used for IBLT
 const uint32_t IBLT_ENTROPY = 13;
 // any value greater than 2 will use SipHash
@@ -22,6 +35,8 @@ const int64_t MEMPOOLSYNC_FREQ_US = 30 * 1e6;
 const int64_t MEMPOOLSYNC_FREQ_GRACE_US = 5 * 1e6;
 // frequency that CMempoolSyncState maps are cleared in microseconds
 const int64_t MEMPOOLSYNC_CLEAR_FREQ_US = 3600 * 1e6;
+// time after a request that a responder drops its encoder, in microseconds
+const int64_t MEMPOOLSYNC_ENCODER_TIMEOUT_US = MEMPOOLSYNC_FREQ_US;
 // Use CVariableFastFilter if true, otherwise use CBloomFilter
 const bool COMPUTE_OPTIMIZED = true;
 
@@ -36,13 +51,26 @@ public:
     uint64_t shorttxidk1;
     /** Flag indicating that all appropriate messages have been received from peer.*/
     bool completed;
+    /** Upper bound on the number of rateless symbols exchanged in this round. */
+    uint64_t nMaxSymbols;
+    /** Responder side of a rateless round: the symbol stream of the responder's mempool. */
+    std::shared_ptr<CRibltEncoder> pEncoder;
+    /** Requester side of a rateless round: the symbols received so far, minus our own mempool. */
+    std::shared_ptr<CRibltDecoder> pDecoder;
+    /** Requester side: bytes of reconciliation data received in this round. */
+    uint64_t nReconcileBytes;
 
 public:
     CMempoolSyncState(uint64_t _lastUpdated, uint64_t _shorttxidk0, uint64_t _shorttxidk1, bool _completed)
-        : lastUpdated(_lastUpdated), shorttxidk0(_shorttxidk0), shorttxidk1(_shorttxidk1), completed(_completed)
+        : lastUpdated(_lastUpdated), shorttxidk0(_shorttxidk0), shorttxidk1(_shorttxidk1), completed(_completed),
+          nMaxSymbols(0), nReconcileBytes(0)
+    {
+    }
+    CMempoolSyncState()
+        : lastUpdated(GetStopwatchMicros()), shorttxidk0(0), shorttxidk1(0), completed(false), nMaxSymbols(0),
+          nReconcileBytes(0)
     {
     }
-    CMempoolSyncState() : lastUpdated(GetStopwatchMicros()), shorttxidk0(0), shorttxidk1(0), completed(false) {}
 };
 
 extern std::map<NodeId, CMempoolSyncState> mempoolSyncRequested;
@@ -83,7 +111,12 @@ public:
     }
 };
 
-/** Mempool sync payload sent to requester by responder. */
+/**
+ * Mempool sync payload sent to requester by responder.  Up to version 1 it carries a single graphene set sized
+ * from the estimated difference between the two mempools.  From RATELESS_MEMPOOL_SYNC_VERSION on it carries
+ * a batch of rateless IBLT symbols instead, and the requester asks for further batches with getmemsymbol
+ * until it can decode the difference.
+ */
 class CMempoolSync
 {
 public:
@@ -93,6 +126,10 @@ public:
     std::shared_ptr<CGrapheneSet> pGrapheneSet;
     /** Negotiated mempool sync version. */
     uint64_t version;
+    /** Position of the first rateless symbol in this batch. */
+    uint64_t nFirstSymbol;
+    /** Batch of rateless symbols encoding the responder's mempool. */
+    std::vector<CRibltSymbol> vSymbols;
 
 public:
     CMempoolSync(std::vector<uint256> mempoolTxHashes,
@@ -101,8 +138,18 @@ public:
         uint64_t shorttxidk0,
         uint64_t shorttxidk1,
         uint64_t _version);
-    CMempoolSync() : nSenderMempoolTxs(0), pGrapheneSet(nullptr), version(0) {}
-    CMempoolSync(uint64_t _version) : nSenderMempoolTxs(0), pGrapheneSet(nullptr) {}
+    CMempoolSync(uint64_t _nSenderMempoolTxs,
+        uint64_t _nFirstSymbol,
+        std::vector<CRibltSymbol> _vSymbols,
+        uint64_t _version)
+        : nSenderMempoolTxs(_nSenderMempoolTxs), pGrapheneSet(nullptr), version(_version),
+          nFirstSymbol(_nFirstSymbol), vSymbols(std::move(_vSymbols))
+    {
+    }
+    CMempoolSync() : nSenderMempoolTxs(0), pGrapheneSet(nullptr), version(0), nFirstSymbol(0) {}
+    CMempoolSync(uint64_t _version) : nSenderMempoolTxs(0), pGrapheneSet(nullptr), version(_version), nFirstSymbol(0)
+    {
+    }
     ~CMempoolSync();
 
     static inline uint64_t GetGrapheneSetVersion(uint64_t grapheneBlockVersion) { return 4; }
@@ -114,7 +161,8 @@ public:
      * @return True if handling succeeded
      */
     static bool ReceiveMempoolSync(CDataStream &vRecv, CNode *pfrom, std::string strCommand);
-    bool process(CNode *pfrom);
+    bool process(CNode *pfrom, uint64_t nBytes);
+    bool processRateless(CNode *pfrom, uint64_t nBytes);
 
     ADD_SERIALIZE_METHODS;
 
@@ -125,6 +173,14 @@ public:
         READWRITE(nSenderMempoolTxs);
         if (nSenderMempoolTxs > (maxMessageSizeMultiplier * excessiveBlockSize / MIN_TX_SIZE))
             throw std::runtime_error("nSenderMempoolTxs exceeds threshold for excessive block txs");
+        if (version >= RATELESS_MEMPOOL_SYNC_VERSION)
+        {
+            READWRITE(COMPACTSIZE(nFirstSymbol));
+            READWRITE(vSymbols);
+            if (vSymbols.size() > MEMPOOLSYNC_MAX_SYMBOLS_PER_MSG)
+                throw std::runtime_error("Too many rateless symbols in mempool sync");
+            return;
+        }
         if (!pGrapheneSet)
         {
             pGrapheneSet = std::make_shared<CGrapheneSet>(
@@ -136,6 +192,39 @@ public:
     bool process(CNode *pfrom, std::string strCommand, std::shared_ptr<CBlockThinRelay> pblock);
 };
 
+/** Request for the next batch of rateless symbols, sent by the requester while it cannot decode yet. */
+class CRequestMempoolSyncSymbols
+{
+public:
+    /** Position of the first symbol requested; must follow the last one already sent. */
+    uint64_t nFirstSymbol;
+    /** Number of symbols requested. */
+    uint64_t nSymbols;
+
+public:
+    CRequestMempoolSyncSymbols(uint64_t _nFirstSymbol, uint64_t _nSymbols)
+        : nFirstSymbol(_nFirstSymbol), nSymbols(_nSymbols)
+    {
+    }
+    CRequestMempoolSyncSymbols() : nFirstSymbol(0), nSymbols(0) {}
+    /**
+     * Handle an incoming request for more rateless symbols
+     * @param[in] vRecv        The raw binary message
+     * @param[in] pFrom        The node the message was from
+     * @return True if handling succeeded
+     */
+    static bool HandleMessage(CDataStream &vRecv, CNode *pfrom);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(COMPACTSIZE(nFirstSymbol));
+        READWRITE(COMPACTSIZE(nSymbols));
+    }
+};
+
 /** Payload of cheap hashes corresponding to transactions missing from requester. */
 class CRequestMempoolSyncTx
 {
@@ -191,11 +280,42 @@ public:
     }
 };
 
+/** Running totals comparing the bandwidth of graphene and rateless mempool reconciliation (requester side). */
+class CMempoolSyncData
+{
+private:
+    CCriticalSection cs_mempoolsyncstats; // locks everything below this point
+
+    struct Totals
+    {
+        uint64_t nRounds = 0;
+        uint64_t nFailures = 0;
+        uint64_t nReconcileBytes = 0;
+        uint64_t nMissingTx = 0;
+    };
+    Totals graphene;
+    Totals rateless;
+
+public:
+    /** Record a finished reconciliation round and the number of transactions it found missing */
+    void UpdateReconciled(bool fRateless, uint64_t nReconcileBytes, uint64_t nMissingTx);
+    /** Record a reconciliation round that could not be decoded */
+    void UpdateFailed(bool fRateless, uint64_t nReconcileBytes);
+    /** Average reconciliation bytes spent per missing transaction, or -1 if none went missing yet */
+    double BytesPerMissingTx(bool fRateless);
+    std::string ToString();
+};
+extern CMempoolSyncData mempoolsyncdata; // Singleton class
+
+/** Set at startup so that the first mempool sync runs as soon as the chain is synced instead of after
+ *  MEMPOOLSYNC_FREQ_US, letting a restarted node catch up with the mempool of its peers. */
+extern std::atomic<bool> fMempoolSyncCatchUp;
+
 bool HandleMempoolSyncRequest(CDataStream &vRecv, CNode *pfrom);
 void GetMempoolTxHashes(std::vector<uint256> &mempoolTxHashes);
 CMempoolSyncInfo GetMempoolSyncInfo();
 uint64_t NegotiateMempoolSyncVersion(CNode *pfrom);
-CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy);
+CNode *SelectMempoolSyncPeer(std::vector<CNode *> vNodesCopy, bool fPreferRateless = false);
 void ClearDisconnectedFromMempoolSyncMaps(NodeId nodeid);
 
 #endif // BITCOIN_MEMPOOL_SYNC_H
@@ -20,6 +20,7 @@
 #include "extversionkeys.h"
 #include "net.h"
 #include "parallel.h"
+#include "pipelinetrace.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "requestManager.h"
@@ -777,6 +778,8 @@ static bool ReconstructBlock(CNode *pfrom,
     const std::vector<uint256> &vHashes,
     std::shared_ptr<CBlockThinRelay> pblock)
 {
+    CPipelineTimer timer(PIPELINE_BLOCK_RECONSTRUCT, pblock->GetHash());
+
     // We must have all the full tx hashes by this point.  We first check for any duplicate
     // transaction ids.  This is a possible attack vector and has been used in the past.
     {
@@ -0,0 +1,159 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "coldfiles.h"
+#include "sequential_files.h"
+#include "tweak.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern CTweak<uint32_t> mappedBlockFiles;
+
+CBlockFileMaps blockFileMaps;
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void *)pdata, nSize);
+#endif
+}
+
+void CMappedBlockFile::WillNeed(uint64_t nBegin, uint64_t nEnd) const
+{
+#ifndef WIN32
+    nEnd = std::min<uint64_t>(nEnd, nSize);
+    if (nBegin >= nEnd)
+        return;
+    // madvise wants a page aligned start, and the mapping itself starts on a page
+    static const uint64_t nPageSize = sysconf(_SC_PAGESIZE);
+    nBegin -= nBegin % nPageSize;
+    madvise((void *)(pdata + nBegin), nEnd - nBegin, MADV_WILLNEED);
+#endif
+}
+
+static fs::path GetFilename(int nFile, BlockFileType type)
+{
+    switch (type)
+    {
+    case BLOCK_FILE:
+        return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    case UNDO_FILE:
+        return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "rev");
+    case COLD_BLOCK_FILE:
+        return GetColdFilename(nFile, false);
+    case COLD_UNDO_FILE:
+        return GetColdFilename(nFile, true);
+    }
+    assert(false);
+    return fs::path();
+}
+
+static std::shared_ptr<const CMappedBlockFile> MapBlockFile(int nFile, BlockFileType type)
+{
+#ifndef WIN32
+    // a 32 bit address space is too small to map more than a handful of files
+    if (sizeof(void *) < 8)
+        return nullptr;
+
+    fs::path path = GetFilename(nFile, type);
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    std::shared_ptr<const CMappedBlockFile> map;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            map = std::make_shared<const CMappedBlockFile>((const char *)p, st.st_size);
+        else
+            LOG(BLK, "Unable to map %s: %s\n", path.string(), strerror(errno));
+    }
+    close(fd); // the mapping stays valid without the descriptor
+    return map;
+#else
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileMaps::Get(int nFile, BlockFileType type, uint64_t nMinSize)
+{
+    const size_t nMaxMaps = mappedBlockFiles.Value();
+    if (nMaxMaps == 0)
+        return nullptr;
+
+    const Key key(nFile, type);
+    {
+        LOCK(cs_maps);
+        auto it = mapMaps.find(key);
+        if (it != mapMaps.end())
+        {
+            if (it->second->second->size() >= nMinSize)
+            {
+                lruMaps.splice(lruMaps.begin(), lruMaps, it->second);
+                return it->second->second;
+            }
+            // the file has grown since we mapped it
+            lruMaps.erase(it->second);
+            mapMaps.erase(it);
+        }
+    }
+
+    // map the file without holding the lock; if another thread raced us we simply keep the newest mapping
+    std::shared_ptr<const CMappedBlockFile> map = MapBlockFile(nFile, type);
+    if (!map || map->size() < nMinSize)
+        return nullptr;
+
+    LOCK(cs_maps);
+    auto it = mapMaps.find(key);
+    if (it != mapMaps.end())
+    {
+        lruMaps.erase(it->second);
+        mapMaps.erase(it);
+    }
+    lruMaps.emplace_front(key, map);
+    mapMaps.emplace(key, lruMaps.begin());
+    while (lruMaps.size() > nMaxMaps)
+    {
+        mapMaps.erase(lruMaps.back().first);
+        lruMaps.pop_back();
+    }
+    return map;
+}
+
+void CBlockFileMaps::Forget(int nFile)
+{
+    LOCK(cs_maps);
+    for (BlockFileType type : {BLOCK_FILE, UNDO_FILE, COLD_BLOCK_FILE, COLD_UNDO_FILE})
+    {
+        auto it = mapMaps.find(Key(nFile, type));
+        if (it != mapMaps.end())
+        {
+            lruMaps.erase(it->second);
+            mapMaps.erase(it);
+        }
+    }
+}
+
+void CBlockFileMaps::Clear()
+{
+    LOCK(cs_maps);
+    mapMaps.clear();
+    lruMaps.clear();
+}
+
+size_t CBlockFileMaps::size() const
+{
+    LOCK(cs_maps);
+    return lruMaps.size();
+}
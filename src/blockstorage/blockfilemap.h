@@ -0,0 +1,154 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ios>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+
+/** How many block and undo files we keep memory mapped at once by default */
+static const uint32_t DEFAULT_MAPPED_BLOCK_FILES = 64;
+
+/** The kinds of files in the blocks directory that can be mapped */
+enum BlockFileType
+{
+    BLOCK_FILE = 0, //!< blk?????.dat
+    UNDO_FILE, //!< rev?????.dat
+    COLD_BLOCK_FILE, //!< blk?????.lz
+    COLD_UNDO_FILE, //!< rev?????.lz
+};
+
+/** A read only memory mapping of a whole block, undo or cold file */
+class CMappedBlockFile
+{
+public:
+    CMappedBlockFile(const char *_pdata, size_t _nSize) : pdata(_pdata), nSize(_nSize) {}
+    ~CMappedBlockFile();
+
+    const char *data() const { return pdata; }
+    size_t size() const { return nSize; }
+    /** Ask the OS to start reading [nBegin, nEnd) of the file in, ahead of it being accessed */
+    void WillNeed(uint64_t nBegin, uint64_t nEnd) const;
+
+private:
+    CMappedBlockFile(const CMappedBlockFile &);
+    CMappedBlockFile &operator=(const CMappedBlockFile &);
+
+    const char *pdata;
+    const size_t nSize;
+};
+
+/**
+ * The most recently used block and undo file mappings.  Readers hold on to a mapping through its shared pointer,
+ * so a file that is evicted or pruned while it is being read stays mapped until the reader is done with it.
+ */
+class CBlockFileMaps
+{
+public:
+    /**
+     * Return a mapping of the file nFile of the given type that covers at least nMinSize bytes, or nullptr if the
+     * file cannot be mapped, in which case the caller should fall back to reading it through stdio.  Files that
+     * have grown since they were mapped are mapped again.
+     */
+    std::shared_ptr<const CMappedBlockFile> Get(int nFile, BlockFileType type, uint64_t nMinSize);
+    /** Drop the mappings of a file, e.g. because it was pruned or truncated */
+    void Forget(int nFile);
+    void Clear();
+    size_t size() const;
+
+private:
+    typedef std::pair<int, BlockFileType> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<const CMappedBlockFile> > > LruList;
+
+    mutable CCriticalSection cs_maps;
+    //! most recently used at the front
+    LruList lruMaps GUARDED_BY(cs_maps);
+    std::map<Key, LruList::iterator> mapMaps GUARDED_BY(cs_maps);
+};
+extern CBlockFileMaps blockFileMaps;
+
+/** Deserializes directly out of a span of memory, such as a mapped block file */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+    const char *pbegin;
+    const char *pend;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char *_pbegin, size_t nSize)
+        : nType(nTypeIn), nVersion(nVersionIn), pbegin(_pbegin), pend(_pbegin + nSize)
+    {
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t size() const { return pend - pbegin; }
+    void read(char *pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read: end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore: end of data");
+        pbegin += nSize;
+    }
+
+    template <typename T>
+    CSpanReader &operator>>(T &obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+/**
+ * A block exactly as it is serialized in its block file, so that it can be sent to peers without being
+ * deserialized first.  The object keeps the file mapped, or the buffer it was decompressed into, for as long as
+ * it exists.
+ */
+class CRawBlock
+{
+public:
+    CRawBlock() : pbegin(nullptr), nSize(0) {}
+    void Set(std::shared_ptr<const void> _owner, const char *_pbegin, size_t _nSize)
+    {
+        owner = std::move(_owner);
+        pbegin = _pbegin;
+        nSize = _nSize;
+    }
+
+    const char *data() const { return pbegin; }
+    size_t size() const { return nSize; }
+    template <typename Stream>
+    void Serialize(Stream &s) const
+    {
+        if (nSize)
+            s.write(pbegin, nSize);
+    }
+
+private:
+    std::shared_ptr<const void> owner;
+    const char *pbegin;
+    size_t nSize;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
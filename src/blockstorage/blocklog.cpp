@@ -0,0 +1,557 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocklog.h"
+#include "blockfilemap.h"
+#include "blockstorage.h"
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hashwrapper.h"
+#include "streams.h"
+#include "unlimited.h"
+#include "util.h"
+
+#include <errno.h>
+#include <set>
+#include <stdexcept>
+#include <string.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// Record layout: magic, type, 3 reserved bytes, hash, LE32 payload size, payload, LE64 checksum of all that
+static const unsigned char BLOCKLOG_MAGIC[4] = {'B', 'L', 'O', 'G'};
+static const uint32_t RECORD_HEADER_SIZE = 44;
+static const uint32_t RECORD_TRAILER_SIZE = 8;
+static const uint32_t RECORD_OVERHEAD = RECORD_HEADER_SIZE + RECORD_TRAILER_SIZE;
+// The checksum only has to catch torn and damaged records, so the keys are fixed
+static const uint64_t BLOCKLOG_CHECKSUM_K0 = 0x626c6f636b6c6f67ULL;
+static const uint64_t BLOCKLOG_CHECKSUM_K1 = 0;
+
+enum
+{
+    RECORD_BLOCK = 1,
+    RECORD_UNDO = 2,
+    RECORD_ERASE_BLOCK = 3,
+    RECORD_ERASE_UNDO = 4,
+};
+
+struct CBlockLogSegment
+{
+    FILE *file;
+    //! including what is still in the write buffer, for the active segment
+    uint64_t nSize;
+    //! bytes of records that are still in use
+    uint64_t nLive;
+
+    CBlockLogSegment(FILE *_file, uint64_t _nSize) : file(_file), nSize(_nSize), nLive(0) {}
+    ~CBlockLogSegment() { fclose(file); }
+};
+
+static uint64_t RecordChecksum(const unsigned char *header, const char *pdata, uint32_t nSize)
+{
+    return CSipHasher(BLOCKLOG_CHECKSUM_K0, BLOCKLOG_CHECKSUM_K1)
+        .Write(header, RECORD_HEADER_SIZE)
+        .Write((const unsigned char *)pdata, nSize)
+        .Finalize();
+}
+
+static bool ReadAt(const CBlockLogSegment &seg, const fs::path &path, uint64_t nOffset, void *buf, size_t nLen)
+{
+#ifndef WIN32
+    size_t nDone = 0;
+    while (nDone < nLen)
+    {
+        ssize_t n = pread(fileno(seg.file), (char *)buf + nDone, nLen - nDone, nOffset + nDone);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        nDone += n;
+    }
+    return true;
+#else
+    // No pread, and seeking the shared FILE would get in the way of the writer
+    FILE *file = fsbridge::fopen(path, "rb");
+    if (!file)
+        return false;
+    bool fOk = fseek(file, nOffset, SEEK_SET) == 0 && fread(buf, 1, nLen, file) == nLen;
+    fclose(file);
+    return fOk;
+#endif
+}
+
+static bool IsEraseRecord(uint8_t nType) { return nType == RECORD_ERASE_BLOCK || nType == RECORD_ERASE_UNDO; }
+static uint256 UndoKey(const CBlockIndex *pindex) { return pindex ? pindex->GetBlockHash() : uint256(); }
+
+CBlockLogDB::CBlockLogDB(const fs::path &_dir, uint64_t _nMaxSegmentSize)
+    : dir(_dir), nMaxSegmentSize(_nMaxSegmentSize), nActive(0), nWriteBufOffset(0), nAppended(0), nCommitted(0),
+      fCommitting(false)
+{
+    vWriteBuf.reserve(BLOCKLOG_WRITE_BUFFER_SIZE);
+    Recover();
+}
+
+CBlockLogDB::~CBlockLogDB()
+{
+    boost::unique_lock<boost::mutex> lock(cs_log);
+    if (FlushWriteBuffer() && !mapSegments.empty())
+        FileCommit(mapSegments[nActive]->file);
+}
+
+fs::path CBlockLogDB::SegmentPath(uint32_t nSegment, const char *ext) const
+{
+    return dir / strprintf("log%05u.%s", nSegment, ext);
+}
+
+bool CBlockLogDB::OpenSegment(uint32_t nSegment, const char *mode)
+{
+    FILE *file = fsbridge::fopen(SegmentPath(nSegment, "dat"), mode);
+    if (!file)
+        return error("%s: cannot open %s", __func__, SegmentPath(nSegment, "dat").string());
+    fseek(file, 0, SEEK_END);
+    mapSegments[nSegment] = std::make_shared<CBlockLogSegment>(file, ftell(file));
+    return true;
+}
+
+void CBlockLogDB::Apply(uint32_t nSegment, const CBlockLogEntry &entry)
+{
+    PosMap &mapPos = (entry.nType == RECORD_BLOCK || entry.nType == RECORD_ERASE_BLOCK) ? mapBlocks : mapUndo;
+    PosMap::iterator it = mapPos.find(entry.hash);
+    if (it != mapPos.end())
+    {
+        // whatever we had for this hash is superseded, so its segment has that much less in use
+        auto seg = mapSegments.find(it->second.nSegment);
+        if (seg != mapSegments.end())
+            seg->second->nLive -= RECORD_OVERHEAD + it->second.nSize;
+        mapPos.erase(it);
+    }
+    if (!IsEraseRecord(entry.nType))
+    {
+        mapPos[entry.hash] = CBlockLogPos{nSegment, entry.nOffset, entry.nSize};
+        mapSegments[nSegment]->nLive += RECORD_OVERHEAD + entry.nSize;
+    }
+}
+
+// Read the record list of a closed segment, which is only valid if the segment is still the size it had then
+static bool ReadSegmentIndex(const fs::path &path, uint64_t nSegmentSize, std::vector<CBlockLogEntry> &entries)
+{
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    try
+    {
+        uint64_t nSize = 0;
+        filein >> nSize;
+        filein >> entries;
+        return nSize == nSegmentSize;
+    }
+    catch (const std::exception &)
+    {
+        entries.clear();
+        return false;
+    }
+}
+
+// Walk the records of a segment.  Returns the offset right after the last complete record.
+static uint64_t ScanSegment(const CBlockLogSegment &seg,
+    const fs::path &path,
+    bool fVerify,
+    std::vector<CBlockLogEntry> &entries)
+{
+    uint64_t nPos = 0;
+    unsigned char header[RECORD_HEADER_SIZE];
+    std::vector<char> payload;
+    while (nPos + RECORD_OVERHEAD <= seg.nSize)
+    {
+        if (!ReadAt(seg, path, nPos, header, RECORD_HEADER_SIZE) || memcmp(header, BLOCKLOG_MAGIC, 4) != 0)
+            break;
+        const uint8_t nType = header[4];
+        const uint32_t nSize = ReadLE32(header + 40);
+        if (nType < RECORD_BLOCK || nType > RECORD_ERASE_UNDO || nPos + RECORD_OVERHEAD + nSize > seg.nSize)
+            break;
+        if (fVerify)
+        {
+            payload.resize(nSize + RECORD_TRAILER_SIZE);
+            if (!ReadAt(seg, path, nPos + RECORD_HEADER_SIZE, payload.data(), payload.size()) ||
+                ReadLE64((const unsigned char *)payload.data() + nSize) !=
+                    RecordChecksum(header, payload.data(), nSize))
+                break;
+        }
+        CBlockLogEntry entry;
+        entry.nType = nType;
+        memcpy(entry.hash.begin(), header + 8, 32);
+        entry.nOffset = nPos;
+        entry.nSize = nSize;
+        entries.push_back(entry);
+        nPos += RECORD_OVERHEAD + nSize;
+    }
+    return nPos;
+}
+
+void CBlockLogDB::Recover()
+{
+    fs::create_directories(dir);
+
+    std::set<uint32_t> setSegments;
+    for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it)
+    {
+        const std::string name = it->path().filename().string();
+        if (name.size() == 12 && name.compare(0, 3, "log") == 0 && name.compare(8, 4, ".dat") == 0)
+            setSegments.insert(atoi(name.substr(3, 5)));
+    }
+    if (setSegments.empty())
+    {
+        if (!OpenSegment(0, "ab+"))
+            throw std::runtime_error("Cannot create the block log in " + dir.string());
+        return;
+    }
+
+    const uint32_t nLast = *setSegments.rbegin();
+    for (uint32_t nSegment : setSegments)
+    {
+        const bool fLast = nSegment == nLast;
+        if (!OpenSegment(nSegment, fLast ? "ab+" : "rb"))
+            throw std::runtime_error("Cannot open block log segment " + SegmentPath(nSegment, "dat").string());
+        CBlockLogSegment &seg = *mapSegments[nSegment];
+        const fs::path path = SegmentPath(nSegment, "dat");
+
+        std::vector<CBlockLogEntry> entries;
+        if (fLast || !ReadSegmentIndex(SegmentPath(nSegment, "idx"), seg.nSize, entries))
+        {
+            // Only the segment we were appending to can end in a torn record, so that is the only one where the
+            // checksums are worth the time.
+            const uint64_t nEnd = ScanSegment(seg, path, fLast, entries);
+            if (nEnd != seg.nSize)
+            {
+                if (!fLast)
+                    LOGA("Block log: %s is damaged after %u of %u bytes\n", path.string(), nEnd, seg.nSize);
+                else
+                {
+                    LOGA("Block log: truncating %s from %u to %u bytes, the last record was not completely written\n",
+                        path.string(), seg.nSize, nEnd);
+                    if (!TruncateFile(seg.file, nEnd))
+                        throw std::runtime_error("Cannot truncate block log segment " + path.string());
+                    seg.nSize = nEnd;
+                }
+            }
+        }
+        for (const CBlockLogEntry &entry : entries)
+            Apply(nSegment, entry);
+        if (fLast)
+            vActiveEntries.swap(entries);
+    }
+    nActive = nLast;
+    nWriteBufOffset = mapSegments[nActive]->nSize;
+    LOGA("Block log: %u blocks and %u undo records in %u segments\n", mapBlocks.size(), mapUndo.size(),
+        mapSegments.size());
+}
+
+bool CBlockLogDB::FlushWriteBuffer()
+{
+    if (vWriteBuf.empty())
+        return true;
+    FILE *file = mapSegments[nActive]->file;
+    if (fwrite(vWriteBuf.data(), 1, vWriteBuf.size(), file) != vWriteBuf.size() || fflush(file) != 0)
+        return error("%s: cannot write to %s", __func__, SegmentPath(nActive, "dat").string());
+    nWriteBufOffset += vWriteBuf.size();
+    vWriteBuf.clear();
+    return true;
+}
+
+bool CBlockLogDB::CloseActiveSegment()
+{
+    if (!FlushWriteBuffer())
+        return false;
+    std::shared_ptr<CBlockLogSegment> seg = mapSegments[nActive];
+    FileCommit(seg->file);
+    nCommitted = nAppended;
+
+    // List the records so the next startup does not have to scan the segment.  If this fails, it just will.
+    CAutoFile fileout(fsbridge::fopen(SegmentPath(nActive, "idx"), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!fileout.IsNull())
+    {
+        try
+        {
+            fileout << seg->nSize;
+            fileout << vActiveEntries;
+            FileCommit(fileout.Get());
+        }
+        catch (const std::exception &e)
+        {
+            LOGA("Block log: cannot write %s: %s\n", SegmentPath(nActive, "idx").string(), e.what());
+        }
+    }
+
+    if (!OpenSegment(nActive + 1, "ab+"))
+        return false;
+    nActive++;
+    vActiveEntries.clear();
+    nWriteBufOffset = 0;
+    return true;
+}
+
+bool CBlockLogDB::Append(uint8_t nType, const uint256 &hash, const char *pdata, uint32_t nSize)
+{
+    const uint64_t nRecord = RECORD_OVERHEAD + nSize;
+    uint64_t nSeq = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        if (mapSegments[nActive]->nSize > 0 && mapSegments[nActive]->nSize + nRecord > nMaxSegmentSize &&
+            !CloseActiveSegment())
+            return false;
+        CBlockLogSegment &seg = *mapSegments[nActive];
+
+        unsigned char header[RECORD_HEADER_SIZE] = {};
+        memcpy(header, BLOCKLOG_MAGIC, 4);
+        header[4] = nType;
+        memcpy(header + 8, hash.begin(), 32);
+        WriteLE32(header + 40, nSize);
+        unsigned char trailer[RECORD_TRAILER_SIZE];
+        WriteLE64(trailer, RecordChecksum(header, pdata, nSize));
+
+        vWriteBuf.insert(vWriteBuf.end(), (const char *)header, (const char *)header + RECORD_HEADER_SIZE);
+        vWriteBuf.insert(vWriteBuf.end(), pdata, pdata + nSize);
+        vWriteBuf.insert(vWriteBuf.end(), (const char *)trailer, (const char *)trailer + RECORD_TRAILER_SIZE);
+
+        CBlockLogEntry entry;
+        entry.nType = nType;
+        entry.hash = hash;
+        entry.nOffset = seg.nSize;
+        entry.nSize = nSize;
+        seg.nSize += nRecord;
+        vActiveEntries.push_back(entry);
+        Apply(nActive, entry);
+        nAppended += nRecord;
+
+        if (vWriteBuf.size() >= BLOCKLOG_WRITE_BUFFER_SIZE && !FlushWriteBuffer())
+            return false;
+        // Once we are synced every block is committed right away, like the block db does.  During IBD the
+        // commits are left to FlushStateToDisk, unless too much has piled up.
+        if (IsChainNearlySyncd() || nAppended - nCommitted >= BLOCKLOG_MAX_UNSYNCED)
+            nSeq = nAppended;
+    }
+    if (nSeq)
+        Commit(nSeq);
+    return true;
+}
+
+void CBlockLogDB::Commit(uint64_t nSeq)
+{
+    std::shared_ptr<CBlockLogSegment> seg;
+    uint64_t nTarget = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        while (nCommitted < nSeq && fCommitting)
+        {
+            // whoever is committing now may well cover us as well
+            condCommitted.wait(lock);
+        }
+        if (nCommitted >= nSeq)
+            return;
+        if (!FlushWriteBuffer())
+            return;
+        fCommitting = true;
+        nTarget = nAppended;
+        seg = mapSegments[nActive];
+    }
+
+    // The sync runs without the lock, so others can append in the meantime and have their data committed by the
+    // next sync, together with whatever else arrives until then.
+    FileCommit(seg->file);
+
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        nCommitted = std::max(nCommitted, nTarget);
+        fCommitting = false;
+    }
+    condCommitted.notify_all();
+}
+
+void CBlockLogDB::Flush()
+{
+    uint64_t nSeq = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        nSeq = nAppended;
+    }
+    Commit(nSeq);
+}
+
+bool CBlockLogDB::Read(uint8_t nType, const uint256 &hash, std::vector<char> &data)
+{
+    std::shared_ptr<CBlockLogSegment> seg;
+    CBlockLogPos pos;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        const PosMap &mapPos = nType == RECORD_BLOCK ? mapBlocks : mapUndo;
+        PosMap::const_iterator it = mapPos.find(hash);
+        if (it == mapPos.end())
+            return false;
+        pos = it->second;
+        if (pos.nSegment == nActive && pos.nOffset >= nWriteBufOffset)
+        {
+            // not even handed to the OS yet
+            const char *p = vWriteBuf.data() + (pos.nOffset - nWriteBufOffset);
+            data.assign(p, p + RECORD_OVERHEAD + pos.nSize);
+            return true;
+        }
+        seg = mapSegments[pos.nSegment];
+    }
+
+    data.resize(RECORD_OVERHEAD + pos.nSize);
+    if (!ReadAt(*seg, SegmentPath(pos.nSegment, "dat"), pos.nOffset, data.data(), data.size()))
+        return error("%s: cannot read %u bytes at %u of %s", __func__, data.size(), pos.nOffset,
+            SegmentPath(pos.nSegment, "dat").string());
+    const unsigned char *header = (const unsigned char *)data.data();
+    if (memcmp(header, BLOCKLOG_MAGIC, 4) != 0 || header[4] != nType || memcmp(header + 8, hash.begin(), 32) != 0 ||
+        ReadLE32(header + 40) != pos.nSize ||
+        ReadLE64(header + RECORD_HEADER_SIZE + pos.nSize) !=
+            RecordChecksum(header, data.data() + RECORD_HEADER_SIZE, pos.nSize))
+        return error("%s: corrupt record for %s at %u of %s", __func__, hash.ToString(), pos.nOffset,
+            SegmentPath(pos.nSegment, "dat").string());
+    return true;
+}
+
+bool CBlockLogDB::Erase(uint8_t nType, const uint256 &hash)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_log);
+        const PosMap &mapPos = nType == RECORD_ERASE_BLOCK ? mapBlocks : mapUndo;
+        if (mapPos.find(hash) == mapPos.end())
+            return true;
+    }
+    return Append(nType, hash, nullptr, 0);
+}
+
+bool CBlockLogDB::WriteBlock(const CBlock &block)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    return Append(RECORD_BLOCK, block.GetHash(), ss.data(), ss.size());
+}
+
+bool CBlockLogDB::ReadBlock(const CBlockIndex *pindex, CBlock &block)
+{
+    std::vector<char> record;
+    if (!Read(RECORD_BLOCK, pindex->GetBlockHash(), record))
+        return false;
+    try
+    {
+        CSpanReader reader(
+            SER_DISK, CLIENT_VERSION, record.data() + RECORD_HEADER_SIZE, record.size() - RECORD_OVERHEAD);
+        reader >> block;
+    }
+    catch (const std::exception &e)
+    {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CBlockLogDB::EraseBlock(CBlock &block) { return Erase(RECORD_ERASE_BLOCK, block.GetHash()); }
+bool CBlockLogDB::EraseBlock(const CBlockIndex *pindex) { return Erase(RECORD_ERASE_BLOCK, pindex->GetBlockHash()); }
+bool CBlockLogDB::WriteUndo(const CBlockUndo &blockundo, const CBlockIndex *pindex)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << blockundo;
+    return Append(RECORD_UNDO, UndoKey(pindex), ss.data(), ss.size());
+}
+
+bool CBlockLogDB::ReadUndo(CBlockUndo &blockundo, const CBlockIndex *pindex)
+{
+    std::vector<char> record;
+    if (!Read(RECORD_UNDO, UndoKey(pindex), record))
+        return error("%s: failure to read undoblock from db", __func__);
+    try
+    {
+        CSpanReader reader(
+            SER_DISK, CLIENT_VERSION, record.data() + RECORD_HEADER_SIZE, record.size() - RECORD_OVERHEAD);
+        reader >> blockundo;
+    }
+    catch (const std::exception &e)
+    {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CBlockLogDB::EraseUndo(const CBlockIndex *pindex)
+{
+    if (!pindex)
+        return false;
+    return Erase(RECORD_ERASE_UNDO, pindex->GetBlockHash());
+}
+
+void CBlockLogDB::DeleteUnusedSegments()
+{
+    boost::unique_lock<boost::mutex> lock(cs_log);
+    size_t nDeleted = 0;
+    // Segments go in order, so that an erasure never outlives the segment holding the data it erases
+    while (!mapSegments.empty())
+    {
+        auto it = mapSegments.begin();
+        if (it->first == nActive || it->second->nLive > 0)
+            break;
+        // a reader that still holds the segment can finish, the file is only gone once it lets go
+        fs::remove(SegmentPath(it->first, "dat"));
+        fs::remove(SegmentPath(it->first, "idx"));
+        mapSegments.erase(it);
+        nDeleted++;
+    }
+    if (nDeleted)
+        LOG(PRUNE, "Block log: deleted %u unused segments\n", nDeleted);
+}
+
+uint64_t CBlockLogDB::DiskUsage() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_log);
+    uint64_t nTotal = 0;
+    for (const auto &seg : mapSegments)
+        nTotal += seg.second->nSize;
+    return nTotal;
+}
+
+size_t CBlockLogDB::SegmentCount() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_log);
+    return mapSegments.size();
+}
+
+uint64_t CBlockLogDB::PruneDB(uint64_t nLastBlockWeCanPrune)
+{
+    CBlockIndex *pindexOldest = chainActive.Tip();
+    while (pindexOldest->pprev && pindexOldest->pprev->nFile != 0)
+    {
+        pindexOldest = pindexOldest->pprev;
+    }
+    uint64_t prunedCount = 0;
+    while (nDBUsedSpace >= nPruneTarget && pindexOldest != nullptr)
+    {
+        if (pindexOldest->nHeight >= (int)nLastBlockWeCanPrune)
+        {
+            break;
+        }
+        EraseBlock(pindexOldest);
+        EraseUndo(pindexOldest);
+        nDBUsedSpace = nDBUsedSpace - pindexOldest->nDataPos;
+        pindexOldest->nStatus &= ~BLOCK_HAVE_DATA;
+        pindexOldest->nStatus &= ~BLOCK_HAVE_UNDO;
+        pindexOldest->nFile = 0;
+        pindexOldest->nDataPos = 0;
+        pindexOldest->nUndoPos = 0;
+        setDirtyBlockIndex.insert(pindexOldest);
+        prunedCount = prunedCount + 1;
+        pindexOldest = chainActive.Next(pindexOldest);
+    }
+    CValidationState state;
+    FlushStateToDiskInternal(state);
+    // the block index no longer refers to the erased data, so the erasures can be committed and whole segments
+    // given back
+    Flush();
+    DeleteUnusedSegments();
+    nDBUsedSpace = DiskUsage();
+    return prunedCount;
+}
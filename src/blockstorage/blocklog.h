@@ -0,0 +1,138 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKLOG_H
+#define BITCOIN_BLOCKLOG_H
+
+#include "chain.h"
+#include "dbabstract.h"
+#include "fs.h"
+#include "main.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+#include "undo.h"
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/** A segment of the block log is closed, and a new one started, once it reaches this size */
+static const uint64_t DEFAULT_BLOCKLOG_SEGMENT_SIZE = 512ULL << 20;
+/** Appends are collected in memory up to this size before they are handed to the OS */
+static const size_t BLOCKLOG_WRITE_BUFFER_SIZE = 4 << 20;
+/** At most this much data is appended before it is committed to disk, even if nobody asked for it */
+static const uint64_t BLOCKLOG_MAX_UNSYNCED = 64 << 20;
+
+/** Where a record of the block log lives */
+struct CBlockLogPos
+{
+    uint32_t nSegment;
+    uint64_t nOffset; //!< of the record header in the segment
+    uint32_t nSize; //!< of the payload
+};
+
+/** A record as listed in the index file of a closed segment */
+struct CBlockLogEntry
+{
+    uint8_t nType;
+    uint256 hash;
+    uint64_t nOffset;
+    uint32_t nSize;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(nType);
+        READWRITE(hash);
+        READWRITE(nOffset);
+        READWRITE(nSize);
+    }
+};
+
+struct CBlockLogSegment;
+
+/**
+ * Block and undo storage in an append-only log (blocklog/log/log?????.dat).
+ *
+ * Every block, undo record and erasure is appended to the current segment, with the hash it belongs to and a
+ * checksum, and an in memory map from hash to position is all we need to find it again.  Unlike the block db,
+ * which hands every block to leveldb as one huge value that is then copied around by compactions, data is
+ * written exactly once.  Writes only reach the OS once BLOCKLOG_WRITE_BUFFER_SIZE has been collected and are
+ * committed to disk as a group: one fsync covers everything appended since the last one, however many writers
+ * are waiting for it.  Reads use pread on the segment files so they neither block each other nor the writer.
+ *
+ * When a segment is closed, its records are listed in log?????.idx so startup only has to scan the segment that
+ * was still open, which is also where a crash can leave a partially written record behind.  Erased data is
+ * reclaimed by deleting segments from the oldest one on, once nothing in them is in use anymore.
+ */
+class CBlockLogDB : public CDatabaseAbstract
+{
+public:
+    explicit CBlockLogDB(const fs::path &dir, uint64_t nMaxSegmentSize = DEFAULT_BLOCKLOG_SEGMENT_SIZE);
+    ~CBlockLogDB();
+
+    bool WriteBlock(const CBlock &block);
+    bool ReadBlock(const CBlockIndex *pindex, CBlock &block);
+    bool EraseBlock(CBlock &block);
+    bool EraseBlock(const CBlockIndex *pindex);
+    //! space is reclaimed a segment at a time, whatever the range
+    void CondenseBlockData(const std::string &start, const std::string &end) { DeleteUnusedSegments(); }
+    bool WriteUndo(const CBlockUndo &blockundo, const CBlockIndex *pindex);
+    bool ReadUndo(CBlockUndo &blockundo, const CBlockIndex *pindex);
+    bool EraseUndo(const CBlockIndex *pindex);
+    //! commit everything written so far to disk
+    void Flush();
+    void CondenseUndoData(const std::string &start, const std::string &end) { DeleteUnusedSegments(); }
+    uint64_t PruneDB(uint64_t nLastBlockWeCanPrune);
+
+    /** Size of all segments on disk */
+    uint64_t DiskUsage() const;
+    size_t SegmentCount() const;
+
+private:
+    CBlockLogDB(const CBlockLogDB &);
+    void operator=(const CBlockLogDB &);
+
+    typedef std::unordered_map<uint256, CBlockLogPos, BlockHasher> PosMap;
+
+    bool Append(uint8_t nType, const uint256 &hash, const char *pdata, uint32_t nSize);
+    bool Read(uint8_t nType, const uint256 &hash, std::vector<char> &data);
+    bool Erase(uint8_t nType, const uint256 &hash);
+    /** Wait until everything appended up to nSeq is on disk */
+    void Commit(uint64_t nSeq);
+
+    void Recover();
+    bool OpenSegment(uint32_t nSegment, const char *mode);
+    void Apply(uint32_t nSegment, const CBlockLogEntry &entry);
+    bool FlushWriteBuffer();
+    bool CloseActiveSegment();
+    void DeleteUnusedSegments();
+    fs::path SegmentPath(uint32_t nSegment, const char *ext) const;
+
+    const fs::path dir;
+    const uint64_t nMaxSegmentSize;
+
+    mutable CWaitableCriticalSection cs_log;
+    CConditionVariable condCommitted;
+    std::map<uint32_t, std::shared_ptr<CBlockLogSegment> > mapSegments;
+    PosMap mapBlocks;
+    PosMap mapUndo;
+    //! the segment we append to, and the records in it so far
+    uint32_t nActive;
+    std::vector<CBlockLogEntry> vActiveEntries;
+    //! appended data that has not been written to the active segment yet, and the offset it goes to
+    std::vector<char> vWriteBuf;
+    uint64_t nWriteBufOffset;
+    //! bytes appended since we opened the log, and how many of those are on disk
+    uint64_t nAppended;
+    uint64_t nCommitted;
+    bool fCommitting;
+};
+
+#endif // BITCOIN_BLOCKLOG_H
@@ -0,0 +1,172 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocklz.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_LOG = 16;
+static const uint32_t NO_POS = 0xffffffff;
+
+static inline uint32_t Read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t Hash32(uint32_t v) { return (v * 2654435761U) >> (32 - HASH_LOG); }
+// Lengths that do not fit in their 4 bit nibble continue in bytes of 255 followed by the remainder
+static inline char *WriteLength(char *op, size_t nLen)
+{
+    while (nLen >= 255)
+    {
+        *op++ = (char)255;
+        nLen -= 255;
+    }
+    *op++ = (char)nLen;
+    return op;
+}
+
+static inline char *WriteSequence(char *op, const char *literals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    char *token = op++;
+    uint8_t nToken = (uint8_t)((nLiterals >= 15 ? 15 : nLiterals) << 4);
+    if (nLiterals >= 15)
+        op = WriteLength(op, nLiterals - 15);
+    memcpy(op, literals, nLiterals);
+    op += nLiterals;
+    if (nMatch)
+    {
+        *op++ = (char)(nOffset & 0xff);
+        *op++ = (char)(nOffset >> 8);
+        size_t nLen = nMatch - MIN_MATCH;
+        nToken |= (uint8_t)(nLen >= 15 ? 15 : nLen);
+        if (nLen >= 15)
+            op = WriteLength(op, nLen - 15);
+    }
+    *token = (char)nToken;
+    return op;
+}
+
+size_t BlockLzBound(size_t nSize) { return nSize + nSize / 255 + 16; }
+size_t BlockLzCompress(const char *src, size_t nSrc, char *dst)
+{
+    std::vector<uint32_t> vTable(1 << HASH_LOG, NO_POS);
+    char *op = dst;
+    size_t nAnchor = 0;
+    size_t nPos = 0;
+    size_t nMisses = 0;
+
+    while (nPos + MIN_MATCH <= nSrc)
+    {
+        const uint32_t v = Read32(src + nPos);
+        uint32_t &slot = vTable[Hash32(v)];
+        const uint32_t nRef = slot;
+        slot = (uint32_t)nPos;
+
+        if (nRef == NO_POS || nPos - nRef > MAX_OFFSET || Read32(src + nRef) != v)
+        {
+            // Incompressible data such as signatures is skipped over ever faster
+            nPos += 1 + (nMisses++ >> 5);
+            continue;
+        }
+        nMisses = 0;
+
+        size_t nMatch = MIN_MATCH;
+        while (nPos + nMatch < nSrc && src[nRef + nMatch] == src[nPos + nMatch])
+            nMatch++;
+        // extend the match backwards over literals that also match
+        size_t nBack = 0;
+        while (nPos - nBack > nAnchor && nRef > nBack && src[nRef - nBack - 1] == src[nPos - nBack - 1])
+            nBack++;
+
+        op = WriteSequence(op, src + nAnchor, nPos - nBack - nAnchor, nPos - nRef, nMatch + nBack);
+        nPos += nMatch;
+        nAnchor = nPos;
+        if (nPos >= 2 && nPos + MIN_MATCH <= nSrc)
+            vTable[Hash32(Read32(src + nPos - 2))] = (uint32_t)(nPos - 2);
+    }
+
+    // the last sequence is made of literals only
+    op = WriteSequence(op, src + nAnchor, nSrc - nAnchor, 0, 0);
+    return op - dst;
+}
+
+bool BlockLzDecompress(const char *src, size_t nSrc, char *dst, size_t nDst)
+{
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *const iend = ip + nSrc;
+    char *op = dst;
+    char *const oend = dst + nDst;
+
+    for (;;)
+    {
+        // the compressor always finishes with a literals only sequence, even an empty one after a final match, so
+        // input that runs out right after a match was cut short
+        if (ip >= iend)
+            return false;
+        const uint8_t nToken = *ip++;
+
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                nLiterals += b;
+            } while (b == 255);
+        }
+        if (nLiterals > (size_t)(iend - ip) || nLiterals > (size_t)(oend - op))
+            return false;
+        memcpy(op, ip, nLiterals);
+        ip += nLiterals;
+        op += nLiterals;
+
+        // only the last sequence may end after its literals
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        const size_t nOffset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t nMatch = (nToken & 15);
+        if (nMatch == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                nMatch += b;
+            } while (b == 255);
+        }
+        nMatch += MIN_MATCH;
+
+        if (nOffset == 0 || nOffset > (size_t)(op - dst) || nMatch > (size_t)(oend - op))
+            return false;
+        const char *match = op - nOffset;
+        if (nOffset >= nMatch)
+        {
+            memcpy(op, match, nMatch);
+            op += nMatch;
+        }
+        else
+        {
+            // the match overlaps the bytes it produces, e.g. a run of zeros
+            for (size_t i = 0; i < nMatch; i++)
+                *op++ = *match++;
+        }
+    }
+    return op == oend;
+}
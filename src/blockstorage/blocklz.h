@@ -0,0 +1,27 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKLZ_H
+#define BITCOIN_BLOCKLZ_H
+
+#include <stddef.h>
+
+//
+// A small LZ77 compressor for block and undo data, using the LZ4 block format: a run of literals followed by a
+// back reference of at least 4 bytes up to 64KiB back.  Block data is mostly hashes, keys and signatures which
+// no compressor can shrink, so we go for speed: decompression has to keep up with serving blocks to peers.
+// What it does pick up is the repetition of script templates, outpoints and amounts, and the zero padding
+// found in block files.
+//
+
+/** Largest size the compressed form of nSize bytes can take */
+size_t BlockLzBound(size_t nSize);
+
+/** Compress nSrc bytes into dst, which must hold at least BlockLzBound(nSrc) bytes; returns the compressed size */
+size_t BlockLzCompress(const char *src, size_t nSrc, char *dst);
+
+/** Decompress into exactly nDst bytes; returns false if src is not a valid compressed form of that many bytes */
+bool BlockLzDecompress(const char *src, size_t nSrc, char *dst, size_t nDst);
+
+#endif // BITCOIN_BLOCKLZ_H
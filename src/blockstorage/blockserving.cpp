@@ -0,0 +1,129 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockserving.h"
+
+#include "blockfilemap.h"
+#include "blockstorage.h"
+#include "chain.h"
+#include "sequential_files.h"
+#include "tweak.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation/validation.h"
+
+#include <algorithm>
+
+extern CTweak<unsigned int> blockReadAhead;
+extern CTweak<unsigned int> blockServeReads;
+
+/** How many read ahead blocks we remember, so peers that ask for the same blocks do not advise them again */
+static const size_t READAHEAD_HISTORY = 1024;
+
+CBlockServer blockServer;
+
+CBlockServer::CBlockServer()
+    : nReads(0), nBlocks(0), nBytes(0), nReadAheadBlocks(0), nReadAheadBytes(0), nReadWaits(0), nReadWaitMicros(0),
+      nMaxReads(0)
+{
+}
+
+void CBlockServer::ReadAhead(std::deque<CInv>::const_iterator begin, std::deque<CInv>::const_iterator end)
+{
+    const unsigned int nWindow = blockReadAhead.Value();
+    if (nWindow == 0 || pblockdb)
+        return;
+
+    std::vector<CDiskBlockPos> vPos;
+    {
+        LOCK(cs_readahead);
+        unsigned int nBlocksSeen = 0;
+        for (auto it = begin; it != end && nBlocksSeen < nWindow; ++it)
+        {
+            if (it->type != MSG_BLOCK && it->type != MSG_FILTERED_BLOCK && it->type != MSG_CMPCT_BLOCK)
+                continue;
+            nBlocksSeen++;
+            if (setReadAhead.count(it->hash))
+                continue;
+            const CBlockIndex *pindex = LookupBlockIndex(it->hash);
+            if (!pindex)
+                continue;
+            const CDiskBlockPos pos = pindex->GetBlockPos();
+            if (pos.IsNull())
+                continue;
+            vPos.push_back(pos);
+            setReadAhead.insert(it->hash);
+            vReadAhead.push_back(it->hash);
+        }
+        while (vReadAhead.size() > READAHEAD_HISTORY)
+        {
+            setReadAhead.erase(vReadAhead.front());
+            vReadAhead.pop_front();
+        }
+    }
+    if (vPos.empty())
+        return;
+
+    nReadAheadBlocks += vPos.size();
+    nReadAheadBytes += ReadAheadBlocksSequential(std::move(vPos));
+}
+
+void CBlockServer::AcquireRead()
+{
+    boost::unique_lock<boost::mutex> lock(cs_reads);
+    const unsigned int nLimit = blockServeReads.Value();
+    if (nLimit != 0 && nReads >= nLimit)
+    {
+        const uint64_t nStart = GetStopwatchMicros();
+        while (nReads >= std::max(blockServeReads.Value(), 1u))
+            condReads.wait(lock);
+        nReadWaits++;
+        nReadWaitMicros += GetStopwatchMicros() - nStart;
+    }
+    nReads++;
+    if (nReads > nMaxReads)
+        nMaxReads = nReads;
+}
+
+void CBlockServer::ReleaseRead()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_reads);
+        nReads--;
+    }
+    condReads.notify_one();
+}
+
+bool CBlockServer::ReadBlock(const CBlockIndex *pindex,
+    bool fRawOk,
+    CRawBlock &rawBlock,
+    CBlock &block,
+    bool &fRaw,
+    const Consensus::Params &consensusParams)
+{
+    AcquireRead();
+    fRaw = fRawOk && ReadRawBlockFromDisk(rawBlock, pindex);
+    const bool fOk = fRaw || ReadBlockFromDisk(block, pindex, consensusParams);
+    ReleaseRead();
+
+    if (fOk)
+    {
+        nBlocks++;
+        nBytes += fRaw ? rawBlock.size() : ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    }
+    return fOk;
+}
+
+CBlockServer::Stats CBlockServer::GetStats() const
+{
+    Stats stats;
+    stats.nBlocks = nBlocks;
+    stats.nBytes = nBytes;
+    stats.nReadAheadBlocks = nReadAheadBlocks;
+    stats.nReadAheadBytes = nReadAheadBytes;
+    stats.nReadWaits = nReadWaits;
+    stats.nReadWaitMicros = nReadWaitMicros;
+    stats.nMaxConcurrentReads = nMaxReads;
+    return stats;
+}
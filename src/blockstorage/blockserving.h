@@ -0,0 +1,94 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSERVING_H
+#define BITCOIN_BLOCKSERVING_H
+
+#include "primitives/block.h"
+#include "protocol.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <deque>
+#include <set>
+#include <stdint.h>
+
+class CBlockIndex;
+class CRawBlock;
+namespace Consensus
+{
+struct Params;
+}
+
+/** How many of the blocks a peer asked for we read ahead of serving them by default */
+static const unsigned int DEFAULT_BLOCK_READ_AHEAD = 16;
+/** How many blocks we read from disk at once to serve them to peers by default */
+static const unsigned int DEFAULT_BLOCK_SERVE_READS = 4;
+
+/**
+ * Reads the blocks that peers ask for with getdata.
+ *
+ * Peers that sync from us ask for long runs of old blocks, which are served one after the other from each peer's
+ * message handler, so the disk sees a stream of small reads that jump between files for every peer.  Once a peer's
+ * getdata is being served, the blocks it is still waiting for are handed to the OS to read ahead, grouped into
+ * ranges per block file, so by the time we get to them they are in memory.  Blocks another peer already had read
+ * ahead are not advised again.  The number of disk reads that run at once is bounded, so peers take turns instead
+ * of all seeking at the same time.
+ */
+class CBlockServer
+{
+public:
+    struct Stats
+    {
+        uint64_t nBlocks; //!< served from disk
+        uint64_t nBytes; //!< of the blocks served
+        uint64_t nReadAheadBlocks;
+        uint64_t nReadAheadBytes;
+        uint64_t nReadWaits; //!< reads that had to wait for a turn
+        uint64_t nReadWaitMicros;
+        unsigned int nMaxConcurrentReads;
+    };
+
+    CBlockServer();
+
+    /** Read ahead the blocks requested in [begin, end) that nobody had read ahead yet */
+    void ReadAhead(std::deque<CInv>::const_iterator begin, std::deque<CInv>::const_iterator end);
+    /**
+     * Read pindex's block to serve it, waiting for a turn to read if too many reads are running.  If fRawOk the
+     * block is read without being deserialized into rawBlock when its file allows for that, and fRaw is set.
+     */
+    bool ReadBlock(const CBlockIndex *pindex,
+        bool fRawOk,
+        CRawBlock &rawBlock,
+        CBlock &block,
+        bool &fRaw,
+        const Consensus::Params &consensusParams);
+
+    Stats GetStats() const;
+
+private:
+    void AcquireRead();
+    void ReleaseRead();
+
+    //! blocks we had read ahead most recently, oldest first
+    CCriticalSection cs_readahead;
+    std::set<uint256> setReadAhead;
+    std::deque<uint256> vReadAhead;
+
+    CWaitableCriticalSection cs_reads;
+    CConditionVariable condReads;
+    unsigned int nReads;
+
+    std::atomic<uint64_t> nBlocks;
+    std::atomic<uint64_t> nBytes;
+    std::atomic<uint64_t> nReadAheadBlocks;
+    std::atomic<uint64_t> nReadAheadBytes;
+    std::atomic<uint64_t> nReadWaits;
+    std::atomic<uint64_t> nReadWaitMicros;
+    std::atomic<unsigned int> nMaxReads;
+};
+extern CBlockServer blockServer;
+
+#endif // BITCOIN_BLOCKSERVING_H
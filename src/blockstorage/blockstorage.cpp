@@ -7,11 +7,14 @@
 #include "blockstorage.h"
 
 #include "blockleveldb.h"
+#include "blocklog.h"
 #include "chainparams.h"
+#include "coldfiles.h"
 #include "dbwrapper.h"
 #include "fs.h"
 #include "main.h"
 #include "sequential_files.h"
+#include "txlookup.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "validation/validation.h"
@@ -24,6 +27,9 @@ extern std::multimap<CBlockIndex *, CBlockIndex *> mapBlocksUnlinked;
 extern CTweak<uint64_t> pruneIntervalTweak;
 
 CDatabaseAbstract *pblockdb = nullptr;
+// Time spent pruning while holding up a flush, in microseconds
+static int64_t nTimeFindFilesToPrune = 0;
+static int64_t nTimeUnlinkPrunedFiles = 0;
 uint64_t blockfile_chunk_size = DEFAULT_BLOCKFILE_CHUNK_SIZE;
 uint64_t undofile_chunk_size = DEFAULT_UNDOFILE_CHUNK_SIZE;
 
@@ -36,6 +42,8 @@ void InitializeBlockStorage(const int64_t &_nBlockTreeDBCache,
     const int64_t &_nBlockDBCache,
     const int64_t &_nBlockUndoDBCache)
 {
+    // also needed in block db mode, to sync blocks over from the block files
+    coldBlockFiles.Init();
     if (BLOCK_DB_MODE == SEQUENTIAL_BLOCK_FILES) // BLOCK_DB_MODE 0
     {
         pblocktree = new CBlockTreeDB(_nBlockTreeDBCache, "blocks", false, fReindex);
@@ -58,6 +66,22 @@ void InitializeBlockStorage(const int64_t &_nBlockTreeDBCache,
         }
         pblockdb = new CBlockLevelDB(_nBlockDBCache, _nBlockUndoDBCache, false, false, false);
     }
+    else if (BLOCK_DB_MODE == BLOCKLOG_BLOCK_STORAGE) // BLOCK_DB_MODE 2
+    {
+        pblocktree = new CBlockTreeDB(_nBlockTreeDBCache, "blocklog", false, fReindex);
+        CBlockLogDB *pblocklog = new CBlockLogDB(GetDataDir() / "blocklog" / "log");
+        nDBUsedSpace = pblocklog->DiskUsage();
+        pblockdb = pblocklog;
+    }
+}
+
+fs::path GetBlockStorageDir(BlockDBMode mode)
+{
+    if (mode == LEVELDB_BLOCK_STORAGE)
+        return "blockdb";
+    if (mode == BLOCKLOG_BLOCK_STORAGE)
+        return "blocklog";
+    return "blocks";
 }
 
 // grab the block tree for mode and put it at pblocktreeother
@@ -65,13 +89,9 @@ void GetBlockTreeOther(BlockDBMode mode)
 {
     // hardcode 2MiB here, it is a negligable amount and is only used temporarily
     int64_t _nBlockTreeDBCache = (1 << 21);
-    if (mode == SEQUENTIAL_BLOCK_FILES)
-    {
-        pblocktreeother = new CBlockTreeDB(_nBlockTreeDBCache, "blocks", false, fReindex);
-    }
-    else if (mode == LEVELDB_BLOCK_STORAGE)
+    if (mode < END_STORAGE_OPTIONS)
     {
-        pblocktreeother = new CBlockTreeDB(_nBlockTreeDBCache, "blockdb", false, fReindex);
+        pblocktreeother = new CBlockTreeDB(_nBlockTreeDBCache, GetBlockStorageDir(mode).string(), false, fReindex);
     }
 }
 
@@ -88,6 +108,10 @@ void GetTempBlockDB(CDatabaseAbstract *&_pblockdbsync, BlockDBMode &_otherMode)
         int64_t _nBlockUndoDBCache = 64 << 20;
         _pblockdbsync = new CBlockLevelDB(_nBlockDBCache, _nBlockUndoDBCache, false, false, false);
     }
+    else if (_otherMode == BLOCKLOG_BLOCK_STORAGE)
+    {
+        _pblockdbsync = new CBlockLogDB(GetDataDir() / "blocklog" / "log");
+    }
 }
 
 bool DetermineStorageSync(BlockDBMode &_otherMode)
@@ -310,8 +334,9 @@ void SyncStorage(const CChainParams &chainparams)
         }
     }
 
-    else if (BLOCK_DB_MODE == LEVELDB_BLOCK_STORAGE)
+    else
     {
+        // The blocks come from the sequential files, or from the other database if we used one before
         std::vector<std::pair<int, CDiskBlockIndex> > indexByHeight;
         pblocktreeother->GetSortedHashIndex(indexByHeight);
         LOGA("indexByHeight size = %u \n", indexByHeight.size());
@@ -384,7 +409,9 @@ void SyncStorage(const CChainParams &chainparams)
             if (index->nStatus & BLOCK_HAVE_DATA && !index->GetBlockPos().IsNull())
             {
                 CBlock block_seq;
-                if (!ReadBlockFromDiskSequential(block_seq, index->GetBlockPos(), chainparams.GetConsensus()))
+                if (pblockdbsync ? !pblockdbsync->ReadBlock(index, block_seq) :
+                                   !ReadBlockFromDiskSequential(block_seq, index->GetBlockPos(),
+                                       chainparams.GetConsensus()))
                 {
                     LOGA("SyncStorage(): critical error, failure to read block data from sequential files \n");
                     assert(false);
@@ -411,7 +438,8 @@ void SyncStorage(const CChainParams &chainparams)
                         index->GetBlockHash().GetHex().c_str());
                     assert(false);
                 }
-                if (!ReadUndoFromDiskSequential(blockundo, pos, index->pprev->GetBlockHash()))
+                if (pblockdbsync ? !pblockdbsync->ReadUndo(blockundo, index->pprev) :
+                                   !ReadUndoFromDiskSequential(blockundo, pos, index->pprev->GetBlockHash()))
                 {
                     LOGA("SyncStorage(): critical error, failure to read undo data from sequential files \n");
                     assert(false);
@@ -433,7 +461,8 @@ void SyncStorage(const CChainParams &chainparams)
                 }
             }
             setDirtyBlockIndex.insert(index);
-            if (lastFinishedFile <= loadedblockfile && index->nHeight > (int)blockfiles[lastFinishedFile].nHeightLast)
+            if (!pblockdbsync && lastFinishedFile <= loadedblockfile &&
+                index->nHeight > (int)blockfiles[lastFinishedFile].nHeightLast)
             {
                 fs::remove(GetDataDir() / "blocks" / strprintf("blk%05u.dat", lastFinishedFile));
                 fs::remove(GetDataDir() / "blocks" / strprintf("rev%05u.dat", lastFinishedFile));
@@ -445,7 +474,7 @@ void SyncStorage(const CChainParams &chainparams)
         if (bestHeight != 0)
         {
             assert(pindexBest);
-            pcoinsdbview->WriteBestBlock(pindexBest->GetBlockHash(), LEVELDB_BLOCK_STORAGE);
+            pcoinsdbview->WriteBestBlock(pindexBest->GetBlockHash(), BLOCK_DB_MODE);
         }
     }
     // make sure whatever node we did a sync from has no best block anymore
@@ -495,6 +524,80 @@ bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(CRawBlock &block, const CBlockIndex *pindex)
+{
+    if (pblockdb)
+        return false;
+    if (!ReadRawBlockFromDiskSequential(block, pindex->GetBlockPos()))
+        return false;
+
+    // The header is enough to make sure the file holds the block we were asked for
+    CBlockHeader header;
+    try
+    {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, block.data(), block.size());
+        reader >> header;
+    }
+    catch (const std::exception &e)
+    {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+    {
+        return error("ReadRawBlockFromDisk(CRawBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+            pindex->ToString(), pindex->GetBlockPos().ToString());
+    }
+    return true;
+}
+
+bool ReadTxFromDisk(CTransactionRef &ptx,
+    const CBlockIndex *pindex,
+    const uint256 &txhash,
+    const Consensus::Params &consensusParams)
+{
+    // Only sequential block files can be read a transaction at a time
+    if (!pblockdb && pblocktree)
+    {
+        CBlockTxOffsets offsets;
+        if (pblocktree->ReadTxOffsets(pindex->GetBlockHash(), offsets))
+        {
+            const uint64_t nShortId = txhash.GetCheapHash();
+            for (size_t i = 0; i < offsets.vShortIds.size() && i < offsets.vOffsets.size(); i++)
+            {
+                if (offsets.vShortIds[i] != nShortId)
+                    continue;
+                CBlockHeader header;
+                CTransactionRef tx;
+                if (!ReadTxFromDiskSequential(CDiskTxPos(pindex->GetBlockPos(), offsets.vOffsets[i]), header, tx))
+                    return false;
+                if (header.GetHash() != pindex->GetBlockHash())
+                    return error("%s: GetHash() doesn't match index for %s at %s", __func__, pindex->ToString(),
+                        pindex->GetBlockPos().ToString());
+                if (tx->GetHash() == txhash)
+                {
+                    ptx = tx;
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        return false;
+    // A block pruned since we read it has already had its offsets erased, so do not store them again
+    if (!pblockdb && pblocktree && (pindex->nStatus & BLOCK_HAVE_DATA))
+        pblocktree->WriteTxOffsets(pindex->GetBlockHash(), CBlockTxOffsets(block));
+
+    bool ctor_enabled = pindex->nHeight >= consensusParams.nov2018Height;
+    int64_t pos = FindTxPosition(block, txhash, ctor_enabled);
+    if (pos == TX_NOT_FOUND)
+        return false;
+    ptx = block.vtx.at(pos);
+    return true;
+}
+
 bool WriteUndoToDisk(const CBlockUndo &blockundo,
     CDiskBlockPos &pos,
     const CBlockIndex *pindex,
@@ -535,7 +638,7 @@ void FindFilesToPrune(std::set<int> &setFilesToPrune, uint64_t nPruneAfterHeight
 {
     LOCK2(cs_main, cs_LastBlockFile);
 
-    if (chainActive.Tip() == nullptr || nPruneTarget == 0)
+    if (chainActive.Tip() == nullptr || (nPruneTarget == 0 && nPruneDepth == 0 && nPruneAge == 0))
     {
         return;
     }
@@ -551,7 +654,8 @@ void FindFilesToPrune(std::set<int> &setFilesToPrune, uint64_t nPruneAfterHeight
     }
     else // if (pblockdb)
     {
-        if (nDBUsedSpace < nPruneTarget + (pruneIntervalTweak.Value() * 1024 * 1024))
+        // only the size target applies to the block databases
+        if (nPruneTarget == 0 || nDBUsedSpace < nPruneTarget + (pruneIntervalTweak.Value() * 1024 * 1024))
         {
             return;
         }
@@ -640,24 +744,18 @@ bool FlushStateToDiskInternal(CValidationState &state,
         {
             std::vector<std::pair<int, const CBlockFileInfo *> > vFiles;
             vFiles.reserve(setDirtyFileInfo.size());
-            for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end();)
-            {
-                vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
-                setDirtyFileInfo.erase(it++);
-            }
-            std::vector<const CBlockIndex *> vBlocks;
-            vBlocks.reserve(setDirtyBlockIndex.size());
-            for (std::set<CBlockIndex *>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();)
-            {
-                vBlocks.push_back(*it);
-                setDirtyBlockIndex.erase(it++);
-            }
+            for (int nFile : setDirtyFileInfo)
+                vFiles.push_back(std::make_pair(nFile, &vinfoBlockFile[nFile]));
+            setDirtyFileInfo.clear();
+            // an entry that was changed many times since the last flush is still only written once
+            std::vector<const CBlockIndex *> vBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            setDirtyBlockIndex.clear();
 
 
             // we write different info depending on block storage system
             if (!pblockdb) // sequential files
             {
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks))
+                if (!pblocktree->WriteBlockIndexAsync(vFiles, nLastBlockFile, vBlocks))
                 {
                     return AbortNode(state, "Files to write to block index database");
                 }
@@ -666,16 +764,25 @@ bool FlushStateToDiskInternal(CValidationState &state,
             {
                 // vFiles should be empty for a DB call so insert a blank vector instead
                 std::vector<std::pair<int, const CBlockFileInfo *> > vFilesEmpty;
-                if (!pblocktree->WriteBatchSync(vFilesEmpty, 0, vBlocks))
+                if (!pblocktree->WriteBlockIndexAsync(vFilesEmpty, 0, vBlocks))
                 {
                     return AbortNode(state, "Files to write to block index database");
                 }
             }
         }
-        // Finally remove any pruned files, this will be empty for blockdb mode
+        // Finally remove any pruned files, this will be empty for blockdb mode.  The index must no longer point
+        // into them on disk before they go, so wait for the database writer.
         if (fFlushForPrune)
         {
+            if (!dbWriter.Barrier(true))
+            {
+                return AbortNode(state, "Failed to write to block index database");
+            }
+            int64_t nStart = GetStopwatchMicros();
             UnlinkPrunedFiles(setFilesToPrune);
+            int64_t nTime = GetStopwatchMicros() - nStart;
+            nTimeUnlinkPrunedFiles += nTime;
+            LOG(BENCH, "  - Unlink pruned files: %.2fms [%.2fs]\n", nTime * 0.001, nTimeUnlinkPrunedFiles * 0.000001);
         }
         nLastWrite = nNow;
     }
@@ -691,7 +798,11 @@ bool FlushStateToDiskInternal(CValidationState &state,
         {
             return state.Error("out of disk space");
         }
-        // Flush the chainstate (which may refer to block index entries).
+        // Flush the chainstate (which may refer to block index entries), once those are on disk.
+        if (!dbWriter.Barrier(true))
+        {
+            return AbortNode(state, "Failed to write to block index database");
+        }
         if (!pcoinsTip->Flush())
         {
             return AbortNode(state, "Failed to write to coin database");
@@ -762,7 +873,11 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode)
     {
         if (fPruneMode && fCheckForPruning && !fReindex)
         {
+            int64_t nStart = GetStopwatchMicros();
             FindFilesToPrune(setFilesToPrune, chainparams.PruneAfterHeight());
+            int64_t nTime = GetStopwatchMicros() - nStart;
+            nTimeFindFilesToPrune += nTime;
+            LOG(BENCH, "  - Find files to prune: %.2fms [%.2fs]\n", nTime * 0.001, nTimeFindFilesToPrune * 0.000001);
             fCheckForPruning = false;
             if (!setFilesToPrune.empty())
             {
@@ -911,6 +1026,12 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, uint64_
 
     LOCK(cs_LastBlockFile);
 
+    // undo data is appended to the original file, so bring it back if it was compressed
+    if (coldBlockFiles.IsCold(nFile, true) && !coldBlockFiles.Restore(nFile, true))
+    {
+        return state.Error("cannot restore compressed undo file");
+    }
+
     uint64_t nNewSize;
     pos.nPos = vinfoBlockFile[nFile].nUndoSize;
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
@@ -4,6 +4,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockfilemap.h"
 #include "blockleveldb.h"
 #include "main.h"
 #include "undo.h"
@@ -32,12 +33,28 @@ void InitializeBlockStorage(const int64_t &_nBlockTreeDBCache,
     const int64_t &_nBlockDBCache,
     const int64_t &_nBlockUndoDBCache);
 
-/** Catch leveldb up with sequential block files */
+/** Directory below the data dir that holds the block index, and the blocks unless they are in sequential files */
+fs::path GetBlockStorageDir(BlockDBMode mode);
+
+/** Catch the storage mode in use up with the one that was used before */
 void SyncStorage(const CChainParams &chainparams);
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex, const Consensus::Params &consensusParams);
 bool WriteBlockToDisk(const CBlock &block, CDiskBlockPos &pos, const CMessageHeader::MessageStartChars &messageStart);
+/**
+ * Get a block as it is serialized on disk without deserializing it, for sending it on to peers.  This is only
+ * possible for blocks in finalized block files; returns false if the block has to be read with ReadBlockFromDisk.
+ */
+bool ReadRawBlockFromDisk(CRawBlock &block, const CBlockIndex *pindex);
+/**
+ * Read a single transaction of a block.  The first lookup in a block reads the whole block and stores the
+ * offsets of its transactions in the block index database, later ones read only the transaction asked for.
+ */
+bool ReadTxFromDisk(CTransactionRef &ptx,
+    const CBlockIndex *pindex,
+    const uint256 &txhash,
+    const Consensus::Params &consensusParams);
 
 bool WriteUndoToDisk(const CBlockUndo &blockundo,
     CDiskBlockPos &pos,
@@ -0,0 +1,499 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coldfiles.h"
+
+#include "blockfilemap.h"
+#include "blocklz.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "init.h"
+#include "main.h"
+#include "sequential_files.h"
+#include "unlimited.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+extern CCriticalSection cs_LastBlockFile;
+
+CColdBlockFiles coldBlockFiles;
+
+//
+// A cold file is a sequence of frames, followed by the frame index and a footer:
+//   frame index: per frame the position and size of the data in the original file and in the cold file
+//   footer:      number of frames, size of the original file, format version and magic
+// All numbers are 32 bit little endian, like the positions in the block index.  A frame that does not
+// compress is stored as is, which is the case when its two sizes are equal.
+//
+static const char COLD_FILE_MAGIC[4] = {'B', 'U', 'L', 'Z'};
+static const uint32_t COLD_FILE_VERSION = 1;
+static const size_t COLD_ENTRY_SIZE = 16;
+static const size_t COLD_FOOTER_SIZE = 16;
+//! padding between records is split into frames of at most this size
+static const uint32_t MAX_GAP_FRAME = 1 << 20;
+
+struct ColdFrame
+{
+    uint32_t nRawPos;
+    uint32_t nRawSize;
+    uint32_t nCompPos;
+    uint32_t nCompSize;
+};
+
+fs::path GetColdFilename(int nFile, bool fUndo)
+{
+    return GetDataDir() / "blocks" / strprintf("%s%05u.lz", fUndo ? "rev" : "blk", nFile);
+}
+
+static fs::path GetRawFilename(int nFile, bool fUndo)
+{
+    return GetBlockPosFilename(CDiskBlockPos(nFile, 0), fUndo ? "rev" : "blk");
+}
+
+/** Read access to a cold file, through its memory mapping if it can be mapped or else through stdio */
+class CColdFile
+{
+public:
+    CColdFile() : file(nullptr), nFileSize(0), nIndexPos(0), nFrames(0), nRawSize(0) {}
+    ~CColdFile()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    bool Open(int nFile, bool fUndo)
+    {
+        map = blockFileMaps.Get(nFile, fUndo ? COLD_UNDO_FILE : COLD_BLOCK_FILE, 0);
+        if (map)
+            nFileSize = map->size();
+        else
+        {
+            file = fsbridge::fopen(GetColdFilename(nFile, fUndo), "rb");
+            if (!file || fseek(file, 0, SEEK_END))
+                return false;
+            long nEnd = ftell(file);
+            if (nEnd < 0)
+                return false;
+            nFileSize = nEnd;
+        }
+
+        std::vector<char> buf;
+        if (nFileSize < COLD_FOOTER_SIZE)
+            return false;
+        const unsigned char *footer = (const unsigned char *)Span(nFileSize - COLD_FOOTER_SIZE, COLD_FOOTER_SIZE, buf);
+        if (!footer || memcmp(footer + 12, COLD_FILE_MAGIC, sizeof(COLD_FILE_MAGIC)) ||
+            ReadLE32(footer + 8) != COLD_FILE_VERSION)
+            return false;
+        nFrames = ReadLE32(footer);
+        nRawSize = ReadLE32(footer + 4);
+        if ((uint64_t)nFrames * COLD_ENTRY_SIZE > nFileSize - COLD_FOOTER_SIZE)
+            return false;
+        nIndexPos = nFileSize - COLD_FOOTER_SIZE - (uint64_t)nFrames * COLD_ENTRY_SIZE;
+        return true;
+    }
+
+    uint32_t Frames() const { return nFrames; }
+    uint32_t RawSize() const { return nRawSize; }
+    bool GetFrame(uint32_t i, ColdFrame &frame)
+    {
+        std::vector<char> buf;
+        const unsigned char *p =
+            (const unsigned char *)Span(nIndexPos + (uint64_t)i * COLD_ENTRY_SIZE, COLD_ENTRY_SIZE, buf);
+        if (i >= nFrames || !p)
+            return false;
+        frame.nRawPos = ReadLE32(p);
+        frame.nRawSize = ReadLE32(p + 4);
+        frame.nCompPos = ReadLE32(p + 8);
+        frame.nCompSize = ReadLE32(p + 12);
+        return frame.nCompPos + (uint64_t)frame.nCompSize <= nIndexPos;
+    }
+
+    /** Find the frame holding position nPos of the original file */
+    bool FindFrame(uint32_t nPos, uint32_t &nFrame, ColdFrame &frame)
+    {
+        // the frames are in file order, so look for the last one starting at or before nPos
+        uint32_t nLow = 0;
+        uint32_t nHigh = nFrames;
+        while (nHigh - nLow > 1)
+        {
+            uint32_t nMid = nLow + (nHigh - nLow) / 2;
+            if (!GetFrame(nMid, frame))
+                return false;
+            if (frame.nRawPos <= nPos)
+                nLow = nMid;
+            else
+                nHigh = nMid;
+        }
+        nFrame = nLow;
+        return GetFrame(nLow, frame) && frame.nRawPos <= nPos && nPos - frame.nRawPos < frame.nRawSize;
+    }
+
+    /** Decompress a frame into out, which must have room for frame.nRawSize bytes */
+    bool Decompress(const ColdFrame &frame, char *out)
+    {
+        std::vector<char> buf;
+        const char *p = Span(frame.nCompPos, frame.nCompSize, buf);
+        if (!p)
+            return false;
+        if (frame.nCompSize == frame.nRawSize)
+        {
+            memcpy(out, p, frame.nRawSize);
+            return true;
+        }
+        return BlockLzDecompress(p, frame.nCompSize, out, frame.nRawSize);
+    }
+
+private:
+    CColdFile(const CColdFile &);
+    CColdFile &operator=(const CColdFile &);
+
+    /** Point to nLen bytes at nOffset of the file, reading them into buf if the file is not mapped */
+    const char *Span(uint64_t nOffset, size_t nLen, std::vector<char> &buf)
+    {
+        if (nOffset + nLen > nFileSize)
+            return nullptr;
+        if (map)
+            return map->data() + nOffset;
+        buf.resize(nLen);
+        if (fseek(file, nOffset, SEEK_SET) || fread(buf.data(), 1, nLen, file) != nLen)
+            return nullptr;
+        return buf.data();
+    }
+
+    std::shared_ptr<const CMappedBlockFile> map;
+    FILE *file;
+    uint64_t nFileSize;
+    uint64_t nIndexPos;
+    uint32_t nFrames;
+    uint32_t nRawSize;
+};
+
+void CColdBlockFiles::Init()
+{
+    std::set<std::pair<int, bool> > setFound;
+    std::vector<fs::path> vTmpFiles;
+    fs::path dir = GetDataDir() / "blocks";
+    if (fs::exists(dir))
+    {
+        for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it)
+        {
+            const std::string name = it->path().filename().string();
+            if (name.size() < 11 || (name.compare(0, 3, "blk") != 0 && name.compare(0, 3, "rev") != 0) ||
+                !std::all_of(name.begin() + 3, name.begin() + 8, ::isdigit))
+                continue;
+            // an interrupted compression or restore, the file it was made from is still there
+            const std::string ext = name.substr(8);
+            if (ext == ".lz.tmp" || ext == ".dat.tmp")
+                vTmpFiles.push_back(it->path());
+            else if (ext == ".lz")
+                setFound.insert(std::make_pair(atoi(name.substr(3, 5).c_str()), name[0] == 'r'));
+        }
+    }
+    for (const fs::path &path : vTmpFiles)
+        fs::remove(path);
+
+    for (auto it = setFound.begin(); it != setFound.end();)
+    {
+        // We crashed after writing an original back or before deleting it after compression.  Either way the
+        // original is complete as it was committed to disk before the rename, and it is the one we trust.
+        fs::path pathRaw = GetRawFilename(it->first, it->second);
+        if (fs::exists(pathRaw) && fs::file_size(pathRaw) > 0)
+        {
+            LOGA("Removing %s, the uncompressed block file exists\n", GetColdFilename(it->first, it->second).string());
+            fs::remove(GetColdFilename(it->first, it->second));
+            it = setFound.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    LOG(BLK, "Found %d compressed block and undo files\n", setFound.size());
+    LOCK(cs_cold);
+    setCold.swap(setFound);
+}
+
+bool CColdBlockFiles::IsCold(int nFile, bool fUndo) const
+{
+    LOCK(cs_cold);
+    return setCold.count(std::make_pair(nFile, fUndo)) != 0;
+}
+
+std::shared_ptr<const std::vector<char> > CColdBlockFiles::ReadRecord(const CDiskBlockPos &pos,
+    bool fUndo,
+    uint64_t nTrailer,
+    const char *&pdata,
+    uint32_t &nSize) const
+{
+    if (pos.IsNull() || pos.nPos < 8 || !IsCold(pos.nFile, fUndo))
+        return nullptr;
+    CColdFile cold;
+    if (!cold.Open(pos.nFile, fUndo))
+    {
+        error("%s: cannot open %s", __func__, GetColdFilename(pos.nFile, fUndo).string());
+        return nullptr;
+    }
+
+    // the record starts with the network magic and its size
+    uint32_t nFrame;
+    ColdFrame frame;
+    if (!cold.FindFrame(pos.nPos - 8, nFrame, frame))
+        return nullptr;
+    const uint64_t nBase = frame.nRawPos;
+    std::shared_ptr<std::vector<char> > buf = std::make_shared<std::vector<char> >();
+
+    // Every record is a frame of its own, but should that not be the case we decompress as many frames as the
+    // record covers
+    auto fnCover = [&](uint64_t nEnd) {
+        while (nBase + buf->size() < nEnd)
+        {
+            if (buf->size() && (nFrame == cold.Frames() - 1 || !cold.GetFrame(++nFrame, frame)))
+                return false;
+            size_t nOld = buf->size();
+            buf->resize(nOld + frame.nRawSize);
+            if (!cold.Decompress(frame, buf->data() + nOld))
+                return false;
+        }
+        return true;
+    };
+
+    if (!fnCover(pos.nPos))
+        return nullptr;
+    nSize = ReadLE32((const unsigned char *)buf->data() + pos.nPos - 4 - nBase);
+    if (!fnCover((uint64_t)pos.nPos + nSize + nTrailer))
+        return nullptr;
+    pdata = buf->data() + pos.nPos - nBase;
+    return buf;
+}
+
+/** Write the cold form of the nRawSize bytes long file pathRaw to pathTmp */
+static bool WriteColdFile(const fs::path &pathRaw,
+    const fs::path &pathTmp,
+    uint64_t nRawSize,
+    bool fUndo,
+    const CMessageHeader::MessageStartChars &messageStart)
+{
+    CAutoFile filein(fsbridge::fopen(pathRaw, "rb"), SER_DISK, CLIENT_VERSION);
+    CAutoFile fileout(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull() || fileout.IsNull())
+        return error("%s: cannot open %s or %s", __func__, pathRaw.string(), pathTmp.string());
+
+    const char *magic = (const char *)messageStart;
+    const uint64_t nTrailer = fUndo ? sizeof(uint256) : 0;
+    std::vector<char> raw, comp, check, index;
+    uint64_t nPos = 0;
+    uint64_t nCompPos = 0;
+    while (nPos < nRawSize)
+    {
+        if (ShutdownRequested())
+            return false;
+        const uint64_t nAvail = nRawSize - nPos;
+        uint64_t nLen = 0;
+        unsigned char header[8];
+        if (nAvail >= sizeof(header) && fread(header, 1, sizeof(header), filein.Get()) == sizeof(header) &&
+            memcmp(header, magic, MESSAGE_START_SIZE) == 0)
+        {
+            const uint64_t nRecord = sizeof(header) + ReadLE32(header + 4) + nTrailer;
+            if (nRecord <= nAvail)
+                nLen = nRecord;
+        }
+        if (nLen)
+        {
+            raw.resize(nLen);
+            memcpy(raw.data(), header, sizeof(header));
+            if (fread(raw.data() + sizeof(header), 1, nLen - sizeof(header), filein.Get()) != nLen - sizeof(header))
+                return error("%s: read error in %s", __func__, pathRaw.string());
+        }
+        else
+        {
+            // padding, or anything else that is not a record, up to the next record
+            raw.resize(std::min(nAvail, (uint64_t)MAX_GAP_FRAME));
+            if (fseek(filein.Get(), nPos, SEEK_SET) || fread(raw.data(), 1, raw.size(), filein.Get()) != raw.size())
+                return error("%s: read error in %s", __func__, pathRaw.string());
+            auto it = std::search(raw.begin() + 1, raw.end(), magic, magic + MESSAGE_START_SIZE);
+            nLen = it - raw.begin();
+            raw.resize(nLen);
+            if (fseek(filein.Get(), nPos + nLen, SEEK_SET))
+                return error("%s: seek error in %s", __func__, pathRaw.string());
+        }
+
+        // check that every frame decompresses to what we compressed before we rely on it
+        comp.resize(BlockLzBound(nLen));
+        size_t nComp = BlockLzCompress(raw.data(), nLen, comp.data());
+        if (nComp >= nLen)
+        {
+            nComp = nLen;
+            comp.swap(raw);
+        }
+        else
+        {
+            check.resize(nLen);
+            if (!BlockLzDecompress(comp.data(), nComp, check.data(), nLen) ||
+                memcmp(check.data(), raw.data(), nLen) != 0)
+                return error("%s: compression of %s failed", __func__, pathRaw.string());
+        }
+        if (fwrite(comp.data(), 1, nComp, fileout.Get()) != nComp)
+            return error("%s: write error in %s", __func__, pathTmp.string());
+
+        unsigned char entry[COLD_ENTRY_SIZE];
+        WriteLE32(entry, nPos);
+        WriteLE32(entry + 4, nLen);
+        WriteLE32(entry + 8, nCompPos);
+        WriteLE32(entry + 12, nComp);
+        index.insert(index.end(), entry, entry + sizeof(entry));
+        nPos += nLen;
+        nCompPos += nComp;
+    }
+
+    unsigned char footer[COLD_FOOTER_SIZE];
+    WriteLE32(footer, index.size() / COLD_ENTRY_SIZE);
+    WriteLE32(footer + 4, nRawSize);
+    WriteLE32(footer + 8, COLD_FILE_VERSION);
+    memcpy(footer + 12, COLD_FILE_MAGIC, sizeof(COLD_FILE_MAGIC));
+    if (fwrite(index.data(), 1, index.size(), fileout.Get()) != index.size() ||
+        fwrite(footer, 1, sizeof(footer), fileout.Get()) != sizeof(footer))
+        return error("%s: write error in %s", __func__, pathTmp.string());
+    FileCommit(fileout.Get());
+    return true;
+}
+
+bool CColdBlockFiles::Compress(int nFile, bool fUndo, const CMessageHeader::MessageStartChars &messageStart)
+{
+    uint64_t nRawSize;
+    {
+        LOCK(cs_LastBlockFile);
+        if (nFile >= nLastBlockFile)
+            return false;
+        nRawSize = fUndo ? vinfoBlockFile[nFile].nUndoSize : vinfoBlockFile[nFile].nSize;
+    }
+    const fs::path pathRaw = GetRawFilename(nFile, fUndo);
+    const fs::path pathCold = GetColdFilename(nFile, fUndo);
+    const fs::path pathTmp = pathCold.string() + ".tmp";
+    // positions in block files are 32 bit, and so are those in cold files
+    if (nRawSize == 0 || nRawSize > std::numeric_limits<uint32_t>::max() || !fs::exists(pathRaw) ||
+        fs::file_size(pathRaw) != nRawSize)
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    if (!WriteColdFile(pathRaw, pathTmp, nRawSize, fUndo, messageStart) || !RenameOver(pathTmp, pathCold))
+    {
+        fs::remove(pathTmp);
+        return false;
+    }
+
+    {
+        // switch readers over to the cold file, unless the original changed in the mean time
+        LOCK(cs_LastBlockFile);
+        if ((fUndo ? vinfoBlockFile[nFile].nUndoSize : vinfoBlockFile[nFile].nSize) != nRawSize ||
+            !fs::exists(pathRaw) || fs::file_size(pathRaw) != nRawSize)
+        {
+            fs::remove(pathCold);
+            return false;
+        }
+        {
+            LOCK(cs_cold);
+            setCold.insert(std::make_pair(nFile, fUndo));
+        }
+        blockFileMaps.Forget(nFile);
+        fs::remove(pathRaw);
+    }
+    const uint64_t nColdSize = fs::file_size(pathCold);
+    LOG(BLK, "Compressed %s to %u bytes (%.1f%%) in %.2fs\n", pathRaw.string(), nColdSize,
+        100.0 * nColdSize / nRawSize, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool CColdBlockFiles::Restore(int nFile, bool fUndo)
+{
+    const fs::path pathRaw = GetRawFilename(nFile, fUndo);
+    const fs::path pathTmp = pathRaw.string() + ".tmp";
+    {
+        CColdFile cold;
+        if (!cold.Open(nFile, fUndo))
+            return error("%s: cannot open %s", __func__, GetColdFilename(nFile, fUndo).string());
+        CAutoFile fileout(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: cannot open %s", __func__, pathTmp.string());
+
+        std::vector<char> raw;
+        uint64_t nPos = 0;
+        for (uint32_t i = 0; i < cold.Frames(); i++)
+        {
+            ColdFrame frame;
+            if (!cold.GetFrame(i, frame) || frame.nRawPos != nPos)
+                return error("%s: bad frame %u in %s", __func__, i, GetColdFilename(nFile, fUndo).string());
+            raw.resize(frame.nRawSize);
+            if (!cold.Decompress(frame, raw.data()) || fwrite(raw.data(), 1, raw.size(), fileout.Get()) != raw.size())
+                return error("%s: cannot restore frame %u of %s", __func__, i, GetColdFilename(nFile, fUndo).string());
+            nPos += frame.nRawSize;
+        }
+        if (nPos != cold.RawSize())
+            return error("%s: %s is truncated", __func__, GetColdFilename(nFile, fUndo).string());
+        FileCommit(fileout.Get());
+    }
+    if (!RenameOver(pathTmp, pathRaw))
+        return error("%s: cannot rename %s", __func__, pathTmp.string());
+
+    {
+        LOCK(cs_cold);
+        setCold.erase(std::make_pair(nFile, fUndo));
+    }
+    blockFileMaps.Forget(nFile);
+    fs::remove(GetColdFilename(nFile, fUndo));
+    LOG(BLK, "Restored %s from its compressed copy\n", pathRaw.string());
+    return true;
+}
+
+void CColdBlockFiles::Remove(int nFile)
+{
+    {
+        LOCK(cs_cold);
+        setCold.erase(std::make_pair(nFile, false));
+        setCold.erase(std::make_pair(nFile, true));
+    }
+    blockFileMaps.Forget(nFile);
+    fs::remove(GetColdFilename(nFile, false));
+    fs::remove(GetColdFilename(nFile, true));
+}
+
+void ThreadCompressBlockFiles(int64_t nDepth)
+{
+    RenameThread("coldblocks");
+    const CMessageHeader::MessageStartChars &messageStart = Params().MessageStart();
+    while (!ShutdownRequested())
+    {
+        // look for files to compress once a minute
+        for (int i = 0; i < 60 && !ShutdownRequested(); i++)
+            MilliSleep(1000);
+        // leave the disk to the initial sync, most files will be compressed in one go afterwards
+        if (ShutdownRequested() || fReindex || IsInitialBlockDownload())
+            continue;
+
+        std::vector<std::pair<int, bool> > vFiles;
+        {
+            const int64_t nTipHeight = chainActive.Height();
+            LOCK(cs_LastBlockFile);
+            for (int nFile = 0; nFile < nLastBlockFile; nFile++)
+            {
+                const CBlockFileInfo &info = vinfoBlockFile[nFile];
+                if (info.nSize == 0 || (int64_t)info.nHeightLast + nDepth >= nTipHeight)
+                    continue;
+                if (!coldBlockFiles.IsCold(nFile, false))
+                    vFiles.emplace_back(nFile, false);
+                if (info.nUndoSize > 0 && !coldBlockFiles.IsCold(nFile, true))
+                    vFiles.emplace_back(nFile, true);
+            }
+        }
+
+        for (const auto &file : vFiles)
+        {
+            if (ShutdownRequested())
+                break;
+            coldBlockFiles.Compress(file.first, file.second, messageStart);
+        }
+    }
+}
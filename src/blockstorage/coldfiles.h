@@ -0,0 +1,69 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COLDFILES_H
+#define BITCOIN_COLDFILES_H
+
+#include "chain.h"
+#include "fs.h"
+#include "protocol.h"
+#include "sync.h"
+
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** By default block files are never compressed */
+static const int64_t DEFAULT_COLD_BLOCK_DEPTH = 0;
+
+/**
+ * Block and undo files whose blocks are all deep in the chain are rarely read again: only peers catching up and
+ * deep reorgs need them.  Such files are moved to a compressed "cold" tier (blocks/blk?????.lz and rev?????.lz) to
+ * save disk space.  Every block or undo record, and every stretch of padding between records, is compressed on its
+ * own into a frame, and an index of the frames at the end of the file maps positions in the original file to
+ * frames.  The block index keeps pointing into the original files, so reading a record means finding its frame
+ * and decompressing it.  A file can always be turned back into the exact original.
+ */
+class CColdBlockFiles
+{
+public:
+    /** Find the compressed files in the blocks directory and clean up after an interrupted compression */
+    void Init();
+    bool IsCold(int nFile, bool fUndo) const;
+
+    /**
+     * Decompress the record at pos, which is followed by nTrailer bytes, from its cold file.  On success pdata points
+     * to the record inside the returned buffer and nSize holds the size of the record without the trailer.
+     */
+    std::shared_ptr<const std::vector<char> > ReadRecord(const CDiskBlockPos &pos,
+        bool fUndo,
+        uint64_t nTrailer,
+        const char *&pdata,
+        uint32_t &nSize) const;
+
+    /**
+     * Compress the finalized block or undo file nFile, whose records start with messageStart, and delete the
+     * original.  Gives up if the file changes while it is being compressed.
+     */
+    bool Compress(int nFile, bool fUndo, const CMessageHeader::MessageStartChars &messageStart);
+    /** Turn a cold file back into the original, e.g. because undo data is appended to it again */
+    bool Restore(int nFile, bool fUndo);
+    /** Delete the cold files of nFile, e.g. because it is pruned */
+    void Remove(int nFile);
+
+private:
+    mutable CCriticalSection cs_cold;
+    std::set<std::pair<int, bool> > setCold GUARDED_BY(cs_cold);
+};
+extern CColdBlockFiles coldBlockFiles;
+
+/** Translation of a cold file to a filesystem path */
+fs::path GetColdFilename(int nFile, bool fUndo);
+
+/** Compress the files of blocks that are more than nDepth blocks deep, until shutdown */
+void ThreadCompressBlockFiles(int64_t nDepth);
+
+#endif // BITCOIN_COLDFILES_H
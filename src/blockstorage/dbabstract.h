@@ -12,6 +12,7 @@ enum BlockDBMode
 {
     SEQUENTIAL_BLOCK_FILES, // 0
     LEVELDB_BLOCK_STORAGE, // 1
+    BLOCKLOG_BLOCK_STORAGE, // 2
 
     END_STORAGE_OPTIONS // should always be the last option in the list
 };
@@ -6,7 +6,14 @@
 
 #include "sequential_files.h"
 
+#include "blockfilemap.h"
 #include "blockstorage.h"
+#include "coldfiles.h"
+#include "crypto/common.h"
+
+#include <algorithm>
+#include <deque>
+#include <thread>
 
 
 extern bool AbortNode(CValidationState &state, const std::string &strMessage, const std::string &userMessage = "");
@@ -49,6 +56,57 @@ FILE *OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 
 FILE *OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly) { return OpenDiskFile(pos, "blk", fReadOnly); }
 FILE *OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) { return OpenDiskFile(pos, "rev", fReadOnly); }
+/**
+ * Map the block or undo file holding the record at pos, which is preceded by the network magic and the size of
+ * the record, and return the size of the record in nSize.  Returns nullptr if the file cannot be mapped.
+ *
+ * The file we are currently appending blocks to is preallocated and still being written, so it is never mapped.
+ * Undo files of finalized block files can still grow when their blocks are connected out of order, in which
+ * case they get mapped again.
+ */
+static std::shared_ptr<const CMappedBlockFile> MapRecord(const CDiskBlockPos &pos,
+    bool fUndo,
+    uint64_t nTrailer,
+    uint32_t &nSize)
+{
+    if (pos.IsNull() || pos.nPos < 8)
+        return nullptr;
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile)
+            return nullptr;
+    }
+
+    const BlockFileType type = fUndo ? UNDO_FILE : BLOCK_FILE;
+    std::shared_ptr<const CMappedBlockFile> map = blockFileMaps.Get(pos.nFile, type, pos.nPos);
+    if (!map)
+        return nullptr;
+    nSize = ReadLE32((const unsigned char *)map->data() + pos.nPos - 4);
+    const uint64_t nEnd = (uint64_t)pos.nPos + nSize + nTrailer;
+    if (nEnd > map->size())
+        map = blockFileMaps.Get(pos.nFile, type, nEnd);
+    return map;
+}
+
+/**
+ * Get the record at pos in memory, from the cold file it was compressed into or else from the mapping of its file.
+ * On success pdata points to the record and nSize holds its size, and the returned object keeps them valid.
+ * Returns nullptr if the record has to be read through stdio instead.
+ */
+static std::shared_ptr<const void> GetRecord(const CDiskBlockPos &pos,
+    bool fUndo,
+    uint64_t nTrailer,
+    const char *&pdata,
+    uint32_t &nSize)
+{
+    if (coldBlockFiles.IsCold(pos.nFile, fUndo))
+        return coldBlockFiles.ReadRecord(pos, fUndo, nTrailer, pdata, nSize);
+    std::shared_ptr<const CMappedBlockFile> map = MapRecord(pos, fUndo, nTrailer, nSize);
+    if (map)
+        pdata = map->data() + pos.nPos;
+    return map;
+}
+
 void FlushBlockFile(bool fFinalize)
 {
     LOCK(cs_LastBlockFile);
@@ -74,17 +132,110 @@ void FlushBlockFile(bool fFinalize)
     }
 }
 
-void UnlinkPrunedFiles(std::set<int> &setFilesToPrune)
+static void DeletePrunedFile(int nFile)
 {
-    for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it)
+    int64_t nStart = GetStopwatchMicros();
+    CDiskBlockPos pos(nFile, 0);
+    boost::system::error_code ec;
+    fs::remove(GetBlockPosFilename(pos, "blk"), ec);
+    fs::remove(GetBlockPosFilename(pos, "rev"), ec);
+    try
+    {
+        coldBlockFiles.Remove(nFile);
+    }
+    catch (const fs::filesystem_error &e)
     {
-        CDiskBlockPos pos(*it, 0);
-        fs::remove(GetBlockPosFilename(pos, "blk"));
-        fs::remove(GetBlockPosFilename(pos, "rev"));
-        LOG(PRUNE, "Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+        LOGA("Prune: failed to delete cold file %05u: %s\n", nFile, e.what());
     }
+    LOG(PRUNE, "Prune: %s deleted blk/rev (%05u) in %.2fms\n", __func__, nFile,
+        (GetStopwatchMicros() - nStart) * 0.001);
 }
 
+/**
+ * Deletes the files of pruned blocks in the background.  Deleting a block file can take a long time on some
+ * filesystems, and the flush that pruned it holds cs_main.  The index no longer refers to the files once they are
+ * queued here, so a crash before they are gone only leaves them behind, and LoadBlockIndexDB queues them again.
+ */
+class CPrunedFileDeleter
+{
+public:
+    ~CPrunedFileDeleter() { Stop(); }
+
+    void Queue(const std::set<int> &setFiles)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!fStopped)
+            {
+                queue.insert(queue.end(), setFiles.begin(), setFiles.end());
+                if (!thread.joinable())
+                    thread = std::thread(&CPrunedFileDeleter::Run, this);
+                cond.notify_all();
+                return;
+            }
+        }
+        for (int nFile : setFiles)
+            DeletePrunedFile(nFile);
+    }
+
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!queue.empty())
+            cond.wait(lock);
+    }
+
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStopped = true;
+            cond.notify_all();
+        }
+        if (thread.joinable())
+            thread.join();
+    }
+
+private:
+    void Run()
+    {
+        RenameThread("prunedelete");
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true)
+        {
+            while (queue.empty() && !fStopped)
+                cond.wait(lock);
+            if (queue.empty())
+                return;
+            // the file stays at the front of the queue until it is gone, so Wait() waits for it as well
+            int nFile = queue.front();
+            lock.unlock();
+            DeletePrunedFile(nFile);
+            lock.lock();
+            queue.pop_front();
+            cond.notify_all();
+        }
+    }
+
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    std::deque<int> queue;
+    std::thread thread;
+    bool fStopped = false;
+};
+static CPrunedFileDeleter prunedFileDeleter;
+
+void UnlinkPrunedFiles(std::set<int> &setFilesToPrune)
+{
+    // stop serving the files from memory right away, they are gone as far as the index is concerned
+    for (int nFile : setFilesToPrune)
+        blockFileMaps.Forget(nFile);
+    prunedFileDeleter.Queue(setFilesToPrune);
+}
+
+void WaitForPrunedFiles() { prunedFileDeleter.Wait(); }
+void StopPrunedFileDeleter() { prunedFileDeleter.Stop(); }
+
 
 bool WriteBlockToDiskSequential(const CBlock &block,
     CDiskBlockPos &pos,
@@ -115,21 +266,42 @@ bool WriteBlockToDiskSequential(const CBlock &block,
 bool ReadBlockFromDiskSequential(CBlock &block, const CDiskBlockPos &pos, const Consensus::Params &consensusParams)
 {
     block.SetNull();
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
+    const char *pdata = nullptr;
+    uint32_t nSize = 0;
+    std::shared_ptr<const void> record = GetRecord(pos, false, 0, pdata, nSize);
+    CAutoFile filein(record ? nullptr : OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // the file may have been compressed since we looked
+    if (!record && filein.IsNull())
+        record = coldBlockFiles.ReadRecord(pos, false, 0, pdata, nSize);
+    if (record)
     {
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-    }
-
-    // Read block
-    try
-    {
-        filein >> block;
+        try
+        {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, pdata, nSize);
+            reader >> block;
+        }
+        catch (const std::exception &e)
+        {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
-    catch (const std::exception &e)
+    else
     {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Open history file to read
+        if (filein.IsNull())
+        {
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        }
+
+        // Read block
+        try
+        {
+            filein >> block;
+        }
+        catch (const std::exception &e)
+        {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -140,6 +312,90 @@ bool ReadBlockFromDiskSequential(CBlock &block, const CDiskBlockPos &pos, const
     return true;
 }
 
+bool ReadRawBlockFromDiskSequential(CRawBlock &block, const CDiskBlockPos &pos)
+{
+    const char *pdata = nullptr;
+    uint32_t nSize = 0;
+    std::shared_ptr<const void> record = GetRecord(pos, false, 0, pdata, nSize);
+    if (!record)
+        return false;
+    block.Set(record, pdata, nSize);
+    return true;
+}
+
+/** Requested blocks this close to each other in a block file are read ahead as one range, gap included */
+static const uint64_t READAHEAD_MAX_GAP = 4 << 20;
+
+uint64_t ReadAheadBlocksSequential(std::vector<CDiskBlockPos> vPos)
+{
+    vPos.erase(std::remove_if(vPos.begin(), vPos.end(), [](const CDiskBlockPos &pos) { return pos.nPos < 8; }),
+        vPos.end());
+    std::sort(vPos.begin(), vPos.end(), [](const CDiskBlockPos &a, const CDiskBlockPos &b) {
+        return a.nFile < b.nFile || (a.nFile == b.nFile && a.nPos < b.nPos);
+    });
+
+    uint64_t nAdvised = 0;
+    size_t i = 0;
+    while (i < vPos.size())
+    {
+        // extend the range for as long as the next block is in the same file and close by
+        size_t j = i + 1;
+        while (j < vPos.size() && vPos[j].nFile == vPos[i].nFile &&
+               vPos[j].nPos - vPos[j - 1].nPos <= READAHEAD_MAX_GAP)
+            j++;
+        const CDiskBlockPos &first = vPos[i];
+        const CDiskBlockPos &last = vPos[j - 1];
+        i = j;
+
+        // cold files are decompressed as a whole, and the file we are appending to is likely still in the cache
+        if (coldBlockFiles.IsCold(first.nFile, false))
+            continue;
+        uint32_t nSize = 0;
+        std::shared_ptr<const CMappedBlockFile> map = MapRecord(last, false, 0, nSize);
+        if (!map)
+            continue;
+        const uint64_t nBegin = first.nPos - 8;
+        const uint64_t nEnd = std::min<uint64_t>((uint64_t)last.nPos + nSize, map->size());
+        map->WillNeed(nBegin, nEnd);
+        nAdvised += nEnd - nBegin;
+    }
+    return nAdvised;
+}
+
+bool ReadTxFromDiskSequential(const CDiskTxPos &postx, CBlockHeader &header, CTransactionRef &ptx)
+{
+    const char *pdata = nullptr;
+    uint32_t nSize = 0;
+    std::shared_ptr<const void> record = GetRecord(postx, false, 0, pdata, nSize);
+    try
+    {
+        CAutoFile filein(record ? nullptr : OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+        if (!record && filein.IsNull())
+            record = coldBlockFiles.ReadRecord(postx, false, 0, pdata, nSize);
+        if (record)
+        {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, pdata, nSize);
+            reader >> header;
+            reader.ignore(postx.nTxOffset);
+            reader >> ptx;
+        }
+        else
+        {
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed for %s", __func__, postx.ToString());
+            filein >> header;
+            if (fseek(filein.Get(), postx.nTxOffset, SEEK_CUR))
+                return error("%s: fseek failed for %s", __func__, postx.ToString());
+            filein >> ptx;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), postx.ToString());
+    }
+    return true;
+}
+
 /* Calculate the amount of disk space the block & undo files currently use */
 uint64_t CalculateCurrentUsage()
 {
@@ -154,16 +410,61 @@ uint64_t CalculateCurrentUsage()
 }
 
 
+// The blocks that have data in each block file, so pruning a file only has to visit those instead of the whole
+// block index.  Built when we first prune and kept up to date by AddBlockToFileList after that.  Protected by cs_main.
+static std::map<int, std::vector<CBlockIndex *> > mapBlocksByFile;
+static bool fBlocksByFileBuilt = false;
+
+static void BuildBlockFileLists()
+{
+    AssertLockHeld(cs_main);
+    READLOCK(cs_mapBlockIndex);
+    for (const std::pair<const uint256, CBlockIndex *> &item : mapBlockIndex)
+    {
+        CBlockIndex *pindex = item.second;
+        if (pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO))
+            mapBlocksByFile[pindex->nFile].push_back(pindex);
+    }
+    fBlocksByFileBuilt = true;
+}
+
+void AddBlockToFileList(CBlockIndex *pindex)
+{
+    AssertLockHeld(cs_main);
+    if (fBlocksByFileBuilt)
+        mapBlocksByFile[pindex->nFile].push_back(pindex);
+}
+
+void ClearBlockFileLists()
+{
+    AssertLockHeld(cs_main);
+    mapBlocksByFile.clear();
+    fBlocksByFileBuilt = false;
+}
+
 /* Prune a block file (modify associated database entries)*/
 void PruneOneBlockFile(const int fileNumber)
 {
     AssertLockHeld(cs_main); // For setDirtyBlockIndex
+    if (!fBlocksByFileBuilt)
+        BuildBlockFileLists();
+    std::vector<CBlockIndex *> vBlocks;
+    auto itFile = mapBlocksByFile.find(fileNumber);
+    if (itFile != mapBlocksByFile.end())
+    {
+        vBlocks.swap(itFile->second);
+        mapBlocksByFile.erase(itFile);
+    }
+
+    std::vector<uint256> vPrunedHashes;
     READLOCK(cs_mapBlockIndex);
-    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it)
+    for (CBlockIndex *pindex : vBlocks)
     {
-        CBlockIndex *pindex = it->second;
+        // the block may have moved on since it was listed
         if (pindex->nFile == fileNumber)
         {
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                vPrunedHashes.push_back(pindex->GetBlockHash());
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
             pindex->nFile = 0;
@@ -191,10 +492,15 @@ void PruneOneBlockFile(const int fileNumber)
     }
     vinfoBlockFile[fileNumber].SetNull();
     setDirtyFileInfo.insert(fileNumber);
+
+    // ReadTxFromDisk may have stored where the transactions of these blocks were
+    if (pblocktree)
+        pblocktree->EraseTxOffsetsAsync(vPrunedHashes);
 }
 
 void FindFilesToPruneSequential(std::set<int> &setFilesToPrune, uint64_t nLastBlockWeCanPrune)
 {
+    AssertLockHeld(cs_main);
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -203,25 +509,41 @@ void FindFilesToPruneSequential(std::set<int> &setFilesToPrune, uint64_t nLastBl
     uint64_t nBytesToPrune;
     int count = 0;
 
-    if (nCurrentUsage + nBuffer >= nPruneTarget)
+    // Files that are entirely below the depth or older than the age we keep go whatever the target
+    const CBlockIndex *pindexTip = chainActive.Tip();
+    uint64_t nLastBlockByDepth = 0;
+    if (nPruneDepth && pindexTip && (uint64_t)pindexTip->nHeight > nPruneDepth)
+        nLastBlockByDepth = pindexTip->nHeight - nPruneDepth;
+    int64_t nLastTimeByAge = 0;
+    if (nPruneAge && pindexTip)
+        nLastTimeByAge = pindexTip->GetBlockTime() - nPruneAge;
+    const bool fPolicy = nLastBlockByDepth || nLastTimeByAge > 0;
+
+    if (fPolicy || nCurrentUsage + nBuffer >= nPruneTarget)
     {
         for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++)
         {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+            const CBlockFileInfo &info = vinfoBlockFile[fileNumber];
+            nBytesToPrune = info.nSize + info.nUndoSize;
 
-            if (vinfoBlockFile[fileNumber].nSize == 0)
+            if (info.nSize == 0)
             {
                 continue;
             }
 
-            if (nCurrentUsage + nBuffer < nPruneTarget) // are we below our target?
+            const bool fOld = (nLastBlockByDepth && info.nHeightLast <= nLastBlockByDepth) ||
+                              (int64_t)info.nTimeLast < nLastTimeByAge;
+            if (!fOld && nCurrentUsage + nBuffer < nPruneTarget) // are we below our target?
             {
-                break;
+                // blocks are not stored strictly in height order, so a later file may still be old enough
+                if (!fPolicy)
+                    break;
+                continue;
             }
 
             // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep
             // scanning
-            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+            if (info.nHeightLast > nLastBlockWeCanPrune)
             {
                 continue;
             }
@@ -273,18 +595,12 @@ bool WriteUndoToDiskSequenatial(const CBlockUndo &blockundo,
     return true;
 }
 
-bool ReadUndoFromDiskSequential(CBlockUndo &blockundo, const CDiskBlockPos &pos, const uint256 &hashBlock)
+template <typename Stream>
+static bool ReadUndoFromStream(Stream &filein, CBlockUndo &blockundo, const uint256 &hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-    {
-        return error("%s: OpenUndoFile failed", __func__);
-    }
-
     // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<Stream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try
     {
         verifier << hashBlock;
@@ -304,3 +620,26 @@ bool ReadUndoFromDiskSequential(CBlockUndo &blockundo, const CDiskBlockPos &pos,
 
     return true;
 }
+
+bool ReadUndoFromDiskSequential(CBlockUndo &blockundo, const CDiskBlockPos &pos, const uint256 &hashBlock)
+{
+    // the undo data is followed by its checksum
+    const char *pdata = nullptr;
+    uint32_t nSize = 0;
+    std::shared_ptr<const void> record = GetRecord(pos, true, sizeof(uint256), pdata, nSize);
+    CAutoFile filein(record ? nullptr : OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (!record && filein.IsNull())
+        record = coldBlockFiles.ReadRecord(pos, true, sizeof(uint256), pdata, nSize);
+    if (record)
+    {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pdata, nSize + sizeof(uint256));
+        return ReadUndoFromStream(reader, blockundo, hashBlock);
+    }
+
+    // Open history file to read
+    if (filein.IsNull())
+    {
+        return error("%s: OpenUndoFile failed", __func__);
+    }
+    return ReadUndoFromStream(filein, blockundo, hashBlock);
+}
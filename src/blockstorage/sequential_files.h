@@ -7,6 +7,7 @@
 #ifndef BLOCKDB_SEQUENTIAL_H
 #define BLOCKDB_SEQUENTIAL_H
 
+#include "blockfilemap.h"
 #include "net.h"
 #include "txdb.h"
 #include "undo.h"
@@ -26,14 +27,33 @@ fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 void FlushBlockFile(bool fFinalize = false);
 
 /**
- *  Actually unlink the specified files
+ *  Actually unlink the specified files.  They are deleted by a thread of their own, so this does not wait for the
+ *  filesystem.
  */
 void UnlinkPrunedFiles(std::set<int> &setFilesToPrune);
+/** Wait until all files passed to UnlinkPrunedFiles are deleted */
+void WaitForPrunedFiles();
+/** Delete what is still queued and end the deleting thread, files pruned after this are deleted right away */
+void StopPrunedFileDeleter();
+
+/** Record that the data of pindex is in block file pindex->nFile, so pruning that file can find it */
+void AddBlockToFileList(CBlockIndex *pindex);
+/** Forget which blocks are in which file, as the block index is unloaded */
+void ClearBlockFileLists();
 
 bool WriteBlockToDiskSequential(const CBlock &block,
     CDiskBlockPos &pos,
     const CMessageHeader::MessageStartChars &messageStart);
 bool ReadBlockFromDiskSequential(CBlock &block, const CDiskBlockPos &pos, const Consensus::Params &consensusParams);
+/** Get the serialized block at pos, if its block file can be mapped or it is in a cold file */
+bool ReadRawBlockFromDiskSequential(CRawBlock &block, const CDiskBlockPos &pos);
+/**
+ * Have the OS read the blocks at vPos in ahead of them being served.  Blocks of the same file that are close
+ * together are advised as one range.  Returns the number of bytes advised.
+ */
+uint64_t ReadAheadBlocksSequential(std::vector<CDiskBlockPos> vPos);
+/** Read only the header of the block at postx and the transaction nTxOffset bytes after it */
+bool ReadTxFromDiskSequential(const CDiskTxPos &postx, CBlockHeader &header, CTransactionRef &ptx);
 void FindFilesToPruneSequential(std::set<int> &setFilesToPrune, uint64_t nPruneAfterHeight);
 bool WriteUndoToDiskSequenatial(const CBlockUndo &blockundo,
     CDiskBlockPos &pos,
@@ -25,6 +25,10 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
     return false;
 }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
+bool CCoinsView::GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const
+{
+    return false;
+}
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) {}
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
@@ -38,6 +42,10 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
     return base->BatchWrite(mapCoins, hashBlock, nBestCoinHeight, nChildCachedCoinsUsage);
 }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
+bool CCoinsViewBacked::GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const
+{
+    return base->GetCoinsByTxid(txid, coins);
+}
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 SaltedOutpointHasher::SaltedOutpointHasher()
     : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max()))
@@ -223,6 +231,37 @@ bool CCoinsViewCache::GetCoinFromDB(const COutPoint &outpoint) const
     return !ret->second.coin.IsSpent();
 }
 
+bool CCoinsViewCache::GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const
+{
+    std::vector<std::pair<COutPoint, Coin> > vBase;
+    if (!base->GetCoinsByTxid(txid, vBase))
+        return false;
+
+    WRITELOCK(cs_utxo);
+    for (std::pair<COutPoint, Coin> &item : vBase)
+    {
+        // Whatever we already have for an outpoint is newer than what the base has, so it stays
+        std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.emplace(
+            std::piecewise_construct, std::forward_as_tuple(item.first), std::forward_as_tuple(std::move(item.second)));
+        if (ret.second)
+        {
+            cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+            if (nBestCoinHeight < ret.first->second.coin.nHeight)
+                nBestCoinHeight = ret.first->second.coin.nHeight;
+        }
+        if (!ret.first->second.coin.IsSpent())
+            coins.emplace_back(item.first, ret.first->second.coin);
+    }
+    return true;
+}
+
+size_t CCoinsViewCache::PrefetchCoins(const uint256 &txid) const
+{
+    std::vector<std::pair<COutPoint, Coin> > coins;
+    GetCoinsByTxid(txid, coins);
+    return coins.size();
+}
+
 bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint, bool &fSpent) const
 {
     READLOCK(cs_utxo);
@@ -167,6 +167,10 @@ public:
     //! This may (but cannot always) return true for spent outputs.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Append the unspent outputs of txid to coins, in one go.  Views that can not look coins up by txid return
+    //! false, so this is only good for prefetching.
+    virtual bool GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 _GetBestBlock() const;
     uint256 GetBestBlock() const
@@ -202,6 +206,7 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const override;
     uint256 _GetBestBlock() const override;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins,
@@ -299,6 +304,14 @@ public:
      */
     bool GetCoinFromDB(const COutPoint &outpoint) const;
 
+    /**
+     * Load all unspent outputs of txid from the backing view into this cache with one range read, rather than a
+     * lookup per output.  Only returns the outputs the backing view has; outputs only this cache knows about are
+     * already here.
+     */
+    bool GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const override;
+    size_t PrefetchCoins(const uint256 &txid) const;
+
     /**
      * Check if we have the given utxo already loaded in this cache.
      *
@@ -13,7 +13,9 @@
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
+#include <sstream>
 #include <stdint.h>
+#include <stdio.h>
 
 static void SetMaxOpenFiles(leveldb::Options *options)
 {
@@ -41,12 +43,14 @@ static void SetMaxOpenFiles(leveldb::Options *options)
     LOGA("LevelDB using max_open_files=%d (default=%d)\n", options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetDefaultOptions(size_t nCacheSize)
+static const int DEFAULT_BLOOM_BITS = 10;
+
+static leveldb::Options GetDefaultOptions(size_t nCacheSize, size_t nBlockCacheSize, int nBloomBits)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.filter_policy = nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(nBloomBits) : nullptr;
     options.compression = leveldb::kNoCompression;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16))
     {
@@ -60,7 +64,7 @@ static leveldb::Options GetDefaultOptions(size_t nCacheSize)
     return options;
 }
 
-static void OverrideOptions(leveldb::Options &_options, COverrideOptions *_pOverride)
+static void OverrideOptions(leveldb::Options &_options, size_t nCacheSize, const COverrideOptions *_pOverride)
 {
     if (_pOverride == nullptr)
         return;
@@ -72,6 +76,9 @@ static void OverrideOptions(leveldb::Options &_options, COverrideOptions *_pOver
     if (_pOverride->block_size > 0)
         _options.block_size = _pOverride->block_size;
 
+    if (_pOverride->write_buffer_share > 0)
+        _options.write_buffer_size = nCacheSize * _pOverride->write_buffer_share;
+
     if (_pOverride->write_buffer_size > 0)
         _options.write_buffer_size = _pOverride->write_buffer_size;
 }
@@ -81,7 +88,7 @@ CDBWrapper::CDBWrapper(const fs::path &path,
     bool fMemory,
     bool fWipe,
     bool obfuscate,
-    COverrideOptions *pOverride)
+    const COverrideOptions *pOverride)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
@@ -90,10 +97,17 @@ CDBWrapper::CDBWrapper(const fs::path &path,
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
     writeoptions.sync = false;
-    options = GetDefaultOptions(nCacheSize);
+    // The block cache and the bloom filter are allocated with the options, so they are decided on up front
+    nBlockCacheSize = nCacheSize / 2;
+    nBloomBits = DEFAULT_BLOOM_BITS;
+    if (pOverride && pOverride->block_cache_share > 0)
+        nBlockCacheSize = nCacheSize * pOverride->block_cache_share;
+    if (pOverride && pOverride->bloom_bits != 0)
+        nBloomBits = std::max(pOverride->bloom_bits, 0);
+    options = GetDefaultOptions(nCacheSize, nBlockCacheSize, nBloomBits);
 
     // Modify default database options
-    OverrideOptions(options, pOverride);
+    OverrideOptions(options, nCacheSize, pOverride);
 
     if (fMemory)
     {
@@ -138,6 +152,7 @@ CDBWrapper::CDBWrapper(const fs::path &path,
 
 CDBWrapper::~CDBWrapper()
 {
+    dbWriter.Release(this);
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -148,6 +163,37 @@ CDBWrapper::~CDBWrapper()
     options.env = nullptr;
 }
 
+CDBStats CDBWrapper::GetStats() const
+{
+    CDBStats stats;
+    stats.nBlockCacheSize = nBlockCacheSize;
+    stats.nWriteBufferSize = options.write_buffer_size;
+    stats.nBlockSize = options.block_size;
+    stats.nMaxFileSize = options.max_file_size;
+    stats.nBloomBits = nBloomBits;
+
+    std::string strValue;
+    stats.nMemoryUsage = 0;
+    if (pdb->GetProperty("leveldb.approximate-memory-usage", &strValue))
+        stats.nMemoryUsage = atoi64(strValue);
+
+    // One line per level that has files or has seen compactions:
+    // level, files, size (MB), compaction time (s), compaction read (MB), compaction write (MB)
+    if (pdb->GetProperty("leveldb.stats", &strValue))
+    {
+        std::istringstream lines(strValue);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            CDBLevelStats level;
+            if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMB,
+                    &level.dCompactionSecs, &level.dCompactionReadMB, &level.dCompactionWriteMB) == 6)
+                stats.levels.push_back(level);
+        }
+    }
+    return stats;
+}
+
 bool CDBWrapper::WriteBatch(CDBBatch &batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
@@ -155,6 +201,230 @@ bool CDBWrapper::WriteBatch(CDBBatch &batch, bool fSync)
     return true;
 }
 
+void CDBWrapper::WriteBatchAsync(std::unique_ptr<CDBBatch> batch) { dbWriter.Queue(this, std::move(batch)); }
+
+CDBWriter dbWriter;
+
+namespace
+{
+// Copies the operations of one leveldb batch into another, as this leveldb has no WriteBatch::Append
+class BatchAppender : public leveldb::WriteBatch::Handler
+{
+public:
+    leveldb::WriteBatch &dest;
+    explicit BatchAppender(leveldb::WriteBatch &_dest) : dest(_dest) {}
+    void Put(const leveldb::Slice &key, const leveldb::Slice &value) override { dest.Put(key, value); }
+    void Delete(const leveldb::Slice &key) override { dest.Delete(key); }
+};
+}
+
+uint64_t CDBWriter::Push(Item &&item)
+{
+    // the caller holds cs_writer
+    if (item.batch)
+        item.nQueuedBytes = item.batch->SizeEstimate();
+    if (item.batch || item.fill)
+        nBatches++;
+    nQueuedBytes += item.nQueuedBytes;
+    queue.push_back(std::move(item));
+    if (!fRunning)
+    {
+        fRunning = true;
+        thread = std::thread(&TraceThread<std::function<void()> >, "dbwriter",
+            std::function<void()>(std::bind(&CDBWriter::ThreadWriter, this)));
+    }
+    condQueued.notify_one();
+    return ++nPushed;
+}
+
+void CDBWriter::Wait(uint64_t nSeq, boost::unique_lock<boost::mutex> &lock)
+{
+    while (nDone < nSeq)
+        condWritten.wait(lock);
+}
+
+void CDBWriter::WaitForRoom(boost::unique_lock<boost::mutex> &lock)
+{
+    while (fRunning && !fStopped && !fWriteFailed && nQueuedBytes >= DBWRITER_MAX_QUEUED_BYTES)
+        condWritten.wait(lock);
+    if (fWriteFailed)
+        throw dbwrapper_error("Database writer failed");
+}
+
+void CDBWriter::Queue(CDBWrapper *pdb, std::unique_ptr<CDBBatch> batch)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_writer);
+        WaitForRoom(lock);
+        if (!fStopped)
+        {
+            Push(Item{pdb, std::move(batch), false, nullptr, 0});
+            return;
+        }
+    }
+    // too late for the thread, so we do the writing ourselves
+    pdb->WriteBatch(*batch);
+}
+
+void CDBWriter::QueueJob(CDBWrapper *pdb, std::function<void(CDBBatch &)> fill, size_t nBytes)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_writer);
+        WaitForRoom(lock);
+        if (!fStopped)
+        {
+            Push(Item{pdb, nullptr, false, std::move(fill), nBytes});
+            return;
+        }
+    }
+    CDBBatch batch(*pdb);
+    fill(batch);
+    pdb->WriteBatch(batch);
+}
+
+bool CDBWriter::Barrier(bool fSync)
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    if (fRunning && !fStopped)
+        Wait(Push(Item{nullptr, nullptr, fSync, nullptr, 0}), lock);
+    return !fWriteFailed;
+}
+
+void CDBWriter::Release(CDBWrapper *pdb)
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    if (fRunning && !fStopped)
+        Wait(Push(Item{pdb, nullptr, true, nullptr, 0}), lock);
+}
+
+void CDBWriter::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_writer);
+        if (fStopped)
+            return;
+        if (fRunning)
+            Wait(Push(Item{nullptr, nullptr, true, nullptr, 0}), lock);
+        fStopped = true;
+        condQueued.notify_one();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+size_t CDBWriter::QueueDepth() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    return nPushed - nDone;
+}
+
+size_t CDBWriter::QueuedBytes() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    return nQueuedBytes;
+}
+
+uint64_t CDBWriter::TotalBatches() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    return nBatches;
+}
+
+uint64_t CDBWriter::TotalWrites() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_writer);
+    return nWrites;
+}
+
+void CDBWriter::ThreadWriter()
+{
+    while (true)
+    {
+        std::deque<Item> items;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_writer);
+            while (queue.empty() && !fStopped)
+                condQueued.wait(lock);
+            if (queue.empty())
+                return;
+            items.swap(queue);
+        }
+
+        bool fOk = true;
+        size_t nBytes = 0;
+        uint64_t nWritten = 0;
+        for (Item &item : items)
+        {
+            nBytes += item.nQueuedBytes;
+            if (!item.fill)
+                continue;
+            try
+            {
+                item.batch.reset(new CDBBatch(*item.pdb));
+                item.fill(*item.batch);
+            }
+            catch (const std::exception &e)
+            {
+                LOGA("Database writer: %s\n", e.what());
+                fOk = false;
+                // what is left is a barrier that does nothing
+                item.batch.reset();
+                item.pdb = nullptr;
+                item.fSync = false;
+            }
+        }
+        for (size_t i = 0; i < items.size();)
+        {
+            Item &item = items[i];
+            try
+            {
+                if (!item.batch)
+                {
+                    // A barrier syncs every database we wrote to, a release just the one that is going away
+                    for (auto it = setUnsynced.begin(); it != setUnsynced.end();)
+                    {
+                        if (item.pdb && *it != item.pdb)
+                        {
+                            ++it;
+                            continue;
+                        }
+                        if (item.fSync)
+                            (*it)->Sync();
+                        it = setUnsynced.erase(it);
+                    }
+                    i++;
+                    continue;
+                }
+
+                // Merge the run of batches for this database into the first one, and write them as one
+                BatchAppender appender(item.batch->batch);
+                size_t j = i + 1;
+                for (; j < items.size() && items[j].batch && items[j].pdb == item.pdb; j++)
+                    items[j].batch->batch.Iterate(&appender);
+                item.pdb->WriteBatch(*item.batch);
+                setUnsynced.insert(item.pdb);
+                nWritten++;
+                i = j;
+            }
+            catch (const std::exception &e)
+            {
+                LOGA("Database writer: %s\n", e.what());
+                fOk = false;
+                i++;
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(cs_writer);
+            nDone += items.size();
+            nQueuedBytes -= nBytes;
+            nWrites += nWritten;
+            fWriteFailed |= !fOk;
+        }
+        condWritten.notify_all();
+    }
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -10,6 +10,7 @@
 #include "fs.h"
 #include "serialize.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -17,8 +18,16 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <thread>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+//! the database writer makes those queueing wait while it is this many bytes behind
+static const size_t DBWRITER_MAX_QUEUED_BYTES = 64 * 1024 * 1024;
 
 // DBWrapper leveldb options that can be modified rather than using the defaults defined in GetDefaultOptions().
 struct COverrideOptions
@@ -26,15 +35,46 @@ struct COverrideOptions
     size_t max_file_size;
     size_t block_size;
     size_t write_buffer_size;
+    //! bits per key of the bloom filter, or -1 for no bloom filter at all
+    int bloom_bits;
+    //! part of nCacheSize that goes to the block cache and to each of the (up to two) write buffers
+    double block_cache_share;
+    double write_buffer_share;
 
     COverrideOptions()
     {
         max_file_size = 0;
         block_size = 0;
         write_buffer_size = 0;
+        bloom_bits = 0;
+        block_cache_share = 0;
+        write_buffer_share = 0;
     }
 };
 
+/** Compaction statistics of one level of a database, as leveldb reports them */
+struct CDBLevelStats
+{
+    int nLevel;
+    int nFiles;
+    double dSizeMB;
+    double dCompactionSecs;
+    double dCompactionReadMB;
+    double dCompactionWriteMB;
+};
+
+/** What a database is tuned for and how it is doing, see CDBWrapper::GetStats() */
+struct CDBStats
+{
+    size_t nBlockCacheSize;
+    size_t nWriteBufferSize;
+    size_t nBlockSize;
+    size_t nMaxFileSize;
+    int nBloomBits;
+    uint64_t nMemoryUsage;
+    std::vector<CDBLevelStats> levels;
+};
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -62,6 +102,7 @@ const std::vector<unsigned char> &GetObfuscateKey(const CDBWrapper &w);
 class CDBBatch
 {
     friend class CDBWrapper;
+    friend class CDBWriter;
 
 private:
     const CDBWrapper &parent;
@@ -207,6 +248,12 @@ protected:
     //! database options used
     leveldb::Options options;
 
+    //! bits per key of the bloom filter in options.filter_policy, 0 if there is none
+    int nBloomBits;
+
+    //! size of options.block_cache
+    size_t nBlockCacheSize;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -247,7 +294,7 @@ public:
         bool fMemory = false,
         bool fWipe = false,
         bool obfuscate = false,
-        COverrideOptions *pOverride = nullptr);
+        const COverrideOptions *pOverride = nullptr);
     ~CDBWrapper();
 
     CDBWrapper(const CDBWrapper &) = delete;
@@ -317,6 +364,12 @@ public:
 
     bool WriteBatch(CDBBatch &batch, bool fSync = false);
 
+    /**
+     * Hand the batch to the database writer thread rather than waiting for leveldb, see CDBWriter.  It is written
+     * after everything queued before it, but until then reads do not see it.
+     */
+    void WriteBatchAsync(std::unique_ptr<CDBBatch> batch);
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush() { return true; }
     bool Sync()
@@ -384,9 +437,79 @@ public:
         return options.write_buffer_size * 2;
     }
 
+    /** Options in use and leveldb's own per level statistics */
+    CDBStats GetStats() const;
+
     leveldb::DB *getpdb() { return this->pdb; }
     leveldb::ReadOptions getreadoptions() const { return this->readoptions; }
     std::vector<unsigned char> getobfuscate_key() const { return this->obfuscate_key; }
 };
 
+/**
+ * The database writer thread.  Index updates (block index, txindex) are queued here by validation and notification
+ * threads, which then carry on without waiting for the disk.  The thread writes the queue in order, merging
+ * consecutive batches for the same database into one leveldb write, and without syncing: durability comes from
+ * Barrier(true) at the points that need it, which syncs every database written to since the last barrier once.
+ * Queueing waits while more than DBWRITER_MAX_QUEUED_BYTES are waiting to be written, and throws a dbwrapper_error
+ * once a write has failed, as a write done right away would.
+ */
+class CDBWriter
+{
+public:
+    ~CDBWriter() { Stop(); }
+
+    void Queue(CDBWrapper *pdb, std::unique_ptr<CDBBatch> batch);
+    /**
+     * Queue a batch that is filled in by the writer thread, for callers that would rather copy their data than
+     * serialize it where they are.  It is written in order with everything else, and counts as nBytes queued.
+     */
+    void QueueJob(CDBWrapper *pdb, std::function<void(CDBBatch &)> fill, size_t nBytes);
+    /** Wait until everything queued so far is written, and with fSync also on disk.  False if a write failed. */
+    bool Barrier(bool fSync);
+    /** Write and sync whatever is queued for pdb, and forget about it, as it is about to be closed */
+    void Release(CDBWrapper *pdb);
+    /** Write out the queue and end the thread.  Batches queued after this are written right away. */
+    void Stop();
+
+    //! batches and bytes waiting to be written
+    size_t QueueDepth() const;
+    size_t QueuedBytes() const;
+    //! batches queued in total, and the leveldb writes they took
+    uint64_t TotalBatches() const;
+    uint64_t TotalWrites() const;
+
+private:
+    struct Item
+    {
+        CDBWrapper *pdb; //!< nullptr for a barrier
+        std::unique_ptr<CDBBatch> batch; //!< nullptr for a barrier or a release, and for a job until it runs
+        bool fSync;
+        std::function<void(CDBBatch &)> fill;
+        size_t nQueuedBytes;
+    };
+
+    uint64_t Push(Item &&item);
+    void WaitForRoom(boost::unique_lock<boost::mutex> &lock);
+    void Wait(uint64_t nSeq, boost::unique_lock<boost::mutex> &lock);
+    void ThreadWriter();
+
+    mutable CWaitableCriticalSection cs_writer;
+    CConditionVariable condQueued;
+    CConditionVariable condWritten;
+    std::deque<Item> queue;
+    std::thread thread;
+    bool fRunning = false;
+    bool fStopped = false;
+    bool fWriteFailed = false;
+    size_t nQueuedBytes = 0;
+    //! items queued and items done; barriers and releases count as well
+    uint64_t nPushed = 0;
+    uint64_t nDone = 0;
+    uint64_t nBatches = 0;
+    uint64_t nWrites = 0;
+    //! only touched by the writer thread
+    std::set<CDBWrapper *> setUnsynced;
+};
+extern CDBWriter dbWriter;
+
 #endif // BITCOIN_DBWRAPPER_H
@@ -43,7 +43,8 @@ enum {
     BU_MEMPOOL_DESCENDANT_COUNT_LIMIT       = MAKE_KEY_BU(0000000b),
     BU_MEMPOOL_DESCENDANT_SIZE_LIMIT        = MAKE_KEY_BU(0000000c),
     BU_TXN_CONCATENATION                    = MAKE_KEY_BU(0000000d),
-    // there is a gap here from 000d to f00d
+    BU_TX_RECONCILIATION                    = MAKE_KEY_BU(0000000e),
+    // there is a gap here from 000e to f00d
     BU_ELECTRUM_SERVER_PORT_TCP             = MAKE_KEY_BU(0000f00d),
     BU_ELECTRUM_SERVER_PROTOCOL_VERSION     = MAKE_KEY_BU(0000f00e),
     BU_ELECTRUM_WS_SERVER_PORT_TCP          = MAKE_KEY_BU(0000f00f),
@@ -76,6 +77,7 @@ const std::unordered_map<uint64_t, int> valtype = {
     {   BU_MEMPOOL_SYNC_MIN_VERSION_SUPPORTED,  xvt_u64c },
     {                  BU_MSG_IGNORE_CHECKSUM,  xvt_u64c },
     {                    BU_TXN_CONCATENATION,  xvt_u64c },
+    {                    BU_TX_RECONCILIATION,  xvt_u64c },
     {                        BU_XTHIN_VERSION,  xvt_u64c },
 }; // const unordered_map valtype
 
@@ -14,6 +14,8 @@
 #include "blockrelay/graphene.h"
 #include "blockrelay/mempool_sync.h"
 #include "blockrelay/thinblock.h"
+#include "blockstorage/blockfilemap.h"
+#include "blockstorage/blockserving.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "clientversion.h"
@@ -41,6 +43,7 @@
 #include "txadmission.h"
 #include "txmempool.h"
 #include "txorphanpool.h"
+#include "txrecon.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -255,6 +258,11 @@ std::queue<CTxInputData> txInQ GUARDED_BY(csTxInQ);
 // Transaction that cannot be processed in this round (may potentially conflict with other tx)
 std::queue<CTxInputData> txDeferQ GUARDED_BY(csTxInQ);
 
+// Transactions from disconnected blocks and the cleared mempool, waiting to be readmitted once a reorg is done
+CCriticalSection cs_reorgTxs;
+std::vector<CTransactionRef> vReorgTxs GUARDED_BY(cs_reorgTxs);
+thread_local unsigned int nTxAdmissionPauseDepth = 0;
+
 
 // Transactions that have been validated and are waiting to be committed into the mempool
 CWaitableCriticalSection csCommitQ;
@@ -288,6 +296,12 @@ CTweakRef<uint64_t> ebTweak("net.excessiveBlock",
     strprintf("Excessive block size in bytes (default: %d)", excessiveBlockSize),
     &excessiveBlockSize,
     &ExcessiveBlockValidator);
+
+CTweak<bool> lockProfiling("debug.lockProfiling",
+    "Record how long every lock site waits for and holds its lock, see getlockstats (default: false)",
+    false,
+    &LockProfilingValidator);
+
 CTweak<bool> ignoreNetTimeouts("net.ignoreTimeouts",
     "ignore inactivity timeouts, used during debugging (default: false)",
     false);
@@ -506,6 +520,16 @@ CTweak<double> grapheneBloomFprOverride("net.grapheneBloomFprOverride",
 
 CTweak<bool> syncMempoolWithPeers("net.syncMempoolWithPeers", "Synchronize mempool with peers (default: false)", false);
 
+CTweak<bool> txReconciliation("net.txReconciliation",
+    "Announce transactions to capable peers by periodic set reconciliation instead of per transaction INVs "
+    "(default: false)",
+    false);
+CTweak<unsigned int> txReconFloodPeers("net.txReconFloodPeers",
+    strprintf("Number of reconciling peers, outbound first, that transactions are still flooded to, to keep "
+              "propagation latency low (default: %u)",
+        DEFAULT_TX_RECON_FLOOD_PEERS),
+    DEFAULT_TX_RECON_FLOOD_PEERS);
+
 /** This setting specifies the minimum supported mempool sync version (inclusive).
  *  The actual version used will be negotiated between sender and receiver.
  */
@@ -524,6 +548,21 @@ CTweak<uint64_t> mempoolSyncMaxVersionSupported("net.mempoolSyncMaxVersionSuppor
     memSyncMaxVerStr,
     DEFAULT_MEMPOOL_SYNC_MAX_VERSION_SUPPORTED);
 
+CTweak<unsigned int> blockReadAhead("net.blockReadAhead",
+    strprintf("How many of the blocks a peer asked for are read ahead of serving them, 0 to disable (default: %u)",
+                                       DEFAULT_BLOCK_READ_AHEAD),
+    DEFAULT_BLOCK_READ_AHEAD);
+CTweak<unsigned int> blockServeReads("net.blockServeReads",
+    strprintf("How many blocks are read from disk at once to serve them to peers, 0 for no limit (default: %u)",
+                                         DEFAULT_BLOCK_SERVE_READS),
+    DEFAULT_BLOCK_SERVE_READS);
+
+CTweak<uint32_t> mappedBlockFiles("blockchain.mappedBlockFiles",
+    strprintf("Number of block and undo files kept memory mapped for reading historical blocks, 0 to read them "
+              "through stdio (default: %d)",
+                                      DEFAULT_MAPPED_BLOCK_FILES),
+    DEFAULT_MAPPED_BLOCK_FILES);
+
 /** This is the initial size of CFileBuffer's RAM buffer during reindex.  A
 larger size will result in a tiny bit better performance if blocks are that
 size.
@@ -593,6 +632,7 @@ thread_group threadGroup;
 
 CStatHistory<unsigned int> txAdded; //"memPool/txAdded");
 CStatHistory<uint64_t, MinValMax<uint64_t> > poolSize; // "memPool/size",STAT_OP_AVE);
+CStatHistory<uint64_t> nRemoveForBlockTime("memPool/removeForBlockTime", STAT_OP_MAX | STAT_INDIVIDUAL);
 CStatHistory<uint64_t> recvAmt;
 CStatHistory<uint64_t> sendAmt;
 CStatHistory<uint64_t> nTxValidationTime("txValidationTime", STAT_OP_MAX | STAT_INDIVIDUAL);
@@ -608,7 +648,11 @@ CCriticalSection cs_mempoolsync;
 std::map<NodeId, CMempoolSyncState> mempoolSyncRequested GUARDED_BY(cs_mempoolsync);
 std::map<NodeId, CMempoolSyncState> mempoolSyncResponded GUARDED_BY(cs_mempoolsync);
 uint64_t lastMempoolSync = GetStopwatchMicros();
+std::atomic<bool> fMempoolSyncCatchUp{true};
+CMempoolSyncData mempoolsyncdata;
 uint64_t lastMempoolSyncClear = GetStopwatchMicros();
+CCriticalSection cs_txrecon;
+std::map<NodeId, CTxReconState> mapTxRecon GUARDED_BY(cs_txrecon);
 
 // Are we shutting down. Replaces boost interrupts.
 std::atomic<bool> shutdown_threads{false};
@@ -234,22 +234,15 @@ bool TxIndex::FindTx(const uint256 &txhash, uint256 &blockhash, CTransactionRef
 {
     CDiskTxPos postx;
     if (!db->ReadTxPos(txhash, postx))
-        return false;
-
-    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-    if (file.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-    CBlockHeader header;
-    try
-    {
-        file >> header;
-        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-        file >> ptx;
-    }
-    catch (const std::exception &e)
     {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        // it may still be waiting for the database writer
+        if (dbWriter.QueueDepth() == 0 || !dbWriter.Barrier(false) || !db->ReadTxPos(txhash, postx))
+            return false;
     }
+
+    CBlockHeader header;
+    if (!ReadTxFromDiskSequential(postx, header, ptx))
+        return false;
     blockhash = header.GetHash();
     if (ptx->GetHash() != txhash)
         return error("%s: txid mismatch", __func__);
@@ -76,6 +76,9 @@ public:
 
     /// Stops the instance from staying in sync with blockchain updates.
     void Stop();
+
+    /// Options and statistics of the underlying database.
+    CDBStats GetDBStats() const { return db->GetStats(); }
 };
 
 /// The global transaction index, used in GetTransaction. May be null.
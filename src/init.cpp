@@ -13,6 +13,7 @@
 #include "addrman.h"
 #include "amount.h"
 #include "blockstorage/blockstorage.h"
+#include "blockstorage/coldfiles.h"
 #include "blockstorage/sequential_files.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -31,6 +32,7 @@
 #include "index/txindex.h"
 #include "key.h"
 #include "main.h"
+#include "metrics.h"
 #include "miner.h"
 #include "net.h"
 #include "parallel.h"
@@ -217,6 +219,7 @@ void Shutdown()
     // Call every async stop function before flushing to disk
     StopHTTPRPC();
     StopREST();
+    StopMetrics();
     StopRPC();
     StopHTTPServer();
     StopTxAdmission();
@@ -271,6 +274,8 @@ void Shutdown()
         {
             FlushStateToDisk();
         }
+        dbWriter.Stop();
+        StopPrunedFileDeleter();
         delete pcoinsTip;
         pcoinsTip = nullptr;
         delete pcoinscatcher;
@@ -319,6 +324,7 @@ void Shutdown()
     MainCleanup();
     UnlimitedCleanup();
     LOGA("%s: done\n", __func__);
+    StopAsyncLog();
 }
 
 /**
@@ -479,6 +485,11 @@ void ThreadImport(std::vector<fs::path> vImportFiles, uint64_t nTxIndexCache)
         while (true)
         {
             CDiskBlockPos pos(nFile, 0);
+            // compressed files are reindexed from the original, and their undo data is written again
+            if (coldBlockFiles.IsCold(nFile, false) && !coldBlockFiles.Restore(nFile, false))
+                break;
+            if (coldBlockFiles.IsCold(nFile, true) && !coldBlockFiles.Restore(nFile, true))
+                break;
             if (!fs::exists(GetBlockPosFilename(pos, "blk")))
                 break; // No block files left to reindex
             FILE *file = OpenBlockFile(pos, true);
@@ -715,6 +726,8 @@ bool AppInitServers(int rpcport, const std::string &network)
         return false;
     if (GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE) && !StartMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     if (!electrum::ElectrumServer::Instance().Start(rpcport, network))
@@ -1020,6 +1033,39 @@ bool AppInit2(Config &config)
         LOGA("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
     }
+    // and what is too old to keep, whatever the size
+    const int64_t nSignedPruneDepth = GetArg("-prunedepth", 0);
+    const int64_t nSignedPruneAge = GetArg("-pruneage", 0);
+    if (nSignedPruneDepth || nSignedPruneAge)
+    {
+        if (!fPruneMode)
+            return InitError(_("-prunedepth and -pruneage require -prune."));
+        if (GetArg("-useblockdb", DEFAULT_BLOCK_DB_MODE) != SEQUENTIAL_BLOCK_FILES)
+            return InitError(_("-prunedepth and -pruneage are only supported with block files (-useblockdb=0)."));
+        if (nSignedPruneDepth < 0 || nSignedPruneAge < 0)
+            return InitError(_("Prune cannot be configured with a negative value."));
+        if (nSignedPruneDepth && nSignedPruneDepth < (int64_t)MIN_BLOCKS_TO_KEEP)
+            return InitError(strprintf(_("-prunedepth must be at least %d."), MIN_BLOCKS_TO_KEEP));
+        nPruneDepth = nSignedPruneDepth;
+        nPruneAge = nSignedPruneAge * 24 * 60 * 60;
+        LOGA("Prune configured to also delete blocks more than %d blocks deep or %d days old.\n", nPruneDepth,
+            nSignedPruneAge);
+    }
+
+    fCompactUndo = GetBoolArg("-compactundo", DEFAULT_COMPACT_UNDO);
+
+    // compression of old block files; get the depth at which blocks go into the cold tier
+    const int64_t nColdBlockDepth = GetArg("-coldblocks", DEFAULT_COLD_BLOCK_DEPTH);
+    if (nColdBlockDepth < 0)
+    {
+        return InitError(_("Cold block storage cannot be configured with a negative value."));
+    }
+    if (nColdBlockDepth && nColdBlockDepth < MIN_BLOCKS_TO_KEEP)
+    {
+        return InitError(strprintf(
+            _("Cold block storage configured below the minimum of %d blocks.  Please use a higher number."),
+            MIN_BLOCKS_TO_KEEP));
+    }
 
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
@@ -1154,7 +1200,11 @@ bool AppInit2(Config &config)
         ShrinkDebugFile();
 
     if (fPrintToDebugLog)
+    {
         OpenDebugLog();
+        if (GetBoolArg("-logasync", DEFAULT_LOGASYNC))
+            StartAsyncLog();
+    }
 
 #ifdef ENABLE_WALLET
     LOGA("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
@@ -1385,9 +1435,7 @@ bool AppInit2(Config &config)
                     cacheConfig.nBlockTreeDBCache, cacheConfig.nBlockDBCache, cacheConfig.nBlockUndoDBCache);
 
                 uiInterface.InitMessage(_("Opening UTXO database..."));
-                COverrideOptions overridecache;
-                overridecache.block_size = 4096;
-                pcoinsdbview = new CCoinsViewDB(cacheConfig.nCoinDBCache, false, fReindex, true, &overridecache);
+                pcoinsdbview = new CCoinsViewDB(cacheConfig.nCoinDBCache, false, fReindex, true);
 
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 uiInterface.InitMessage(_("Opening Coins Cache database..."));
@@ -1784,6 +1832,11 @@ bool AppInit2(Config &config)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles, cacheConfig.nTxIndexCache));
+    if (nColdBlockDepth && BLOCK_DB_MODE == SEQUENTIAL_BLOCK_FILES)
+    {
+        LOGA("Compressing block files once their blocks are %d blocks deep\n", nColdBlockDepth);
+        threadGroup.create_thread(boost::bind(&ThreadCompressBlockFiles, nColdBlockDepth));
+    }
 
     uiInterface.InitMessage(_("Waiting for Genesis Block..."));
     CBlockIndex *tip = nullptr;
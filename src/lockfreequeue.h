@@ -0,0 +1,103 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LOCKFREEQUEUE_H
+#define BITCOIN_LOCKFREEQUEUE_H
+
+#include <assert.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded multi-producer, multi-consumer FIFO queue that never takes a lock (D. Vyukov's bounded MPMC queue).
+ *
+ * Every cell carries a sequence number that says whether it is free for the producer at that position or holds a
+ * value for the consumer at that position.  Producers and consumers claim a position with a compare and swap on
+ * their end's counter and then only touch their own cell, so a full or empty queue is detected without waiting for
+ * anyone.  The size must be a power of two.
+ */
+template <typename T>
+class CLockFreeQueue
+{
+public:
+    explicit CLockFreeQueue(size_t nSize) : vCells(nSize), nMask(nSize - 1), nEnqueue(0), nDequeue(0)
+    {
+        assert(nSize >= 2 && (nSize & (nSize - 1)) == 0);
+        for (size_t i = 0; i < nSize; i++)
+            vCells[i].nSeq.store(i, std::memory_order_relaxed);
+    }
+
+    /** Move value into the queue, returns false and leaves value alone if the queue is full */
+    bool TryPush(T &&value)
+    {
+        size_t nPos = nEnqueue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = vCells[nPos & nMask];
+            const size_t nSeq = cell.nSeq.load(std::memory_order_acquire);
+            const intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nPos;
+            if (nDiff == 0)
+            {
+                if (nEnqueue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.nSeq.store(nPos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (nDiff < 0)
+                return false; // the consumer has not taken the value a lap ago out of this cell yet
+            else
+                nPos = nEnqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    /** Move the oldest value out of the queue into value, returns false if the queue is empty */
+    bool TryPop(T &value)
+    {
+        size_t nPos = nDequeue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = vCells[nPos & nMask];
+            const size_t nSeq = cell.nSeq.load(std::memory_order_acquire);
+            const intptr_t nDiff = (intptr_t)nSeq - (intptr_t)(nPos + 1);
+            if (nDiff == 0)
+            {
+                if (nDequeue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.nSeq.store(nPos + nMask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (nDiff < 0)
+                return false;
+            else
+                nPos = nDequeue.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t Capacity() const { return nMask + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> nSeq;
+        T value;
+    };
+
+    std::vector<Cell> vCells;
+    const size_t nMask;
+    // the counters are written by different threads, keep them off each other's cache line
+    char padding0[64];
+    std::atomic<size_t> nEnqueue;
+    char padding1[64];
+    std::atomic<size_t> nDequeue;
+    char padding2[64];
+};
+
+#endif // BITCOIN_LOCKFREEQUEUE_H
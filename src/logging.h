@@ -20,6 +20,7 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS = true;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC = false;
 
 /** Send a string to the log output */
 int LogPrintStr(const std::string &str);
@@ -245,6 +246,14 @@ inline void LogWrite(const std::string &str)
 // Flush log file (if you know you are about to abort)
 void LogFlush();
 
+/** Write debug.log from a thread of its own from now on, so logging never waits for the disk.  Precondition: the
+ *  log is open */
+void StartAsyncLog();
+/** Write out the lines still queued and go back to writing debug.log from the thread that logs */
+void StopAsyncLog();
+/** How many log lines were dropped because the writer thread fell too far behind */
+uint64_t GetLogDropped();
+
 /** Get format string from VA_ARGS for error reporting */
 template <typename... Args>
 std::string FormatStringFromLogArgs(const char *fmt, const Args &... args)
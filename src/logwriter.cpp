@@ -0,0 +1,128 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logwriter.h"
+
+#include "tinyformat.h"
+#include "util.h"
+#include "utiltime.h"
+
+CAsyncLogWriter::CAsyncLogWriter(std::function<void(const std::string &)> fnWriteIn, size_t nQueueSize)
+    : fnWrite(fnWriteIn), queue(nQueueSize), nQueued(0), nWritten(0), nDropped(0), nDroppedUnreported(0),
+      fIdle(false), fStop(false)
+{
+    Start();
+}
+
+CAsyncLogWriter::~CAsyncLogWriter() { Stop(); }
+
+void CAsyncLogWriter::Start()
+{
+    std::lock_guard<std::mutex> lock(csWriter);
+    if (writer.joinable())
+        return;
+    fIdle = false;
+    fStop = false;
+    writer = std::thread(&CAsyncLogWriter::ThreadWriter, this);
+}
+
+bool CAsyncLogWriter::Push(std::string &&strLine)
+{
+    if (fStop.load() || !queue.TryPush(std::move(strLine)))
+    {
+        nDropped++;
+        nDroppedUnreported++;
+        return false;
+    }
+    nQueued++;
+    // the writer sets fIdle before it checks nQueued one last time, so either it sees this line or we see it idle
+    if (fIdle.load())
+    {
+        {
+            std::lock_guard<std::mutex> lock(csWriter);
+        }
+        cvWriter.notify_one();
+    }
+    return true;
+}
+
+void CAsyncLogWriter::Flush()
+{
+    const uint64_t nTarget = nQueued.load();
+    std::unique_lock<std::mutex> lock(csWriter);
+    cvWritten.wait(lock, [this, nTarget]() { return nWritten.load() >= nTarget || fStop.load(); });
+}
+
+void CAsyncLogWriter::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(csWriter);
+        if (!writer.joinable())
+            return;
+        fStop = true;
+    }
+    cvWriter.notify_one();
+    writer.join();
+
+    // a line whose Push started just before fStop was set may have come in after the writer was done
+    std::string strBatch;
+    const size_t nLines = TakeBatch(strBatch);
+    if (nLines)
+    {
+        fnWrite(strBatch);
+        nWritten += nLines;
+    }
+    cvWritten.notify_all();
+}
+
+size_t CAsyncLogWriter::TakeBatch(std::string &strBatch)
+{
+    size_t nLines = 0;
+    std::string strLine;
+    while (nLines < LOG_BATCH_RECORDS && queue.TryPop(strLine))
+    {
+        strBatch += strLine;
+        nLines++;
+    }
+    return nLines;
+}
+
+void CAsyncLogWriter::ThreadWriter()
+{
+    RenameThread("logwriter");
+    // a previous run of the writer has written everything it took, Stop included
+    uint64_t nTaken = nWritten.load();
+    std::string strBatch;
+    for (;;)
+    {
+        strBatch.clear();
+        const uint64_t nDroppedNow = nDroppedUnreported.exchange(0);
+        if (nDroppedNow)
+        {
+            strBatch = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) +
+                       strprintf(" Log writer dropped %u lines\n", nDroppedNow);
+        }
+        const size_t nLines = TakeBatch(strBatch);
+        nTaken += nLines;
+        if (!strBatch.empty())
+            fnWrite(strBatch);
+        if (nLines)
+        {
+            nWritten += nLines;
+            {
+                std::lock_guard<std::mutex> lock(csWriter);
+            }
+            cvWritten.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(csWriter);
+        fIdle = true;
+        // lines that are queued after fStop is set are dropped by Push, so the queue is empty for good
+        if (fStop.load() && nQueued.load() <= nTaken)
+            break;
+        cvWriter.wait(lock, [this, nTaken]() { return nQueued.load() > nTaken || fStop.load(); });
+        fIdle = false;
+    }
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LOGWRITER_H
+#define BITCOIN_LOGWRITER_H
+
+#include "lockfreequeue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+/** How many log lines can wait to be written before further ones are dropped */
+static const size_t LOG_QUEUE_SIZE = 1 << 16;
+/** How many log lines the writer gathers into one write at most */
+static const size_t LOG_BATCH_RECORDS = 1024;
+
+/**
+ * Writes log lines from a thread of its own.
+ *
+ * Logging threads format their line themselves and move it into a lock free queue, so they never wait for the
+ * disk or for each other.  The writer thread takes whatever is queued, joins it into one buffer and hands that to
+ * fnWrite in a single call.  If the queue is full the line is dropped and counted, and the writer notes how many
+ * lines were lost in the log the next time it writes.
+ */
+class CAsyncLogWriter
+{
+public:
+    CAsyncLogWriter(std::function<void(const std::string &)> fnWriteIn, size_t nQueueSize = LOG_QUEUE_SIZE);
+    ~CAsyncLogWriter();
+
+    /** Queue a complete log line, returns false if it was dropped because the queue is full */
+    bool Push(std::string &&strLine);
+    /** Wait until every line queued before the call has been written */
+    void Flush();
+    /** Start the writer thread again after Stop */
+    void Start();
+    /** Write out what is queued and stop the writer thread.  Lines pushed afterwards are dropped until Start. */
+    void Stop();
+
+    /** How many lines were dropped since the writer was created */
+    uint64_t Dropped() const { return nDropped.load(std::memory_order_relaxed); }
+    /** How many lines were written since the writer was created */
+    uint64_t Written() const { return nWritten.load(std::memory_order_relaxed); }
+
+private:
+    void ThreadWriter();
+    /** Take up to LOG_BATCH_RECORDS lines from the queue into strBatch, returns how many */
+    size_t TakeBatch(std::string &strBatch);
+
+    const std::function<void(const std::string &)> fnWrite;
+    CLockFreeQueue<std::string> queue;
+
+    std::atomic<uint64_t> nQueued;
+    std::atomic<uint64_t> nWritten;
+    std::atomic<uint64_t> nDropped;
+    //! dropped lines that have not been noted in the log yet
+    std::atomic<uint64_t> nDroppedUnreported;
+
+    //! the writer waits on cvWriter while it is idle; loggers only notify it if fIdle is set
+    std::mutex csWriter;
+    std::condition_variable cvWriter;
+    std::condition_variable cvWritten;
+    std::atomic<bool> fIdle;
+    std::atomic<bool> fStop;
+    std::thread writer;
+};
+
+#endif // BITCOIN_LOGWRITER_H
@@ -46,9 +46,9 @@
 #include "tinyformat.h"
 #include "txadmission.h"
 #include "txdb.h"
-#include "txlookup.h"
 #include "txmempool.h"
 #include "txorphanpool.h"
+#include "txrecon.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -87,6 +87,8 @@ unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 uint64_t nPruneTarget = 0;
+uint64_t nPruneDepth = 0;
+int64_t nPruneAge = 0;
 uint64_t nDBUsedSpace = 0;
 uint32_t nXthinBloomFilterSize = SMALLEST_MAX_BLOOM_FILTER_SIZE;
 
@@ -147,6 +149,7 @@ void FinalizeNode(NodeId nodeid)
 {
     // Clean up the sync maps
     ClearDisconnectedFromMempoolSyncMaps(nodeid);
+    ClearDisconnectedFromTxRecon(nodeid);
 
     // Clear thintype block data if we have any.
     thinrelay.ClearAllBlocksToReconstruct(nodeid);
@@ -339,17 +342,9 @@ bool GetTransaction(const uint256 &hash,
 
     if (pindexSlow)
     {
-        CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow, consensusParams))
+        if (ReadTxFromDisk(txOut, pindexSlow, hash, consensusParams))
         {
-            bool ctor_enabled = pindexSlow->nHeight >= consensusParams.nov2018Height;
-            int64_t pos = FindTxPosition(block, hash, ctor_enabled);
-            if (pos == TX_NOT_FOUND)
-            {
-                return false;
-            }
-            txOut = block.vtx.at(pos);
-            txTime = block.nTime;
+            txTime = pindexSlow->nTime;
             hashBlock = pindexSlow->GetBlockHash();
             return true;
         }
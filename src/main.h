@@ -170,6 +170,10 @@ extern bool fHavePruned;
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
+/** Block files whose blocks are all more than this many blocks below the tip are pruned, whatever the target. */
+extern uint64_t nPruneDepth;
+/** Block files whose blocks are all more than this many seconds older than the tip are pruned, whatever the target. */
+extern int64_t nPruneAge;
 /** Number of MiB the blockdb is using. */
 extern uint64_t nDBUsedSpace;
 /** The maximum bloom filter size that we will support for an xthin request. This value is communicated to
@@ -0,0 +1,140 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "httpserver.h"
+#include "rpc/protocol.h"
+#include "stat.h"
+#include "sync.h"
+#include "tweak.h"
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+static const char *METRICS_PREFIX = "membercoin_";
+static const char *METRICS_CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8";
+//! statistics named "node/<peer>/<name>" are kept per peer, and exported as "node_<name>" with a peer label
+static const std::string PEER_STAT_PREFIX = "node/";
+
+//! size of the last page rendered, so the next one can be rendered into a buffer of about the right size
+static std::atomic<size_t> nLastMetricsSize{0};
+
+/** Metric names may only hold letters, digits, underscores and colons */
+static void AppendMetricName(std::string &out, const std::string &name)
+{
+    out.append(METRICS_PREFIX);
+    for (char c : name)
+    {
+        const bool fValid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        out.push_back(fValid ? c : '_');
+    }
+}
+
+/** Label values may hold anything, with backslashes, quotes and newlines escaped */
+static void AppendLabelValue(std::string &out, const std::string &value)
+{
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            out.push_back('\\');
+        if (c == '\n')
+            out.append("\\n");
+        else
+            out.push_back(c);
+    }
+}
+
+std::string RenderMetrics()
+{
+    std::string out;
+    out.reserve(nLastMetricsSize.load() * 5 / 4 + 4096);
+    std::string metric;
+
+    {
+        LOCK(cs_statMap);
+        // per peer statistics, by statistic and then by peer, so each becomes one metric labeled by peer
+        std::map<std::string, std::vector<std::pair<std::string, CStatBase *> > > peerStats;
+        const std::string noLabels;
+        for (const auto &item : statistics)
+        {
+            if (!item.second)
+                continue;
+            if (item.first.compare(0, PEER_STAT_PREFIX.size(), PEER_STAT_PREFIX) == 0)
+            {
+                const size_t pos = item.first.rfind('/');
+                if (pos >= PEER_STAT_PREFIX.size())
+                {
+                    peerStats[item.first.substr(pos + 1)].emplace_back(
+                        item.first.substr(PEER_STAT_PREFIX.size(), pos - PEER_STAT_PREFIX.size()), item.second);
+                    continue;
+                }
+            }
+            metric.clear();
+            AppendMetricName(metric, item.first);
+            out.append("# TYPE ");
+            out.append(metric);
+            out.append(" gauge\n");
+            item.second->WriteMetrics(out, metric, noLabels);
+        }
+
+        std::string labels;
+        for (const auto &item : peerStats)
+        {
+            metric.clear();
+            AppendMetricName(metric, PEER_STAT_PREFIX + item.first);
+            out.append("# TYPE ");
+            out.append(metric);
+            out.append(" gauge\n");
+            for (const auto &peer : item.second)
+            {
+                labels.assign("peer=\"");
+                AppendLabelValue(labels, peer.first);
+                labels.push_back('"');
+                peer.second->WriteMetrics(out, metric, labels);
+            }
+        }
+    }
+
+    metric.assign(METRICS_PREFIX);
+    metric.append("tweak");
+    out.append("# TYPE ");
+    out.append(metric);
+    out.append(" gauge\n");
+    char labels[128];
+    for (const auto &item : tweaks)
+    {
+        const UniValue value = item.second->Get();
+        snprintf(labels, sizeof(labels), "name=\"%s\"", item.first.c_str());
+        if (value.isBool())
+            AppendMetric(out, metric, labels, value.get_bool() ? 1 : 0);
+        else if (value.isNum())
+            AppendMetric(out, metric, labels, value.get_real());
+    }
+
+    nLastMetricsSize = out.size();
+    return out;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest *req, const std::string &strURIPart)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET)
+    {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are supported\r\n");
+        return false;
+    }
+    const std::string page = RenderMetrics();
+    req->WriteHeader("Content-Type", METRICS_CONTENT_TYPE);
+    req->WriteReply(HTTP_OK, page);
+    return true;
+}
+
+bool StartMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
+    return true;
+}
+
+void StopMetrics() { UnregisterHTTPHandler("/metrics", true); }
@@ -0,0 +1,25 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
+#include <string>
+
+/** Whether /metrics is served by default */
+static const bool DEFAULT_METRICS_ENABLE = false;
+
+/**
+ * Render every registered statistic and every numeric tweak in the Prometheus text exposition format.  A
+ * statistic named "net/send/total" becomes the gauge membercoin_net_send_total; statistics with a history are
+ * labeled with the series each sample comes from, and tweaks are samples of membercoin_tweak labeled by name.
+ */
+std::string RenderMetrics();
+
+/** Start serving RenderMetrics at /metrics on the RPC port.  Precondition: the HTTP server has been initialized. */
+bool StartMetrics();
+/** Stop serving /metrics */
+void StopMetrics();
+
+#endif // BITCOIN_METRICS_H
@@ -246,14 +246,9 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript &sc
         std::vector<const CTxMemPoolEntry *> vtxe;
         addPriorityTxs(&vtxe);
 
-        // Mine by package (CPFP)
-        // We make two passes through addPackageTxs(). The first pass is for
-        // transactions and chains that are not dirty, which will likely be the bulk
-        // of the block. Then a second quick pass is made to see if any dirty transactions
-        // would be able to fill the rest of the block.
+        // Mine by package (CPFP), merging the precomputed chunks of every mempool cluster
         int64_t nStartPackage = GetStopwatchMicros();
-        addPackageTxs(&vtxe, canonical, false);
-        addPackageTxs(&vtxe, canonical, true);
+        addPackageTxs(&vtxe);
         nTotalPackage += GetStopwatchMicros() - nStartPackage;
 
         nLastBlockTx = nBlockTx;
@@ -338,7 +333,7 @@ bool BlockAssembler::TestPackageSigOps(uint64_t packageSize, unsigned int packag
 
 // Block size and sigops have already been tested.  Check that all transactions
 // are final.
-bool BlockAssembler::TestPackageFinality(const CTxMemPool::setEntries &package)
+bool BlockAssembler::TestPackageFinality(const std::vector<CTxMemPool::txiter> &package)
 {
     for (const CTxMemPool::txiter it : package)
     {
@@ -457,136 +452,119 @@ void BlockAssembler::AddToBlock(std::vector<const CTxMemPoolEntry *> *vtxe, CTxM
     }
 }
 
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries &package, std::vector<CTxMemPool::txiter> &sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
-
-// This transaction selection algorithm orders the mempool based
-// on feerate of a transaction including all unconfirmed ancestors.
+// This transaction selection algorithm mines the mempool by chunks.
 //
-// This is accomplished by considering a group of ancestors as a single transaction. We can call these
-// transactions, Ancestor Grouped Transactions (AGT). This approach to grouping allows us to process
-// packages orders of magnitude faster than other methods of package mining since we no longer have
-// to continuously update the descendant state as we mine part of an unconfirmed chain.
+// The mempool groups transactions into clusters (sets of transactions connected by spending relationships) and
+// keeps a linearization of each cluster: a valid block order, cut into chunks of strictly decreasing feerate.
+// Because each chunk only depends on itself and the chunks before it, picking the best chunk across all
+// clusters and then offering that cluster's next chunk is a simple k-way merge. This gives child-pays-for-parent
+// for any shape of package, not just a transaction and its ancestors, without recomputing ancestor sets or
+// depending on the (possibly dirty) ancestor state of mempool entries.
 //
-// There is a theoretical flaw in this approach which could happen when a block is almost full. We
-// could for instance end up including a lower fee transaction as part of an ancestor group when
-// in fact it would be better, in terms of fees, to include some other single transaction. This
-// would result in slightly less fees (perhaps a few hundred satoshis) rewarded to the miner. However,
-// this situation is not likely to be seen for two reasons. One, long unconfirmed chains are typically
-// having transactions with all the same fees and Two, the typical child pays for parent scenario has only
-// two transactions with the child having the higher fee. And neither of these two types of packages could
-// cause any loss of fees with this mining algorithm, when the block is nearly full.
-//
-// The mining algorithm is surprisingly simple and centers around parsing though the mempools ancestor_score
-// index and adding the AGT's into the new block. There is however a pathological case which has to be
-// accounted for where a child transaction has less fees per KB than its parent which causes child transactions
-// to show up later as we parse though the ancestor index. In this case we then have to recalculate the
-// ancestor sigops and package size which can be time consuming given we have to parse through the ancestor
-// tree each time. However we get around that by shortcutting the process by parsing through only the portion
-// of the tree that is currently not in the block. This shortcutting happens in _CalculateMempoolAncestors()
-// where we pass in the inBlock vector of already added transactions. Even so, if we didn't do this shortcutting
-// the current algo is still much better than the older method which needed to update calculations for the
-// entire descendant tree after each package was added to the block.
-
-void BlockAssembler::addPackageTxs(std::vector<const CTxMemPoolEntry *> *vtxe, bool fCanonical, bool fAllowDirtyTxns)
+// The merge starts from the mempool's index of clusters sorted by their best chunk and pulls from it only as
+// fast as chunks are added, so the cost is proportional to what ends up in the block rather than to the size of
+// the mempool. Only the clusters that changed since the last template need to be linearized again.
+
+void BlockAssembler::addPackageTxs(std::vector<const CTxMemPoolEntry *> *vtxe)
 {
     AssertLockHeld(mempool.cs_txmempool);
 
-    CTxMemPool::txiter iter;
+    mempool._UpdateClusters();
+    const CTxMemPool::setChunkKeys &byBestChunk = mempool._GetClustersByBestChunk();
+    CTxMemPool::CompareTxChunkKey compare;
+
+    // The next unmined chunk of every cluster we have started on, keyed by that chunk's feerate
+    std::map<CTxMemPool::TxChunkKey, size_t, CTxMemPool::CompareTxChunkKey> mapNextChunk;
+    auto nextCluster = byBestChunk.begin();
+
     uint64_t nPackageFailures = 0;
-    for (auto mi = mempool.mapTx.get<ancestor_score>().begin(); mi != mempool.mapTx.get<ancestor_score>().end(); mi++)
+    while (nextCluster != byBestChunk.end() || !mapNextChunk.empty())
     {
-        iter = mempool.mapTx.project<0>(mi);
-
-        // Skip txns we know are in the block
-        if (inBlock.count(iter) || (fAllowDirtyTxns == false && iter->IsDirty() == true))
+        // Take whichever is better: the best chunk of a cluster we haven't looked at yet or the next chunk
+        // of one we have.
+        CTxMemPool::TxChunkKey key;
+        size_t nChunk = 0;
+        if (!mapNextChunk.empty() &&
+            (nextCluster == byBestChunk.end() || compare(mapNextChunk.begin()->first, *nextCluster)))
         {
-            continue;
+            key = mapNextChunk.begin()->first;
+            nChunk = mapNextChunk.begin()->second;
+            mapNextChunk.erase(mapNextChunk.begin());
         }
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        // mempool uses same field for sigops and sigchecks
-        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
-
-        // Get any unconfirmed ancestors of this txn
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        mempool._CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, dummy, &inBlock, false);
-
-        // Include in the package the current txn we're working with
-        ancestors.insert(iter);
-
-        // Recalculate sigops and package size, only if there were txns already in the block for
-        // this set of ancestors
-        if (iter->GetCountWithAncestors() > ancestors.size())
+        else
         {
-            packageSize = 0;
-            packageSigOps = 0;
-            for (auto &it : ancestors)
-            {
-                packageSize += it->GetTxSize();
-                packageSigOps += it->GetSigOpCount();
-            }
+            key = *nextCluster;
+            ++nextCluster;
         }
-        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize)
+        const CTxMemPool::TxCluster *pcluster = mempool._GetCluster(key.nClusterId);
+        DbgAssert(pcluster && nChunk < pcluster->vChunks.size(), continue);
+        const CTxMemPool::TxChunk &chunk = pcluster->vChunks[nChunk];
+
+        // Transactions may already be in the block from addPriorityTxs()
+        std::vector<CTxMemPool::txiter> package;
+        package.reserve(chunk.vTxns.size());
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        unsigned int packageSigOps = 0;
+        for (CTxMemPool::txiter it : chunk.vTxns)
         {
-            // Everything else we might consider has a lower fee rate so no need to continue
-            return;
+            if (inBlock.count(it))
+                continue;
+            package.push_back(it);
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            // mempool uses same field for sigops and sigchecks
+            packageSigOps += it->GetSigOpCount();
         }
 
-        // Test if package fits in the block
-        if (nBlockSize + packageSize > nBlockMaxSize)
+        // Later chunks of a cluster may depend on this one, so they are only offered once this one is in the
+        // block. On any failure below the rest of the cluster is skipped.
+        if (!package.empty())
         {
-            if (nBlockSize > nBlockMaxSize * .50)
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize)
             {
-                nPackageFailures++;
+                // Everything else we might consider has a lower fee rate so no need to continue
+                return;
             }
 
-            // If we keep failing then the block must be almost full so bail out here.
-            if (nPackageFailures >= MAX_PACKAGE_FAILURES)
-                return;
-            else
-                continue;
-        }
+            // Test if package fits in the block
+            if (nBlockSize + packageSize > nBlockMaxSize)
+            {
+                if (nBlockSize > nBlockMaxSize * .50)
+                {
+                    nPackageFailures++;
+                }
 
-        // Test that the package does not exceed sigops limits
-        if (!TestPackageSigOps(packageSize, packageSigOps))
-        {
-            continue;
-        }
-        // Test if all tx's are Final
-        if (!TestPackageFinality(ancestors))
-        {
-            continue;
-        }
+                // If we keep failing then the block must be almost full so bail out here.
+                if (nPackageFailures >= MAX_PACKAGE_FAILURES)
+                    return;
+                else
+                    continue;
+            }
 
-        // The Package can now be added to the block.
-        if (fCanonical)
-        {
-            for (auto &it : ancestors)
+            // Test that the package does not exceed sigops limits
+            if (!TestPackageSigOps(packageSize, packageSigOps))
+            {
+                continue;
+            }
+            // Test if all tx's are Final
+            if (!TestPackageFinality(package))
+            {
+                continue;
+            }
+
+            // The chunk is already in a valid block order, which also suffices when we are doing CTOR since
+            // the block is sorted at the end.
+            for (CTxMemPool::txiter it : package)
             {
                 AddToBlock(vtxe, it);
             }
         }
-        else
+
+        if (nChunk + 1 < pcluster->vChunks.size())
         {
-            // Sort the entries in a valid order if we are not doing CTOR
-            vector<CTxMemPool::txiter> sortedEntries;
-            SortForBlock(ancestors, sortedEntries);
-            for (size_t i = 0; i < sortedEntries.size(); ++i)
-            {
-                AddToBlock(vtxe, sortedEntries[i]);
-            }
+            const CTxMemPool::TxChunk &next = pcluster->vChunks[nChunk + 1];
+            mapNextChunk.emplace(CTxMemPool::TxChunkKey{next.nModFees, next.nSize, key.nClusterId}, nChunk + 1);
         }
     }
 }
@@ -59,21 +59,6 @@ struct CompareCTxMemPoolIter
     bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const { return &(*a) < &(*b); }
 };
 
-/** A comparator that sorts transactions based on number of ancestors.
- * This is sufficient to sort an ancestor package in an order that is valid
- * to appear in a block.
- */
-struct CompareTxIterByAncestorCount
-{
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
-    {
-        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
-            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-        return CTxMemPool::CompareIteratorByHash()(a, b);
-    }
-};
-
-
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -117,8 +102,8 @@ private:
     /** Add transactions based on tx "priority" */
     void addPriorityTxs(std::vector<const CTxMemPoolEntry *> *vtxe);
 
-    /** Add transactions based on feerate including unconfirmed ancestors */
-    void addPackageTxs(std::vector<const CTxMemPoolEntry *> *vtxe, bool fCanonical, bool fAllowDirty);
+    /** Add transactions by merging the feerate-sorted chunks of the mempool's clusters */
+    void addPackageTxs(std::vector<const CTxMemPoolEntry *> *vtxe);
 
     // helper function for addPriorityTxs
     bool IsIncrementallyGood(uint64_t nExtraSize, unsigned int nExtraSigOps);
@@ -137,9 +122,7 @@ private:
     /** Test whether a package, if added to the block, would make the block exceed the sigops limits */
     bool TestPackageSigOps(uint64_t packageSize, unsigned int packageSigOps);
     /** Test if a set of transactions are all final */
-    bool TestPackageFinality(const CTxMemPool::setEntries &package);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries &package, std::vector<CTxMemPool::txiter> &sortedEntries);
+    bool TestPackageFinality(const std::vector<CTxMemPool::txiter> &package);
 };
 
 /** Modify the extranonce in a block */
@@ -28,6 +28,7 @@
 #include "iblt.h"
 #include "primitives/transaction.h"
 #include "requestManager.h"
+#include "txrecon.h"
 #include "ui_interface.h"
 #include "unlimited.h"
 #include "utilstrencodings.h"
@@ -84,6 +85,7 @@ extern bool fReindex;
 extern CTxMemPool mempool;
 extern CTweak<uint64_t> grapheneMinVersionSupported;
 extern CTweak<uint64_t> grapheneMaxVersionSupported;
+extern CTweak<bool> txReconciliation;
 
 bool ShutdownRequested();
 
@@ -589,6 +591,10 @@ void CNode::copyStats(CNodeStats &stats)
     }
     X(fWhitelisted);
     X(fSupportsCompactBlocks);
+    X(fTxReconciliation);
+    X(fTxReconFlood);
+    X(nTxAnnounceBytesSent);
+    X(nTxAnnounceBytesRecv);
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -2547,12 +2553,18 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        if (((GetStopwatchMicros() - lastMempoolSync) > MEMPOOLSYNC_FREQ_US) && vNodesCopy.size() > 0)
+        // After a restart sync as soon as the chain allows it, since our mempool may be far behind
+        bool fCatchUp = fMempoolSyncCatchUp.load();
+        if ((fCatchUp || (GetStopwatchMicros() - lastMempoolSync) > MEMPOOLSYNC_FREQ_US) && vNodesCopy.size() > 0 &&
+            IsChainNearlySyncd())
         {
             // select node from whom to request mempool sync
-            CNode *syncPeer = SelectMempoolSyncPeer(vNodesCopy);
-            if (syncPeer && IsChainNearlySyncd())
+            CNode *syncPeer = SelectMempoolSyncPeer(vNodesCopy, fCatchUp);
+            if (syncPeer)
+            {
                 requester.RequestMempoolSync(syncPeer);
+                fMempoolSyncCatchUp = false;
+            }
         }
 
         for (CNode *pnode : vNodesCopy)
@@ -3001,6 +3013,10 @@ void RelayTransaction(const CTransactionRef ptx, const CTxProperties *txProperti
                 pnode->PushInventory(inv);
             }
         }
+        else if (pnode->fTxReconciliation && !pnode->fTxReconFlood)
+        {
+            pnode->PushTxRecon(inv);
+        }
         else
         {
             pnode->PushInventory(inv);
@@ -3008,6 +3024,18 @@ void RelayTransaction(const CTransactionRef ptx, const CTxProperties *txProperti
     }
 }
 
+void CNode::PushTxRecon(const CInv &inv)
+{
+    LOCK(cs_inventory);
+    if (filterInventoryKnown.contains(inv.hash))
+        return;
+    // A peer that does not keep up with reconciliation gets plain INVs rather than an ever growing set
+    if (vTxReconSet.size() >= TX_RECON_MAX_SET_SIZE)
+        vInventoryToSend.push_back(inv);
+    else
+        vTxReconSet.push_back(inv.hash);
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes) { nTotalBytesRecv.fetch_add(bytes); }
 void CNode::RecordBytesSent(uint64_t bytes)
 {
@@ -3541,6 +3569,7 @@ void CNode::ReadConfigFromExtversion()
     nMempoolSyncMinVersionSupported = extversion.as_u64c(XVer::BU_MEMPOOL_SYNC_MIN_VERSION_SUPPORTED);
     nMempoolSyncMaxVersionSupported = extversion.as_u64c(XVer::BU_MEMPOOL_SYNC_MAX_VERSION_SUPPORTED);
     txConcat = extversion.as_u64c(XVer::BU_TXN_CONCATENATION);
+    fTxReconciliation = txReconciliation.Value() && extversion.as_u64c(XVer::BU_TX_RECONCILIATION) >= TX_RECON_VERSION;
     minGrapheneVersion = extversion.as_u64c(XVer::BU_GRAPHENE_MIN_VERSION_SUPPORTED);
     maxGrapheneVersion = extversion.as_u64c(XVer::BU_GRAPHENE_MAX_VERSION_SUPPORTED);
 
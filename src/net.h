@@ -259,6 +259,12 @@ public:
     std::string addrLocal;
     //! Whether this peer supports CompactBlocks
     bool fSupportsCompactBlocks;
+    //! Whether transactions are announced to this peer by reconciliation, and whether they are also flooded
+    bool fTxReconciliation;
+    bool fTxReconFlood;
+    //! Bytes spent on transaction announcements (tx INVs and reconciliation messages)
+    uint64_t nTxAnnounceBytesSent;
+    uint64_t nTxAnnounceBytesRecv;
 };
 
 
@@ -363,6 +369,10 @@ public:
     std::atomic<uint64_t> nMempoolSyncMaxVersionSupported{0};
     /** Tx concatenation supported (set by xversion) */
     std::atomic<bool> txConcat{false};
+    /** Are transactions announced to this node by set reconciliation (see txrecon.h) */
+    std::atomic<bool> fTxReconciliation{false};
+    /** Are transactions still flooded to this reconciling node, to keep propagation latency low */
+    std::atomic<bool> fTxReconFlood{false};
     /** set to true if this node support xVersion */
     /** set to true if this node support extversion */
     std::atomic<bool> extversionEnabled{false};
@@ -547,6 +557,8 @@ public:
     CRollingFastFilter<4 * 1024 * 1024> filterInventoryKnown;
     CCriticalSection cs_inventory;
     std::vector<CInv> vInventoryToSend GUARDED_BY(cs_inventory);
+    // transactions held back for the next reconciliation round instead of being announced by INV
+    std::vector<uint256> vTxReconSet GUARDED_BY(cs_inventory);
     int64_t nNextInvSend;
     // Used for headers announcements - unfiltered blocks to relay
     // Also protected by cs_inventory
@@ -571,6 +583,9 @@ public:
     CStatHistory<unsigned int> bytesSent;
     // track the number of bytes received from this node
     CStatHistory<unsigned int> bytesReceived;
+    // track the bytes spent announcing transactions to and from this node, as tx INVs or reconciliation messages
+    std::atomic<uint64_t> nTxAnnounceBytesSent{0};
+    std::atomic<uint64_t> nTxAnnounceBytesRecv{0};
     // track the average round trip latency for transaction requests to this node
     CStatHistory<unsigned int> txReqLatency;
     // track the # of times this node is the first to send us a transaction INV
@@ -751,6 +766,13 @@ public:
         vInventoryToSend.push_back(inv);
     }
 
+    /**
+     * Hold a transaction back for the next reconciliation round with this node instead of announcing it by INV
+     *
+     * @param[in] inv reference to the transaction INV object
+     */
+    void PushTxRecon(const CInv &inv);
+
     /** Get size of INVs to be sent in a thread safe way*/
     unsigned int GetInventoryToSendSize()
     {
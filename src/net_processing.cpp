@@ -15,6 +15,7 @@
 #include "blockrelay/graphene.h"
 #include "blockrelay/mempool_sync.h"
 #include "blockrelay/thinblock.h"
+#include "blockstorage/blockserving.h"
 #include "blockstorage/blockstorage.h"
 #include "chain.h"
 #include "dosman.h"
@@ -27,6 +28,7 @@
 #include "requestManager.h"
 #include "timedata.h"
 #include "txadmission.h"
+#include "txrecon.h"
 #include "validation/validation.h"
 #include "validationinterface.h"
 #include "version.h"
@@ -41,9 +43,11 @@ extern CTweak<uint64_t> grapheneFastFilterCompatibility;
 extern CTweak<uint64_t> mempoolSyncMinVersionSupported;
 extern CTweak<uint64_t> mempoolSyncMaxVersionSupported;
 extern CTweak<uint64_t> syncMempoolWithPeers;
+extern CTweak<bool> txReconciliation;
 extern CTweak<uint32_t> randomlyDontInv;
 extern CTweak<uint32_t> doubleSpendProofs;
 extern CTweak<bool> extVersionEnabled;
+extern CTweak<unsigned int> blockReadAhead;
 
 /** How many inbound connections will we track before pruning entries */
 const uint32_t MAX_INBOUND_CONNECTIONS_TRACKED = 10000;
@@ -86,6 +90,42 @@ bool PeerHasHeader(const CNodeState *state, CBlockIndex *pindex)
     return false;
 }
 
+/**
+ * Read ahead the blocks among the next few that pfrom asks for that ProcessGetData() would serve without looking at
+ * them closer: blocks of the active chain that we have, and are neither historical while the outbound target is
+ * reached nor below the NODE_NETWORK_LIMITED threshold.
+ */
+static void ReadAheadForPeer(CNode *pfrom, std::deque<CInv>::const_iterator begin, std::deque<CInv>::const_iterator end)
+{
+    static const int nOneWeek = 7 * 24 * 60 * 60;
+    const unsigned int nWindow = blockReadAhead.Value();
+    std::deque<CInv> vServable;
+    {
+        LOCK(cs_main);
+        const bool fTargetReached = !pfrom->fWhitelisted && CNode::OutboundTargetReached(true);
+        const bool fLimited = !pfrom->fWhitelisted &&
+                              (nLocalServices & (NODE_NETWORK_LIMITED | NODE_NETWORK)) == NODE_NETWORK_LIMITED;
+        const CBlockIndex *pindexBest = pindexBestHeader;
+        unsigned int nBlocksSeen = 0;
+        for (auto it = begin; it != end && nBlocksSeen < nWindow; ++it)
+        {
+            if (it->type != MSG_BLOCK && it->type != MSG_FILTERED_BLOCK && it->type != MSG_CMPCT_BLOCK)
+                continue;
+            nBlocksSeen++;
+            const CBlockIndex *pindex = LookupBlockIndex(it->hash);
+            if (!pindex || !chainActive.Contains(pindex) || !(pindex->nStatus & BLOCK_HAVE_DATA))
+                continue;
+            if (fTargetReached && (it->type == MSG_FILTERED_BLOCK ||
+                                      (pindexBest && pindexBest->GetBlockTime() - pindex->GetBlockTime() > nOneWeek)))
+                continue;
+            if (fLimited && chainActive.Tip()->nHeight - pindex->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2)
+                continue;
+            vServable.push_back(*it);
+        }
+    }
+    blockServer.ReadAhead(vServable.begin(), vServable.end());
+}
+
 void static ProcessGetData(CNode *pfrom, const Consensus::Params &consensusParams, std::deque<CInv> &vInv)
 {
     std::vector<CInv> vNotFound;
@@ -187,9 +227,15 @@ void static ProcessGetData(CNode *pfrom, const Consensus::Params &consensusParam
                 // it's available before trying to send.
                 if (fSend && mi->nStatus & BLOCK_HAVE_DATA)
                 {
-                    // Send block from disk
+                    // have the blocks this peer asks for next read in while we serve this one
+                    ReadAheadForPeer(pfrom, it, vInv.end());
+
+                    // Send block from disk.  Full blocks in finalized block files are sent straight out of the
+                    // mapped file without being deserialized.
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, mi, consensusParams))
+                    CRawBlock rawBlock;
+                    bool fRaw = false;
+                    if (!blockServer.ReadBlock(mi, inv.type == MSG_BLOCK, rawBlock, block, fRaw, consensusParams))
                     {
                         // its possible that I know about it but haven't stored it yet
                         LOG(THIN, "unable to load block %s from disk\n",
@@ -201,7 +247,10 @@ void static ProcessGetData(CNode *pfrom, const Consensus::Params &consensusParam
                         if (inv.type == MSG_BLOCK)
                         {
                             pfrom->blocksSent += 1;
-                            pfrom->PushMessage(NetMsgType::BLOCK, block);
+                            if (fRaw)
+                                pfrom->PushMessage(NetMsgType::BLOCK, rawBlock);
+                            else
+                                pfrom->PushMessage(NetMsgType::BLOCK, block);
                         }
                         else if (inv.type == MSG_CMPCT_BLOCK)
                         {
@@ -565,6 +614,7 @@ bool ProcessMessage(CNode *pfrom, std::string strCommand, CDataStream &vRecv, in
             xver.set_u64c(XVer::BU_MEMPOOL_DESCENDANT_COUNT_LIMIT, nLimitDescendants);
             xver.set_u64c(XVer::BU_MEMPOOL_DESCENDANT_SIZE_LIMIT, nLimitDescendantSize);
             xver.set_u64c(XVer::BU_TXN_CONCATENATION, 1);
+            xver.set_u64c(XVer::BU_TX_RECONCILIATION, txReconciliation.Value() ? TX_RECON_VERSION : 0);
 
             electrum::set_extversion_flags(xver, chainparams.NetworkIDString());
 
@@ -634,6 +684,7 @@ bool ProcessMessage(CNode *pfrom, std::string strCommand, CDataStream &vRecv, in
         }
 
         pfrom->ReadConfigFromExtversion();
+        InitTxReconciliation(pfrom);
 
         pfrom->PushMessage(NetMsgType::VERACK);
     }
@@ -968,6 +1019,7 @@ bool ProcessMessage(CNode *pfrom, std::string strCommand, CDataStream &vRecv, in
             }
             else if (inv.type == MSG_TX)
             {
+                pfrom->nTxAnnounceBytesRecv += ::GetSerializeSize(inv, SER_NETWORK, PROTOCOL_VERSION);
                 bool fAlreadyHaveTx = TxAlreadyHave(inv);
                 // LOG(NET, "got inv: %s  %d peer=%s\n", inv.ToString(), fAlreadyHaveTx ? "have" : "new",
                 // pfrom->GetLogName());
@@ -1753,11 +1805,38 @@ bool ProcessMessage(CNode *pfrom, std::string strCommand, CDataStream &vRecv, in
         return CRequestMempoolSyncTx::HandleMessage(vRecv, pfrom);
     }
 
+    // Rateless mempool synchronization request for more symbols
+    else if (strCommand == NetMsgType::GET_MEMPOOLSYNCSYM)
+    {
+        return CRequestMempoolSyncSymbols::HandleMessage(vRecv, pfrom);
+    }
+
     else if (strCommand == NetMsgType::MEMPOOLSYNCTX)
     {
         return CMempoolSyncTx::HandleMessage(vRecv, pfrom);
     }
 
+    // Transaction announcement reconciliation
+    else if (strCommand == NetMsgType::REQRECON)
+    {
+        return CTxReconRequest::HandleMessage(vRecv, pfrom);
+    }
+
+    else if (strCommand == NetMsgType::RECONSKETCH)
+    {
+        return CTxReconSketch::HandleMessage(vRecv, pfrom);
+    }
+
+    else if (strCommand == NetMsgType::REQRECONSYM)
+    {
+        return CTxReconSymbolRequest::HandleMessage(vRecv, pfrom);
+    }
+
+    else if (strCommand == NetMsgType::RECONDIFF)
+    {
+        return CTxReconDiff::HandleMessage(vRecv, pfrom);
+    }
+
 
     // Handle full blocks
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
@@ -2718,6 +2797,9 @@ bool SendMessages(CNode *pto)
             }
         }
 
+        // Transactions held back for reconciliation
+        SendTxReconMessages(pto);
+
         //
         // Message: inventory
         //
@@ -2737,6 +2819,7 @@ bool SendMessages(CNode *pto)
                 // Send message INV up to the MAX_INV_TO_SEND. Once we reach the max then send the INV message
                 // and if there is any remaining it will be sent on the next iteration until vInventoryToSend is empty.
                 int nToErase = 0;
+                uint64_t nTxInvs = 0;
                 {
                     // BU - here we only want to forward message inventory if our peer has actually been requesting
                     // useful data or giving us useful data.  We give them 2 minutes to be useful but then choke off
@@ -2764,6 +2847,7 @@ bool SendMessages(CNode *pto)
                             // skip if we already know about this one
                             if (pto->filterInventoryKnown.contains(inv.hash))
                                 continue;
+                            nTxInvs++;
                         }
                         vInvSend.push_back(inv);
                         pto->filterInventoryKnown.insert(inv.hash);
@@ -2791,6 +2875,7 @@ bool SendMessages(CNode *pto)
                     if (!vInvSend.empty())
                     {
                         pto->PushMessage(NetMsgType::INV, vInvSend);
+                        pto->nTxAnnounceBytesSent += nTxInvs * ::GetSerializeSize(CInv(), SER_NETWORK, PROTOCOL_VERSION);
                         vInvSend.clear();
                     }
                 }
@@ -11,6 +11,7 @@
 #include "chainparams.h"
 #include "dosman.h"
 #include "net.h"
+#include "pipelinetrace.h"
 #include "pow.h"
 #include "requestManager.h"
 #include "script/sigcache.h"
@@ -496,6 +497,7 @@ void CParallelValidation::HandleBlockMessage(CNode *pfrom, const string &strComm
     // Indicate that the block was received and is about to be processed. Setting the processing flag
     // prevents us from re-requesting the block during the time it is being processed.
     requester.ProcessingBlock(pblock->GetHash(), pfrom);
+    pipelineTrace.RecordSinceStart(PIPELINE_BLOCK_RECEIVE, pblock->GetHash());
 
     // NOTE: You must not have a cs_main lock before you aquire the semaphore grant or you can end up deadlocking
     AssertLockNotHeld(cs_main);
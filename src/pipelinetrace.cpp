@@ -0,0 +1,207 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pipelinetrace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+const unsigned int CLatencyHistogram::SUB_BUCKET_BITS;
+const unsigned int CLatencyHistogram::SUB_BUCKETS;
+const unsigned int CLatencyHistogram::BUCKETS;
+const size_t CPipelineTrace::RING_SIZE;
+const size_t CPipelineTrace::START_SLOTS;
+
+CPipelineTrace pipelineTrace;
+
+const char *PipelineStageName(PipelineStage stage)
+{
+    switch (stage)
+    {
+    case PIPELINE_BLOCK_RECEIVE:
+        return "block_receive";
+    case PIPELINE_BLOCK_RECONSTRUCT:
+        return "block_reconstruct";
+    case PIPELINE_BLOCK_CHECK:
+        return "block_check";
+    case PIPELINE_BLOCK_PREFETCH:
+        return "block_prefetch";
+    case PIPELINE_BLOCK_CONNECT:
+        return "block_connect";
+    case PIPELINE_BLOCK_FLUSH:
+        return "block_flush";
+    case PIPELINE_BLOCK_RELAY:
+        return "block_relay";
+    case PIPELINE_TX_VALIDATE:
+        return "tx_validate";
+    case PIPELINE_TX_RELAY:
+        return "tx_relay";
+    case PIPELINE_STAGES:
+        break;
+    }
+    return "unknown";
+}
+
+bool IsBlockPipelineStage(PipelineStage stage) { return stage <= PIPELINE_BLOCK_RELAY; }
+
+unsigned int CLatencyHistogram::BucketIndex(uint64_t nValue)
+{
+    if (nValue < 2 * SUB_BUCKETS)
+        return nValue;
+    // shift the value so its top SUB_BUCKET_BITS + 1 bits are left, the top one is always set
+    const unsigned int nMsb = 63 - __builtin_clzll(nValue);
+    const unsigned int nShift = nMsb - SUB_BUCKET_BITS;
+    return 2 * SUB_BUCKETS + (nShift - 1) * SUB_BUCKETS + ((nValue >> nShift) - SUB_BUCKETS);
+}
+
+uint64_t CLatencyHistogram::BucketHighest(unsigned int nIndex)
+{
+    if (nIndex < 2 * SUB_BUCKETS)
+        return nIndex;
+    const unsigned int nShift = (nIndex - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+    const uint64_t nSub = (nIndex - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+    return (nSub << nShift) + ((uint64_t(1) << nShift) - 1);
+}
+
+void CLatencyHistogram::Add(uint64_t nMicros)
+{
+    vBuckets[BucketIndex(nMicros)].fetch_add(1, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nMicros, std::memory_order_relaxed);
+    uint64_t nPrev = nMax.load(std::memory_order_relaxed);
+    while (nMicros > nPrev && !nMax.compare_exchange_weak(nPrev, nMicros, std::memory_order_relaxed))
+    {
+    }
+}
+
+void CLatencyHistogram::Clear()
+{
+    for (std::atomic<uint64_t> &bucket : vBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+    nCount.store(0, std::memory_order_relaxed);
+    nSum.store(0, std::memory_order_relaxed);
+    nMax.store(0, std::memory_order_relaxed);
+}
+
+uint64_t CLatencyHistogram::Percentile(double dPercent) const
+{
+    // the buckets are summed up again rather than trusting nCount, which may be a little ahead of them
+    uint64_t nTotal = 0;
+    for (const std::atomic<uint64_t> &bucket : vBuckets)
+        nTotal += bucket.load(std::memory_order_relaxed);
+    if (nTotal == 0)
+        return 0;
+
+    const double dClamped = std::min(std::max(dPercent, 0.0), 100.0);
+    const uint64_t nRank = std::max<uint64_t>(1, (uint64_t)std::ceil(dClamped / 100.0 * nTotal));
+    uint64_t nSeen = 0;
+    for (unsigned int i = 0; i < BUCKETS; i++)
+    {
+        nSeen += vBuckets[i].load(std::memory_order_relaxed);
+        if (nSeen >= nRank)
+            return std::min(BucketHighest(i), Max());
+    }
+    return Max();
+}
+
+/** Small per-thread number for the trace, so events of one thread line up in a trace viewer */
+static uint32_t PipelineThreadId()
+{
+    static std::atomic<uint32_t> nNextThread{1};
+    thread_local uint32_t nThread = nNextThread.fetch_add(1, std::memory_order_relaxed);
+    return nThread;
+}
+
+CPipelineTrace::CPipelineTrace() : nNext(0), vRing(RING_SIZE), vStarts(START_SLOTS) { Clear(); }
+
+void CPipelineTrace::Record(PipelineStage stage, const uint256 &hash, uint64_t nStartNanos, uint64_t nEndNanos)
+{
+    const uint64_t nDuration = (nEndNanos > nStartNanos) ? nEndNanos - nStartNanos : 0;
+    vHistograms[stage].Add(nDuration / 1000);
+
+    const uint64_t nIndex = nNext.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = vRing[nIndex % RING_SIZE];
+    slot.nSeq.store(2 * nIndex + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t vHash[4];
+    memcpy(vHash, hash.begin(), sizeof(vHash));
+    for (unsigned int i = 0; i < 4; i++)
+        slot.vHash[i].store(vHash[i], std::memory_order_relaxed);
+    slot.nStart.store(nStartNanos, std::memory_order_relaxed);
+    slot.nDuration.store(nDuration, std::memory_order_relaxed);
+    slot.nStage.store(stage, std::memory_order_relaxed);
+    slot.nThread.store(PipelineThreadId(), std::memory_order_relaxed);
+    slot.nSeq.store(2 * nIndex + 2, std::memory_order_release);
+}
+
+void CPipelineTrace::Start(const uint256 &hash)
+{
+    const uint64_t nKey = hash.GetCheapHash();
+    StartSlot &slot = vStarts[nKey % START_SLOTS];
+    if (slot.nKey.load(std::memory_order_relaxed) == nKey)
+        return;
+    // the start is stored first, so a reader that sees the new key at worst reads a start that is too recent
+    slot.nStart.store(GetStopwatch(), std::memory_order_relaxed);
+    slot.nKey.store(nKey, std::memory_order_release);
+}
+
+void CPipelineTrace::RecordSinceStart(PipelineStage stage, const uint256 &hash)
+{
+    const uint64_t nKey = hash.GetCheapHash();
+    StartSlot &slot = vStarts[nKey % START_SLOTS];
+    if (slot.nKey.load(std::memory_order_acquire) != nKey)
+    {
+        Start(hash);
+        return;
+    }
+    Record(stage, hash, slot.nStart.load(std::memory_order_relaxed), GetStopwatch());
+}
+
+std::vector<CPipelineEvent> CPipelineTrace::GetEvents(const uint256 *phash) const
+{
+    std::vector<CPipelineEvent> vEvents;
+    const uint64_t nEnd = nNext.load(std::memory_order_acquire);
+    const uint64_t nBegin = (nEnd > RING_SIZE) ? nEnd - RING_SIZE : 0;
+    for (uint64_t nIndex = nBegin; nIndex < nEnd; nIndex++)
+    {
+        const Slot &slot = vRing[nIndex % RING_SIZE];
+        const uint64_t nSeq = slot.nSeq.load(std::memory_order_acquire);
+        if (nSeq != 2 * nIndex + 2)
+            continue; // still being written, or already overwritten
+
+        uint64_t vHash[4];
+        for (unsigned int i = 0; i < 4; i++)
+            vHash[i] = slot.vHash[i].load(std::memory_order_relaxed);
+        CPipelineEvent event;
+        memcpy(event.hash.begin(), vHash, sizeof(vHash));
+        event.stage = (PipelineStage)slot.nStage.load(std::memory_order_relaxed);
+        event.nThread = slot.nThread.load(std::memory_order_relaxed);
+        event.nStartNanos = slot.nStart.load(std::memory_order_relaxed);
+        event.nDurationNanos = slot.nDuration.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.nSeq.load(std::memory_order_relaxed) != nSeq)
+            continue; // overwritten while we copied it
+        if (phash && event.hash != *phash)
+            continue;
+        vEvents.push_back(event);
+    }
+    return vEvents;
+}
+
+void CPipelineTrace::Clear()
+{
+    for (CLatencyHistogram &histogram : vHistograms)
+        histogram.Clear();
+    for (Slot &slot : vRing)
+        slot.nSeq.store(0, std::memory_order_relaxed);
+    for (StartSlot &slot : vStarts)
+    {
+        slot.nKey.store(0, std::memory_order_relaxed);
+        slot.nStart.store(0, std::memory_order_relaxed);
+    }
+    nNext.store(0, std::memory_order_release);
+}
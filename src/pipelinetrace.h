@@ -0,0 +1,147 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PIPELINETRACE_H
+#define BITCOIN_PIPELINETRACE_H
+
+#include "uint256.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+/** The stages a block or a transaction goes through between reaching us and being relayed */
+enum PipelineStage
+{
+    PIPELINE_BLOCK_RECEIVE = 0, //!< from its header until the whole block is handed to validation
+    PIPELINE_BLOCK_RECONSTRUCT, //!< rebuilding a thin, compact or graphene block from the mempool
+    PIPELINE_BLOCK_CHECK, //!< CheckBlock
+    PIPELINE_BLOCK_PREFETCH, //!< reading the spent outputs ahead of connecting the block
+    PIPELINE_BLOCK_CONNECT, //!< ConnectBlock
+    PIPELINE_BLOCK_FLUSH, //!< writing the block's coins to the tip's cache
+    PIPELINE_BLOCK_RELAY, //!< from its header until it is announced to our peers
+    PIPELINE_TX_VALIDATE, //!< ParallelAcceptToMemoryPool
+    PIPELINE_TX_RELAY, //!< from being received until it is relayed
+    PIPELINE_STAGES
+};
+
+const char *PipelineStageName(PipelineStage stage);
+/** Whether the stage belongs to a block rather than a transaction */
+bool IsBlockPipelineStage(PipelineStage stage);
+
+/**
+ * Histogram of latencies in microseconds with a fixed relative precision, in the style of HdrHistogram.  Values
+ * below 32us have a bucket each, above that every power of two is split into 16 buckets, so any percentile is
+ * reported within 1/16 of the real value.  Buckets are plain atomic counters, so recording never takes a lock.
+ */
+class CLatencyHistogram
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 4;
+    static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const unsigned int BUCKETS = 2 * SUB_BUCKETS + (64 - SUB_BUCKET_BITS - 1) * SUB_BUCKETS;
+
+    CLatencyHistogram() { Clear(); }
+    void Add(uint64_t nMicros);
+    void Clear();
+
+    uint64_t Count() const { return nCount.load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return nSum.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return nMax.load(std::memory_order_relaxed); }
+    /** The value that dPercent percent of the recorded values are at or below, 0 if nothing was recorded */
+    uint64_t Percentile(double dPercent) const;
+
+    static unsigned int BucketIndex(uint64_t nValue);
+    /** The largest value that falls into bucket nIndex */
+    static uint64_t BucketHighest(unsigned int nIndex);
+
+private:
+    std::atomic<uint64_t> vBuckets[BUCKETS];
+    std::atomic<uint64_t> nCount;
+    std::atomic<uint64_t> nSum;
+    std::atomic<uint64_t> nMax;
+};
+
+/** One stage of one block or transaction, as recorded in the trace */
+struct CPipelineEvent
+{
+    uint256 hash;
+    PipelineStage stage;
+    uint32_t nThread; //!< small number identifying the thread that recorded it
+    uint64_t nStartNanos; //!< GetStopwatch() time
+    uint64_t nDurationNanos;
+};
+
+/**
+ * Always-on tracing of where the time goes while blocks and transactions move through the node.
+ *
+ * Every stage is added to a per-stage latency histogram and written to a ring buffer of the most recent events.
+ * Writers claim a slot with a single fetch_add and publish it with a sequence number, so they never wait for each
+ * other or for a reader; readers skip slots that are being rewritten while they copy them.  Stages that span
+ * several messages (receive, relay) are measured from the time the block's header or the transaction reached us,
+ * which is remembered in a small table indexed by hash that later hashes simply overwrite.
+ */
+class CPipelineTrace
+{
+public:
+    static const size_t RING_SIZE = 1 << 14;
+    static const size_t START_SLOTS = 1 << 10;
+
+    CPipelineTrace();
+
+    /** Record that hash spent [nStartNanos, nEndNanos) in stage */
+    void Record(PipelineStage stage, const uint256 &hash, uint64_t nStartNanos, uint64_t nEndNanos);
+    /** Remember now as the time hash reached us, unless it is already remembered */
+    void Start(const uint256 &hash);
+    /** Record stage as the time from hash's Start until now.  If hash has no start it starts now instead. */
+    void RecordSinceStart(PipelineStage stage, const uint256 &hash);
+
+    /** The most recent events, oldest first, optionally only those of hash */
+    std::vector<CPipelineEvent> GetEvents(const uint256 *phash = nullptr) const;
+    const CLatencyHistogram &Histogram(PipelineStage stage) const { return vHistograms[stage]; }
+    /** Forget all events and histograms */
+    void Clear();
+
+private:
+    struct Slot
+    {
+        //! 2 * index + 1 while index is being written, 2 * index + 2 once it is complete
+        std::atomic<uint64_t> nSeq;
+        std::atomic<uint64_t> vHash[4];
+        std::atomic<uint64_t> nStart;
+        std::atomic<uint64_t> nDuration;
+        std::atomic<uint32_t> nStage;
+        std::atomic<uint32_t> nThread;
+    };
+    struct StartSlot
+    {
+        std::atomic<uint64_t> nKey;
+        std::atomic<uint64_t> nStart;
+    };
+
+    std::atomic<uint64_t> nNext;
+    std::vector<Slot> vRing;
+    std::vector<StartSlot> vStarts;
+    CLatencyHistogram vHistograms[PIPELINE_STAGES];
+};
+extern CPipelineTrace pipelineTrace;
+
+/** Records the lifetime of the object as a stage of hash */
+class CPipelineTimer
+{
+public:
+    CPipelineTimer(PipelineStage stageIn, const uint256 &hashIn)
+        : stage(stageIn), hash(hashIn), nStart(GetStopwatch())
+    {
+    }
+    ~CPipelineTimer() { pipelineTrace.Record(stage, hash, nStart, GetStopwatch()); }
+
+private:
+    const PipelineStage stage;
+    const uint256 hash;
+    const uint64_t nStart;
+};
+
+#endif // BITCOIN_PIPELINETRACE_H
@@ -16,9 +16,15 @@
 #include "util.h"
 #include "utilmoneystr.h"
 
+#include <algorithm>
+
+
+// Rebase the moving averages once the epoch scale gets this large, which with the default decay happens
+// roughly every 170000 blocks
+static const double MAX_EPOCH_SCALE = 1e150;
 
 void TxConfirmStats::Initialize(std::vector<double> &defaultBuckets,
-    unsigned int maxConfirms,
+    unsigned int _maxConfirms,
     double _decay,
     std::string _dataTypeString)
 {
@@ -27,41 +33,53 @@ void TxConfirmStats::Initialize(std::vector<double> &defaultBuckets,
         throw std::runtime_error("Decay must be between 0 and 1 (non-inclusive)");
     }
     decay = _decay;
+    scale = 1;
     dataTypeString = _dataTypeString;
-    for (unsigned int i = 0; i < defaultBuckets.size(); i++)
-    {
-        buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
-    }
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++)
+    buckets = defaultBuckets;
+    maxConfirms = _maxConfirms;
+
+    confAvg.assign(buckets.size() * maxConfirms, 0);
+    unconfTxs.assign(buckets.size() * maxConfirms, 0);
+    oldUnconfTxs.assign(buckets.size(), 0);
+    txCtAvg.assign(buckets.size(), 0);
+    avg.assign(buckets.size(), 0);
+}
+
+unsigned int TxConfirmStats::BucketIndex(double val) const
+{
+    // the last bucket is INF_FEERATE so every value finds one
+    auto it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    if (it == buckets.end())
+        --it;
+    return it - buckets.begin();
+}
+
+void TxConfirmStats::Rebase()
+{
+    for (double &val : confAvg)
+        val /= scale;
+    for (unsigned int j = 0; j < buckets.size(); j++)
     {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
+        avg[j] /= scale;
+        txCtAvg[j] /= scale;
     }
-
-    oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
-    txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-    avg.resize(buckets.size());
+    scale = 1;
 }
 
-// Zero out the data for the current block
-void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+void TxConfirmStats::NewBlock(unsigned int nBlockHeight)
 {
+    // Transactions that entered the mempool maxConfirms blocks ago are now old
+    int *unconf = &unconfTxs[(nBlockHeight % maxConfirms) * buckets.size()];
     for (unsigned int j = 0; j < buckets.size(); j++)
     {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight % unconfTxs.size()][j];
-        unconfTxs[nBlockHeight % unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
+        oldUnconfTxs[j] += unconf[j];
+        unconf[j] = 0;
     }
+
+    // Decaying the averages of all the previous blocks is the same as giving this block more weight
+    scale /= decay;
+    if (scale > MAX_EPOCH_SCALE)
+        Rebase();
 }
 
 
@@ -70,132 +88,160 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++)
-    {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
+    unsigned int bucketindex = BucketIndex(val);
+    if ((unsigned int)blocksToConfirm <= maxConfirms)
+        confAvg[bucketindex * maxConfirms + blocksToConfirm - 1] += scale;
+    txCtAvg[bucketindex] += scale;
+    avg[bucketindex] += val * scale;
 }
 
-void TxConfirmStats::UpdateMovingAverages()
+// returns -1 on error conditions
+CAmount TxConfirmStats::EstimateMedianVal(int confTarget,
+    double sufficientTxVal,
+    double successBreakPoint,
+    unsigned int nBlockHeight) const
 {
-    for (unsigned int j = 0; j < buckets.size(); j++)
-    {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-        {
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        }
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = (txCtAvg[j] * decay) + curBlockTxCt[j];
-    }
+    return EstimateMedianVals(std::vector<int>(1, confTarget), sufficientTxVal, successBreakPoint, nBlockHeight)[0];
 }
 
-// returns -1 on error conditions
-CAmount TxConfirmStats::EstimateMedianVal(int confTarget,
+std::vector<CAmount> TxConfirmStats::EstimateMedianVals(const std::vector<int> &confTargets,
     double sufficientTxVal,
     double successBreakPoint,
-    unsigned int nBlockHeight)
+    unsigned int nBlockHeight) const
 {
     // bucket calculations are doubles, but the minTxFee is an CAmount, this loss of precision is
     // intentional and ok as it will only cut off fractions of a satoshi
     CAmount minTxFee = minRelayTxFee.GetFeePerK(); // sats per 1000 bytes
 
-    // Counters for a bucket (or range of buckets)
-    double nConf = 0; // Number of tx's confirmed within the confTarget
-    double totalNum = 0; // Total number of tx's that were ever confirmed
-    int32_t extraNum = 0; // Number of tx's still in mempool for confTarget or longer
+    // Counters for a bucket (or range of buckets), one set per target
+    struct Range
+    {
+        double nConf = 0; // Number of tx's confirmed within the confTarget
+        double totalNum = 0; // Total number of tx's that were ever confirmed
+        int32_t extraNum = 0; // Number of tx's still in mempool for confTarget or longer
+        int32_t selectedBucket = -1;
+    };
+    std::vector<Range> ranges(confTargets.size());
+    size_t nUnselected = confTargets.size();
+
+    // The stored averages carry the epoch scale
+    double norm = 1 / scale;
+    double sufficientNum = sufficientTxVal / (1 - decay);
 
     int32_t maxbucketindex = buckets.size() - 1;
 
-    // We want a sub-vector of buckets to be our range from which we select a bucket for our fee
-    // so instead of copying each bucket into a new vector we can simulate a sub-vector that is
-    // between bucketFront and bucketBack (naming from std::vector.front and std::vector.back)
-    int32_t selectedBucket = -1;
-
-    uint32_t bins = unconfTxs.size();
+    // Cumulative counts of the current bucket by confirmation target
+    std::vector<double> confWithin(maxConfirms + 1, 0);
+    std::vector<int32_t> unconfSince(maxConfirms + 1, 0);
 
     // Start counting from highest fee transactions
-    for (int32_t bucket = maxbucketindex; bucket >= 0 && bucket <= maxbucketindex; bucket = bucket - 1)
+    for (int32_t bucket = maxbucketindex; bucket >= 0 && nUnselected > 0; bucket--)
     {
-        // add the moving average number of confirmed tx's for the conf target in bucket
-        nConf += confAvg[confTarget - 1][bucket];
-        // add the moving average number of transactions in bucket to the total number of transactions
-        totalNum += txCtAvg[bucket];
-        for (uint32_t confct = confTarget; confct < GetMaxConfirms(); confct++)
-        {
-            // add number of unconfirmed transactions for a conf target in the given bucket (less than MAX_CONFIRMS)
-            extraNum += unconfTxs[(nBlockHeight - confct) % bins][bucket];
-        }
-        // add num txs still unconfirmed after MAX_CONFIRMS in the given bucket
-        extraNum += oldUnconfTxs[bucket];
-
-        // if we have no pending confirmations for this bucket we can continue, we do this because the decay rate
-        // can skew the data for a bucket making it seem like the bucket has a lower than 100%
-        // confirmation rate when in reality the bucket has had no pending transactions in it for a while
-        if (extraNum == 0)
-        {
-            continue;
-        }
-
-        // check for enough data points
-        if (totalNum >= sufficientTxVal / (1 - decay))
+        // number of tx's confirmed within Y blocks and of tx's unconfirmed for Y blocks or longer
+        const double *conf = &confAvg[bucket * maxConfirms];
+        for (unsigned int y = 1; y <= maxConfirms; y++)
+            confWithin[y] = confWithin[y - 1] + conf[y - 1] * norm;
+        unconfSince[maxConfirms] = oldUnconfTxs[bucket];
+        for (unsigned int confct = maxConfirms - 1; confct >= 1; confct--)
+            unconfSince[confct] =
+                unconfSince[confct + 1] + unconfTxs[((nBlockHeight - confct) % maxConfirms) * buckets.size() + bucket];
+        double txCt = txCtAvg[bucket] * norm;
+
+        for (size_t i = 0; i < confTargets.size(); i++)
         {
-            // find the rate at which transactions in this bucket are being confirmed
-            double curPct = nConf / (totalNum + extraNum);
-            if (curPct < successBreakPoint)
+            Range &range = ranges[i];
+            if (range.selectedBucket != -1)
+                continue;
+            int confTarget = confTargets[i];
+
+            // add the moving average number of confirmed tx's for the conf target in bucket
+            range.nConf += confWithin[confTarget];
+            // add the moving average number of transactions in bucket to the total number of transactions
+            range.totalNum += txCt;
+            // add number of unconfirmed transactions for the conf target or longer in the given bucket
+            range.extraNum += unconfSince[confTarget];
+
+            // if we have no pending confirmations for this bucket we can continue, we do this because the decay
+            // rate can skew the data for a bucket making it seem like the bucket has a lower than 100%
+            // confirmation rate when in reality the bucket has had no pending transactions in it for a while
+            if (range.extraNum == 0)
+                continue;
+
+            // check for enough data points
+            if (range.totalNum >= sufficientNum)
             {
-                selectedBucket = bucket;
-                break;
+                // find the rate at which transactions in this bucket are being confirmed
+                double curPct = range.nConf / (range.totalNum + range.extraNum);
+                if (curPct < successBreakPoint)
+                {
+                    range.selectedBucket = bucket;
+                    nUnselected--;
+                    continue;
+                }
+                range.nConf = 0;
+                range.totalNum = 0;
+                range.extraNum = 0;
             }
-            nConf = 0;
-            totalNum = 0;
-            extraNum = 0;
         }
     }
-    // if our confirm rate for any bucket is never less than 80% selectedBucket will
-    // be -1 at the end of the loop.
-    // so we return mintxfee
-    if (selectedBucket <= 0)
+
+    std::vector<CAmount> vMedians(confTargets.size(), minTxFee);
+    for (size_t i = 0; i < confTargets.size(); i++)
     {
-        return minTxFee;
-    }
+        const Range &range = ranges[i];
 
-    CAmount median = -1;
+        // if our confirm rate for any bucket is never less than 80% selectedBucket will
+        // be -1 at the end of the loop.
+        // so we return mintxfee
+        if (range.selectedBucket <= 0)
+            continue;
 
-    // check if the historical moving average of txs in this bucket is 0
-    if (txCtAvg[selectedBucket] != 0)
-    {
-        // if it is not, we are in the right bucket
-        median = avg[selectedBucket] / txCtAvg[selectedBucket];
-    }
-    else
-    {
-        return minTxFee;
-    }
-    // if we didnt error but somehow got a value less than the mintxfee return the mintxfee
-    if (median > 0 && median < minTxFee)
-    {
-        median = minTxFee;
-    }
+        // check if the historical moving average of txs in this bucket is 0
+        if (txCtAvg[range.selectedBucket] == 0)
+            continue;
 
-    LOG(ESTIMATEFEE, "%3d: For conf success > %4.2f need >: %12.5g from bucket %8g  Cur Bucket "
-                     "stats %6.2f%%  %8.1f/(%.1f+%d mempool)\n",
-        confTarget, successBreakPoint, median, buckets[selectedBucket], 100 * nConf / (totalNum + extraNum), nConf,
-        totalNum, extraNum);
+        // if it is not, we are in the right bucket
+        CAmount median = avg[range.selectedBucket] / txCtAvg[range.selectedBucket];
+        // if we didnt error but somehow got a value less than the mintxfee return the mintxfee
+        if (median > 0 && median < minTxFee)
+        {
+            median = minTxFee;
+        }
+        vMedians[i] = median;
 
+        LOG(ESTIMATEFEE, "%3d: For conf success > %4.2f need >: %12.5g from bucket %8g  Cur Bucket "
+                         "stats %6.2f%%  %8.1f/(%.1f+%d mempool)\n",
+            confTargets[i], successBreakPoint, median, buckets[range.selectedBucket],
+            100 * range.nConf / (range.totalNum + range.extraNum), range.nConf, range.totalNum, range.extraNum);
+    }
 
-    return median;
+    return vMedians;
 }
 
-void TxConfirmStats::Write(CAutoFile &fileout)
+void TxConfirmStats::Write(CAutoFile &fileout) const
 {
+    // The file holds the actual moving averages, with the confirmation counts cumulative by target
+    double norm = 1 / scale;
+    std::vector<double> fileAvg(buckets.size());
+    std::vector<double> fileTxCtAvg(buckets.size());
+    std::vector<std::vector<double> > fileConfAvg(maxConfirms, std::vector<double>(buckets.size()));
+    for (unsigned int j = 0; j < buckets.size(); j++)
+    {
+        fileAvg[j] = avg[j] * norm;
+        fileTxCtAvg[j] = txCtAvg[j] * norm;
+        double confWithin = 0;
+        for (unsigned int i = 0; i < maxConfirms; i++)
+        {
+            confWithin += confAvg[j * maxConfirms + i] * norm;
+            fileConfAvg[i][j] = confWithin;
+        }
+    }
+
     fileout << decay;
     fileout << buckets;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
+    fileout << fileAvg;
+    fileout << fileTxCtAvg;
+    fileout << fileConfAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile &filein)
@@ -206,7 +252,7 @@ void TxConfirmStats::Read(CAutoFile &filein)
     std::vector<std::vector<double> > fileConfAvg;
     std::vector<double> fileTxCtAvg;
     double fileDecay;
-    size_t maxConfirms;
+    size_t fileMaxConfirms;
     size_t numBuckets;
 
     filein >> fileDecay;
@@ -216,6 +262,8 @@ void TxConfirmStats::Read(CAutoFile &filein)
     numBuckets = fileBuckets.size();
     if (numBuckets <= 1 || numBuckets > 1000)
         throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 fee buckets");
+    if (!std::is_sorted(fileBuckets.begin(), fileBuckets.end()))
+        throw std::runtime_error("Corrupt estimates file. Fee buckets are out of order");
     filein >> fileAvg;
     if (fileAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in fee average bucket count");
@@ -223,11 +271,11 @@ void TxConfirmStats::Read(CAutoFile &filein)
     if (fileTxCtAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
     filein >> fileConfAvg;
-    maxConfirms = fileConfAvg.size();
-    if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) // one week
+    fileMaxConfirms = fileConfAvg.size();
+    if (fileMaxConfirms <= 0 || fileMaxConfirms > 6 * 24 * 7) // one week
         throw std::runtime_error(
             "Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
-    for (unsigned int i = 0; i < maxConfirms; i++)
+    for (unsigned int i = 0; i < fileMaxConfirms; i++)
     {
         if (fileConfAvg[i].size() != numBuckets)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee conf average bucket count");
@@ -235,31 +283,23 @@ void TxConfirmStats::Read(CAutoFile &filein)
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
     decay = fileDecay;
+    scale = 1;
     buckets = fileBuckets;
+    maxConfirms = fileMaxConfirms;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
-
-    // Resize the current block variables which aren't stored in the data file
-    // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++)
-    {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
 
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++)
+    // The file holds cumulative confirmation counts, we keep them by exact confirmation
+    confAvg.assign(buckets.size() * maxConfirms, 0);
+    for (unsigned int j = 0; j < buckets.size(); j++)
     {
-        unconfTxs[i].resize(buckets.size());
+        for (unsigned int i = 0; i < maxConfirms; i++)
+            confAvg[j * maxConfirms + i] = fileConfAvg[i][j] - (i > 0 ? fileConfAvg[i - 1][j] : 0);
     }
-    oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
+    // Resize the mempool counts which aren't stored in the data file to match the number of confirms and buckets
+    unconfTxs.assign(buckets.size() * maxConfirms, 0);
+    oldUnconfTxs.assign(buckets.size(), 0);
 
     LOG(ESTIMATEFEE, "Reading estimates: %u %s buckets counting confirms up to %u blocks\n", numBuckets, dataTypeString,
         maxConfirms);
@@ -267,9 +307,9 @@ void TxConfirmStats::Read(CAutoFile &filein)
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int bucketindex = BucketIndex(val);
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    unconfTxs[blockIndex * buckets.size() + bucketindex]++;
     LOG(ESTIMATEFEE, "adding to %s", dataTypeString);
     return bucketindex;
 }
@@ -286,7 +326,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return; // This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size())
+    if (blocksAgo >= (int)maxConfirms)
     {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
@@ -296,9 +336,10 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     }
     else
     {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % maxConfirms;
+        int &unconf = unconfTxs[blockIndex * buckets.size() + bucketindex];
+        if (unconf > 0)
+            unconf--;
         else
             LOG(ESTIMATEFEE, "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                 blockIndex, bucketindex);
@@ -307,19 +348,13 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
-    std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
+    // Only transactions that count for fee estimation are tracked
+    auto pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end())
-    {
-        LOG(ESTIMATEFEE, "Blockpolicy error mempool tx %s not found for removeTx\n", hash.ToString().c_str());
         return;
-    }
-    TxConfirmStats *stats = pos->second.stats;
-    unsigned int entryHeight = pos->second.blockHeight;
-    unsigned int bucketIndex = pos->second.bucketIndex;
 
-    if (stats != nullptr)
-        stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
-    mapMemPoolTxs.erase(hash);
+    feeStats.removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex);
+    mapMemPoolTxs.erase(pos);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate &_minRelayFee) : nBestSeenHeight(0)
@@ -333,16 +368,13 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate &_minRelayFee) : nBe
     }
     vfeelist.push_back(INF_FEERATE);
     feeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
-
-    feeUnlikely = CFeeRate(0);
-    feeLikely = CFeeRate(INF_FEERATE);
 }
 
 void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
-    if (mapMemPoolTxs[hash].stats != nullptr)
+    if (mapMemPoolTxs.count(hash))
     {
         LOG(ESTIMATEFEE, "Blockpolicy error mempool tx %s already being tracked\n", hash.ToString().c_str());
         return;
@@ -368,14 +400,17 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry &entry, boo
         return;
     }
 
+    // A very large mempool gives us more than enough data points, so don't let it grow the estimator
+    if (mapMemPoolTxs.size() >= MAX_TRACKED_TXS)
+        return;
+
     // Fees are stored and reported as BCH-per-kb:
     CFeeRate feeRate(entry.GetFee(), entry.GetTxSize());
 
-    mapMemPoolTxs[hash].blockHeight = txHeight;
-
     LOG(ESTIMATEFEE, "Blockpolicy mempool tx %s ", hash.ToString().substr(0, 10));
-    mapMemPoolTxs[hash].stats = &feeStats;
-    mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+    TxStatsInfo &info = mapMemPoolTxs[hash];
+    info.blockHeight = txHeight;
+    info.bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
 }
 
 void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry &entry)
@@ -424,46 +459,51 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     if (!fCurrentEstimate)
         return;
 
-    // Update the dynamic cutoffs
-    // a fee is "likely" the reason your tx was included in a block if >85% of such tx's
-    // were confirmed in 2 blocks and is "unlikely" if <50% were confirmed in 10 blocks
-    LOG(ESTIMATEFEE, "Blockpolicy recalculating dynamic cutoffs:\n");
-
-    CAmount feeLikelyEst = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBlockHeight);
-    if (feeLikelyEst == -1)
-        feeLikely = CFeeRate(INF_FEERATE);
-    else
-        feeLikely = CFeeRate(feeLikelyEst);
-
-    // Clear the current block states
-    feeStats.ClearCurrent(nBlockHeight);
+    // Decay the historical averages and age the mempool counts
+    feeStats.NewBlock(nBlockHeight);
 
-    // Repopulate the current block states
+    // Add the data points of this block
     for (auto &it : setTxnsInBlock)
         processBlockTx(nBlockHeight, *it);
 
-    // Update all exponential averages with the current block states
-    feeStats.UpdateMovingAverages();
-
     LOG(ESTIMATEFEE, "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
         setTxnsInBlock.size(), mapMemPoolTxs.size());
 }
 
-CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
 {
-    // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
-        return CFeeRate(0);
+    return estimateFees(std::vector<int>(1, confTarget))[0];
+}
 
-    CAmount median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+std::vector<CFeeRate> CBlockPolicyEstimator::estimateFees(const std::vector<int> &confTargets) const
+{
+    std::vector<CFeeRate> vFeeRates(confTargets.size(), CFeeRate(0));
 
-    if (median < 0)
-        return CFeeRate(0);
+    // Return failure for targets we're not tracking
+    std::vector<int> vTracked;
+    std::vector<size_t> vTrackedPos;
+    for (size_t i = 0; i < confTargets.size(); i++)
+    {
+        if (confTargets[i] > 0 && (unsigned int)confTargets[i] <= feeStats.GetMaxConfirms())
+        {
+            vTracked.push_back(confTargets[i]);
+            vTrackedPos.push_back(i);
+        }
+    }
+    if (vTracked.empty())
+        return vFeeRates;
 
-    return CFeeRate(median);
+    std::vector<CAmount> vMedians =
+        feeStats.EstimateMedianVals(vTracked, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, nBestSeenHeight);
+    for (size_t i = 0; i < vMedians.size(); i++)
+    {
+        if (vMedians[i] >= 0)
+            vFeeRates[vTrackedPos[i]] = CFeeRate(vMedians[i]);
+    }
+    return vFeeRates;
 }
 
-void CBlockPolicyEstimator::Write(CAutoFile &fileout)
+void CBlockPolicyEstimator::Write(CAutoFile &fileout) const
 {
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
@@ -14,6 +14,7 @@
 #include <deque>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class CAutoFile;
@@ -77,47 +78,57 @@ class CFeeRate;
  *
  * The tracking of unconfirmed (mempool) transactions is completely independent of the
  * historical tracking of transactions that have been confirmed in a block.
+ *
+ * The historical moving averages are decayed lazily: rather than multiplying every one of them by the
+ * decay each block, a block's data points are added with a weight that grows by 1 / decay per block
+ * (the epoch scale) and the averages are divided by that scale when they are read.  Processing a block
+ * therefore only costs O(buckets + block transactions), and once in a long while (when the scale gets too
+ * large for a double) all of the averages are rebased.
  */
 class TxConfirmStats
 {
 private:
     // Define the buckets we will group transactions into fee buckets
     std::vector<double> buckets; // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+
+    unsigned int maxConfirms;
 
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
-    // Count the total # of txs confirmed within Y blocks in each bucket
+    // Count the # of txs confirmed in exactly Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
+    std::vector<double> confAvg; // confAvg[X * maxConfirms + Y - 1]
 
     // Sum the total fee of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee per bucket
 
     std::string dataTypeString;
     double decay;
+    // The weight given to the current block's data points, i.e. decay^-(blocks since the last rebase)
+    double scale;
 
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs; // unconfTxs[Y][X]
+    std::vector<int> unconfTxs; // unconfTxs[(height % maxConfirms) * buckets.size() + X]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Index of the bucket a value falls into */
+    unsigned int BucketIndex(double val) const;
+    /** Fold the epoch scale into all of the moving averages */
+    void Rebase();
+
 public:
+    TxConfirmStats() : maxConfirms(0), decay(0), scale(1) {}
+
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
      * constructor with default values.
@@ -131,8 +142,8 @@ public:
         double decay,
         std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
-    void ClearCurrent(unsigned int nBlockHeight);
+    /** Start a new block: age the mempool counts and decay the historical moving averages */
+    void NewBlock(unsigned int nBlockHeight);
 
     /**
      * Record a new transaction data point in the current block stats
@@ -148,10 +159,6 @@ public:
     /** Remove a transaction from mempool tracking stats*/
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight, unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
-
     /**
      * Calculate a satoshi per Kb fee estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -159,17 +166,23 @@ public:
      * @param confTarget target number of confirmations
      * @param sufficientTxVal required average number of transactions per block in a bucket range
      * @param minSuccess the success probability we require
-     * @param successIdeal the ideal success probability we desire
-     * @param requireGreater return the lowest fee such that all higher values pass minSuccess OR
-     *        return the highest fee such that all lower values fail minSuccess
      * @param nBlockHeight the current block height
      */
-    CAmount EstimateMedianVal(int confTarget, double sufficientTxVal, double minSuccess, unsigned int nBlockHeight);
+    CAmount EstimateMedianVal(int confTarget, double sufficientTxVal, double minSuccess, unsigned int nBlockHeight) const;
+
+    /**
+     * Calculate the estimates for several confirmation targets in a single pass over the buckets.
+     * Each target must be between 1 and GetMaxConfirms().
+     */
+    std::vector<CAmount> EstimateMedianVals(const std::vector<int> &confTargets,
+        double sufficientTxVal,
+        double minSuccess,
+        unsigned int nBlockHeight) const;
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return maxConfirms; }
     /** Write state of estimation data to a file*/
-    void Write(CAutoFile &fileout);
+    void Write(CAutoFile &fileout) const;
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
@@ -191,6 +204,9 @@ static const double MIN_SUCCESS_PCT = 0.80;
 /** Require an avg of 0.1 tx in the combined fee bucket per block to have stat significance */
 static const double SUFFICIENT_FEETXS = 0.1;
 
+/** Stop tracking new mempool transactions beyond this many, to bound the memory the estimator uses */
+static const size_t MAX_TRACKED_TXS = 500000;
+
 // Minimum and Maximum values for tracking fees
 static const double MIN_FEERATE = 10;
 static const double MAX_FEERATE = 1e7;
@@ -226,10 +242,13 @@ public:
     void removeTx(uint256 hash);
 
     /** Return a fee estimate */
-    CFeeRate estimateFee(int confTarget);
+    CFeeRate estimateFee(int confTarget) const;
+
+    /** Return fee estimates for several confirmation targets at once */
+    std::vector<CFeeRate> estimateFees(const std::vector<int> &confTargets) const;
 
     /** Write estimation data to a file */
-    void Write(CAutoFile &fileout);
+    void Write(CAutoFile &fileout) const;
 
     /** Read estimation data from a file */
     void Read(CAutoFile &filein);
@@ -239,19 +258,15 @@ private:
     unsigned int nBestSeenHeight;
     struct TxStatsInfo
     {
-        TxConfirmStats *stats;
         unsigned int blockHeight;
         unsigned int bucketIndex;
-        TxStatsInfo() : stats(nullptr), blockHeight(0), bucketIndex(0) {}
+        TxStatsInfo() : blockHeight(0), bucketIndex(0) {}
     };
 
-    // map of txids to information about that transaction
-    std::map<uint256, TxStatsInfo> mapMemPoolTxs;
+    // map of txids to information about the tracked mempool transactions, at most MAX_TRACKED_TXS of them
+    std::unordered_map<uint256, TxStatsInfo, SaltedTxidHasher> mapMemPoolTxs;
 
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats;
-
-    /** Breakpoints to help determine whether a transaction was confirmed by Fee */
-    CFeeRate feeLikely, feeUnlikely;
 };
 #endif /*BITCOIN_POLICY_FEES_H */
@@ -19,6 +19,9 @@ static const uint64_t BU_DEFAULT_ANCESTOR_SIZE_LIMIT =  256 * 1000;
 static const uint64_t BU_DEFAULT_DESCENDANT_LIMIT = 256 * 1000000;
 /** BU's default for -limitdescendantsize, maximum kilobytes of in-mempool descendants. */
 static const uint64_t BU_DEFAULT_DESCENDANT_SIZE_LIMIT = 256 * 1000;
+/** Default for -limitclustercount, max number of transactions in a connected group of in-mempool transactions.
+ *  Every change to a cluster costs a re-linearization of all of it, so it is limited even though chains are not. */
+static const uint64_t DEFAULT_CLUSTER_LIMIT = 10000;
 
 
 /** Network default for the max number of in-mempool ancestors */
@@ -59,7 +59,14 @@ const char *MEMPOOLSYNC = "memsync";
 const char *MEMPOOLSYNCTX = "memsynctx";
 const char *GET_MEMPOOLSYNC = "get_memsync";
 const char *GET_MEMPOOLSYNCTX = "getmemsynctx";
+const char *GET_MEMPOOLSYNCSYM = "getmemsymbol";
 // Mempool sync - end section
+// Transaction reconciliation - begin section
+const char *REQRECON = "reqrecon";
+const char *RECONSKETCH = "reconsketch";
+const char *REQRECONSYM = "reqreconsym";
+const char *RECONDIFF = "recondiff";
+// Transaction reconciliation - end section
 const char *XPEDITEDREQUEST = "req_xpedited";
 const char *XPEDITEDBLK = "Xb";
 const char *XPEDITEDTXN = "Xt";
@@ -93,9 +100,11 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::XTHINBLOCK, NetMsgType::XBLOCKTX, NetMsgType::GET_XBLOCKTX, NetMsgType::GET_XTHIN, NetMsgType::GET_THIN,
     NetMsgType::GRAPHENEBLOCK, NetMsgType::GRAPHENETX, NetMsgType::GET_GRAPHENETX, NetMsgType::GET_GRAPHENE,
     NetMsgType::GET_GRAPHENE_RECOVERY, NetMsgType::GRAPHENE_RECOVERY, NetMsgType::MEMPOOLSYNC,
-    NetMsgType::MEMPOOLSYNCTX, NetMsgType::GET_MEMPOOLSYNC, NetMsgType::GET_MEMPOOLSYNCTX, NetMsgType::XPEDITEDREQUEST,
-    NetMsgType::XPEDITEDBLK, NetMsgType::XPEDITEDTXN, NetMsgType::EXTVERSION, NetMsgType::XUPDATE,
-    NetMsgType::SENDCMPCT, NetMsgType::CMPCTBLOCK, NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN, NetMsgType::DSPROOF,
+    NetMsgType::MEMPOOLSYNCTX, NetMsgType::GET_MEMPOOLSYNC, NetMsgType::GET_MEMPOOLSYNCTX, NetMsgType::GET_MEMPOOLSYNCSYM,
+    NetMsgType::REQRECON, NetMsgType::RECONSKETCH, NetMsgType::REQRECONSYM, NetMsgType::RECONDIFF,
+    NetMsgType::XPEDITEDREQUEST, NetMsgType::XPEDITEDBLK, NetMsgType::XPEDITEDTXN, NetMsgType::EXTVERSION,
+    NetMsgType::XUPDATE, NetMsgType::SENDCMPCT, NetMsgType::CMPCTBLOCK, NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN,
+    NetMsgType::DSPROOF,
 
 };
 const static std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes,
@@ -206,6 +206,26 @@ extern const char *GET_MEMPOOLSYNC;
  * The get_mempoolsynctx message transmits a single serialized get_memsynctx.
  */
 extern const char *GET_MEMPOOLSYNCTX;
+/**
+ * The getmemsymbol message requests the next batch of rateless mempool sync symbols.
+ */
+extern const char *GET_MEMPOOLSYNCSYM;
+/**
+ * The reqrecon message starts a round of transaction announcement reconciliation.
+ */
+extern const char *REQRECON;
+/**
+ * The reconsketch message carries a batch of rateless symbols of the sender's held back transactions.
+ */
+extern const char *RECONSKETCH;
+/**
+ * The reqreconsym message requests the next batch of reconciliation symbols.
+ */
+extern const char *REQRECONSYM;
+/**
+ * The recondiff message ends a reconciliation round with the short ids of the transactions to announce.
+ */
+extern const char *RECONDIFF;
 
 /**
  * The getaddr message requests an addr message from the receiving node,
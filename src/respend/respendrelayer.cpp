@@ -112,6 +112,9 @@ void RespendRelayer::Trigger(CTxMemPool &pool)
                 auto item = *originalTxIter;
                 dsp = DoubleSpendProof::create(originalTxIter->GetTx(), *pRespend, pool);
                 item.dsproof = pool.doubleSpendProofStorage()->add(dsp).second;
+                // The proof storage is full, so the proof is dropped and not relayed
+                if (item.dsproof == -1)
+                    return;
                 LOG(DSPROOF, "Double spend found, creating double spend proof %d\n", item.dsproof);
                 pool.mapTx.replace(originalTxIter, item);
 
@@ -382,4 +382,48 @@ BOOST_AUTO_TEST_CASE(dsproof_orphan_handling)
     // Cleanup
     vNodes.erase(vNodes.end() - 1);
 }
+
+BOOST_AUTO_TEST_CASE(dsproof_orphan_limits)
+{
+    // well formed proofs for arbitrary outpoints, which is all the storage looks at
+    auto makeProof = [](const COutPoint &prevOut, uint32_t nonce) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << prevOut.hash << (int32_t)prevOut.n;
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            ss << (uint32_t)2 << (uint32_t)(nonce + i) << (uint32_t)0 << uint256() << uint256() << uint256();
+            ss << std::vector<std::vector<uint8_t> >(1, std::vector<uint8_t>(72, (uint8_t)i));
+        }
+        DoubleSpendProof dsp;
+        ss >> dsp;
+        return dsp;
+    };
+
+    DoubleSpendProofStorage *storage = mempool.doubleSpendProofStorage();
+    const COutPoint first(GetRandHash(), 3);
+    storage->addOrphan(makeProof(first, 0), 1);
+    storage->addOrphan(makeProof(first, 2), 2);
+    BOOST_CHECK_EQUAL(storage->findOrphans(first).size(), 2);
+    BOOST_CHECK_EQUAL(storage->findOrphans(COutPoint(first.hash, 2)).size(), 0);
+
+    // the oldest orphans make room for new ones once the table is full
+    for (uint32_t i = 0; i < MAX_DSPROOF_ORPHANS; i++)
+        storage->addOrphan(makeProof(COutPoint(GetRandHash(), 0), 4 + 2 * i), 3);
+    BOOST_CHECK_EQUAL(storage->orphanSize(), MAX_DSPROOF_ORPHANS);
+    BOOST_CHECK_EQUAL(storage->size(), MAX_DSPROOF_ORPHANS);
+    BOOST_CHECK(storage->findOrphans(first).empty());
+    BOOST_CHECK(!storage->exists(makeProof(first, 0).GetHash()));
+
+    // claiming an orphan keeps the proof but takes it out of the orphan table
+    const COutPoint last(GetRandHash(), 1);
+    DoubleSpendProof dsp = makeProof(last, 1);
+    storage->addOrphan(dsp, 4);
+    auto orphans = storage->findOrphans(last);
+    BOOST_CHECK_EQUAL(orphans.size(), 1);
+    storage->claimOrphan(orphans.front().first);
+    BOOST_CHECK(storage->findOrphans(last).empty());
+    BOOST_CHECK(storage->exists(dsp.GetHash()));
+    BOOST_CHECK(storage->proof(orphans.front().first).GetHash() == dsp.GetHash());
+    BOOST_CHECK_EQUAL(storage->orphanSize(), MAX_DSPROOF_ORPHANS - 1);
+}
 BOOST_AUTO_TEST_SUITE_END();
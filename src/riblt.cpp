@@ -0,0 +1,165 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "riblt.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+// Keys are already salted short ids, so a cheap bit mixer is enough to derive
+// both the checksum and the seed of the position sequence from them.
+static inline uint64_t RibltHash(uint64_t key)
+{
+    uint64_t z = key + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint32_t RibltCheck(uint64_t key) { return (uint32_t)(RibltHash(key) >> 32); }
+static inline CRibltMapping RibltMapping(uint64_t key) { return CRibltMapping(RibltHash(key)); }
+
+void CRibltSymbol::apply(uint64_t key, uint32_t check, int64_t direction)
+{
+    keySum ^= key;
+    keyCheck ^= check;
+    count += direction;
+}
+
+void CRibltSymbol::subtract(const CRibltSymbol &other)
+{
+    keySum ^= other.keySum;
+    keyCheck ^= other.keyCheck;
+    count -= other.count;
+}
+
+bool CRibltSymbol::isPure() const
+{
+    if (count == 1 || count == -1)
+        return keyCheck == RibltCheck(keySum);
+    return false;
+}
+
+bool CRibltSymbol::empty() const { return (count == 0 && keySum == 0 && keyCheck == 0); }
+uint64_t CRibltMapping::next()
+{
+    // Each key lands on position i with probability of roughly 1 / (1 + i / 2), so the early symbols
+    // cover many keys while the later ones become sparse enough to peel.
+    prng *= 0xda942042e4dd58b5ULL;
+    double step = std::ceil(((double)nIndex + 1.5) * ((double)(1ULL << 32) / std::sqrt((double)prng + 1) - 1));
+    if (step < 1)
+        step = 1;
+    if (step >= (double)(std::numeric_limits<uint64_t>::max() - nIndex))
+        nIndex = std::numeric_limits<uint64_t>::max();
+    else
+        nIndex += (uint64_t)step;
+    return nIndex;
+}
+
+void CRibltKeyQueue::push(uint64_t key, uint32_t check, const CRibltMapping &mapping, int64_t direction)
+{
+    vHeap.push_back({key, check, direction, mapping});
+    std::push_heap(vHeap.begin(), vHeap.end(), EntryCompare());
+}
+
+void CRibltKeyQueue::applyTo(CRibltSymbol &symbol, uint64_t nIndex)
+{
+    while (!vHeap.empty() && vHeap.front().mapping.nIndex == nIndex)
+    {
+        std::pop_heap(vHeap.begin(), vHeap.end(), EntryCompare());
+        Entry &entry = vHeap.back();
+        symbol.apply(entry.key, entry.check, entry.direction);
+        entry.mapping.next();
+        std::push_heap(vHeap.begin(), vHeap.end(), EntryCompare());
+    }
+}
+
+void CRibltEncoder::addKey(uint64_t key)
+{
+    assert(nNextSymbol == 0);
+    queue.push(key, RibltCheck(key), RibltMapping(key), 1);
+    nKeys++;
+}
+
+std::vector<CRibltSymbol> CRibltEncoder::nextSymbols(uint64_t nSymbols)
+{
+    std::vector<CRibltSymbol> vSymbols(nSymbols);
+    for (CRibltSymbol &symbol : vSymbols)
+    {
+        queue.applyTo(symbol, nNextSymbol);
+        nNextSymbol++;
+    }
+    return vSymbols;
+}
+
+void CRibltDecoder::addLocalKey(uint64_t key)
+{
+    if (!vSymbols.empty())
+        fLateLocalKeys = true;
+    applyKey(key, -1);
+    peel();
+}
+
+void CRibltDecoder::addSymbol(const CRibltSymbol &symbol)
+{
+    CRibltSymbol diff = symbol;
+    queue.applyTo(diff, vSymbols.size());
+    vSymbols.push_back(diff);
+    if (diff.isPure())
+        vPure.push_back(vSymbols.size() - 1);
+    peel();
+}
+
+bool CRibltDecoder::decoded() const { return !vSymbols.empty() && vSymbols[0].empty(); }
+void CRibltDecoder::applyKey(uint64_t key, int64_t direction)
+{
+    uint32_t check = RibltCheck(key);
+    CRibltMapping mapping = RibltMapping(key);
+    for (uint64_t nIndex = 0; nIndex < vSymbols.size(); nIndex = mapping.next())
+    {
+        CRibltSymbol &symbol = vSymbols[nIndex];
+        symbol.apply(key, check, direction);
+        if (symbol.isPure())
+            vPure.push_back(nIndex);
+    }
+    queue.push(key, check, mapping, direction);
+}
+
+void CRibltDecoder::peel()
+{
+    while (!vPure.empty())
+    {
+        uint64_t nIndex = vPure.back();
+        vPure.pop_back();
+
+        // the symbol may have been peeled already through another one
+        const CRibltSymbol &symbol = vSymbols[nIndex];
+        if (!symbol.isPure())
+            continue;
+
+        // A key peeled before the local set was complete can come back with the opposite sign once the
+        // matching local key is added, in which case the two cancel out.
+        uint64_t key = symbol.keySum;
+        if (symbol.count == 1)
+        {
+            auto it = fLateLocalKeys ? std::find(vLocalOnly.begin(), vLocalOnly.end(), key) : vLocalOnly.end();
+            if (it != vLocalOnly.end())
+                vLocalOnly.erase(it);
+            else
+                vRemoteOnly.push_back(key);
+            applyKey(key, -1);
+        }
+        else
+        {
+            auto it = fLateLocalKeys ? std::find(vRemoteOnly.begin(), vRemoteOnly.end(), key) : vRemoteOnly.end();
+            if (it != vRemoteOnly.end())
+                vRemoteOnly.erase(it);
+            else
+                vLocalOnly.push_back(key);
+            applyKey(key, 1);
+        }
+    }
+}
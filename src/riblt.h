@@ -0,0 +1,149 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RIBLT_H
+#define BITCOIN_RIBLT_H
+
+#include "serialize.h"
+
+#include <inttypes.h>
+#include <vector>
+
+//
+// Rateless Invertible Bloom Lookup Table implementation
+// Reference:
+//
+// "Practical Rateless Set Reconciliation" by Yang, Gilad
+// and Alizadeh
+//
+// The encoder turns a set of 64 bit keys into an endless stream of coded
+// symbols.  A peer holding a similar set subtracts the symbols of its own
+// keys from the ones it receives and peels off the difference once enough
+// of them have arrived.  Roughly 1.35 to 1.7 symbols per differing key are
+// needed whatever the size of the difference, so nobody has to estimate it
+// up front: the receiver simply asks for more symbols until decoding works.
+//
+
+/** A single coded symbol, i.e. the sum of every key mapped onto one position of the stream. */
+class CRibltSymbol
+{
+public:
+    uint64_t keySum;
+    uint32_t keyCheck;
+    int64_t count;
+
+    CRibltSymbol() : keySum(0), keyCheck(0), count(0) {}
+    /** Add (direction 1) or subtract (direction -1) a key */
+    void apply(uint64_t key, uint32_t check, int64_t direction);
+    /** Subtract another symbol from this one */
+    void subtract(const CRibltSymbol &other);
+    /** True if exactly one key, present on only one side, remains in this symbol */
+    bool isPure() const;
+    bool empty() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(keySum);
+        READWRITE(keyCheck);
+
+        // counts are small and may be negative so zigzag encode them into a compact size
+        uint64_t nZigZag = 0;
+        if (!ser_action.ForRead())
+            nZigZag = ((uint64_t)count << 1) ^ (uint64_t)(count >> 63);
+        READWRITE(COMPACTSIZE(nZigZag));
+        if (ser_action.ForRead())
+            count = (int64_t)(nZigZag >> 1) ^ -(int64_t)(nZigZag & 1);
+    }
+};
+
+/** The positions in the symbol stream a key is mapped to.  Every key starts at position 0. */
+class CRibltMapping
+{
+public:
+    uint64_t prng;
+    uint64_t nIndex;
+
+    CRibltMapping(uint64_t seed) : prng(seed), nIndex(0) {}
+    /** Advance to the next position this key is mapped to and return it */
+    uint64_t next();
+};
+
+/** Keys waiting to be added to symbols that have not been produced yet, ordered by their next position */
+class CRibltKeyQueue
+{
+public:
+    void push(uint64_t key, uint32_t check, const CRibltMapping &mapping, int64_t direction);
+    /** Apply every queued key that maps to position nIndex to the symbol, then advance those keys */
+    void applyTo(CRibltSymbol &symbol, uint64_t nIndex);
+    size_t size() const { return vHeap.size(); }
+    void clear() { vHeap.clear(); }
+private:
+    struct Entry
+    {
+        uint64_t key;
+        uint32_t check;
+        int64_t direction;
+        CRibltMapping mapping;
+    };
+    struct EntryCompare
+    {
+        bool operator()(const Entry &a, const Entry &b) const { return a.mapping.nIndex > b.mapping.nIndex; }
+    };
+    std::vector<Entry> vHeap;
+};
+
+/** Produces the symbol stream for a set of keys, a batch at a time */
+class CRibltEncoder
+{
+public:
+    CRibltEncoder() : nNextSymbol(0), nKeys(0) {}
+    /** Add a key to the set.  Keys must all be added before the first symbol is produced. */
+    void addKey(uint64_t key);
+    /** Produce the next nSymbols symbols of the stream */
+    std::vector<CRibltSymbol> nextSymbols(uint64_t nSymbols);
+    /** Number of symbols produced so far, which is also the position of the next one */
+    uint64_t symbolsProduced() const { return nNextSymbol; }
+    size_t size() const { return nKeys; }
+private:
+    CRibltKeyQueue queue;
+    uint64_t nNextSymbol;
+    size_t nKeys;
+};
+
+/** Reconstructs the difference between a remote set and the local one from the remote symbol stream */
+class CRibltDecoder
+{
+public:
+    CRibltDecoder() : fLateLocalKeys(false) {}
+    /** Add a key of the local set.  Adding them all before the first symbol is cheapest. */
+    void addLocalKey(uint64_t key);
+    /** Add the next symbol received from the remote peer and peel whatever becomes decodable */
+    void addSymbol(const CRibltSymbol &symbol);
+    /** True once the symbols received so far are enough to know the whole difference */
+    bool decoded() const;
+    /** Number of remote symbols added so far */
+    uint64_t symbolCount() const { return vSymbols.size(); }
+    /** Keys only the remote set holds */
+    const std::vector<uint64_t> &remoteOnly() const { return vRemoteOnly; }
+    /** Keys only the local set holds */
+    const std::vector<uint64_t> &localOnly() const { return vLocalOnly; }
+private:
+    /** Apply a key to every symbol received so far and queue it for the ones still to come */
+    void applyKey(uint64_t key, int64_t direction);
+    void peel();
+
+    /** Remote symbols with the local keys and the decoded keys removed */
+    std::vector<CRibltSymbol> vSymbols;
+    CRibltKeyQueue queue;
+    std::vector<uint64_t> vPure;
+    std::vector<uint64_t> vRemoteOnly;
+    std::vector<uint64_t> vLocalOnly;
+    /** Set once a local key arrives after remote symbols, so decoded keys may later cancel out */
+    bool fLateLocalKeys;
+};
+
+#endif // BITCOIN_RIBLT_H
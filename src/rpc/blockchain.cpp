@@ -14,6 +14,7 @@
 #include "coins.h"
 #include "consensus/validation.h"
 #include "hashwrapper.h"
+#include "index/txindex.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
@@ -241,10 +242,14 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+static void entryToJSON(UniValue &info,
+    const CTxMemPoolEntry &e,
+    uint64_t nCountWithAncestors,
+    uint64_t nSizeWithAncestors,
+    CAmount nModFeesWithAncestors,
+    const set<uint256> &setDepends,
+    const set<uint256> &setSpent)
 {
-    AssertLockHeld(mempool.cs_txmempool);
-
     info.pushKV("size", (int)e.GetTxSize());
     info.pushKV("fee", ValueFromAmount(e.GetFee()));
     info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
@@ -253,51 +258,111 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.pushKV("doublespent", (e.dsproof == 1 ? true : false));
     info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
     info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-    info.pushKV("ancestorcount", e.GetCountWithAncestors());
-    info.pushKV("ancestorsize", e.GetSizeWithAncestors());
-    info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
-    const CTransaction &tx = e.GetTx();
-    set<string> setDepends;
-    for (const CTxIn &txin : tx.vin)
-    {
-        if (mempool._exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
-    }
+    info.pushKV("ancestorcount", nCountWithAncestors);
+    info.pushKV("ancestorsize", nSizeWithAncestors);
+    info.pushKV("ancestorfees", nModFeesWithAncestors);
 
     UniValue depends(UniValue::VARR);
-    for (const string &dep : setDepends)
+    for (const uint256 &dep : setDepends)
     {
-        depends.push_back(dep);
+        depends.push_back(dep.ToString());
     }
     info.pushKV("depends", depends);
 
     UniValue spent(UniValue::VARR);
-    const CTxMemPool::txiter &it = mempool.mapTx.find(tx.GetHash());
-    const CTxMemPool::setEntries &setChildren = mempool.GetMemPoolChildren(it);
-    for (const CTxMemPool::txiter &childiter : setChildren)
+    for (const uint256 &child : setSpent)
     {
-        spent.push_back(childiter->GetTx().GetHash().ToString());
+        spent.push_back(child.ToString());
     }
     info.pushKV("spentby", spent);
 }
 
+void entryToJSON(UniValue &info, const CTxMemPoolSnapshot &snapshot, uint32_t n)
+{
+    const CTxMemPoolSnapshot::Entry &snapEntry = snapshot.vEntries[n];
+    const CTxMemPoolEntry &e = snapEntry.entry;
+
+    // The ancestor state of a dirty entry is out of date, so work it out from the snapshot instead.
+    uint64_t nCountWithAncestors = e.GetCountWithAncestors();
+    uint64_t nSizeWithAncestors = e.GetSizeWithAncestors();
+    CAmount nModFeesWithAncestors = e.GetModFeesWithAncestors();
+    if (e.IsDirty())
+    {
+        std::set<uint32_t> setAncestors;
+        snapshot.CalculateAncestors(n, setAncestors);
+        nCountWithAncestors = setAncestors.size() + 1;
+        nSizeWithAncestors = e.GetTxSize();
+        nModFeesWithAncestors = e.GetModifiedFee();
+        for (uint32_t k : setAncestors)
+        {
+            nSizeWithAncestors += snapshot.vEntries[k].entry.GetTxSize();
+            nModFeesWithAncestors += snapshot.vEntries[k].entry.GetModifiedFee();
+        }
+    }
+
+    set<uint256> setDepends;
+    for (uint32_t k : snapEntry.vParents)
+        setDepends.insert(snapshot.vEntries[k].entry.GetTx().GetHash());
+    set<uint256> setSpent;
+    for (uint32_t k : snapEntry.vChildren)
+        setSpent.insert(snapshot.vEntries[k].entry.GetTx().GetHash());
+    entryToJSON(info, e, nCountWithAncestors, nSizeWithAncestors, nModFeesWithAncestors, setDepends, setSpent);
+}
+
+void entryToJSON(UniValue &info, CTxMemPool::txiter it)
+{
+    AssertLockHeld(mempool.cs_txmempool);
+    const CTxMemPoolEntry &e = *it;
+
+    // The ancestor state of a dirty entry is out of date, so work it out without updating the mempool, which
+    // only a shared lock is held on.
+    uint64_t nCountWithAncestors = e.GetCountWithAncestors();
+    uint64_t nSizeWithAncestors = e.GetSizeWithAncestors();
+    CAmount nModFeesWithAncestors = e.GetModFeesWithAncestors();
+    if (e.IsDirty())
+    {
+        CTxMemPool::setEntries setAncestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool._CalculateMemPoolAncestors(e, setAncestors, nNoLimit, nNoLimit, dummy, nullptr, false);
+        nCountWithAncestors = setAncestors.size() + 1;
+        nSizeWithAncestors = e.GetTxSize();
+        nModFeesWithAncestors = e.GetModifiedFee();
+        for (CTxMemPool::txiter ancestor : setAncestors)
+        {
+            nSizeWithAncestors += ancestor->GetTxSize();
+            nModFeesWithAncestors += ancestor->GetModifiedFee();
+        }
+    }
+
+    set<uint256> setDepends;
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it))
+        setDepends.insert(parent->GetTx().GetHash());
+    set<uint256> setSpent;
+    for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(it))
+        setSpent.insert(child->GetTx().GetHash());
+    entryToJSON(info, e, nCountWithAncestors, nSizeWithAncestors, nModFeesWithAncestors, setDepends, setSpent);
+}
+
 UniValue mempoolToJSON(bool fVerbose /* = false */)
 {
     if (fVerbose)
     {
-        READLOCK(mempool.cs_txmempool);
+        // Work from a snapshot so that building a large reply does not hold up transaction admission
+        CTxMemPoolSnapshotRef snapshot = mempool.GetSnapshot();
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry &e : mempool.mapTx)
+        for (uint32_t n = 0; n < snapshot->size(); n++)
         {
-            const uint256 &hash = e.GetTx().GetHash();
+            const uint256 &hash = snapshot->vEntries[n].entry.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, *snapshot, n);
             o.pushKV(hash.ToString(), info);
         }
         return o;
     }
     else
     {
+        // Only the hashes are needed, which are quicker to take under the lock than a snapshot is to build
         vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
 
@@ -398,6 +463,8 @@ UniValue getmempoolancestors(const UniValue &params, bool fHelp)
 
     uint256 paramhash = ParseHashV(params[0], "parameter 1");
 
+    // Only the entry and its relatives are looked at, so do it under the lock rather than copying the whole
+    // mempool into a snapshot
     READLOCK(mempool.cs_txmempool);
 
     CTxMemPool::txiter it = mempool.mapTx.find(paramhash);
@@ -426,10 +493,9 @@ UniValue getmempoolancestors(const UniValue &params, bool fHelp)
         UniValue o(UniValue::VOBJ);
         for (CTxMemPool::txiter ancestorIt : setAncestors)
         {
-            const CTxMemPoolEntry &e = *ancestorIt;
-            const uint256 &hash = e.GetTx().GetHash();
+            const uint256 &hash = ancestorIt->GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, ancestorIt);
             o.pushKV(hash.ToString(), info);
         }
         return o;
@@ -468,7 +534,9 @@ UniValue getmempooldescendants(const UniValue &params, bool fHelp)
 
     uint256 paramhash = ParseHashV(params[0], "parameter 1");
 
-    WRITELOCK(mempool.cs_txmempool);
+    // Only the entry and its relatives are looked at, so do it under the lock rather than copying the whole
+    // mempool into a snapshot.  Walking the descendants only reads the mempool, so a shared lock will do.
+    READLOCK(mempool.cs_txmempool);
 
     CTxMemPool::txiter it = mempool.mapTx.find(paramhash);
     if (it == mempool.mapTx.end())
@@ -496,10 +564,9 @@ UniValue getmempooldescendants(const UniValue &params, bool fHelp)
         UniValue o(UniValue::VOBJ);
         for (CTxMemPool::txiter descendantIt : setDescendants)
         {
-            const CTxMemPoolEntry &e = *descendantIt;
-            const uint256 &hash = e.GetTx().GetHash();
+            const uint256 &hash = descendantIt->GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, descendantIt);
             o.pushKV(hash.ToString(), info);
         }
         return o;
@@ -524,21 +591,16 @@ UniValue getmempoolentry(const UniValue &params, bool fHelp)
 
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
+    // Look up a single entry under the lock rather than copying the whole mempool into a snapshot
     READLOCK(mempool.cs_txmempool);
-
     CTxMemPool::txiter it = mempool.mapTx.find(hash);
     if (it == mempool.mapTx.end())
     {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    // Update the ancestor chain state if this transaction is part of
-    // an unconfirmed chain
-    mempool.UpdateTxnChainState(it);
-
-    const CTxMemPoolEntry &e = *it;
     UniValue info(UniValue::VOBJ);
-    entryToJSON(info, e);
+    entryToJSON(info, it);
     return info;
 }
 
@@ -968,6 +1030,85 @@ UniValue gettxoutsetinfo(const UniValue &params, bool fHelp)
     return ret;
 }
 
+static UniValue DBStatsToJSON(const CDBStats &stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("block_cache", (uint64_t)stats.nBlockCacheSize);
+    ret.pushKV("write_buffer", (uint64_t)stats.nWriteBufferSize);
+    ret.pushKV("block_size", (uint64_t)stats.nBlockSize);
+    ret.pushKV("max_file_size", (uint64_t)stats.nMaxFileSize);
+    ret.pushKV("bloom_bits", stats.nBloomBits);
+    ret.pushKV("memory_usage", stats.nMemoryUsage);
+    UniValue levels(UniValue::VARR);
+    for (const CDBLevelStats &level : stats.levels)
+    {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("level", level.nLevel);
+        obj.pushKV("files", level.nFiles);
+        obj.pushKV("size_mb", level.dSizeMB);
+        obj.pushKV("compaction_secs", level.dCompactionSecs);
+        obj.pushKV("compaction_read_mb", level.dCompactionReadMB);
+        obj.pushKV("compaction_write_mb", level.dCompactionWriteMB);
+        levels.push_back(obj);
+    }
+    ret.pushKV("levels", levels);
+    return ret;
+}
+
+UniValue dbstats(const UniValue &params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "dbstats\n"
+            "\nReturns the tuning and the internal statistics of the leveldb databases, per database.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {                (object) The UTXO database\n"
+            "    \"block_cache\": n,            (numeric) Size of the read cache in bytes\n"
+            "    \"write_buffer\": n,           (numeric) Size of each of the (up to two) write buffers in bytes\n"
+            "    \"block_size\": n,             (numeric) Size of the blocks that make up a table file\n"
+            "    \"max_file_size\": n,          (numeric) Size at which table files are split\n"
+            "    \"bloom_bits\": n,             (numeric) Bits per key of the bloom filter, 0 if there is none\n"
+            "    \"memory_usage\": n,           (numeric) Approximate memory in use by caches and write buffers\n"
+            "    \"levels\": [                  (array) Levels that have files or have seen compactions\n"
+            "      {\n"
+            "        \"level\": n,              (numeric) The level\n"
+            "        \"files\": n,              (numeric) Number of table files\n"
+            "        \"size_mb\": n,            (numeric) Size of the level in MiB\n"
+            "        \"compaction_secs\": n,    (numeric) Time spent compacting into this level\n"
+            "        \"compaction_read_mb\": n, (numeric) MiB read by those compactions\n"
+            "        \"compaction_write_mb\": n (numeric) MiB written by those compactions\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  },\n"
+            "  \"blocktree\": {...},            (object) The block index database, same fields\n"
+            "  \"txindex\": {...},              (object) The transaction index, if enabled, same fields\n"
+            "  \"writer\": {                    (object) The thread that writes block index and txindex updates\n"
+            "    \"queue_depth\": n,            (numeric) Batches waiting to be written\n"
+            "    \"queued_bytes\": n,           (numeric) Size of those batches\n"
+            "    \"batches\": n,                (numeric) Batches queued since startup\n"
+            "    \"writes\": n                  (numeric) Database writes they were merged into\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("dbstats", "") + HelpExampleRpc("dbstats", ""));
+
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.pushKV("chainstate", DBStatsToJSON(pcoinsdbview->GetDBStats()));
+    if (pblocktree)
+        ret.pushKV("blocktree", DBStatsToJSON(pblocktree->GetStats()));
+    if (g_txindex)
+        ret.pushKV("txindex", DBStatsToJSON(g_txindex->GetDBStats()));
+    UniValue writer(UniValue::VOBJ);
+    writer.pushKV("queue_depth", (uint64_t)dbWriter.QueueDepth());
+    writer.pushKV("queued_bytes", (uint64_t)dbWriter.QueuedBytes());
+    writer.pushKV("batches", dbWriter.TotalBatches());
+    writer.pushKV("writes", dbWriter.TotalWrites());
+    ret.pushKV("writer", writer);
+    return ret;
+}
+
 UniValue evicttransaction(const UniValue &params, bool fHelp)
 {
     if (fHelp || params.size() < 1)
@@ -1215,6 +1356,10 @@ UniValue getblockchaininfo(const UniValue &params, bool fHelp)
             "enabled)\n"
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic "
             "pruning is enabled)\n"
+            "  \"prune_depth\": xxxxxx,    (numeric) blocks this far below the tip are pruned regardless of size, 0 if "
+            "not (only present if pruning is enabled)\n"
+            "  \"prune_age\": xxxxxx,      (numeric) blocks this many seconds older than the tip are pruned regardless "
+            "of size, 0 if not (only present if pruning is enabled)\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1296,6 +1441,8 @@ UniValue getblockchaininfo(const UniValue &params, bool fHelp)
         }
 
         obj.pushKV("prune_target_size", nPruneTarget);
+        obj.pushKV("prune_depth", nPruneDepth);
+        obj.pushKV("prune_age", nPruneAge);
     }
 
     const Consensus::Params &consensusParams = Params().GetConsensus();
@@ -2345,7 +2492,7 @@ static const CRPCCommand commands[] = {
     {"blockchain", "getraworphanpool", &getraworphanpool, true}, {"blockchain", "gettxout", &gettxout, true},
     {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true}, {"blockchain", "savemempool", &savemempool, true},
     {"blockchain", "saveorphanpool", &saveorphanpool, true}, {"blockchain", "verifychain", &verifychain, true},
-    {"blockchain", "getblockstats", &getblockstats, true},
+    {"blockchain", "getblockstats", &getblockstats, true}, {"blockchain", "dbstats", &dbstats, true},
 
     /* Not shown in help */
     {"hidden", "invalidateblock", &invalidateblock, true}, {"hidden", "reconsiderblock", &reconsiderblock, true},
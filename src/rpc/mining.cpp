@@ -1014,19 +1014,48 @@ UniValue estimatesmartfee(const UniValue &params, bool fHelp)
                             "\nEstimates the approximate fee per kilobyte needed for a transaction to begin\n"
                             "confirmation within nblocks blocks.\n"
                             "\nArguments:\n"
-                            "1. nblocks     (numeric)\n"
+                            "1. nblocks     (numeric or array) a number of blocks, or an array of them to estimate\n"
+                            "               several targets at once\n"
                             "\nResult:\n"
                             "{\n"
                             "  \"feerate\" : x.x,     (numeric) estimate fee-per-kilobyte (in BCH)\n"
                             "  \"blocks\" : 1         (numeric) hardcoded to 1 for backwards compatibility reasons\n"
                             "}\n"
+                            "\nResult (for an array of nblocks):\n"
+                            "[\n"
+                            "  {\n"
+                            "    \"feerate\" : x.x,   (numeric) estimate fee-per-kilobyte (in BCH)\n"
+                            "    \"blocks\" : n       (numeric) the nblocks this estimate is for\n"
+                            "  }\n"
+                            "  ,...\n"
+                            "]\n"
                             "\n"
                             "A negative value is returned if not enough transactions and blocks\n"
                             "have been observed to make an estimate.\n"
-                            "\nExample:\n" +
-                            HelpExampleCli("estimatesmartfee", "6"));
+                            "\nExamples:\n" +
+                            HelpExampleCli("estimatesmartfee", "6") + HelpExampleCli("estimatesmartfee", "\"[1,2,6,25]\""));
 
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
+    if (!params[0].isNum() && !params[0].isArray())
+        throw JSONRPCError(RPC_TYPE_ERROR, "Expected a number or an array of numbers of blocks");
+
+    if (params[0].isArray())
+    {
+        const UniValue &targets = params[0].get_array();
+        std::vector<int> vBlocks;
+        for (unsigned int i = 0; i < targets.size(); i++)
+            vBlocks.push_back(std::max(targets[i].get_int(), 1));
+
+        std::vector<CFeeRate> vFeeRates = mempool.estimateFees(vBlocks);
+        UniValue result(UniValue::VARR);
+        for (unsigned int i = 0; i < vBlocks.size(); i++)
+        {
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("feerate", vFeeRates[i] == CFeeRate(0) ? -1.0 : ValueFromAmount(vFeeRates[i].GetFeePerK()));
+            entry.pushKV("blocks", vBlocks[i]);
+            result.push_back(entry);
+        }
+        return result;
+    }
 
     int nBlocks = params[0].get_int();
     if (nBlocks < 1)
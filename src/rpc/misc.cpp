@@ -73,6 +73,8 @@ UniValue getinfo(const UniValue &params, bool fHelp)
             "  \"relayfee\": x.xxxx,         (numeric) minimum relay fee for non-free transactions in " +
             CURRENCY_UNIT +
             "/kB\n"
+            "  \"logdropped\": xxxx,         (numeric) how many debug.log lines were dropped because the log writer "
+            "thread fell behind\n"
             "  \"status\":\"...\"            (string) long running operations are indicated here (rescan).\n"
             "  \"errors\": \"...\"           (string) any error messages\n"
             "  \"fork\": \"...\"             (string) \"Member\" or \"Bitcoin\".  Will display as Member "
@@ -126,6 +128,7 @@ UniValue getinfo(const UniValue &params, bool fHelp)
     obj.pushKV("paytxfee", ValueFromAmount(payTxFee.GetFeePerK()));
 #endif
     obj.pushKV("relayfee", ValueFromAmount(::minRelayTxFee.GetFeePerK()));
+    obj.pushKV("logdropped", GetLogDropped());
     obj.pushKV("status", statusStrings.GetPrintable());
     obj.pushKV("txindex", IsTxIndexReady() ? "synced" : "not ready");
     obj.pushKV("errors", GetWarnings("statusbar"));
@@ -6,7 +6,9 @@
 #include "rpc/server.h"
 
 #include "blockrelay/graphene.h"
+#include "blockrelay/mempool_sync.h"
 #include "blockrelay/thinblock.h"
+#include "blockstorage/blockserving.h"
 #include "chainparams.h"
 #include "clientversion.h"
 #include "dosman.h"
@@ -159,6 +161,11 @@ UniValue getpeerinfo(const UniValue &params, bool fHelp)
             "    ]\n"
             "    \"whitelisted\": true|false,     (boolean) Whether we have whitelisted this peer, preventing us from "
             "banning the node due to misbehavior, though we may still disconnect it\n"
+            "    \"txrelay\": \"flood\"|\"reconcile\"|\"flood+reconcile\", (string) How transactions are announced to "
+            "this peer\n"
+            "    \"txannouncebytessent\": n,      (numeric) Bytes of transaction invs and reconciliation messages sent\n"
+            "    \"txannouncebytesrecv\": n,      (numeric) Bytes of transaction invs and reconciliation messages "
+            "received\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -224,6 +231,12 @@ UniValue getpeerinfo(const UniValue &params, bool fHelp)
                 obj.pushKV("inflight", heights);
             }
             obj.pushKV("whitelisted", stats.fWhitelisted);
+            if (!stats.fTxReconciliation)
+                obj.pushKV("txrelay", "flood");
+            else
+                obj.pushKV("txrelay", stats.fTxReconFlood ? "flood+reconcile" : "reconcile");
+            obj.pushKV("txannouncebytessent", stats.nTxAnnounceBytesSent);
+            obj.pushKV("txannouncebytesrecv", stats.nTxAnnounceBytesRecv);
 
             CNodeRef snode = FindLikelyNode(stats.addrName);
 
@@ -454,6 +467,15 @@ UniValue getnettotals(const UniValue &params, bool fHelp)
             "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
             "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  },\n"
+            "  \"blockserving\": {\n"
+            "    \"blocks\": n,                            (numeric) Blocks read from disk and sent to peers\n"
+            "    \"bytes\": n,                             (numeric) Size of those blocks\n"
+            "    \"readahead_blocks\": n,                  (numeric) Requested blocks that were read ahead\n"
+            "    \"readahead_bytes\": n,                   (numeric) Bytes the OS was asked to read ahead\n"
+            "    \"read_waits\": n,                        (numeric) Block reads that waited for their turn\n"
+            "    \"read_wait_ms\": n,                      (numeric) Total time spent waiting for a turn to read\n"
+            "    \"max_concurrent_reads\": n               (numeric) Most block reads that ran at once\n"
             "  }\n"
             "}\n"
             "\nExamples:\n" +
@@ -472,6 +494,17 @@ UniValue getnettotals(const UniValue &params, bool fHelp)
     outboundLimit.pushKV("bytes_left_in_cycle", CNode::GetOutboundTargetBytesLeft());
     outboundLimit.pushKV("time_left_in_cycle", CNode::GetMaxOutboundTimeLeftInCycle());
     obj.pushKV("uploadtarget", outboundLimit);
+
+    const CBlockServer::Stats stats = blockServer.GetStats();
+    UniValue serving(UniValue::VOBJ);
+    serving.pushKV("blocks", stats.nBlocks);
+    serving.pushKV("bytes", stats.nBytes);
+    serving.pushKV("readahead_blocks", stats.nReadAheadBlocks);
+    serving.pushKV("readahead_bytes", stats.nReadAheadBytes);
+    serving.pushKV("read_waits", stats.nReadWaits);
+    serving.pushKV("read_wait_ms", stats.nReadWaitMicros / 1000);
+    serving.pushKV("max_concurrent_reads", (uint64_t)stats.nMaxConcurrentReads);
+    obj.pushKV("blockserving", serving);
     return obj;
 }
 
@@ -540,6 +573,15 @@ static UniValue GetGrapheneStats()
     return obj;
 }
 
+static UniValue GetMempoolSyncStats()
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("summary", mempoolsyncdata.ToString());
+    obj.pushKV("graphene_bytes_per_missing_tx", mempoolsyncdata.BytesPerMissingTx(false));
+    obj.pushKV("rateless_bytes_per_missing_tx", mempoolsyncdata.BytesPerMissingTx(true));
+    return obj;
+}
+
 static UniValue GetCompactBlockStats()
 {
     UniValue obj(UniValue::VOBJ);
@@ -610,6 +652,7 @@ UniValue getnetworkinfo(const UniValue &params, bool fHelp)
             "  \"thinblockstats\": \"...\"              (string) thin block related statistics \n"
             "  \"compactblockstats\": \"...\"           (string) compact block related statistics \n"
             "  \"grapheneblockstats\": \"...\"          (string) graphene block related statistics \n"
+            "  \"mempoolsyncstats\": \"...\"            (string) mempool sync reconciliation statistics \n"
             "  \"warnings\": \"...\"                    (string) any network warnings (such as alert messages) \n"
             "}\n"
             "\nExamples:\n" +
@@ -647,6 +690,7 @@ UniValue getnetworkinfo(const UniValue &params, bool fHelp)
     obj.pushKV("thinblockstats", GetThinBlockStats());
     obj.pushKV("compactblockstats", GetCompactBlockStats());
     obj.pushKV("grapheneblockstats", GetGrapheneStats());
+    obj.pushKV("mempoolsyncstats", GetMempoolSyncStats());
     obj.pushKV("warnings", GetWarnings("statusbar"));
     return obj;
 }
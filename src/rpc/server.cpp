@@ -159,7 +159,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     {"getmempoolancestors", 1},
     {"getmempooldescendants", 1},
     {"getrawtransactionssince", 1},
-    {"getblockstats", 1}
+    {"getblockstats", 1},
+    {"getlockstats", 0},
+    {"getlockstats", 1},
+    {"getlockstats", 2},
+    {"getpipelinestats", 0},
+    {"getpipelinetrace", 1}
 };
 /* clang-format on */
 
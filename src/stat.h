@@ -8,8 +8,11 @@
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/bind/bind.hpp>
+#include <atomic>
 #include <chrono>
-// c++11 #include <type_traits>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
 #include "univalue/include/univalue.h"
 
 #include "sync.h"
@@ -62,6 +65,46 @@ void statReset(NUM &tally, uint64_t flags)
 }
 
 
+/**
+ * Append the sample "metric{labels} value" to out, in the Prometheus text exposition format.  labels may be empty.
+ * Numbers are formatted straight into out, so the only allocations are out growing.
+ */
+template <typename NUM>
+void AppendMetric(std::string &out, const std::string &metric, const char *labels, const NUM &value)
+{
+    out.append(metric);
+    if (labels[0])
+    {
+        out.push_back('{');
+        out.append(labels);
+        out.push_back('}');
+    }
+    out.push_back(' ');
+    char buf[32];
+    int n;
+    if (std::is_floating_point<NUM>::value)
+    {
+        const double d = (double)value;
+        if (std::isnan(d))
+            n = snprintf(buf, sizeof(buf), "NaN");
+        else if (std::isinf(d))
+            n = snprintf(buf, sizeof(buf), d > 0 ? "+Inf" : "-Inf");
+        else
+            n = snprintf(buf, sizeof(buf), "%.17g", d);
+    }
+    else if (std::is_signed<NUM>::value)
+        n = snprintf(buf, sizeof(buf), "%lld", (long long)value);
+    else
+        n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+    out.append(buf, n);
+    out.push_back('\n');
+}
+
+template <class NUM>
+class MinValMax;
+template <typename NUM>
+void AppendMetric(std::string &out, const std::string &metric, const char *labels, const MinValMax<NUM> &value);
+
 class CStatBase
 {
 public:
@@ -72,6 +115,9 @@ public:
     virtual UniValue GetSeries(const std::string &_name, int count) = 0; // Returns the historical or series data
     // Returns the historical or series data along with timestamp
     virtual UniValue GetSeriesTime(const std::string &_namep, int count) = 0;
+    /** Append the samples of this statistic to out as the Prometheus metric of that name, each sample carrying the
+     * labels given (which may be empty) ahead of its own */
+    virtual void WriteMetrics(std::string &out, const std::string &metric, const std::string &labels) = 0;
 };
 
 template <class DataType, class RecordType = DataType>
@@ -142,6 +188,10 @@ public:
 
     RecordType &operator()() { return value; }
     virtual UniValue GetNow() { return UniValue(value); }
+    virtual void WriteMetrics(std::string &out, const std::string &metric, const std::string &labels)
+    {
+        AppendMetric(out, metric, labels.c_str(), value);
+    }
     virtual UniValue GetTotal() { return NullUniValue; }
     virtual UniValue GetSeries(const std::string &_name, int count)
     {
@@ -176,6 +226,74 @@ enum
 {
     STATISTICS_NUM_RANGES = 5,
     STATISTICS_SAMPLES = 300,
+    STATISTICS_SHARDS = 16, // summed statistics are counted in this many separate cells
+};
+
+/** The cell of a sharded statistic the calling thread counts in.  Threads are dealt out to the cells in turn. */
+inline unsigned int StatShard()
+{
+    static std::atomic<unsigned int> nNextShard{0};
+    thread_local unsigned int nShard = nNextShard++ % STATISTICS_SHARDS;
+    return nShard;
+}
+
+/**
+ * A sum that threads add to without locking and without fighting over a cache line: every thread adds to its own
+ * cell, and reading the sum adds the cells up.  Only integers can be summed this way, for other types this is
+ * never used.
+ */
+template <typename NUM, bool fIntegral = std::is_integral<NUM>::value>
+class CStatShards
+{
+public:
+    static const bool enabled = false;
+    template <typename T>
+    void Add(const T &rhs)
+    {
+    }
+    template <typename T>
+    void Sub(const T &rhs)
+    {
+    }
+    NUM Sum() const { return NUM(); }
+    NUM Drain() { return NUM(); }
+};
+
+template <typename NUM>
+class CStatShards<NUM, true>
+{
+protected:
+    struct Shard
+    {
+        std::atomic<NUM> n;
+        char padding[64 - sizeof(std::atomic<NUM>)]; // one cache line per cell
+    };
+    Shard shards[STATISTICS_SHARDS];
+
+public:
+    static const bool enabled = true;
+    CStatShards()
+    {
+        for (Shard &shard : shards)
+            shard.n = 0;
+    }
+    void Add(const NUM &rhs) { shards[StatShard()].n.fetch_add(rhs, std::memory_order_relaxed); }
+    void Sub(const NUM &rhs) { shards[StatShard()].n.fetch_sub(rhs, std::memory_order_relaxed); }
+    NUM Sum() const
+    {
+        NUM sum = 0;
+        for (const Shard &shard : shards)
+            sum += shard.n.load(std::memory_order_relaxed);
+        return sum;
+    }
+    /** Return the sum and zero the cells, without losing what is added meanwhile */
+    NUM Drain()
+    {
+        NUM sum = 0;
+        for (Shard &shard : shards)
+            sum += shard.n.exchange(0, std::memory_order_relaxed);
+        return sum;
+    }
 };
 
 template <class DataType, class RecordType = DataType>
@@ -193,22 +311,32 @@ protected:
     std::chrono::steady_clock::time_point timerStartSteady;
     unsigned int sampleCount;
     RecordType total;
+    //! summed integer statistics are counted here without taking cs_statHistory, and folded into value on reads
+    CStatShards<RecordType, std::is_integral<RecordType>::value && std::is_same<DataType, RecordType>::value> shards;
+
+    bool Sharded() const { return shards.enabled && (op & STAT_OP_SUM) && !(op & STAT_INDIVIDUAL); }
+    void Fold()
+    {
+        if (Sharded())
+            this->value += shards.Drain();
+    }
 
 public:
     CStatHistory() : CStat<DataType, RecordType>(), op(STAT_OP_SUM | STAT_KEEP_COUNT), timer(stat_io_service)
     {
         Clear(false);
     }
+    // Registered only once every member exists, so a scrape of the statistics map never sees a half built history
     CStatHistory(const char *_name, unsigned int operation = STAT_OP_SUM)
-        : CStat<DataType, RecordType>(_name), op(operation), timer(stat_io_service)
+        : CStat<DataType, RecordType>(), op(operation), timer(stat_io_service)
     {
-        Clear();
+        init(_name, operation);
     }
 
     CStatHistory(const std::string &_name, unsigned int operation = STAT_OP_SUM)
-        : CStat<DataType, RecordType>(_name), op(operation), timer(stat_io_service)
+        : CStat<DataType, RecordType>(), op(operation), timer(stat_io_service)
     {
-        Clear();
+        init(_name, operation);
     }
 
     void init(const char *_name, unsigned int operation = STAT_OP_SUM)
@@ -242,6 +370,7 @@ public:
                     historyTime[i][j] = 0;
                 }
             total = RecordType();
+            shards.Drain();
             this->value = RecordType();
         }
 
@@ -251,11 +380,86 @@ public:
 
     virtual ~CStatHistory()
     {
+        // Unregister before any member goes away, since a scrape may be in WriteMetrics until cs_statMap is released
+        if (this->name.size())
+            this->cleanup();
         op |= STAT_DELETED;
         Stop();
     }
+    CStatHistory &operator=(const DataType &arg)
+    {
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        shards.Drain();
+        this->value = arg;
+        return *this;
+    }
+
+    CStatHistory &operator+=(const DataType &rhs)
+    {
+        if (Sharded())
+        {
+            shards.Add(rhs);
+            return *this;
+        }
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        this->value += rhs;
+        return *this;
+    }
+
+    CStatHistory &operator-=(const DataType &rhs)
+    {
+        if (Sharded())
+        {
+            shards.Sub(rhs);
+            return *this;
+        }
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        this->value -= rhs;
+        return *this;
+    }
+
+    RecordType &operator()()
+    {
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        Fold();
+        return this->value;
+    }
+
+    virtual UniValue GetNow()
+    {
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        Fold();
+        return UniValue(this->value);
+    }
+
+    /** The current value, the total and the latest sample of every series that has one, each labeled by series */
+    virtual void WriteMetrics(std::string &out, const std::string &metric, const std::string &labels)
+    {
+        const std::string prefix = labels.empty() ? labels : labels + ",";
+        std::lock_guard<std::mutex> lock(cs_statHistory);
+        Fold();
+        AppendMetric(out, metric, (prefix + "series=\"now\"").c_str(), this->value);
+        if ((op & STAT_OP_AVE) && (timerCount != 0))
+            AppendMetric(out, metric, (prefix + "series=\"total\"").c_str(), total / timerCount);
+        else
+            AppendMetric(out, metric, (prefix + "series=\"total\"").c_str(), total);
+        for (int series = 0; series < STATISTICS_NUM_RANGES; series++)
+        {
+            if (len[series] == 0)
+                continue;
+            AppendMetric(out, metric, (prefix + "series=\"" + sampleNames[series] + "\"").c_str(), _History(series, 0));
+        }
+    }
+
     CStatHistory &operator<<(const DataType &rhs)
     {
+        // Sums are counted without a lock
+        if (Sharded())
+        {
+            shards.Add(rhs);
+            return *this;
+        }
+
         // If each call is an individual datapoint, simulate a timeout every time data arrives to advance.
         if (op & STAT_INDIVIDUAL)
             timeout(boost::system::error_code());
@@ -454,6 +658,8 @@ public:
         if ((op & STAT_DELETED) > 0)
             return;
 
+        Fold();
+
         // To avoid taking a mutex, I sample and compare.  This sort of thing isn't perfect but acceptable for
         // statistics calc.  NOTE: a mutex is needed to fix timeouts after destruction.  But leaving this sampling
         // code in until we analyze the performance hit of having one, because it should be possible to keep this
@@ -686,6 +892,16 @@ public:
     }
 };
 
+/** A MinValMax is three samples, told apart by a field label */
+template <typename NUM>
+void AppendMetric(std::string &out, const std::string &metric, const char *labels, const MinValMax<NUM> &value)
+{
+    const std::string prefix = labels[0] ? std::string(labels) + "," : std::string();
+    AppendMetric(out, metric, (prefix + "field=\"min\"").c_str(), value.min);
+    AppendMetric(out, metric, (prefix + "field=\"val\"").c_str(), value.val);
+    AppendMetric(out, metric, (prefix + "field=\"max\"").c_str(), value.max);
+}
+
 template <typename NUM>
 void statAverage(MinValMax<NUM> &tally, const NUM &cur, unsigned int sampleCounts)
 {
@@ -9,8 +9,14 @@
 #include "utilstrencodings.h"
 
 #include <boost/thread/tss.hpp> // for boost::thread_specific_ptr
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
 #include <stdio.h>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
 
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char *pszName, const char *pszFile, unsigned int nLine)
@@ -20,6 +26,175 @@ void PrintLockContention(const char *pszName, const char *pszFile, unsigned int
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+std::atomic<bool> fLockProfiling{false};
+
+namespace
+{
+/** A lock site is identified by where the LOCK macro is, __FILE__ is a string literal so its address will do */
+struct LockSiteKey
+{
+    const char *file;
+    unsigned int line;
+    bool operator==(const LockSiteKey &other) const { return file == other.file && line == other.line; }
+};
+
+struct LockSiteKeyHasher
+{
+    size_t operator()(const LockSiteKey &key) const { return std::hash<const void *>()(key.file) ^ key.line; }
+};
+
+struct LockSiteCounts
+{
+    const char *name = nullptr;
+    uint64_t nCount = 0;
+    uint64_t nContended = 0;
+    uint64_t nWaitNanos = 0;
+    uint64_t nMaxWaitNanos = 0;
+    uint64_t nHoldNanos = 0;
+
+    void Add(const LockSiteCounts &other)
+    {
+        nCount += other.nCount;
+        nContended += other.nContended;
+        nWaitNanos += other.nWaitNanos;
+        nMaxWaitNanos = std::max(nMaxWaitNanos, other.nMaxWaitNanos);
+        nHoldNanos += other.nHoldNanos;
+    }
+};
+
+typedef std::unordered_map<LockSiteKey, LockSiteCounts, LockSiteKeyHasher> LockSiteMap;
+
+/**
+ * The lock statistics of one thread.  Only that thread writes to them, its mutex is only ever contended while
+ * getlockstats reads them.
+ */
+struct ThreadLockStats
+{
+    std::mutex mtx;
+    LockSiteMap sites;
+};
+
+/**
+ * All threads' lock statistics, and those of the threads that ended.  This is never destroyed, as threads may
+ * still take locks while static objects are being destroyed at shutdown.
+ */
+struct LockStatsRegistry
+{
+    std::mutex mtx;
+    std::set<ThreadLockStats *> setThreads;
+    LockSiteMap sitesExited;
+};
+
+LockStatsRegistry &GetLockStatsRegistry()
+{
+    static LockStatsRegistry *registry = new LockStatsRegistry();
+    return *registry;
+}
+
+//! locks taken by destructors of other thread locals can come by after this thread's statistics are gone
+thread_local bool fThreadLockStatsGone = false;
+
+/** Registers the statistics of its thread while it lives, and keeps what they hold once it ends */
+class ThreadLockStatsHolder
+{
+public:
+    ThreadLockStats stats;
+
+    ThreadLockStatsHolder()
+    {
+        LockStatsRegistry &registry = GetLockStatsRegistry();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        registry.setThreads.insert(&stats);
+    }
+    ~ThreadLockStatsHolder()
+    {
+        fThreadLockStatsGone = true;
+        LockStatsRegistry &registry = GetLockStatsRegistry();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        registry.setThreads.erase(&stats);
+        std::lock_guard<std::mutex> lockStats(stats.mtx);
+        for (const auto &site : stats.sites)
+        {
+            LockSiteCounts &counts = registry.sitesExited[site.first];
+            counts.name = site.second.name;
+            counts.Add(site.second);
+        }
+    }
+};
+
+thread_local ThreadLockStatsHolder threadLockStats;
+} // namespace
+
+void RecordLockSite(const char *pszName,
+    const char *pszFile,
+    unsigned int nLine,
+    bool fContended,
+    uint64_t nWaitNanos,
+    uint64_t nHoldNanos)
+{
+    if (fThreadLockStatsGone)
+        return;
+    ThreadLockStats &stats = threadLockStats.stats;
+    std::lock_guard<std::mutex> lock(stats.mtx);
+    LockSiteCounts &counts = stats.sites[LockSiteKey{pszFile, nLine}];
+    counts.name = pszName;
+    counts.nCount++;
+    counts.nContended += fContended;
+    counts.nWaitNanos += nWaitNanos;
+    counts.nMaxWaitNanos = std::max(counts.nMaxWaitNanos, nWaitNanos);
+    counts.nHoldNanos += nHoldNanos;
+}
+
+std::vector<CLockSiteStats> GetLockStats(bool fByLock)
+{
+    // Merge by name and location rather than by the address of the file name, as a LOCK in a header has a copy of
+    // __FILE__ in every translation unit that uses it
+    std::map<std::tuple<std::string, std::string, unsigned int>, LockSiteCounts> mapMerged;
+    auto merge = [&mapMerged, fByLock](const LockSiteMap &sites) {
+        for (const auto &site : sites)
+        {
+            const std::string name = site.second.name ? site.second.name : "";
+            auto key = fByLock ? std::make_tuple(name, std::string(), 0u) :
+                                 std::make_tuple(name, std::string(site.first.file), site.first.line);
+            mapMerged[key].Add(site.second);
+        }
+    };
+    {
+        LockStatsRegistry &registry = GetLockStatsRegistry();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        merge(registry.sitesExited);
+        for (ThreadLockStats *stats : registry.setThreads)
+        {
+            std::lock_guard<std::mutex> lockStats(stats->mtx);
+            merge(stats->sites);
+        }
+    }
+
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(mapMerged.size());
+    for (const auto &item : mapMerged)
+    {
+        const LockSiteCounts &counts = item.second;
+        vStats.push_back(CLockSiteStats{std::get<0>(item.first), std::get<1>(item.first), std::get<2>(item.first),
+            counts.nCount, counts.nContended, counts.nWaitNanos, counts.nMaxWaitNanos, counts.nHoldNanos});
+    }
+    std::sort(vStats.begin(), vStats.end(),
+        [](const CLockSiteStats &a, const CLockSiteStats &b) { return a.nWaitNanos > b.nWaitNanos; });
+    return vStats;
+}
+
+void ResetLockStats()
+{
+    LockStatsRegistry &registry = GetLockStatsRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.sitesExited.clear();
+    for (ThreadLockStats *stats : registry.setThreads)
+    {
+        std::lock_guard<std::mutex> lockStats(stats->mtx);
+        stats->sites.clear();
+    }
+}
+
 #ifdef DEBUG_LOCKORDER // this ifdef covers the rest of the file
 
 void EnterCritical(const char *pszName,
@@ -20,6 +20,10 @@
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/thread.hpp>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 
 /**
  * Template mixin that adds -Wthread-safety locking
@@ -238,6 +242,37 @@ void PrintLockContention(const char *pszName, const char *pszFile, unsigned int
 
 #define LOCK_WARN_TIME (500ULL * 1000ULL * 1000ULL)
 
+/**
+ * Lock contention profiling, switched on and off at runtime with the debug.lockProfiling tweak.  While it is on,
+ * every lock taken through the LOCK, READLOCK and WRITELOCK macros adds how long it waited for the lock and how
+ * long it held it to the statistics of its lock site, in a buffer of the thread that took it.  Condition variable
+ * waits through CMutexLock::Wait are not counted as holding the lock.  getlockstats merges them.  While it is off,
+ * taking a lock costs one relaxed load more.
+ */
+extern std::atomic<bool> fLockProfiling;
+void RecordLockSite(const char *pszName,
+    const char *pszFile,
+    unsigned int nLine,
+    bool fContended,
+    uint64_t nWaitNanos,
+    uint64_t nHoldNanos);
+
+/** What happened at one lock site, or to one lock over all its sites, since profiling was last reset */
+struct CLockSiteStats
+{
+    std::string name;
+    std::string file; //!< empty when this covers all sites of the lock
+    unsigned int line;
+    uint64_t nCount; //!< acquisitions
+    uint64_t nContended; //!< acquisitions that found the lock taken
+    uint64_t nWaitNanos;
+    uint64_t nMaxWaitNanos;
+    uint64_t nHoldNanos;
+};
+/** The statistics of every lock site, or of every lock if fByLock, ordered by total wait time */
+std::vector<CLockSiteStats> GetLockStats(bool fByLock);
+void ResetLockStats();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -252,6 +287,21 @@ private:
     const char *name = "unknown-name";
     const char *file = "unknown-file";
     unsigned int line = 0;
+    //! set when the lock was taken while profiling, see fLockProfiling
+    uint64_t nProfileLocked = 0;
+    uint64_t nProfileWait = 0;
+    bool fProfileContended = false;
+
+    template <typename Lock>
+    void ProfileEnter(Lock &l)
+    {
+        const uint64_t nStart = GetStopwatch();
+        fProfileContended = !l.try_lock();
+        if (fProfileContended)
+            l.lock();
+        nProfileLocked = GetStopwatch();
+        nProfileWait = nProfileLocked - nStart;
+    }
 
     void Enter(const char *pszName, const char *pszFile, unsigned int nLine, LockType type)
     {
@@ -262,15 +312,20 @@ private:
         file = pszFile;
         line = nLine;
         EnterCritical(pszName, pszFile, nLine, (void *)(lock.mutex()), type, OwnershipType::EXCLUSIVE, false);
-#ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock())
+        if (fLockProfiling.load(std::memory_order_relaxed))
+            ProfileEnter(lock);
+        else
         {
-            PrintLockContention(pszName, pszFile, nLine);
+#ifdef DEBUG_LOCKCONTENTION
+            if (!lock.try_lock())
+            {
+                PrintLockContention(pszName, pszFile, nLine);
 #endif
-            lock.lock();
+                lock.lock();
 #ifdef DEBUG_LOCKCONTENTION
-        }
+            }
 #endif
+        }
 
 #ifdef DEBUG_LOCKTIME
         lockedTime = GetStopwatch();
@@ -288,6 +343,8 @@ private:
         line = nLine;
         EnterCritical(pszName, pszFile, nLine, (void *)(lock.mutex()), type, OwnershipType::EXCLUSIVE, true);
         lock.try_lock();
+        if (lock.owns_lock() && fLockProfiling.load(std::memory_order_relaxed))
+            nProfileLocked = GetStopwatch();
         if (!lock.owns_lock())
         {
 #ifdef DEBUG_LOCKTIME
@@ -344,6 +401,9 @@ public:
     {
         if (lock.owns_lock())
         {
+            if (nProfileLocked)
+                RecordLockSite(
+                    name, file, line, fProfileContended, nProfileWait, GetStopwatch() - nProfileLocked);
             LeaveCritical((void *)(lock.mutex()));
 #ifdef DEBUG_LOCKTIME
             uint64_t doneTime = GetStopwatch();
@@ -355,6 +415,23 @@ public:
         }
     }
 
+    /**
+     * Wait on cond, releasing the lock while waiting.  The wait does not count towards how long the lock was held,
+     * so use this rather than waiting on the mutex directly.
+     */
+    template <typename Cond>
+    void Wait(Cond &cond)
+    {
+        const uint64_t nWaitStart = GetStopwatch();
+        cond.wait(lock);
+        const uint64_t nWaited = GetStopwatch() - nWaitStart;
+        if (nProfileLocked)
+            nProfileLocked += nWaited;
+#ifdef DEBUG_LOCKTIME
+        lockedTime += nWaited;
+#endif
+    }
+
     operator bool() { return lock.owns_lock(); }
 };
 
@@ -372,6 +449,21 @@ private:
     const char *name = "unknown-name";
     const char *file = "unknown-file";
     unsigned int line = 0;
+    //! set when the lock was taken while profiling, see fLockProfiling
+    uint64_t nProfileLocked = 0;
+    uint64_t nProfileWait = 0;
+    bool fProfileContended = false;
+
+    template <typename Lock>
+    void ProfileEnter(Lock &l)
+    {
+        const uint64_t nStart = GetStopwatch();
+        fProfileContended = !l.try_lock();
+        if (fProfileContended)
+            l.lock();
+        nProfileLocked = GetStopwatch();
+        nProfileWait = nProfileLocked - nStart;
+    }
 
     void Enter(const char *pszName, const char *pszFile, unsigned int nLine, LockType type)
     {
@@ -383,15 +475,20 @@ private:
         line = nLine;
         EnterCritical(pszName, pszFile, nLine, (void *)(lock.mutex()), type, OwnershipType::SHARED, false);
 // LOG(LCK,"try ReadLock %p %s by %d\n", lock.mutex(), name ? name : "", boost::this_thread::get_id());
-#ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock())
+        if (fLockProfiling.load(std::memory_order_relaxed))
+            ProfileEnter(lock);
+        else
         {
-            PrintLockContention(pszName, pszFile, nLine);
+#ifdef DEBUG_LOCKCONTENTION
+            if (!lock.try_lock())
+            {
+                PrintLockContention(pszName, pszFile, nLine);
 #endif
-            lock.lock();
+                lock.lock();
 #ifdef DEBUG_LOCKCONTENTION
-        }
+            }
 #endif
+        }
 // LOG(LCK,"ReadLock %p %s taken by %d\n", lock.mutex(), name ? name : "", boost::this_thread::get_id());
 #ifdef DEBUG_LOCKTIME
         lockedTime = GetStopwatch();
@@ -408,7 +505,12 @@ private:
         file = pszFile;
         line = nLine;
         EnterCritical(pszName, pszFile, nLine, (void *)(lock.mutex()), type, OwnershipType::SHARED, true);
-        if (!lock.try_lock())
+        if (lock.try_lock())
+        {
+            if (fLockProfiling.load(std::memory_order_relaxed))
+                nProfileLocked = GetStopwatch();
+        }
+        else
         {
 #ifdef DEBUG_LOCKTIME
             lockedTime = 0;
@@ -464,6 +566,9 @@ public:
     {
         if (lock.owns_lock())
         {
+            if (nProfileLocked)
+                RecordLockSite(
+                    name, file, line, fProfileContended, nProfileWait, GetStopwatch() - nProfileLocked);
             LeaveCritical((void *)(lock.mutex()));
 #ifdef DEBUG_LOCKTIME
             int64_t doneTime = GetStopwatch();
@@ -642,7 +747,7 @@ public:
     /** Enter a region.  Block until it is possible */
     void Enter(int region)
     {
-        LOCK(mutex);
+        CCriticalBlock lock(mutex, "mutex", __FILE__, __LINE__, LockType::RECURSIVE_MUTEX);
         while (1)
         {
             // If no region is running and I'm the biggest requested region, then run my region
@@ -663,7 +768,7 @@ public:
             {
                 if (region > maxRequestedRegion)
                     maxRequestedRegion = region;
-                cond.wait(mutex);
+                lock.Wait(cond);
             }
         }
     }
@@ -0,0 +1,358 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "blockstorage/blockfilemap.h"
+#include "blockstorage/blockserving.h"
+#include "blockstorage/blocklz.h"
+#include "blockstorage/coldfiles.h"
+#include "blockstorage/sequential_files.h"
+#include "chainparams.h"
+#include "main.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+
+extern CCriticalSection cs_LastBlockFile;
+extern std::set<int> setDirtyFileInfo;
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, TestingSetup)
+
+static std::vector<char> Serialized(const CBlock &block)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    return std::vector<char>(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(mapped_block_reads)
+{
+    const CChainParams &params = Params();
+    const CBlock &genesis = params.GenesisBlock();
+    const int nFile = 7;
+
+    CDiskBlockPos pos1(nFile, 0);
+    BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos1, params.MessageStart()));
+
+    int nLastBlockFileSaved;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFileSaved = nLastBlockFile;
+        nLastBlockFile = nFile;
+    }
+
+    // the file we are appending to is never mapped
+    CRawBlock raw;
+    BOOST_CHECK(!ReadRawBlockFromDiskSequential(raw, pos1));
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDiskSequential(block, pos1, params.GetConsensus()));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+
+    // once it is finalized it is, and blocks come straight out of the mapping
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nFile + 1;
+    }
+    blockFileMaps.Clear();
+    BOOST_CHECK(ReadRawBlockFromDiskSequential(raw, pos1));
+    BOOST_CHECK(std::vector<char>(raw.data(), raw.data() + raw.size()) == Serialized(genesis));
+    BOOST_CHECK_EQUAL(blockFileMaps.size(), 1);
+    block.SetNull();
+    BOOST_CHECK(ReadBlockFromDiskSequential(block, pos1, params.GetConsensus()));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+
+    // a file that grew after it was mapped is mapped again
+    CDiskBlockPos pos2(nFile, pos1.nPos + Serialized(genesis).size());
+    BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos2, params.MessageStart()));
+    BOOST_CHECK(pos2.nPos > pos1.nPos);
+    CRawBlock raw2;
+    BOOST_CHECK(ReadRawBlockFromDiskSequential(raw2, pos2));
+    BOOST_CHECK(std::vector<char>(raw2.data(), raw2.data() + raw2.size()) == Serialized(genesis));
+
+    // a raw block keeps its mapping alive after the file is forgotten
+    blockFileMaps.Forget(nFile);
+    BOOST_CHECK_EQUAL(blockFileMaps.size(), 0);
+    BOOST_CHECK(std::vector<char>(raw.data(), raw.data() + raw.size()) == Serialized(genesis));
+
+    // undo data is read through the mapping as well, including its checksum
+    CBlockUndo undo;
+    undo.vtxundo.resize(2);
+    CDiskBlockPos undoPos(nFile, 0);
+    BOOST_CHECK(WriteUndoToDiskSequenatial(undo, undoPos, genesis.GetHash(), params.MessageStart()));
+    CBlockUndo undo2;
+    BOOST_CHECK(ReadUndoFromDiskSequential(undo2, undoPos, genesis.GetHash()));
+    BOOST_CHECK_EQUAL(undo2.vtxundo.size(), 2);
+    BOOST_CHECK(!ReadUndoFromDiskSequential(undo2, undoPos, uint256()));
+
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nLastBlockFileSaved;
+    }
+    blockFileMaps.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(single_tx_reads)
+{
+    const CChainParams &params = Params();
+    const CBlock &genesis = params.GenesisBlock();
+    const int nFile = 8;
+
+    CDiskBlockPos pos(nFile, 0);
+    BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos, params.MessageStart()));
+    CBlockTxOffsets offsets(genesis);
+    BOOST_CHECK_EQUAL(offsets.vOffsets.size(), genesis.vtx.size());
+    BOOST_CHECK(offsets.vShortIds[0] == genesis.vtx[0]->GetHash().GetCheapHash());
+
+    int nLastBlockFileSaved;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFileSaved = nLastBlockFile;
+    }
+    // read through stdio while the file is still being appended to, then through its mapping
+    for (int nLast : {nFile, nFile + 1})
+    {
+        {
+            LOCK(cs_LastBlockFile);
+            nLastBlockFile = nLast;
+        }
+        CBlockHeader header;
+        CTransactionRef ptx;
+        BOOST_CHECK(ReadTxFromDiskSequential(CDiskTxPos(pos, offsets.vOffsets[0]), header, ptx));
+        BOOST_CHECK(header.GetHash() == genesis.GetHash());
+        BOOST_CHECK(ptx && ptx->GetHash() == genesis.vtx[0]->GetHash());
+    }
+
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nLastBlockFileSaved;
+    }
+    blockFileMaps.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(block_compression)
+{
+    std::vector<char> raw = Serialized(Params().GenesisBlock());
+    raw.resize(raw.size() + 5000); // padding compresses well
+    std::vector<char> comp(BlockLzBound(raw.size()));
+    comp.resize(BlockLzCompress(raw.data(), raw.size(), comp.data()));
+    BOOST_CHECK(comp.size() < raw.size());
+    std::vector<char> out(raw.size());
+    BOOST_CHECK(BlockLzDecompress(comp.data(), comp.size(), out.data(), out.size()));
+    BOOST_CHECK(out == raw);
+
+    // corrupt or truncated data is rejected rather than read past
+    BOOST_CHECK(!BlockLzDecompress(comp.data(), comp.size() - 1, out.data(), out.size()));
+    BOOST_CHECK(!BlockLzDecompress(comp.data(), comp.size(), out.data(), out.size() - 1));
+    std::vector<char> bad(comp);
+    bad[0] = (char)0x0f;
+    BOOST_CHECK(!BlockLzDecompress(bad.data(), bad.size(), out.data(), out.size()));
+}
+
+BOOST_AUTO_TEST_CASE(cold_block_files)
+{
+    const CChainParams &params = Params();
+    const CBlock &genesis = params.GenesisBlock();
+    const int nFile = 9;
+
+    CDiskBlockPos pos1(nFile, 0);
+    BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos1, params.MessageStart()));
+    CDiskBlockPos pos2(nFile, pos1.nPos + Serialized(genesis).size());
+    BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos2, params.MessageStart()));
+    CBlockUndo undo;
+    undo.vtxundo.resize(3);
+    CDiskBlockPos undoPos(nFile, 0);
+    BOOST_CHECK(WriteUndoToDiskSequenatial(undo, undoPos, genesis.GetHash(), params.MessageStart()));
+    CBlockTxOffsets offsets(genesis);
+
+    int nLastBlockFileSaved;
+    std::vector<CBlockFileInfo> vinfoSaved;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFileSaved = nLastBlockFile;
+        vinfoSaved = vinfoBlockFile;
+        nLastBlockFile = nFile + 1;
+        if (vinfoBlockFile.size() <= (size_t)nFile)
+            vinfoBlockFile.resize(nFile + 1);
+        vinfoBlockFile[nFile].nSize = fs::file_size(GetBlockPosFilename(pos1, "blk"));
+        vinfoBlockFile[nFile].nUndoSize = fs::file_size(GetBlockPosFilename(pos1, "rev"));
+    }
+
+    // a file that does not match its block file info is left alone
+    BOOST_CHECK(!coldBlockFiles.Compress(nFile - 1, false, params.MessageStart()));
+
+    BOOST_CHECK(coldBlockFiles.Compress(nFile, false, params.MessageStart()));
+    BOOST_CHECK(coldBlockFiles.Compress(nFile, true, params.MessageStart()));
+    BOOST_CHECK(coldBlockFiles.IsCold(nFile, false) && coldBlockFiles.IsCold(nFile, true));
+    BOOST_CHECK(!fs::exists(GetBlockPosFilename(pos1, "blk")) && !fs::exists(GetBlockPosFilename(pos1, "rev")));
+
+    // everything reads from the cold files as it did from the originals
+    for (const CDiskBlockPos &pos : {pos1, pos2})
+    {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDiskSequential(block, pos, params.GetConsensus()));
+        BOOST_CHECK(block.GetHash() == genesis.GetHash());
+        CRawBlock raw;
+        BOOST_CHECK(ReadRawBlockFromDiskSequential(raw, pos));
+        BOOST_CHECK(std::vector<char>(raw.data(), raw.data() + raw.size()) == Serialized(genesis));
+        CBlockHeader header;
+        CTransactionRef ptx;
+        BOOST_CHECK(ReadTxFromDiskSequential(CDiskTxPos(pos, offsets.vOffsets[0]), header, ptx));
+        BOOST_CHECK(ptx && ptx->GetHash() == genesis.vtx[0]->GetHash());
+    }
+    CBlockUndo undo2;
+    BOOST_CHECK(ReadUndoFromDiskSequential(undo2, undoPos, genesis.GetHash()));
+    BOOST_CHECK_EQUAL(undo2.vtxundo.size(), 3);
+
+    // a restart finds the cold files again
+    coldBlockFiles.Init();
+    BOOST_CHECK(coldBlockFiles.IsCold(nFile, false) && coldBlockFiles.IsCold(nFile, true));
+
+    // and they turn back into the exact originals
+    const uint64_t nSize = vinfoBlockFile[nFile].nSize;
+    BOOST_CHECK(coldBlockFiles.Restore(nFile, false));
+    BOOST_CHECK(!coldBlockFiles.IsCold(nFile, false));
+    BOOST_CHECK_EQUAL(fs::file_size(GetBlockPosFilename(pos1, "blk")), nSize);
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDiskSequential(block, pos2, params.GetConsensus()));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+
+    // pruning removes the cold files too
+    std::set<int> setPrune = {nFile};
+    UnlinkPrunedFiles(setPrune);
+    WaitForPrunedFiles();
+    BOOST_CHECK(!coldBlockFiles.IsCold(nFile, true));
+    BOOST_CHECK(!fs::exists(GetColdFilename(nFile, true)));
+
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nLastBlockFileSaved;
+        vinfoBlockFile = vinfoSaved;
+    }
+    blockFileMaps.Clear();
+}
+
+BOOST_FIXTURE_TEST_CASE(prune_block_files, TestChain100Setup)
+{
+    const CChainParams &params = Params();
+    const CBlock &genesis = params.GenesisBlock();
+    const int nFirst = 20;
+
+    LOCK2(cs_main, cs_LastBlockFile);
+    const int nLastBlockFileSaved = nLastBlockFile;
+    const std::vector<CBlockFileInfo> vinfoSaved = vinfoBlockFile;
+    const uint64_t nPruneTargetSaved = nPruneTarget;
+    const CBlockIndex *pindexTip = chainActive.Tip();
+
+    // Two old files full of blocks: one deep in the chain, one old in time.  They hold a block of the chain each.
+    vinfoBlockFile.resize(nFirst + 3);
+    for (int nFile = nFirst; nFile < nFirst + 2; nFile++)
+    {
+        CDiskBlockPos pos(nFile, 0);
+        BOOST_CHECK(WriteBlockToDiskSequential(genesis, pos, params.MessageStart()));
+        vinfoBlockFile[nFile].nBlocks = 1;
+        vinfoBlockFile[nFile].nSize = fs::file_size(GetBlockPosFilename(pos, "blk"));
+        vinfoBlockFile[nFile].nTimeLast = pindexTip->GetBlockTime();
+    }
+    vinfoBlockFile[nFirst].nHeightLast = 10;
+    vinfoBlockFile[nFirst + 1].nHeightLast = 80;
+    vinfoBlockFile[nFirst + 1].nTimeLast = pindexTip->GetBlockTime() - 2 * 24 * 60 * 60;
+    nLastBlockFile = nFirst + 2;
+    CBlockIndex *pindexDeep = chainActive[10];
+    CBlockIndex *pindexOld = chainActive[80];
+    pindexDeep->nFile = nFirst;
+    pindexOld->nFile = nFirst + 1;
+    ClearBlockFileLists();
+
+    // nothing is pruned while we are well below the target
+    nPruneTarget = std::numeric_limits<uint64_t>::max() / 2;
+    std::set<int> setPrune;
+    FindFilesToPruneSequential(setPrune, pindexTip->nHeight);
+    BOOST_CHECK(setPrune.empty());
+
+    // unless the blocks are deep enough
+    nPruneDepth = 50;
+    FindFilesToPruneSequential(setPrune, pindexTip->nHeight);
+    BOOST_CHECK(setPrune == std::set<int>({nFirst}));
+    BOOST_CHECK(!(pindexDeep->nStatus & BLOCK_HAVE_DATA) && pindexDeep->nFile == 0);
+    BOOST_CHECK(pindexOld->nStatus & BLOCK_HAVE_DATA);
+    BOOST_CHECK(vinfoBlockFile[nFirst].nSize == 0);
+
+    // or old enough
+    nPruneDepth = 0;
+    nPruneAge = 24 * 60 * 60;
+    setPrune.clear();
+    FindFilesToPruneSequential(setPrune, pindexTip->nHeight);
+    BOOST_CHECK(setPrune == std::set<int>({nFirst + 1}));
+    BOOST_CHECK(!(pindexOld->nStatus & BLOCK_HAVE_DATA));
+    nPruneAge = 0;
+
+    // and the files are deleted in the background
+    setPrune.insert(nFirst);
+    UnlinkPrunedFiles(setPrune);
+    WaitForPrunedFiles();
+    for (int nFile : setPrune)
+        BOOST_CHECK(!fs::exists(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk")));
+
+    for (int nFile = nFirst; nFile < nFirst + 3; nFile++)
+        setDirtyFileInfo.erase(nFile);
+    ClearBlockFileLists();
+    nPruneTarget = nPruneTargetSaved;
+    nLastBlockFile = nLastBlockFileSaved;
+    vinfoBlockFile = vinfoSaved;
+}
+
+BOOST_FIXTURE_TEST_CASE(block_serving, TestChain100Setup)
+{
+    const CChainParams &params = Params();
+    int nLastBlockFileSaved;
+    {
+        // finalize the file the chain is in, so its blocks can be mapped and read ahead
+        LOCK(cs_LastBlockFile);
+        nLastBlockFileSaved = nLastBlockFile;
+        nLastBlockFile = chainActive.Tip()->nFile + 1;
+    }
+    blockFileMaps.Clear();
+
+    // a peer syncing from us asks for a run of blocks
+    std::deque<CInv> vInv;
+    for (int nHeight = 1; nHeight <= (int)DEFAULT_BLOCK_READ_AHEAD + 4; nHeight++)
+        vInv.push_back(CInv(MSG_BLOCK, chainActive[nHeight]->GetBlockHash()));
+
+    // only the next few are read ahead, and only once, however many peers ask for them
+    const CBlockServer::Stats stats1 = blockServer.GetStats();
+    blockServer.ReadAhead(vInv.begin(), vInv.end());
+    const CBlockServer::Stats stats2 = blockServer.GetStats();
+    BOOST_CHECK_EQUAL(stats2.nReadAheadBlocks - stats1.nReadAheadBlocks, DEFAULT_BLOCK_READ_AHEAD);
+    BOOST_CHECK(stats2.nReadAheadBytes > stats1.nReadAheadBytes);
+    blockServer.ReadAhead(vInv.begin(), vInv.end());
+    BOOST_CHECK_EQUAL(blockServer.GetStats().nReadAheadBlocks, stats2.nReadAheadBlocks);
+    blockServer.ReadAhead(vInv.begin() + 4, vInv.end());
+    BOOST_CHECK_EQUAL(blockServer.GetStats().nReadAheadBlocks - stats2.nReadAheadBlocks, 4);
+
+    // and served straight out of the mapped file
+    CBlock block;
+    CRawBlock raw;
+    bool fRaw = false;
+    BOOST_CHECK(blockServer.ReadBlock(chainActive[5], true, raw, block, fRaw, params.GetConsensus()));
+    BOOST_CHECK(fRaw);
+    CBlockHeader header;
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, raw.data(), raw.size());
+    reader >> header;
+    BOOST_CHECK(header.GetHash() == chainActive[5]->GetBlockHash());
+    BOOST_CHECK(blockServer.ReadBlock(chainActive[6], false, raw, block, fRaw, params.GetConsensus()));
+    BOOST_CHECK(!fRaw && block.GetHash() == chainActive[6]->GetBlockHash());
+    const CBlockServer::Stats stats3 = blockServer.GetStats();
+    BOOST_CHECK_EQUAL(stats3.nBlocks - stats2.nBlocks, 2);
+    BOOST_CHECK(stats3.nMaxConcurrentReads >= 1);
+
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nLastBlockFileSaved;
+    }
+    blockFileMaps.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
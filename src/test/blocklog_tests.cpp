@@ -0,0 +1,158 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "blockstorage/blocklog.h"
+#include "chainparams.h"
+#include "fs.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocklog_tests, TestingSetup)
+
+// Copies of the genesis block that only differ in their nonce, and index entries to look them up with
+struct BlockLogTestBlocks
+{
+    std::vector<CBlock> blocks;
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex> indexes;
+
+    BlockLogTestBlocks(size_t nBlocks) : blocks(nBlocks, Params().GenesisBlock()), hashes(nBlocks)
+    {
+        for (size_t i = 0; i < nBlocks; i++)
+        {
+            blocks[i].nNonce += i;
+            hashes[i] = blocks[i].GetHash();
+            indexes.emplace_back(blocks[i]);
+        }
+        for (size_t i = 0; i < nBlocks; i++)
+            indexes[i].phashBlock = &hashes[i];
+    }
+};
+
+static bool HasBlock(CBlockLogDB &db, const CBlockIndex &index)
+{
+    CBlock block;
+    return db.ReadBlock(&index, block) && block.GetHash() == index.GetBlockHash();
+}
+
+BOOST_AUTO_TEST_CASE(blocklog_read_write_erase)
+{
+    BlockLogTestBlocks test(3);
+    CBlockLogDB db(GetDataDir() / "blocklog_rwe");
+
+    for (const CBlock &block : test.blocks)
+        BOOST_CHECK(db.WriteBlock(block));
+    // still in the write buffer
+    for (const CBlockIndex &index : test.indexes)
+        BOOST_CHECK(HasBlock(db, index));
+    db.Flush();
+    // and from the segment file
+    for (const CBlockIndex &index : test.indexes)
+        BOOST_CHECK(HasBlock(db, index));
+
+    CBlockUndo undo;
+    undo.vtxundo.resize(2);
+    BOOST_CHECK(db.WriteUndo(undo, &test.indexes[0]));
+    CBlockUndo undoRead;
+    BOOST_CHECK(db.ReadUndo(undoRead, &test.indexes[0]));
+    BOOST_CHECK_EQUAL(undoRead.vtxundo.size(), 2);
+    BOOST_CHECK(!db.ReadUndo(undoRead, &test.indexes[1]));
+
+    BOOST_CHECK(db.EraseBlock(&test.indexes[1]));
+    BOOST_CHECK(db.EraseUndo(&test.indexes[0]));
+    BOOST_CHECK(HasBlock(db, test.indexes[0]));
+    BOOST_CHECK(!HasBlock(db, test.indexes[1]));
+    BOOST_CHECK(HasBlock(db, test.indexes[2]));
+    BOOST_CHECK(!db.ReadUndo(undoRead, &test.indexes[0]));
+
+    // rewriting an erased block brings it back
+    BOOST_CHECK(db.WriteBlock(test.blocks[1]));
+    BOOST_CHECK(HasBlock(db, test.indexes[1]));
+}
+
+BOOST_AUTO_TEST_CASE(blocklog_recovery)
+{
+    BlockLogTestBlocks test(3);
+    const fs::path dir = GetDataDir() / "blocklog_recovery";
+    {
+        CBlockLogDB db(dir);
+        for (const CBlock &block : test.blocks)
+            BOOST_CHECK(db.WriteBlock(block));
+        BOOST_CHECK(db.EraseBlock(&test.indexes[0]));
+    }
+    {
+        // the log is replayed, erasure included
+        CBlockLogDB db(dir);
+        BOOST_CHECK(!HasBlock(db, test.indexes[0]));
+        BOOST_CHECK(HasBlock(db, test.indexes[1]));
+        BOOST_CHECK(HasBlock(db, test.indexes[2]));
+        BOOST_CHECK(db.WriteBlock(test.blocks[0]));
+    }
+
+    // Tear the last record, as a crash in the middle of a write would
+    const fs::path segment = dir / "log00000.dat";
+    const uint64_t nSize = fs::file_size(segment);
+    fs::resize_file(segment, nSize - 5);
+    {
+        CBlockLogDB db(dir);
+        BOOST_CHECK(!HasBlock(db, test.indexes[0]));
+        BOOST_CHECK(HasBlock(db, test.indexes[1]));
+        BOOST_CHECK(HasBlock(db, test.indexes[2]));
+        // the torn record is cut off, so the next one lands where it started
+        BOOST_CHECK(fs::file_size(segment) < nSize - 5);
+        BOOST_CHECK(db.WriteBlock(test.blocks[0]));
+        db.Flush();
+        BOOST_CHECK_EQUAL(fs::file_size(segment), nSize);
+    }
+    {
+        CBlockLogDB db(dir);
+        for (const CBlockIndex &index : test.indexes)
+            BOOST_CHECK(HasBlock(db, index));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blocklog_segments)
+{
+    BlockLogTestBlocks test(6);
+    const fs::path dir = GetDataDir() / "blocklog_segments";
+    // room for two genesis sized blocks per segment
+    const uint64_t nSegmentSize = 800;
+    {
+        CBlockLogDB db(dir, nSegmentSize);
+        for (const CBlock &block : test.blocks)
+            BOOST_CHECK(db.WriteBlock(block));
+        BOOST_CHECK_EQUAL(db.SegmentCount(), 3);
+        for (const CBlockIndex &index : test.indexes)
+            BOOST_CHECK(HasBlock(db, index));
+    }
+    // the closed segments have their records listed
+    BOOST_CHECK(fs::exists(dir / "log00000.idx"));
+    BOOST_CHECK(fs::exists(dir / "log00001.idx"));
+    BOOST_CHECK(!fs::exists(dir / "log00002.idx"));
+
+    CBlockLogDB db(dir, nSegmentSize);
+    BOOST_CHECK_EQUAL(db.SegmentCount(), 3);
+    for (const CBlockIndex &index : test.indexes)
+        BOOST_CHECK(HasBlock(db, index));
+
+    // Erasing blocks in the second segment frees nothing, as the first one is still in use
+    const uint64_t nUsage = db.DiskUsage();
+    BOOST_CHECK(db.EraseBlock(&test.indexes[2]));
+    BOOST_CHECK(db.EraseBlock(&test.indexes[3]));
+    db.CondenseBlockData("", "");
+    BOOST_CHECK_EQUAL(db.SegmentCount(), 3);
+    BOOST_CHECK(fs::exists(dir / "log00001.dat"));
+
+    // once that is empty as well, both go
+    BOOST_CHECK(db.EraseBlock(&test.indexes[0]));
+    BOOST_CHECK(db.EraseBlock(&test.indexes[1]));
+    db.CondenseBlockData("", "");
+    BOOST_CHECK(!fs::exists(dir / "log00000.dat"));
+    BOOST_CHECK(!fs::exists(dir / "log00001.dat"));
+    BOOST_CHECK(db.DiskUsage() < nUsage);
+    BOOST_CHECK(HasBlock(db, test.indexes[4]));
+    BOOST_CHECK(HasBlock(db, test.indexes[5]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
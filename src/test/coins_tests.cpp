@@ -771,5 +771,137 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_prefetch_by_txid)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    const uint256 txid = InsecureRand256();
+    const uint256 txidOther = InsecureRand256();
+    {
+        CCoinsViewCache cache(&db);
+        // index 300 has a longer VARINT than the others, and still sorts after them
+        for (uint32_t n : {0, 2, 300})
+            cache.AddCoin(COutPoint(txid, n), Coin(CTxOut(n + 1, CScript() << OP_TRUE), 1, false), false);
+        cache.AddCoin(COutPoint(txidOther, 1), Coin(CTxOut(1, CScript() << OP_TRUE), 1, false), false);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    std::vector<std::pair<COutPoint, Coin> > coins;
+    BOOST_CHECK(db.GetCoinsByTxid(txid, coins));
+    BOOST_CHECK_EQUAL(coins.size(), 3);
+    BOOST_CHECK(coins[0].first == COutPoint(txid, 0));
+    BOOST_CHECK(coins[1].first == COutPoint(txid, 2));
+    BOOST_CHECK(coins[2].first == COutPoint(txid, 300));
+    BOOST_CHECK_EQUAL(coins[2].second.out.nValue, 301);
+    coins.clear();
+    BOOST_CHECK(db.GetCoinsByTxid(InsecureRand256(), coins));
+    BOOST_CHECK(coins.empty());
+
+    // A cache gets them all in one go, but keeps what it has already
+    CCoinsViewCache cache(&db);
+    cache.SpendCoin(COutPoint(txid, 2));
+    BOOST_CHECK_EQUAL(cache.PrefetchCoins(txid), 2);
+    bool fSpent = false;
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, 0), fSpent) && !fSpent);
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, 2), fSpent) && fSpent);
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, 300), fSpent) && !fSpent);
+    BOOST_CHECK(!cache.HaveCoinInCache(COutPoint(txidOther, 1), fSpent));
+}
+
+static std::vector<unsigned char> RandomHash160()
+{
+    std::vector<unsigned char> vch(20);
+    GetRandBytes(vch.data(), vch.size());
+    return vch;
+}
+
+static std::vector<char> SerializedUndo(const CBlockUndo &undo)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << undo;
+    return std::vector<char>(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(compact_undo)
+{
+    // Coins of a few scripts, some spent more than once, at heights going either way
+    std::vector<CScript> vScripts;
+    for (int i = 0; i < 5; i++)
+        vScripts.push_back(CScript() << OP_DUP << OP_HASH160 << RandomHash160() << OP_EQUALVERIFY << OP_CHECKSIG);
+    vScripts.push_back(CScript() << OP_RETURN << std::vector<unsigned char>(40, 1));
+    CBlockUndo undo;
+    for (int i = 0; i < 20; i++)
+    {
+        undo.vtxundo.emplace_back();
+        for (int j = 0; j < i % 4; j++)
+        {
+            const int nHeight = (i * 7 + j * 1000) % 2500;
+            const CScript &script = vScripts[(i * 3 + j) % vScripts.size()];
+            undo.vtxundo.back().vprevout.emplace_back(CTxOut(i * COIN + j, script), nHeight, (i + j) % 5 == 0);
+        }
+    }
+
+    const std::vector<char> vLegacy = SerializedUndo(undo);
+    undo.nFormat = UNDO_FORMAT_COMPACT;
+    const std::vector<char> vCompact = SerializedUndo(undo);
+    BOOST_CHECK((unsigned char)vCompact[0] == UNDO_COMPACT_MARKER);
+    BOOST_CHECK(vCompact.size() < vLegacy.size() * 2 / 3);
+
+    // either format is recognized, decodes to the same coins, and serializes back to exactly what it was read from
+    for (const std::vector<char> *pv : {&vLegacy, &vCompact})
+    {
+        CDataStream ss(*pv, SER_DISK, CLIENT_VERSION);
+        CBlockUndo undoRead;
+        ss >> undoRead;
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK(undoRead.nFormat == (pv == &vLegacy ? UNDO_FORMAT_LEGACY : UNDO_FORMAT_COMPACT));
+        BOOST_CHECK(SerializedUndo(undoRead) == *pv);
+        BOOST_REQUIRE_EQUAL(undoRead.vtxundo.size(), undo.vtxundo.size());
+        for (size_t i = 0; i < undo.vtxundo.size(); i++)
+        {
+            BOOST_REQUIRE_EQUAL(undoRead.vtxundo[i].vprevout.size(), undo.vtxundo[i].vprevout.size());
+            for (size_t j = 0; j < undo.vtxundo[i].vprevout.size(); j++)
+            {
+                const Coin &coin = undo.vtxundo[i].vprevout[j];
+                const Coin &coinRead = undoRead.vtxundo[i].vprevout[j];
+                BOOST_CHECK(coin.out == coinRead.out);
+                BOOST_CHECK(coin.nHeight == coinRead.nHeight);
+                BOOST_CHECK(coin.fCoinBase == coinRead.fCoinBase);
+            }
+        }
+    }
+
+    // truncated data is rejected
+    CDataStream ss(std::vector<char>(vCompact.begin(), vCompact.end() - 1), SER_DISK, CLIENT_VERSION);
+    CBlockUndo undoRead;
+    BOOST_CHECK_THROW(ss >> undoRead, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(compact_undo_large_block)
+{
+    // about as much undo data as a large block has
+    CBlockUndo undo;
+    undo.nFormat = UNDO_FORMAT_COMPACT;
+    for (int i = 0; i < 5000; i++)
+    {
+        undo.vtxundo.emplace_back();
+        CScript script = CScript() << OP_HASH160 << RandomHash160() << OP_EQUAL;
+        for (int j = 0; j < 2; j++)
+            undo.vtxundo.back().vprevout.emplace_back(CTxOut(i + j, script), 100000 + i, false);
+    }
+    const std::vector<char> vCompact = SerializedUndo(undo);
+    BOOST_CHECK(vCompact.size() > 128 * 1024);
+
+    CDataStream ss(vCompact, SER_DISK, CLIENT_VERSION);
+    CBlockUndo undoRead;
+    ss >> undoRead;
+    BOOST_REQUIRE_EQUAL(undoRead.vtxundo.size(), undo.vtxundo.size());
+    for (size_t i = 0; i < undo.vtxundo.size(); i++)
+    {
+        BOOST_REQUIRE_EQUAL(undoRead.vtxundo[i].vprevout.size(), 2);
+        BOOST_CHECK(undoRead.vtxundo[i].vprevout[1].out == undo.vtxundo[i].vprevout[1].out);
+        BOOST_CHECK(undoRead.vtxundo[i].vprevout[0].nHeight == 100000 + i);
+    }
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -345,5 +345,90 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options_and_stats)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    {
+        CDBWrapper dbw(ph, (1 << 20), true, false, false);
+        CDBStats stats = dbw.GetStats();
+        BOOST_CHECK_EQUAL(stats.nBlockCacheSize, 1 << 19);
+        BOOST_CHECK_EQUAL(stats.nWriteBufferSize, 1 << 18);
+        BOOST_CHECK_EQUAL(stats.nBloomBits, 10);
+    }
+
+    COverrideOptions options;
+    options.block_size = 4096;
+    options.bloom_bits = -1;
+    options.block_cache_share = 0.75;
+    options.write_buffer_share = 0.125;
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, &options);
+    CDBStats stats = dbw.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlockCacheSize, 3 << 18);
+    BOOST_CHECK_EQUAL(stats.nWriteBufferSize, 1 << 17);
+    BOOST_CHECK_EQUAL(stats.nBlockSize, 4096);
+    BOOST_CHECK_EQUAL(stats.nBloomBits, 0);
+
+    // data that is compacted shows up in the level statistics
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Write(i, InsecureRand256()));
+    dbw.Compact();
+    stats = dbw.GetStats();
+    BOOST_CHECK(!stats.levels.empty());
+    int nFiles = 0;
+    for (const CDBLevelStats &level : stats.levels)
+        nFiles += level.nFiles;
+    BOOST_CHECK(nFiles > 0);
+    BOOST_CHECK(stats.nMemoryUsage > 0);
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_async_writes)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    fs::path ph2 = fs::temp_directory_path() / fs::unique_path();
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, true, false);
+        CDBWrapper dbw2(ph2, (1 << 20), true, false, false);
+
+        BOOST_CHECK(dbWriter.Barrier(false));
+        const uint64_t nBatches = dbWriter.TotalBatches();
+        const uint64_t nWrites = dbWriter.TotalWrites();
+        for (int i = 0; i < 100; i++)
+        {
+            std::unique_ptr<CDBBatch> batch(new CDBBatch(dbw));
+            batch->Write(i, i);
+            dbw.WriteBatchAsync(std::move(batch));
+        }
+        std::unique_ptr<CDBBatch> batch(new CDBBatch(dbw2));
+        batch->Write('a', 1);
+        batch->Erase('b');
+        dbw2.WriteBatchAsync(std::move(batch));
+        // a job is filled in on the writer thread, but written in order all the same
+        dbWriter.QueueJob(&dbw, [](CDBBatch &b) { b.Write(99, 100); }, 16);
+        batch.reset(new CDBBatch(dbw));
+        batch->Write(99, 99);
+        dbw.WriteBatchAsync(std::move(batch));
+
+        // everything queued before the barrier is readable after it, in as many writes as it took
+        BOOST_CHECK(dbWriter.Barrier(true));
+        BOOST_CHECK_EQUAL(dbWriter.QueueDepth(), 0);
+        BOOST_CHECK_EQUAL(dbWriter.QueuedBytes(), 0);
+        BOOST_CHECK_EQUAL(dbWriter.TotalBatches() - nBatches, 103);
+        BOOST_CHECK(dbWriter.TotalWrites() - nWrites >= 3);
+        BOOST_CHECK(dbWriter.TotalWrites() - nWrites <= 103);
+        int n;
+        for (int i = 0; i < 100; i++)
+            BOOST_CHECK(dbw.Read(i, n) && n == i);
+        BOOST_CHECK(dbw2.Read('a', n) && n == 1);
+
+        // batches still queued when a database is closed are written first
+        batch.reset(new CDBBatch(dbw));
+        batch->Write('z', 26);
+        dbw.WriteBatchAsync(std::move(batch));
+    }
+    CDBWrapper dbw(ph, (1 << 20), false, false, false);
+    int n;
+    BOOST_CHECK(dbw.Read('z', n) && n == 26);
+    BOOST_CHECK(dbw.Read(99, n) && n == 99);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
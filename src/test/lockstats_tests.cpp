@@ -0,0 +1,96 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(lockstats_tests, BasicTestingSetup)
+
+static const CLockSiteStats *FindLock(const std::vector<CLockSiteStats> &vStats, const std::string &name)
+{
+    for (const CLockSiteStats &stats : vStats)
+    {
+        if (stats.name == name)
+            return &stats;
+    }
+    return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_contention)
+{
+    CCriticalSection csLockStatsTest;
+    CSharedCriticalSection csSharedLockStatsTest;
+    ResetLockStats();
+
+    // nothing is recorded while profiling is off
+    {
+        LOCK(csLockStatsTest);
+    }
+    BOOST_CHECK(FindLock(GetLockStats(false), "csLockStatsTest") == nullptr);
+
+    fLockProfiling = true;
+    std::thread waiter;
+    {
+        LOCK(csLockStatsTest);
+        // the waiter says when it is about to take the lock, then gets a moment to block on it
+        std::atomic<bool> fWaiting{false};
+        waiter = std::thread([&csLockStatsTest, &fWaiting]() {
+            fWaiting = true;
+            LOCK(csLockStatsTest);
+        });
+        while (!fWaiting)
+            std::this_thread::yield();
+        MilliSleep(10);
+    }
+    waiter.join();
+    {
+        TRY_LOCK(csLockStatsTest, lockTry);
+        const bool fLocked = lockTry;
+        BOOST_CHECK(fLocked);
+    }
+    {
+        READLOCK(csSharedLockStatsTest);
+    }
+    fLockProfiling = false;
+
+    // two sites were taken twice in all, one of them had to wait for the other; the thread that waited is gone
+    // but what it recorded is not
+    const std::vector<CLockSiteStats> vSites = GetLockStats(false);
+    size_t nSites = 0;
+    uint64_t nCount = 0;
+    for (const CLockSiteStats &stats : vSites)
+    {
+        if (stats.name != "csLockStatsTest")
+            continue;
+        nSites++;
+        nCount += stats.nCount;
+        BOOST_CHECK(stats.file.find("lockstats_tests.cpp") != std::string::npos);
+    }
+    BOOST_CHECK_EQUAL(nSites, 3);
+    BOOST_CHECK_EQUAL(nCount, 3);
+
+    const std::vector<CLockSiteStats> vLocks = GetLockStats(true);
+    const CLockSiteStats *lock = FindLock(vLocks, "csLockStatsTest");
+    BOOST_REQUIRE(lock != nullptr);
+    BOOST_CHECK_EQUAL(lock->nCount, 3);
+    BOOST_CHECK_EQUAL(lock->nContended, 1);
+    BOOST_CHECK(lock->nWaitNanos > 0);
+    BOOST_CHECK(lock->nMaxWaitNanos == lock->nWaitNanos);
+    BOOST_CHECK(lock->nHoldNanos > 0);
+    BOOST_CHECK(lock->file.empty());
+    // the most waited for locks come first
+    for (size_t i = 1; i < vLocks.size(); i++)
+        BOOST_CHECK(vLocks[i - 1].nWaitNanos >= vLocks[i].nWaitNanos);
+    BOOST_CHECK(FindLock(vLocks, "csSharedLockStatsTest") != nullptr);
+
+    ResetLockStats();
+    BOOST_CHECK(FindLock(GetLockStats(true), "csLockStatsTest") == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,175 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lockfreequeue.h"
+#include "logwriter.h"
+#include "test/test_bitcoin.h"
+#include "tinyformat.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(logwriter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(lockfreequeue_order)
+{
+    CLockFreeQueue<int> queue(4);
+    int n = 0;
+    BOOST_CHECK(!queue.TryPop(n));
+    for (int i = 0; i < 4; i++)
+    {
+        int v = i;
+        BOOST_CHECK(queue.TryPush(std::move(v)));
+    }
+    int nFull = 4;
+    BOOST_CHECK(!queue.TryPush(std::move(nFull)));
+    BOOST_CHECK(queue.TryPop(n));
+    BOOST_CHECK_EQUAL(n, 0);
+    int nMore = 4;
+    BOOST_CHECK(queue.TryPush(std::move(nMore)));
+    for (int i = 1; i <= 4; i++)
+    {
+        BOOST_CHECK(queue.TryPop(n));
+        BOOST_CHECK_EQUAL(n, i);
+    }
+    BOOST_CHECK(!queue.TryPop(n));
+
+    // several producers, every value arrives once and each producer's values arrive in order
+    const int nProducers = 4;
+    const int nPerProducer = 50000;
+    CLockFreeQueue<int> shared(256);
+    std::vector<std::thread> vProducers;
+    for (int p = 0; p < nProducers; p++)
+    {
+        vProducers.emplace_back([&shared, p]() {
+            for (int i = 0; i < nPerProducer; i++)
+            {
+                int v = p * nPerProducer + i;
+                while (!shared.TryPush(std::move(v)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    std::vector<int> vLast(nProducers, -1);
+    bool fOrdered = true;
+    for (int nReceived = 0; nReceived < nProducers * nPerProducer;)
+    {
+        if (!shared.TryPop(n))
+            continue;
+        const int p = n / nPerProducer;
+        if (n % nPerProducer != vLast[p] + 1)
+            fOrdered = false;
+        vLast[p] = n % nPerProducer;
+        nReceived++;
+    }
+    for (std::thread &producer : vProducers)
+        producer.join();
+    BOOST_CHECK(fOrdered);
+    BOOST_CHECK(!shared.TryPop(n));
+}
+
+BOOST_AUTO_TEST_CASE(logwriter_batches)
+{
+    std::string strLog;
+    size_t nWrites = 0;
+    {
+        CAsyncLogWriter writer(
+            [&strLog, &nWrites](const std::string &str) {
+                strLog += str;
+                nWrites++;
+            },
+            1024);
+        std::vector<std::thread> vLoggers;
+        for (int t = 0; t < 4; t++)
+        {
+            vLoggers.emplace_back([&writer, t]() {
+                for (int i = 0; i < 200; i++)
+                {
+                    // the queue has room for every line, so none are dropped
+                    writer.Push(strprintf("thread %d line %d\n", t, i));
+                }
+            });
+        }
+        for (std::thread &logger : vLoggers)
+            logger.join();
+        writer.Flush();
+        BOOST_CHECK_EQUAL(writer.Dropped(), 0);
+        BOOST_CHECK_EQUAL(writer.Written(), 800);
+        BOOST_CHECK(nWrites <= 800);
+        BOOST_CHECK(strLog.find("thread 3 line 199\n") != std::string::npos);
+
+        std::string strLast = "last\n";
+        BOOST_CHECK(writer.Push(std::move(strLast)));
+        writer.Stop();
+        std::string strLate = "late\n";
+        BOOST_CHECK(!writer.Push(std::move(strLate)));
+    }
+    BOOST_CHECK_EQUAL(std::count(strLog.begin(), strLog.end(), '\n'), 801);
+    BOOST_CHECK(strLog.find("last\n") != std::string::npos);
+    BOOST_CHECK(strLog.find("late\n") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(logwriter_restart)
+{
+    // a stopped writer can be started again and carries on where it left off
+    std::string strLog;
+    CAsyncLogWriter writer([&strLog](const std::string &str) { strLog += str; }, 16);
+    std::string strBefore = "before\n";
+    BOOST_CHECK(writer.Push(std::move(strBefore)));
+    writer.Stop();
+    std::string strStopped = "stopped\n";
+    BOOST_CHECK(!writer.Push(std::move(strStopped)));
+
+    writer.Start();
+    for (int i = 0; i < 3; i++)
+    {
+        std::string strLine = strprintf("after %d\n", i);
+        BOOST_CHECK(writer.Push(std::move(strLine)));
+    }
+    writer.Flush();
+    BOOST_CHECK_EQUAL(writer.Written(), 4);
+    BOOST_CHECK_EQUAL(writer.Dropped(), 1);
+    writer.Stop();
+    BOOST_CHECK(strLog.find("after 2\n") != std::string::npos);
+    BOOST_CHECK(strLog.find("stopped\n") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(logwriter_drops)
+{
+    std::string strLog;
+    std::atomic<bool> fWriting{false};
+    std::atomic<bool> fRelease{false};
+    CAsyncLogWriter writer(
+        [&](const std::string &str) {
+            fWriting = true;
+            while (!fRelease)
+                std::this_thread::yield();
+            strLog += str;
+        },
+        4);
+
+    // hold the writer inside its first write, then overfill the queue behind it
+    std::string strFirst = "first\n";
+    BOOST_CHECK(writer.Push(std::move(strFirst)));
+    while (!fWriting)
+        std::this_thread::yield();
+    for (int i = 0; i < 6; i++)
+    {
+        std::string strLine = strprintf("line %d\n", i);
+        BOOST_CHECK_EQUAL(writer.Push(std::move(strLine)), i < 4);
+    }
+    BOOST_CHECK_EQUAL(writer.Dropped(), 2);
+
+    fRelease = true;
+    writer.Flush();
+    BOOST_CHECK_EQUAL(writer.Written(), 5);
+    writer.Stop();
+    BOOST_CHECK(strLog.find("dropped 2 lines") != std::string::npos);
+    BOOST_CHECK(strLog.find("line 3\n") != std::string::npos);
+    BOOST_CHECK(strLog.find("line 4\n") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,7 +14,7 @@ BOOST_FIXTURE_TEST_SUITE(mempool_sync_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(mempool_sync_can_serde)
 {
-    uint64_t sync_version = DEFAULT_MEMPOOL_SYNC_MAX_VERSION_SUPPORTED;
+    uint64_t sync_version = RATELESS_MEMPOOL_SYNC_VERSION - 1;
     uint64_t nReceiverMemPoolTx = 0;
     uint64_t nSenderMempoolPlusBlock = 1;
     uint64_t shorttxidk0 = 7;
@@ -45,4 +45,32 @@ BOOST_AUTO_TEST_CASE(mempool_sync_can_serde)
     receiverMempoolSync.pGrapheneSet->Reconcile(receiverMempoolTxHashes);
 }
 
+BOOST_AUTO_TEST_CASE(mempool_sync_rateless_can_serde)
+{
+    uint64_t sync_version = RATELESS_MEMPOOL_SYNC_VERSION;
+
+    CRibltEncoder encoder;
+    for (uint64_t i = 0; i < 100; i++)
+        encoder.addKey(i * 7919);
+    encoder.nextSymbols(10);
+    CMempoolSync senderMempoolSync(encoder.size(), 10, encoder.nextSymbols(MEMPOOLSYNC_MIN_SYMBOLS), sync_version);
+    CMempoolSync receiverMempoolSync(sync_version);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+
+    ss << senderMempoolSync;
+    ss >> receiverMempoolSync;
+
+    BOOST_CHECK_EQUAL(receiverMempoolSync.version, sync_version);
+    BOOST_CHECK_EQUAL(receiverMempoolSync.nSenderMempoolTxs, 100);
+    BOOST_CHECK_EQUAL(receiverMempoolSync.nFirstSymbol, 10);
+    BOOST_CHECK(receiverMempoolSync.pGrapheneSet == nullptr);
+    BOOST_CHECK_EQUAL(receiverMempoolSync.vSymbols.size(), MEMPOOLSYNC_MIN_SYMBOLS);
+    for (size_t i = 0; i < receiverMempoolSync.vSymbols.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(receiverMempoolSync.vSymbols[i].keySum, senderMempoolSync.vSymbols[i].keySum);
+        BOOST_CHECK_EQUAL(receiverMempoolSync.vSymbols[i].keyCheck, senderMempoolSync.vSymbols[i].keyCheck);
+        BOOST_CHECK_EQUAL(receiverMempoolSync.vSymbols[i].count, senderMempoolSync.vSymbols[i].count);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2011,15 +2011,16 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx2.GetHash(), entry.Fee(5000LL).FromTx(tx2, &pool));
 
     vNoSpendsRemaining.clear();
-    pool.TrimToSize(pool.DynamicMemoryUsage(), &vNoSpendsRemaining, true); // should do nothing
+    pool.TrimToSize(pool.DynamicMemoryUsage(), &vNoSpendsRemaining); // should do nothing
     BOOST_CHECK(pool.exists(tx1.GetHash()));
     BOOST_CHECK(pool.exists(tx2.GetHash()));
     BOOST_CHECK(pool.size() == 2);
 
     vNoSpendsRemaining.clear();
-    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4, &vNoSpendsRemaining, true);
-    BOOST_CHECK(!pool.exists(tx1.GetHash()));
-    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    // tx2 has the lower feerate so it is evicted first
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4, &vNoSpendsRemaining);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
     BOOST_CHECK(pool.size() == 1);
 
     pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2, &pool));
@@ -2095,14 +2096,15 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    // we only require this removes both tx6 and tx7 because tx6 is chosen which then also removes the decendant tx7.
+    // The cluster linearizes as [tx4] [tx5, tx6, tx7]: tx7 pays for both of its parents but the three together
+    // are still below tx4's feerate, so the whole lower chunk is evicted.
     vNoSpendsRemaining.clear();
-    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining, true);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining);
     BOOST_CHECK(pool.exists(tx4.GetHash()));
-    BOOST_CHECK(pool.exists(tx5.GetHash()));
+    BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(!pool.exists(tx6.GetHash()));
     BOOST_CHECK(!pool.exists(tx7.GetHash()));
-    BOOST_CHECK(pool.size() == 2);
+    BOOST_CHECK(pool.size() == 1);
 
     if (!pool.exists(tx5.GetHash()))
     {
@@ -2110,8 +2112,8 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     }
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    // should maximize mempool size by only removing tx5 and its decendants
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2, &vNoSpendsRemaining, true);
+    // tx7 now only has tx5 as an in-mempool parent; [tx5, tx7] is the lowest feerate chunk
+    pool.TrimToSize(pool.DynamicMemoryUsage() / 2, &vNoSpendsRemaining);
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(!pool.exists(tx6.GetHash()));
@@ -2123,10 +2125,10 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1, &pool));
     pool.addUnchecked(tx4.GetHash(), entry.Fee(7000LL).FromTx(tx4, &pool));
     vNoSpendsRemaining.clear();
-    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining, true);
-    BOOST_CHECK(!pool.exists(tx1.GetHash()));
-    BOOST_CHECK(pool.exists(tx4.GetHash()));
-    BOOST_CHECK(pool.size() == 1); // tx1 should be trimmed from the pool
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx4.GetHash()));
+    BOOST_CHECK(pool.size() == 1); // tx4 has the lower feerate and should be trimmed from the pool
 
     // Add a chain of 10 txns and trim. Only the very last txn in the chain should be removed
     pool.clear();
@@ -2155,7 +2157,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
         tx.vin[0].prevout.hash = hash;
     }
     BOOST_CHECK(pool.size() == 10);
-    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining, false);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining);
     BOOST_CHECK(pool.size() == 9); // only the 10nth should be trimmed from the pool
     BOOST_CHECK(!pool.exists(tx.GetHash())); // last hash should not exist
 
@@ -2190,15 +2192,195 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     }
 
     BOOST_CHECK(pool.size() == 100);
-    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining, false);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, &vNoSpendsRemaining);
 
-    // The chain will have been trimmed anywhere from 1 to 10% of that last
-    // part of the chain. But at least 1 transaction, the very last in the chain,
-    // will have been removed.
-    BOOST_CHECK(pool.size() >= 90 && pool.size() < 100);
+    // All chain txns pay the same feerate so each is its own chunk and only the very last one is removed.
+    BOOST_CHECK(pool.size() == 99);
     for (size_t i = 0; i <= vHashes.size() - 10; i++) // first 90 hashes should exist
         BOOST_CHECK(pool.exists(vHashes[i]));
     BOOST_CHECK(!pool.exists(tx.GetHash())); // at minimum the last hash should not exist
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Two unrelated parents, each in their own cluster
+    CMutableTransaction txA = CMutableTransaction();
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_1;
+    txA.vout.resize(1);
+    txA.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txA.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txA.GetHash(), entry.Fee(1000LL).FromTx(txA));
+
+    CMutableTransaction txB = CMutableTransaction();
+    txB.vin.resize(1);
+    txB.vin[0].scriptSig = CScript() << OP_2;
+    txB.vout.resize(1);
+    txB.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txB.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txB.GetHash(), entry.Fee(5000LL).FromTx(txB));
+
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 2);
+        // txB pays more so its cluster comes first
+        const CTxMemPool::TxCluster *pcluster = pool._GetCluster(pool._GetClustersByBestChunk().begin()->nClusterId);
+        BOOST_CHECK(pcluster && pcluster->vChunks.size() == 1);
+        BOOST_CHECK(pcluster->vChunks[0].vTxns[0]->GetTx().GetHash() == txB.GetHash());
+    }
+
+    // A high fee child spending both parents joins the clusters and pulls txA up with it
+    CMutableTransaction txC = CMutableTransaction();
+    txC.vin.resize(2);
+    txC.vin[0].prevout = COutPoint(txA.GetHash(), 0);
+    txC.vin[0].scriptSig = CScript() << OP_3;
+    txC.vin[1].prevout = COutPoint(txB.GetHash(), 0);
+    txC.vin[1].scriptSig = CScript() << OP_3;
+    txC.vout.resize(1);
+    txC.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    txC.vout[0].nValue = 20 * COIN;
+    pool.addUnchecked(txC.GetHash(), entry.Fee(50000LL).FromTx(txC));
+
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 1);
+        const CTxMemPool::TxCluster *pcluster = pool._GetCluster(pool._GetClustersByBestChunk().begin()->nClusterId);
+        BOOST_CHECK(pcluster && pcluster->vTxns.size() == 3);
+        BOOST_CHECK_EQUAL(pcluster->vChunks.size(), 1);
+        BOOST_CHECK_EQUAL(pcluster->vChunks[0].nModFees, 56000LL);
+        // The chunk is in a valid block order
+        BOOST_CHECK(pcluster->vChunks[0].vTxns[2]->GetTx().GetHash() == txC.GetHash());
+    }
+
+    // Removing the child splits the cluster again
+    pool.Remove(txC.GetHash());
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 2);
+    }
+
+    // A low fee child only lowers the feerate of its parent's cluster, so it gets a chunk of its own
+    CMutableTransaction txD = CMutableTransaction();
+    txD.vin.resize(1);
+    txD.vin[0].prevout = COutPoint(txB.GetHash(), 0);
+    txD.vin[0].scriptSig = CScript() << OP_4;
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    txD.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txD.GetHash(), entry.Fee(100LL).FromTx(txD));
+
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 2);
+        const CTxMemPool::TxCluster *pcluster = pool._GetCluster(pool._GetClustersByBestChunk().begin()->nClusterId);
+        BOOST_CHECK(pcluster && pcluster->vChunks.size() == 2);
+        BOOST_CHECK(pcluster->vChunks[1].vTxns[0]->GetTx().GetHash() == txD.GetHash());
+    }
+
+    {
+        READLOCK(pool.cs_txmempool);
+        // txC would join both clusters
+        BOOST_CHECK_EQUAL(pool._ClusterSizeWithParents(pool.GetMemPoolParents(CTransaction(txC))), 3);
+    }
+
+    // Eviction takes txD, the lowest feerate chunk, and leaves its parent txB, which shares its cluster
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(txA.GetHash()));
+    BOOST_CHECK(pool.exists(txB.GetHash()));
+    BOOST_CHECK(!pool.exists(txD.GetHash()));
+
+    // A chain of ever lower paying children below txB gives its cluster a chunk each
+    CMutableTransaction txE = txD;
+    txE.vin[0].scriptSig = CScript() << OP_5;
+    pool.addUnchecked(txE.GetHash(), entry.Fee(200LL).FromTx(txE));
+    CMutableTransaction txF = CMutableTransaction();
+    txF.vin.resize(1);
+    txF.vin[0].prevout = COutPoint(txE.GetHash(), 0);
+    txF.vin[0].scriptSig = CScript() << OP_6;
+    txF.vout.resize(1);
+    txF.vout[0].scriptPubKey = CScript() << OP_6 << OP_EQUAL;
+    txF.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txF.GetHash(), entry.Fee(100LL).FromTx(txF));
+
+    // Evicting the last chunk keeps the rest of the cluster as it was
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(txE.GetHash()));
+    BOOST_CHECK(!pool.exists(txF.GetHash()));
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 2);
+        const CTxMemPool::TxCluster *pcluster = pool._GetCluster(pool._GetClustersByBestChunk().begin()->nClusterId);
+        BOOST_CHECK(pcluster && pcluster->vChunks.size() == 2);
+        BOOST_CHECK(pcluster->vChunks[1].vTxns[0]->GetTx().GetHash() == txE.GetHash());
+    }
+
+    // One pass can take several chunks of the same cluster
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    {
+        READLOCK(pool.cs_txmempool);
+        pool._UpdateClusters();
+        BOOST_CHECK_EQUAL(pool._ClusterCount(), 0);
+        BOOST_CHECK(pool._GetClustersByBestChunk().empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_2;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txChild.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).FromTx(txChild));
+
+    CTxMemPoolSnapshotRef snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->size(), 2);
+    BOOST_CHECK_EQUAL(snapshot->nTotalTxSize, pool.GetTotalTxSize());
+    int64_t nParent = snapshot->Find(txParent.GetHash());
+    int64_t nChild = snapshot->Find(txChild.GetHash());
+    BOOST_CHECK(nParent >= 0 && nChild >= 0);
+    BOOST_CHECK(snapshot->Find(uint256()) == -1);
+
+    std::set<uint32_t> setRelatives;
+    snapshot->CalculateAncestors(nChild, setRelatives);
+    BOOST_CHECK(setRelatives.size() == 1 && *setRelatives.begin() == nParent);
+    setRelatives.clear();
+    snapshot->CalculateDescendants(nParent, setRelatives);
+    BOOST_CHECK(setRelatives.size() == 1 && *setRelatives.begin() == nChild);
+
+    // An unchanged mempool hands out the same snapshot
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+
+    // A change publishes a new snapshot and leaves the old one intact
+    std::list<CTransactionRef> removed;
+    pool.removeRecursive(CTransaction(txParent), removed);
+    CTxMemPoolSnapshotRef snapshot2 = pool.GetSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot);
+    BOOST_CHECK_EQUAL(snapshot2->size(), 0);
+    BOOST_CHECK_EQUAL(snapshot->size(), 2);
+    BOOST_CHECK(snapshot->vEntries[nChild].entry.GetTx().GetHash() == txChild.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+#include "stat.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+static bool HasLine(const std::string &page, const std::string &line)
+{
+    return page.find("\n" + line + "\n") != std::string::npos;
+}
+
+// Every line is a TYPE comment or a sample, and every metric is declared before its samples
+static bool IsWellFormed(const std::string &page)
+{
+    static const std::regex type("# TYPE ([a-zA-Z_:][a-zA-Z0-9_:]*) gauge");
+    static const std::regex sample(
+        "([a-zA-Z_:][a-zA-Z0-9_:]*)(\\{[a-zA-Z_][a-zA-Z0-9_]*=\"[^\"]*\"(,[a-zA-Z_][a-zA-Z0-9_]*=\"[^\"]*\")*\\})? "
+        "(-?[0-9.e+-]+|NaN|[+-]Inf)");
+    std::istringstream lines(page);
+    std::string line;
+    std::string metric;
+    std::smatch match;
+    while (std::getline(lines, line))
+    {
+        if (std::regex_match(line, match, type))
+            metric = match[1];
+        else if (!std::regex_match(line, match, sample) || match[1] != metric)
+            return false;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(metrics_render)
+{
+    statMinInterval = std::chrono::milliseconds(5000);
+    CStat<uint64_t> plain("metrics/plain");
+    CStatHistory<uint64_t> sum("metrics/sum");
+    CStatHistory<double> ave("metrics/ave", STAT_OP_AVE);
+    CStatHistory<uint64_t, MinValMax<uint64_t> > range("metrics/range");
+    plain = 42;
+    sum << 7;
+    sum.timeout(boost::system::error_code());
+    sum << 3;
+    ave << 1.5;
+    range << 5;
+    CStatHistory<uint64_t> peerSent("node/1.2.3.4:8333/bytesSent");
+    CStatHistory<uint64_t> otherPeerSent("node/[::1]:8333/bytesSent");
+    peerSent << 11;
+    otherPeerSent << 12;
+
+    const std::string page = RenderMetrics();
+    BOOST_CHECK(IsWellFormed(page));
+    BOOST_CHECK(HasLine(page, "# TYPE membercoin_metrics_plain gauge"));
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_plain 42"));
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_sum{series=\"now\"} 3"));
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_sum{series=\"total\"} 7"));
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_sum{series=\"sec10\"} 7"));
+    BOOST_CHECK(page.find("membercoin_metrics_sum{series=\"min5\"}") == std::string::npos);
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_ave{series=\"now\"} 1.5"));
+    BOOST_CHECK(HasLine(page, "membercoin_metrics_range{series=\"now\",field=\"max\"} 5"));
+    BOOST_CHECK(HasLine(page, "membercoin_tweak{name=\"debug.lockProfiling\"} 0"));
+
+    // every peer's statistic shares one metric, told apart by a peer label
+    BOOST_CHECK(HasLine(page, "membercoin_node_bytesSent{peer=\"1.2.3.4:8333\",series=\"now\"} 11"));
+    BOOST_CHECK(HasLine(page, "membercoin_node_bytesSent{peer=\"[::1]:8333\",series=\"now\"} 12"));
+    BOOST_CHECK(page.find("# TYPE membercoin_node_bytesSent gauge") ==
+                page.rfind("# TYPE membercoin_node_bytesSent gauge"));
+    BOOST_CHECK(page.find("membercoin_node_1_2_3_4") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_scrape_under_load)
+{
+    statMinInterval = std::chrono::milliseconds(5000);
+    CStatHistory<uint64_t> counted("metrics/counted");
+    std::atomic<bool> fStop{false};
+    std::vector<std::thread> threads;
+
+    // threads keep counting, and statistics keep coming and going, while we scrape
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back([&counted, &fStop]() {
+            while (!fStop)
+                counted << 1;
+        });
+    threads.emplace_back([&fStop]() {
+        for (int i = 0; !fStop; i++)
+        {
+            CStatHistory<uint64_t> shortLived(strprintf("metrics/shortlived%d", i % 8));
+            shortLived << 1;
+        }
+    });
+
+    uint64_t nLast = 0;
+    for (int i = 0; i < 50; i++)
+    {
+        const std::string page = RenderMetrics();
+        BOOST_CHECK(IsWellFormed(page));
+        const std::string prefix = "membercoin_metrics_counted{series=\"now\"} ";
+        const size_t pos = page.find(prefix);
+        BOOST_REQUIRE(pos != std::string::npos);
+        const uint64_t nNow = std::stoull(page.substr(pos + prefix.size()));
+        // nothing counted gets lost or is reported twice
+        BOOST_CHECK(nNow >= nLast);
+        nLast = nNow;
+    }
+
+    fStop = true;
+    for (std::thread &thread : threads)
+        thread.join();
+    BOOST_CHECK(counted() >= nLast);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -85,13 +85,13 @@ bool TestSequenceLocks(const CTransaction &tx, int flags)
     return CheckSequenceLocks(MakeTransactionRef(tx), flags);
 }
 
-// Test suite for ancestor feerate transaction selection.
+// Test suite for chunk feerate transaction selection.
 // Implemented as an additional function, rather than a separate test case,
 // to allow reusing the blockchain created in CreateNewBlock_validity.
 // Note that this test assumes blockprioritysize is 0.
 void TestPackageSelection(const CChainParams &chainparams, CScript scriptPubKey, std::vector<CTransactionRef> &txFirst)
 {
-    // Test the ancestor feerate transaction selection.
+    // Test the chunk feerate transaction selection.
     TestMemPoolEntryHelper entry;
 
     SetArg("-blockprioritysize", std::to_string(0));
@@ -203,9 +203,10 @@ void TestPackageSelection(const CChainParams &chainparams, CScript scriptPubKey,
     BOOST_CHECK(pblocktemplate->block.vtx[5]->GetHash() == hashHighFeeTx2);
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 
-    // Test CPFP with AGT (ancestor grouped transactions)
-    // Add another 0 fee tx to higher fee tx chain. This should also get mined
-    // because the total package fees will still be above the minrelaytxfee
+    // Test that a zero fee child is not carried along by its parents
+    // Add another 0 fee tx to higher fee tx chain. It would lower the feerate of
+    // the chunk it joins, so it gets a chunk of its own and that chunk is below
+    // the minrelaytxfee.
     tx.vin[0].prevout.n = 0;
     tx.vin[0].prevout.hash = hashHighFeeTx2;
     feeToUse = 0;
@@ -214,14 +215,14 @@ void TestPackageSelection(const CChainParams &chainparams, CScript scriptPubKey,
     mempool.addUnchecked(hashFreeTx3, entry.Fee(feeToUse).SpendsCoinbase(false).FromTx(tx));
     pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
 
-    // Although hashFreeTx3 is a zero fee it still gets mined before hashLowFeeTx2 which
-    // has a higher fee. This is because hashFreeTx3 is part of the ancestor grouping
-    // along with hashHighFeeTx2 and hashFreeTx2 and since it's "group" fee is higher
-    // than hashLowFeeTx2 then it will get mined first.
+    // The rest of the block is unchanged and hashFreeTx3 is not mined.
     BOOST_CHECK(pblocktemplate->block.vtx[4]->GetHash() == hashFreeTx2);
     BOOST_CHECK(pblocktemplate->block.vtx[5]->GetHash() == hashHighFeeTx2);
-    BOOST_CHECK(pblocktemplate->block.vtx[6]->GetHash() == hashFreeTx3);
-    BOOST_CHECK(pblocktemplate->block.vtx[9]->GetHash() == hashLowFeeTx2);
+    BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
+    for (size_t i = 0; i < pblocktemplate->block.vtx.size(); ++i)
+    {
+        BOOST_CHECK(pblocktemplate->block.vtx[i]->GetHash() != hashFreeTx3);
+    }
 
     // reset back to ctor
     fCanonicalTxsOrder = true;
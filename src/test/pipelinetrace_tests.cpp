@@ -0,0 +1,138 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pipelinetrace.h"
+#include "arith_uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <memory>
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(pipelinetrace_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pipelinetrace_histogram)
+{
+    // every value falls into a bucket whose highest value is at most 1/16 above it
+    for (uint64_t nValue : {0ULL, 1ULL, 31ULL, 32ULL, 33ULL, 63ULL, 64ULL, 1000ULL, 123456789ULL, ~0ULL})
+    {
+        const unsigned int nIndex = CLatencyHistogram::BucketIndex(nValue);
+        BOOST_CHECK(nIndex < CLatencyHistogram::BUCKETS);
+        const uint64_t nHighest = CLatencyHistogram::BucketHighest(nIndex);
+        BOOST_CHECK(nHighest >= nValue);
+        BOOST_CHECK(nHighest - nValue <= nValue / CLatencyHistogram::SUB_BUCKETS);
+        if (nIndex > 0)
+            BOOST_CHECK(CLatencyHistogram::BucketHighest(nIndex - 1) < nValue);
+    }
+    BOOST_CHECK_EQUAL(CLatencyHistogram::BucketIndex(~0ULL), CLatencyHistogram::BUCKETS - 1);
+
+    std::unique_ptr<CLatencyHistogram> histogram(new CLatencyHistogram());
+    BOOST_CHECK_EQUAL(histogram->Percentile(50), 0);
+    for (uint64_t i = 1; i <= 1000; i++)
+        histogram->Add(i);
+    BOOST_CHECK_EQUAL(histogram->Count(), 1000);
+    BOOST_CHECK_EQUAL(histogram->Sum(), 500500);
+    BOOST_CHECK_EQUAL(histogram->Max(), 1000);
+    const uint64_t nMedian = histogram->Percentile(50);
+    BOOST_CHECK(nMedian >= 500 && nMedian <= 500 + 500 / 16);
+    const uint64_t n99 = histogram->Percentile(99);
+    BOOST_CHECK(n99 >= 990 && n99 <= 1000);
+    BOOST_CHECK_EQUAL(histogram->Percentile(100), 1000);
+    BOOST_CHECK_EQUAL(histogram->Percentile(0), 1);
+
+    histogram->Clear();
+    BOOST_CHECK_EQUAL(histogram->Count(), 0);
+    BOOST_CHECK_EQUAL(histogram->Percentile(99), 0);
+}
+
+BOOST_AUTO_TEST_CASE(pipelinetrace_events)
+{
+    std::unique_ptr<CPipelineTrace> trace(new CPipelineTrace());
+    const uint256 hashBlock = ArithToUint256(arith_uint256(1));
+    const uint256 hashTx = ArithToUint256(arith_uint256(2));
+
+    trace->Record(PIPELINE_BLOCK_CHECK, hashBlock, 1000, 3000);
+    trace->Record(PIPELINE_TX_VALIDATE, hashTx, 2000, 2500);
+    trace->Record(PIPELINE_BLOCK_CONNECT, hashBlock, 4000, 10000);
+
+    std::vector<CPipelineEvent> vEvents = trace->GetEvents();
+    BOOST_CHECK_EQUAL(vEvents.size(), 3);
+    BOOST_CHECK(vEvents[0].hash == hashBlock);
+    BOOST_CHECK_EQUAL(vEvents[0].stage, PIPELINE_BLOCK_CHECK);
+    BOOST_CHECK_EQUAL(vEvents[0].nStartNanos, 1000);
+    BOOST_CHECK_EQUAL(vEvents[0].nDurationNanos, 2000);
+    BOOST_CHECK(vEvents[1].hash == hashTx);
+
+    vEvents = trace->GetEvents(&hashBlock);
+    BOOST_CHECK_EQUAL(vEvents.size(), 2);
+    BOOST_CHECK_EQUAL(vEvents[1].stage, PIPELINE_BLOCK_CONNECT);
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_BLOCK_CONNECT).Count(), 1);
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_BLOCK_CONNECT).Max(), 6);
+
+    // stages that span messages are only recorded once the hash has a start
+    const uint256 hashNew = ArithToUint256(arith_uint256(3));
+    trace->RecordSinceStart(PIPELINE_BLOCK_RECEIVE, hashNew);
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_BLOCK_RECEIVE).Count(), 0);
+    trace->RecordSinceStart(PIPELINE_BLOCK_RELAY, hashNew);
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_BLOCK_RELAY).Count(), 1);
+    BOOST_CHECK_EQUAL(trace->GetEvents(&hashNew).size(), 1);
+
+    // only the most recent events are kept
+    for (size_t i = 0; i < CPipelineTrace::RING_SIZE; i++)
+        trace->Record(PIPELINE_TX_VALIDATE, hashTx, i, i + 1);
+    BOOST_CHECK_EQUAL(trace->GetEvents().size(), CPipelineTrace::RING_SIZE);
+    BOOST_CHECK(trace->GetEvents(&hashBlock).empty());
+
+    trace->Clear();
+    BOOST_CHECK(trace->GetEvents().empty());
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_TX_VALIDATE).Count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(pipelinetrace_concurrent)
+{
+    std::unique_ptr<CPipelineTrace> trace(new CPipelineTrace());
+    const unsigned int nThreads = 4;
+    const uint64_t nPerThread = 20000;
+    std::atomic<bool> fDone{false};
+    std::atomic<uint64_t> nTorn{0};
+    std::atomic<uint64_t> nRead{0};
+
+    // every event's hash and duration are derived from its start, so a reader copying the ring while the writers
+    // wrap it can tell if it ever got parts of two different events
+    std::thread reader([&]() {
+        while (!fDone)
+        {
+            for (const CPipelineEvent &event : trace->GetEvents())
+            {
+                nRead++;
+                if (event.hash != ArithToUint256(arith_uint256(event.nStartNanos)) ||
+                    event.nDurationNanos != event.nStartNanos)
+                    nTorn++;
+            }
+        }
+    });
+    std::vector<std::thread> vWriters;
+    for (unsigned int t = 0; t < nThreads; t++)
+    {
+        vWriters.emplace_back([&trace, t]() {
+            for (uint64_t i = 1; i <= nPerThread; i++)
+            {
+                const uint64_t nStart = t * nPerThread + i;
+                trace->Record(PIPELINE_TX_VALIDATE, ArithToUint256(arith_uint256(nStart)), nStart, 2 * nStart);
+            }
+        });
+    }
+    for (std::thread &writer : vWriters)
+        writer.join();
+    fDone = true;
+    reader.join();
+
+    BOOST_CHECK_EQUAL(nTorn.load(), 0);
+    BOOST_CHECK(nRead.load() > 0);
+    BOOST_CHECK_EQUAL(trace->Histogram(PIPELINE_TX_VALIDATE).Count(), nThreads * nPerThread);
+    BOOST_CHECK_EQUAL(trace->GetEvents().size(), CPipelineTrace::RING_SIZE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -607,6 +607,24 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates_tx_bell_curve)
             BOOST_CHECK(mpool.estimateFee(5) <= CFeeRate(1000 + (feebumper * 6)));
         }
     }
+
+    // a batch of targets gives the same estimates as asking for them one at a time, and untracked targets fail
+    std::vector<int> vBlocks;
+    for (int i = 0; i <= (int)MAX_BLOCK_CONFIRMS + 1; i++)
+        vBlocks.push_back(i);
+    std::vector<CFeeRate> vFeeRates = mpool.estimateFees(vBlocks);
+    BOOST_CHECK_EQUAL(vFeeRates.size(), vBlocks.size());
+    for (size_t i = 0; i < vBlocks.size(); i++)
+        BOOST_CHECK(vFeeRates[i] == mpool.estimateFee(vBlocks[i]));
+    BOOST_CHECK(vFeeRates.front() == CFeeRate(0));
+    BOOST_CHECK(vFeeRates.back() == CFeeRate(0));
+
+    // the lazily decayed averages are saved in the usual format and can be read back
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(file));
+    rewind(file.Get());
+    CTxMemPool mpool2;
+    BOOST_CHECK(mpool2.ReadFeeEstimates(file));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "random.h"
+#include "riblt.h"
+#include "serialize.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <set>
+
+BOOST_FIXTURE_TEST_SUITE(riblt_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(riblt_symbol_serde)
+{
+    CRibltSymbol symbol;
+    symbol.apply(0x0123456789abcdefULL, 0xdeadbeef, -1);
+    symbol.apply(0xfedcba9876543210ULL, 0xcafebabe, -1);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << symbol;
+    // 8 byte key sum, 4 byte checksum and a single byte for the small count
+    BOOST_CHECK_EQUAL(ss.size(), 13);
+
+    CRibltSymbol symbol2;
+    ss >> symbol2;
+    BOOST_CHECK_EQUAL(symbol2.keySum, symbol.keySum);
+    BOOST_CHECK_EQUAL(symbol2.keyCheck, symbol.keyCheck);
+    BOOST_CHECK_EQUAL(symbol2.count, -2);
+}
+
+BOOST_AUTO_TEST_CASE(riblt_mapping_is_deterministic_and_increasing)
+{
+    CRibltMapping a(12345);
+    CRibltMapping b(12345);
+    uint64_t nLast = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        uint64_t nIndex = a.next();
+        BOOST_CHECK_EQUAL(nIndex, b.next());
+        BOOST_CHECK(nIndex > nLast);
+        nLast = nIndex;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(riblt_identical_sets_decode_immediately)
+{
+    CRibltEncoder encoder;
+    CRibltDecoder decoder;
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        encoder.addKey(i);
+        decoder.addLocalKey(i);
+    }
+
+    for (const CRibltSymbol &symbol : encoder.nextSymbols(1))
+        decoder.addSymbol(symbol);
+    BOOST_CHECK(decoder.decoded());
+    BOOST_CHECK(decoder.remoteOnly().empty());
+    BOOST_CHECK(decoder.localOnly().empty());
+}
+
+BOOST_AUTO_TEST_CASE(riblt_decodes_any_difference)
+{
+    // No matter the difference the decoder gets there by pulling more symbols, and needs
+    // only a small multiple of the difference to do so.
+    size_t sizes[] = {1, 2, 10, 100, 1000, 5000};
+    for (size_t nDiff : sizes)
+    {
+        CRibltEncoder encoder;
+        CRibltDecoder decoder;
+        std::set<uint64_t> setRemote;
+        std::set<uint64_t> setLocal;
+
+        // a large common part plus nDiff keys split between the two sides
+        for (size_t i = 0; i < 2000; i++)
+        {
+            uint64_t key = GetRand(std::numeric_limits<uint64_t>::max());
+            encoder.addKey(key);
+            decoder.addLocalKey(key);
+        }
+        for (size_t i = 0; i < nDiff; i++)
+        {
+            uint64_t key = GetRand(std::numeric_limits<uint64_t>::max());
+            if (i % 3 == 0)
+            {
+                setLocal.insert(key);
+                decoder.addLocalKey(key);
+            }
+            else
+            {
+                setRemote.insert(key);
+                encoder.addKey(key);
+            }
+        }
+
+        while (!decoder.decoded() && decoder.symbolCount() < 10 * nDiff + 100)
+        {
+            for (const CRibltSymbol &symbol : encoder.nextSymbols(16))
+                decoder.addSymbol(symbol);
+        }
+
+        BOOST_CHECK(decoder.decoded());
+        BOOST_CHECK(decoder.symbolCount() <= 3 * nDiff + 32);
+        BOOST_CHECK(std::set<uint64_t>(decoder.remoteOnly().begin(), decoder.remoteOnly().end()) == setRemote);
+        BOOST_CHECK(std::set<uint64_t>(decoder.localOnly().begin(), decoder.localOnly().end()) == setLocal);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(riblt_local_keys_after_symbols)
+{
+    // Local keys may be added after remote symbols have arrived
+    CRibltEncoder encoder;
+    CRibltDecoder decoder;
+    for (uint64_t i = 0; i < 50; i++)
+        encoder.addKey(i);
+    for (const CRibltSymbol &symbol : encoder.nextSymbols(40))
+        decoder.addSymbol(symbol);
+    for (uint64_t i = 5; i < 55; i++)
+        decoder.addLocalKey(i);
+
+    BOOST_CHECK(decoder.decoded());
+    BOOST_CHECK(std::set<uint64_t>(decoder.remoteOnly().begin(), decoder.remoteOnly().end()) ==
+                std::set<uint64_t>({0, 1, 2, 3, 4}));
+    BOOST_CHECK(std::set<uint64_t>(decoder.localOnly().begin(), decoder.localOnly().end()) ==
+                std::set<uint64_t>({50, 51, 52, 53, 54}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
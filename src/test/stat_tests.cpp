@@ -7,6 +7,8 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <thread>
+
 BOOST_FIXTURE_TEST_SUITE(stat_tests, BasicTestingSetup)
 BOOST_AUTO_TEST_CASE(stat_testvectors)
 {
@@ -131,4 +133,46 @@ BOOST_AUTO_TEST_CASE(stat_empty_construct)
     }
 }
 
+BOOST_AUTO_TEST_CASE(stat_sharded_sum)
+{
+    statMinInterval = std::chrono::milliseconds(5000);
+    CStatHistory<uint64_t> *stat = new CStatHistory<uint64_t>("sharded");
+    CStatHistory<uint64_t> *kept = new CStatHistory<uint64_t>("shardedkept", STAT_OP_SUM | STAT_KEEP);
+
+    // threads count into their own cells, nothing gets lost
+    const int nThreads = 8;
+    const int nAdds = 10000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.emplace_back([stat, kept]() {
+            for (int j = 0; j < nAdds; j++)
+            {
+                (*stat) << 2;
+                (*kept) += 1;
+            }
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+    BOOST_CHECK_EQUAL((*stat)(), (uint64_t)nThreads * nAdds * 2);
+    BOOST_CHECK_EQUAL(stat->GetNow().get_int64(), nThreads * nAdds * 2);
+
+    // what was counted goes into the history when the timer fires
+    (*stat) << 5;
+    (*kept) -= 4;
+    stat->timeout(boost::system::error_code());
+    kept->timeout(boost::system::error_code());
+    BOOST_CHECK_EQUAL(stat->History(0, 0), (uint64_t)nThreads * nAdds * 2 + 5);
+    BOOST_CHECK_EQUAL((*stat)(), 0UL);
+    BOOST_CHECK_EQUAL((*kept)(), (uint64_t)nThreads * nAdds - 4);
+    BOOST_CHECK_EQUAL(stat->GetTotalTyped(), (uint64_t)nThreads * nAdds * 2 + 5);
+
+    // assignment replaces whatever was counted
+    (*stat) << 7;
+    (*stat) = 3;
+    BOOST_CHECK_EQUAL((*stat)(), 3UL);
+
+    delete stat;
+    delete kept;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "txrecon.h"
+#include "blockrelay/graphene.h"
+#include "blockrelay/mempool_sync.h"
+#include "serialize.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txrecon_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(txrecon_messages_can_serde)
+{
+    CTxReconRequest req(7, 11, 1234);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << req;
+    CTxReconRequest req2;
+    ss >> req2;
+    BOOST_CHECK_EQUAL(req2.shorttxidk0, 7);
+    BOOST_CHECK_EQUAL(req2.shorttxidk1, 11);
+    BOOST_CHECK_EQUAL(req2.nSetSize, 1234);
+
+    CRibltEncoder encoder;
+    for (uint64_t i = 1; i <= 10; i++)
+        encoder.addKey(i * 0x1000193);
+    CTxReconSketch sketch(10, 0, encoder.nextSymbols(20));
+    ss << sketch;
+    CTxReconSketch sketch2;
+    ss >> sketch2;
+    BOOST_CHECK_EQUAL(sketch2.nSetSize, 10);
+    BOOST_CHECK_EQUAL(sketch2.nFirstSymbol, 0);
+    BOOST_CHECK_EQUAL(sketch2.vSymbols.size(), 20);
+    BOOST_CHECK_EQUAL(sketch2.vSymbols[0].count, 10);
+
+    CTxReconSymbolRequest symreq(20, 40);
+    ss << symreq;
+    CTxReconSymbolRequest symreq2;
+    ss >> symreq2;
+    BOOST_CHECK_EQUAL(symreq2.nFirstSymbol, 20);
+    BOOST_CHECK_EQUAL(symreq2.nSymbols, 40);
+
+    CTxReconDiff diff(false, {1, 2, 3});
+    ss << diff;
+    CTxReconDiff diff2;
+    ss >> diff2;
+    BOOST_CHECK(!diff2.fFailed);
+    BOOST_CHECK(diff2.vShortIds == diff.vShortIds);
+
+    // oversized messages are rejected while deserializing
+    CTxReconDiff bigdiff(false, std::vector<uint64_t>(TX_RECON_MAX_SET_SIZE + 1, 1));
+    ss << bigdiff;
+    BOOST_CHECK_THROW(ss >> diff2, std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(txrecon_round_finds_difference)
+{
+    // Both sides held back most of the same transactions; each should learn exactly what the other one lacks
+    uint64_t k0 = 0x0123456789abcdefULL;
+    uint64_t k1 = 0xfedcba9876543210ULL;
+    std::vector<uint256> vCommon, vInitiatorOnly, vResponderOnly;
+    for (int i = 0; i < 200; i++)
+        vCommon.push_back(GetRandHash());
+    for (int i = 0; i < 7; i++)
+        vInitiatorOnly.push_back(GetRandHash());
+    for (int i = 0; i < 5; i++)
+        vResponderOnly.push_back(GetRandHash());
+
+    CRibltEncoder encoder;
+    for (const uint256 &hash : vCommon)
+        encoder.addKey(GetShortID(k0, k1, hash, SHORT_ID_VERSION));
+    for (const uint256 &hash : vResponderOnly)
+        encoder.addKey(GetShortID(k0, k1, hash, SHORT_ID_VERSION));
+
+    CRibltDecoder decoder;
+    for (const uint256 &hash : vCommon)
+        decoder.addLocalKey(GetShortID(k0, k1, hash, SHORT_ID_VERSION));
+    for (const uint256 &hash : vInitiatorOnly)
+        decoder.addLocalKey(GetShortID(k0, k1, hash, SHORT_ID_VERSION));
+
+    uint64_t nMax = 2 * (vCommon.size() * 2 + vInitiatorOnly.size() + vResponderOnly.size()) + TX_RECON_MIN_SYMBOLS;
+    while (!decoder.decoded() && decoder.symbolCount() < nMax)
+    {
+        for (const CRibltSymbol &symbol : encoder.nextSymbols(TX_RECON_MIN_SYMBOLS))
+            decoder.addSymbol(symbol);
+    }
+    BOOST_CHECK(decoder.decoded());
+    BOOST_CHECK_EQUAL(decoder.remoteOnly().size(), vResponderOnly.size());
+    BOOST_CHECK_EQUAL(decoder.localOnly().size(), vInitiatorOnly.size());
+    for (const uint256 &hash : vResponderOnly)
+    {
+        uint64_t shortid = GetShortID(k0, k1, hash, SHORT_ID_VERSION);
+        BOOST_CHECK(std::find(decoder.remoteOnly().begin(), decoder.remoteOnly().end(), shortid) !=
+                    decoder.remoteOnly().end());
+    }
+    // a dozen differences should cost far fewer symbols than the sets hold
+    BOOST_CHECK(decoder.symbolCount() < vCommon.size());
+}
+
+BOOST_AUTO_TEST_CASE(txrecon_flood_peers_are_replaced)
+{
+    // With room for two flood peers, both outbound peers get one; the inbound peer takes over when one of them goes
+    CNode out1(INVALID_SOCKET, CAddress(ipaddress(0xa0b0c001, 10000)), "", false);
+    CNode out2(INVALID_SOCKET, CAddress(ipaddress(0xa0b0c002, 10001)), "", false);
+    CNode in1(INVALID_SOCKET, CAddress(ipaddress(0xa0b0c003, 10002)), "", true);
+    out1.id = 1;
+    out2.id = 2;
+    in1.id = 3;
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(&in1);
+        vNodes.push_back(&out1);
+        vNodes.push_back(&out2);
+    }
+    for (CNode *node : {&in1, &out1, &out2})
+    {
+        node->fTxReconciliation = true;
+        InitTxReconciliation(node);
+    }
+    BOOST_CHECK_EQUAL(DEFAULT_TX_RECON_FLOOD_PEERS, 2U);
+    BOOST_CHECK(out1.fTxReconFlood);
+    BOOST_CHECK(out2.fTxReconFlood);
+    BOOST_CHECK(!in1.fTxReconFlood);
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.erase(std::remove(vNodes.begin(), vNodes.end(), &out1), vNodes.end());
+    }
+    ClearDisconnectedFromTxRecon(out1.GetId());
+    BOOST_CHECK(out2.fTxReconFlood);
+    BOOST_CHECK(in1.fTxReconFlood);
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.erase(std::remove(vNodes.begin(), vNodes.end(), &out2), vNodes.end());
+        vNodes.erase(std::remove(vNodes.begin(), vNodes.end(), &in1), vNodes.end());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@
 #include "txorphanpool.h"
 #include "utiltime.h"
 #include "validation/forks.h"
+#include "validation/validation.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -535,4 +536,90 @@ BOOST_FIXTURE_TEST_CASE(long_unconfirmed_chains, TestChain100Setup)
 
     dMinLimiterTxFee.Set(nTempFee);
 }
+
+BOOST_FIXTURE_TEST_CASE(reorg_readmits_transactions, TestChain100Setup)
+{
+    // Transactions from a disconnected block go back into the mempool once the outermost admission pause ends,
+    // and the mempool is trimmed afterwards.
+    mempool.clear();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    unsigned int sighashType = SIGHASH_ALL;
+    if (IsUAHFforkActiveOnNextBlock(chainActive.Tip()->nHeight))
+        sighashType |= SIGHASH_FORKID;
+
+    // A parent and child, so that readmission takes two dependency levels
+    std::vector<CMutableTransaction> spends(2);
+    for (int i = 0; i < 2; i++)
+    {
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout.hash = (i == 0) ? coinbaseTxns[0].GetHash() : spends[0].GetHash();
+        spends[i].vin[0].prevout.n = 0;
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = (11 - i) * CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        // Sign:
+        std::vector<unsigned char> vchSig;
+        CAmount nAmount = (i == 0) ? coinbaseTxns[0].vout[0].nValue : spends[0].vout[0].nValue;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, sighashType, nAmount, 0);
+        BOOST_CHECK(hash != SIGNATURE_HASH_ERROR);
+        BOOST_CHECK(coinbaseKey.SignECDSA(hash, vchSig));
+        vchSig.push_back((unsigned char)sighashType);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    CBlock block = CreateAndProcessBlock(spends, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    CBlockIndex *pindex = chainActive.Tip();
+
+    {
+        TxAdmissionPause pause;
+        {
+            TxAdmissionPause nested;
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), pindex));
+            BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+        }
+        // Nothing is readmitted until the outermost pause ends
+        BOOST_CHECK_EQUAL(mempool.size(), 0);
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(mempool.exists(spends[0].GetHash()));
+    BOOST_CHECK(mempool.exists(spends[1].GetHash()));
+
+    // Reconnect the block, which takes the transactions back out of the mempool
+    {
+        TxAdmissionPause pause;
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(ReconsiderBlock(state, pindex));
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+        BOOST_CHECK(chainActive.Tip() == pindex);
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // With no room in the mempool the readmitted transactions are trimmed right away
+    std::string strMaxMempool = GetArg("-maxmempool", std::to_string(DEFAULT_MAX_MEMPOOL_SIZE));
+    SetArg("-maxmempool", "0");
+    {
+        TxAdmissionPause pause;
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), pindex));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    SetArg("-maxmempool", strMaxMempool);
+
+    {
+        TxAdmissionPause pause;
+        LOCK(cs_main);
+        CValidationState state;
+        ReconsiderBlock(state, pindex);
+        ActivateBestChain(state, Params());
+    }
+    mempool.clear();
+}
 BOOST_AUTO_TEST_SUITE_END()
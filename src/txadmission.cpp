@@ -16,6 +16,7 @@
 #include "main.h"
 #include "net.h"
 #include "parallel.h"
+#include "pipelinetrace.h"
 #include "policy/mempool.h"
 #include "requestManager.h"
 #include "respend/respenddetector.h"
@@ -29,7 +30,9 @@
 #include "validation/validation.h"
 #include "validationinterface.h"
 #include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/algorithm/string/case_conv.hpp>
@@ -275,7 +278,7 @@ void LimitMempoolSize(CTxMemPool &pool, size_t limit, unsigned long age)
         LOG(MEMPOOL, "Expired %i transactions from the memory pool\n", expired);
 
     std::vector<COutPoint> vNoSpendsRemaining;
-    pool.TrimToSize(limit, &vNoSpendsRemaining, false);
+    pool.TrimToSize(limit, &vNoSpendsRemaining);
     for (const COutPoint &removed : vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
@@ -385,6 +388,176 @@ void CommitTxToMempool()
     ProcessOrphans(vWhatChanged);
 }
 
+void QueueReorgReadmission(std::vector<CTransactionRef> &vtx)
+{
+    LOCK(cs_reorgTxs);
+    vReorgTxs.insert(vReorgTxs.end(), vtx.begin(), vtx.end());
+}
+
+/** Validate one dependency level of the reorg transactions, spreading the work over the admission threads */
+static void ValidateReorgLevel(const std::vector<CTransactionRef> &vLevel,
+    std::vector<char> &vAccepted,
+    std::vector<char> &vMissingInputs)
+{
+    std::atomic<size_t> nNext{0};
+    auto validate = [&]() {
+        for (size_t i = nNext++; i < vLevel.size(); i = nNext++)
+        {
+            CValidationState state;
+            bool fMissingInputs = false;
+            bool isRespend = false;
+            std::vector<COutPoint> vCoinsToUncache;
+            vAccepted[i] = ParallelAcceptToMemoryPool(txHandlerSnap, mempool, state, vLevel[i], false,
+                &fMissingInputs, false, TransactionClass::DEFAULT, vCoinsToUncache, &isRespend);
+            vMissingInputs[i] = fMissingInputs;
+            if (!vAccepted[i])
+            {
+                LOG(MEMPOOL, "Reorg tx %s not readmitted: %s\n", vLevel[i]->GetHash().ToString(),
+                    FormatStateMessage(state));
+                if (!fMissingInputs)
+                {
+                    recentRejects.insert(vLevel[i]->GetHash());
+                    for (const COutPoint &remove : vCoinsToUncache)
+                        pcoinsTip->Uncache(remove);
+                }
+            }
+        }
+    };
+
+    // Small levels are not worth starting threads for
+    unsigned int nThreads = std::min((size_t)std::max(numTxAdmissionThreads.Value(), 1U), vLevel.size() / 16 + 1);
+    boost::thread_group workers;
+    for (unsigned int i = 1; i < nThreads; i++)
+        workers.create_thread(validate);
+    validate();
+    workers.join_all();
+}
+
+void ReadmitReorgTransactions()
+{
+    std::vector<CTransactionRef> vtx;
+    {
+        LOCK(cs_reorgTxs);
+        vtx.swap(vReorgTxs);
+    }
+    if (vtx.empty())
+        return;
+
+    int64_t nStart = GetStopwatchMicros();
+
+    // Drop duplicates and whatever the new chain already confirmed.  Anything that conflicts with another of these
+    // transactions goes through normal admission instead, so that a level never holds a double spend.
+    std::vector<CTransactionRef> vCandidates;
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> mapIndex;
+    std::set<COutPoint> setSpent;
+    std::vector<CTransactionRef> vConflicted;
+    vCandidates.reserve(vtx.size());
+    for (const CTransactionRef &ptx : vtx)
+    {
+        const uint256 &hash = ptx->GetHash();
+        if (mapIndex.count(hash) || TxAlreadyHave(CInv(MSG_TX, hash)))
+            continue;
+        bool fConflict = false;
+        for (const CTxIn &txin : ptx->vin)
+        {
+            if (setSpent.count(txin.prevout))
+            {
+                fConflict = true;
+                break;
+            }
+        }
+        if (fConflict)
+        {
+            vConflicted.push_back(ptx);
+            continue;
+        }
+        for (const CTxIn &txin : ptx->vin)
+            setSpent.insert(txin.prevout);
+        mapIndex.emplace(hash, vCandidates.size());
+        vCandidates.push_back(ptx);
+    }
+
+    // Order the transactions topologically: each one goes into the level after its deepest parent among them.
+    std::vector<std::vector<size_t> > vChildren(vCandidates.size());
+    std::vector<unsigned int> vPending(vCandidates.size(), 0);
+    for (size_t i = 0; i < vCandidates.size(); i++)
+    {
+        std::set<size_t> setParents;
+        for (const CTxIn &txin : vCandidates[i]->vin)
+        {
+            auto it = mapIndex.find(txin.prevout.hash);
+            if (it != mapIndex.end() && setParents.insert(it->second).second)
+                vChildren[it->second].push_back(i);
+        }
+        vPending[i] = setParents.size();
+    }
+    std::vector<size_t> vNext;
+    for (size_t i = 0; i < vCandidates.size(); i++)
+    {
+        if (vPending[i] == 0)
+            vNext.push_back(i);
+    }
+
+    uint64_t nAccepted = 0;
+    unsigned int nLevels = 0;
+    std::vector<CTransactionRef> vRetry;
+    while (!vNext.empty())
+    {
+        std::vector<CTransactionRef> vLevel;
+        vLevel.reserve(vNext.size());
+        for (size_t i : vNext)
+            vLevel.push_back(vCandidates[i]);
+        std::vector<char> vAccepted(vLevel.size(), 0);
+        std::vector<char> vMissingInputs(vLevel.size(), 0);
+        ValidateReorgLevel(vLevel, vAccepted, vMissingInputs);
+
+        // Commit the whole level at once so that the next one can find its parents in the mempool
+        CommitTxToMempool();
+        nLevels++;
+
+        std::vector<size_t> vLevelNext;
+        for (size_t j = 0; j < vNext.size(); j++)
+        {
+            if (vAccepted[j])
+            {
+                nAccepted++;
+                RelayTransaction(vLevel[j]);
+            }
+            else if (vMissingInputs[j])
+            {
+                // Let normal admission decide whether this is an orphan
+                vRetry.push_back(vLevel[j]);
+            }
+            // Children of a rejected transaction are still tried, they fail quickly on their missing inputs
+            for (size_t child : vChildren[vNext[j]])
+            {
+                if (--vPending[child] == 0)
+                    vLevelNext.push_back(child);
+            }
+        }
+        vNext.swap(vLevelNext);
+    }
+
+    // The blocks we disconnected can hold more than the mempool has room for
+    if (nAccepted > 0)
+    {
+        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
+            GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    }
+
+    vRetry.insert(vRetry.end(), vConflicted.begin(), vConflicted.end());
+    for (const CTransactionRef &ptx : vRetry)
+    {
+        CTxInputData txd;
+        txd.tx = ptx;
+        txd.nodeName = "rollback";
+        EnqueueTxForAdmission(txd);
+    }
+
+    LOG(BENCH, "- Reorg readmission: %u of %u txs in %u levels, %u requeued: %.2fms\n", nAccepted, vtx.size(),
+        nLevels, vRetry.size(), (GetStopwatchMicros() - nStart) * 0.001);
+}
+
 void ThreadTxAdmission()
 {
     // Process at most this many transactions before letting the commit thread take over
@@ -434,7 +607,7 @@ void ThreadTxAdmission()
                 {
                     return;
                 }
-                cvTxInQ.wait(csTxInQ);
+                lock.Wait(cvTxInQ);
             }
             if (shutdown_threads.load() == true)
             {
@@ -480,6 +653,7 @@ void ThreadTxAdmission()
                     {
                         acceptedSomething = true;
                         RelayTransaction(tx, txProps);
+                        pipelineTrace.Record(PIPELINE_TX_RELAY, tx->GetHash(), txd.nReceived, GetStopwatch());
 
                         // LOG(MEMPOOL, "Accepted tx: peer=%s: accepted %s onto Q\n", txd.nodeName,
                         //     tx->GetHash().ToString());
@@ -1255,6 +1429,22 @@ bool ParallelAcceptToMemoryPool(Snapshot &ss,
                     txProps->sizeWithAncestors = size;
                 }
             }
+
+            // Chains may be as long as they like, but every change to a cluster costs a re-linearization of all
+            // of it, so the number of transactions connected to each other is limited.
+            const size_t nLimitCluster = GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+            if (pool._ClusterSizeWithParents(pool.GetMemPoolParents(*tx)) > nLimitCluster)
+            {
+                if (debugger)
+                {
+                    debugger->AddInvalidReason("too-large-mempool-cluster");
+                    debugger->standard = false;
+                }
+                else
+                {
+                    return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-mempool-cluster");
+                }
+            }
         }
 
 
@@ -1330,7 +1520,9 @@ bool ParallelAcceptToMemoryPool(Snapshot &ss,
             (*txCommitQ).emplace(eData.hash, eData);
         }
     }
-    uint64_t interval = (GetStopwatch() - start) / 1000;
+    const uint64_t nEnd = GetStopwatch();
+    pipelineTrace.Record(PIPELINE_TX_VALIDATE, tx->GetHash(), start, nEnd);
+    uint64_t interval = (nEnd - start) / 1000;
     // typically too much logging, but useful when optimizing tx validation
     LOG(BENCH, "ValidateTransaction, time: %d, tx: %s, len: %d, sigops: %llu (legacy: %u), sighash: %llu, Vin: "
                "%llu, Vout: %llu\n",
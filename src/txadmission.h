@@ -11,6 +11,7 @@
 #include "threadgroup.h"
 #include "txdebugger.h"
 #include "txmempool.h"
+#include "utiltime.h"
 #include <queue>
 
 /** The default value for -minrelaytxfee in sat/byte */
@@ -85,8 +86,9 @@ public:
     NodeId nodeId; // hold the id so I don't keep a ref to the node
     bool whitelisted;
     std::string nodeName;
+    uint64_t nReceived; // GetStopwatch() time the tx reached us
 
-    CTxInputData() : nodeId(-1), whitelisted(false), nodeName("none") {}
+    CTxInputData() : nodeId(-1), whitelisted(false), nodeName("none"), nReceived(GetStopwatch()) {}
 };
 
 // Tracks data about transactions that are ready to be committed to the mempool
@@ -143,6 +145,13 @@ extern std::queue<CTxInputData> txInQ;
 // Guarded by csTxInQ
 extern std::queue<CTxInputData> txDeferQ;
 
+// Transactions from disconnected blocks and the cleared mempool, waiting to be readmitted once a reorg is done
+// Guarded by cs_reorgTxs
+extern CCriticalSection cs_reorgTxs;
+extern std::vector<CTransactionRef> vReorgTxs;
+// How many TxAdmissionPause objects this thread holds; only the outermost one readmits vReorgTxs
+extern thread_local unsigned int nTxAdmissionPauseDepth;
+
 // Transactions that are validated and can be committed to the mempool, and protection
 extern CWaitableCriticalSection csCommitQ;
 extern CConditionVariable cvCommitQ;
@@ -186,6 +195,16 @@ bool ParallelAcceptToMemoryPool(Snapshot &ss,
     CValidationDebugger *debugger = nullptr,
     CTxProperties *txProps = nullptr);
 
+/** Hold transactions back for readmission to the mempool once the current reorg is finished */
+void QueueReorgReadmission(std::vector<CTransactionRef> &vtx);
+
+/**
+ * Readmit the transactions held back by a reorg.  They are validated in parallel against txHandlerSnap, one
+ * dependency level at a time, and each level is committed to the mempool in a single batch, after which the mempool
+ * is trimmed back to -maxmempool.  Must be called with tx admission paused and txHandlerSnap loaded for the new tip.
+ */
+void ReadmitReorgTransactions();
+
 /** Checks the size of the mempool and trims it if needed */
 void LimitMempoolSize(CTxMemPool &pool, size_t limit, unsigned long age);
 
@@ -236,12 +255,16 @@ public:
     TxAdmissionPause()
     {
         txProcessingCorral.Enter(CORRAL_TX_PAUSE);
+        nTxAdmissionPauseDepth++;
         CommitTxToMempool();
     }
 
     ~TxAdmissionPause()
     {
         txHandlerSnap.Load(); // Load the new block into the transaction processor's state snapshot
+        // Put back whatever a reorg took out of the mempool, but only once the whole reorg is finished
+        if (--nTxAdmissionPauseDepth == 0)
+            ReadmitReorgTransactions();
         txProcessingCorral.Exit(CORRAL_TX_PAUSE);
     }
 };
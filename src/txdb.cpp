@@ -30,6 +30,7 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_TX_OFFSETS = 'O';
 
 
 namespace
@@ -58,12 +59,56 @@ struct CoinEntry
 }
 
 
+// Each database gets leveldb options that suit the way it is used.  Compaction triggers are compile time
+// constants of leveldb, so max_file_size is the only say we have in how compactions go.
+
+// The UTXO set is read one coin at a time, and many lookups are for coins that do not exist, e.g. when checking
+// that the outputs of a new transaction are unspent.  Small blocks keep a hit to one small read, a stronger bloom
+// filter keeps misses off the disk, and the read cache gets the biggest share of memory.
+static COverrideOptions ChainstateOptions()
+{
+    COverrideOptions options;
+    options.block_size = 4096;
+    options.bloom_bits = 14;
+    options.block_cache_share = 0.6;
+    options.write_buffer_share = 0.2;
+    return options;
+}
+static const COverrideOptions chainstateOptions = ChainstateOptions();
+
+// The block index is read front to back at startup and mostly appended to after that, so it gets bigger blocks to
+// make the scan cheap.
+static COverrideOptions BlockTreeOptions()
+{
+    COverrideOptions options;
+    options.block_size = 16384;
+    return options;
+}
+static const COverrideOptions blockTreeOptions = BlockTreeOptions();
+
+// The transaction index is written for every transaction while it syncs, and only read when someone asks for a
+// transaction, so memory goes to the write buffers rather than the read cache.
+static COverrideOptions TxIndexOptions()
+{
+    COverrideOptions options;
+    options.block_size = 4096;
+    options.block_cache_share = 0.25;
+    options.write_buffer_share = 0.375;
+    return options;
+}
+static const COverrideOptions txIndexOptions = TxIndexOptions();
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize,
     bool fMemory,
     bool fWipe,
     bool fObfuscate,
-    COverrideOptions *overridecache)
-    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, fObfuscate, overridecache)
+    const COverrideOptions *overridecache)
+    : db(GetDataDir() / "chainstate",
+          nCacheSize,
+          fMemory,
+          fWipe,
+          fObfuscate,
+          overridecache ? overridecache : &chainstateOptions)
 {
 }
 
@@ -79,6 +124,27 @@ bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const
     return db.Exists(CoinEntry(&outpoint));
 }
 
+bool CCoinsViewDB::GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const
+{
+    READLOCK(cs_utxo);
+    // The key of a coin is DB_COIN, txid, output index; so the outputs of a transaction form one range of keys,
+    // in the order of their index.
+    std::unique_ptr<CDBIterator> pcursor(const_cast<CDBWrapper &>(db).NewIterator());
+    COutPoint outpoint(txid, 0);
+    pcursor->Seek(CoinEntry(&outpoint));
+    for (; pcursor->Valid(); pcursor->Next())
+    {
+        CoinEntry entry(&outpoint);
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN || outpoint.hash != txid)
+            break;
+        Coin coin;
+        if (!pcursor->GetValue(coin))
+            return error("%s: unable to read coin %s", __func__, outpoint.ToString());
+        coins.emplace_back(outpoint, std::move(coin));
+    }
+    return true;
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const
 {
     READLOCK(cs_utxo);
@@ -159,7 +225,7 @@ void CCoinsViewDB::_WriteBestBlock(const uint256 &hashBlock)
 void CCoinsViewDB::WriteBestBlock(const uint256 &hashBlock, BlockDBMode mode)
 {
     WRITELOCK(cs_utxo);
-    _WriteBestBlock(hashBlock);
+    _WriteBestBlock(hashBlock, mode);
 }
 
 void CCoinsViewDB::_WriteBestBlock(const uint256 &hashBlock, BlockDBMode mode)
@@ -264,7 +330,7 @@ size_t CCoinsViewDB::TotalWriteBufferSize() const
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, string folder, bool fMemory, bool fWipe)
-    : CDBWrapper(GetDataDir() / folder.c_str() / "index", nCacheSize, fMemory, fWipe)
+    : CDBWrapper(GetDataDir() / folder.c_str() / "index", nCacheSize, fMemory, fWipe, false, &blockTreeOptions)
 {
 }
 
@@ -275,6 +341,9 @@ bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info)
 
 bool CBlockTreeDB::WriteReindexing(bool fReindexing)
 {
+    // The flag speaks for the block index queued so far, so that has to be on disk first
+    if (!dbWriter.Barrier(true))
+        return false;
     if (fReindexing)
         return Write(DB_REINDEX_FLAG, '1');
     else
@@ -288,6 +357,43 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing)
 }
 
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) { return Read(DB_LAST_BLOCK, nFile); }
+bool CBlockTreeDB::ReadTxOffsets(const uint256 &hashBlock, CBlockTxOffsets &offsets)
+{
+    return Read(std::make_pair(DB_TX_OFFSETS, hashBlock), offsets);
+}
+
+bool CBlockTreeDB::WriteTxOffsets(const uint256 &hashBlock, const CBlockTxOffsets &offsets)
+{
+    return Write(std::make_pair(DB_TX_OFFSETS, hashBlock), offsets);
+}
+
+void CBlockTreeDB::EraseTxOffsetsAsync(const std::vector<uint256> &vHashBlocks)
+{
+    if (vHashBlocks.empty())
+        return;
+    // each erase is a header, a key length and a 33 byte key
+    const size_t nBytes = vHashBlocks.size() * 35;
+    dbWriter.QueueJob(this,
+        [vHashBlocks](CDBBatch &batch) {
+            for (const uint256 &hashBlock : vHashBlocks)
+                batch.Erase(std::make_pair(DB_TX_OFFSETS, hashBlock));
+        },
+        nBytes);
+}
+
+CBlockTxOffsets::CBlockTxOffsets(const CBlock &block)
+{
+    vShortIds.reserve(block.vtx.size());
+    vOffsets.reserve(block.vtx.size());
+    uint32_t nOffset = GetSizeOfCompactSize(block.vtx.size());
+    for (const auto &tx : block.vtx)
+    {
+        vShortIds.push_back(tx->GetHash().GetCheapHash());
+        vOffsets.push_back(nOffset);
+        nOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper *>(&db)->NewIterator(), GetBestBlock());
@@ -337,29 +443,57 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo *> > &fileInfo,
+bool CBlockTreeDB::WriteBlockIndexAsync(const std::vector<std::pair<int, const CBlockFileInfo *> > &fileInfo,
     int nLastFile,
     const std::vector<const CBlockIndex *> &blockinfo)
 {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<int, const CBlockFileInfo *> >::const_iterator it = fileInfo.begin();
-         it != fileInfo.end(); it++)
-    {
-        batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
-    }
-    if (!pblockdb)
-    {
-        batch.Write(DB_LAST_BLOCK, nLastFile);
-    }
-    for (std::vector<const CBlockIndex *>::const_iterator it = blockinfo.begin(); it != blockinfo.end(); it++)
-    {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
-    }
-    return WriteBatch(batch, true);
+    // The caller holds cs_main, so all we do here is take a copy of the entries.  Serializing them, which for
+    // thousands of entries per flush during IBD is most of the cost, is left to the database writer.
+    int64_t nStart = GetStopwatchMicros();
+    std::vector<std::pair<int, CBlockFileInfo> > vFiles;
+    vFiles.reserve(fileInfo.size());
+    for (const std::pair<int, const CBlockFileInfo *> &item : fileInfo)
+        vFiles.emplace_back(item.first, *item.second);
+    std::vector<std::pair<uint256, CDiskBlockIndex> > vIndex;
+    vIndex.reserve(blockinfo.size());
+    for (const CBlockIndex *pindex : blockinfo)
+        vIndex.emplace_back(pindex->GetBlockHash(), CDiskBlockIndex(pindex));
+    const bool fLastFile = !pblockdb;
+    LOG(BENCH, "  - Block index snapshot: %u entries %.2fms\n", vIndex.size(),
+        (GetStopwatchMicros() - nStart) * 0.001);
+
+    // What leveldb will be given, for the writer's backlog.  Rows of a kind are about the same size, so the first
+    // one is serialized to stand for the rest; the keys plus leveldb's framing are 8 and 36 bytes.
+    size_t nBytes = 0;
+    if (!vFiles.empty())
+        nBytes += vFiles.size() * (8 + ::GetSerializeSize(vFiles[0].second, SER_DISK, CLIENT_VERSION));
+    if (!vIndex.empty())
+        nBytes += vIndex.size() * (36 + ::GetSerializeSize(vIndex[0].second, SER_DISK, CLIENT_VERSION));
+
+    // The copies are moved into the job, and the job into the queue, so each entry is copied only once
+    auto fill = [vFiles = std::move(vFiles), vIndex = std::move(vIndex), nLastFile, fLastFile](CDBBatch &batch) {
+        static int64_t nTimeSerialize = 0;
+        int64_t nStartSerialize = GetStopwatchMicros();
+        for (const std::pair<int, CBlockFileInfo> &item : vFiles)
+            batch.Write(std::make_pair(DB_BLOCK_FILES, item.first), item.second);
+        if (fLastFile)
+            batch.Write(DB_LAST_BLOCK, nLastFile);
+        for (const std::pair<uint256, CDiskBlockIndex> &item : vIndex)
+            batch.Write(std::make_pair(DB_BLOCK_INDEX, item.first), item.second);
+        int64_t nTime = GetStopwatchMicros() - nStartSerialize;
+        nTimeSerialize += nTime;
+        LOG(BENCH, "  - Block index serialize: %u entries %.2fms [%.2fs]\n", vIndex.size(), nTime * 0.001,
+            nTimeSerialize * 0.000001);
+    };
+    dbWriter.QueueJob(this, std::move(fill), nBytes);
+    return true;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue)
 {
+    // A flag such as "prunedblockfiles" must not reach the disk ahead of the index updates queued before it
+    if (!dbWriter.Barrier(true))
+        return false;
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
 
@@ -881,7 +1015,7 @@ void AdjustCoinCacheSize()
 }
 
 TxIndexDB::TxIndexDB(size_t n_cache_size, bool f_memory, bool f_wipe)
-    : CDBWrapper(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe)
+    : CDBWrapper(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe, false, &txIndexOptions)
 {
 }
 
@@ -892,12 +1026,13 @@ bool TxIndexDB::ReadTxPos(const uint256 &txid, CDiskTxPos &pos) const
 
 bool TxIndexDB::WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos> > &v_pos)
 {
-    CDBBatch batch(*this);
+    std::unique_ptr<CDBBatch> batch(new CDBBatch(*this));
     for (const auto &tuple : v_pos)
     {
-        batch.Write(std::make_pair(DB_TXINDEX, tuple.first), tuple.second);
+        batch->Write(std::make_pair(DB_TXINDEX, tuple.first), tuple.second);
     }
-    return WriteBatch(batch);
+    WriteBatchAsync(std::move(batch));
+    return true;
 }
 
 bool TxIndexDB::ReadBestBlock(CBlockLocator &locator) const
@@ -910,7 +1045,14 @@ bool TxIndexDB::ReadBestBlock(CBlockLocator &locator) const
     return success;
 }
 
-bool TxIndexDB::WriteBestBlock(const CBlockLocator &locator) { return Write(DB_BEST_BLOCK, locator); }
+bool TxIndexDB::WriteBestBlock(const CBlockLocator &locator)
+{
+    // queued behind the transactions of the blocks it covers, so it never gets ahead of them on disk
+    std::unique_ptr<CDBBatch> batch(new CDBBatch(*this));
+    batch->Write(DB_BEST_BLOCK, locator);
+    WriteBatchAsync(std::move(batch));
+    return true;
+}
 /*
  * Safely persist a transfer of data from the old txindex database to the new one, and compact the
  * range of keys updated. This is used internally by MigrateData.
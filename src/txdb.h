@@ -114,6 +114,28 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/**
+ * Where each transaction of a block starts, relative to the end of the block header like CDiskTxPos::nTxOffset,
+ * along with a short id of each transaction so that one can be found and read without reading the others.
+ */
+struct CBlockTxOffsets
+{
+    std::vector<uint64_t> vShortIds;
+    std::vector<uint32_t> vOffsets;
+
+    CBlockTxOffsets() {}
+    explicit CBlockTxOffsets(const CBlock &block);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(vShortIds);
+        READWRITE(vOffsets);
+    }
+};
+
 class CCoinsViewDBCursor;
 
 /** CCoinsView backed by the coin database (chainstate/) */
@@ -127,10 +149,11 @@ public:
         bool fMemory = false,
         bool fWipe = false,
         bool fObfuscate = false,
-        COverrideOptions *overridecache = nullptr);
+        const COverrideOptions *overridecache = nullptr);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool GetCoinsByTxid(const uint256 &txid, std::vector<std::pair<COutPoint, Coin> > &coins) const override;
     uint256 GetBestBlock() const;
     uint256 _GetBestBlock() const override;
     uint256 GetBestBlock(BlockDBMode mode) const;
@@ -151,6 +174,8 @@ public:
 
     //! Return the current memory allocated for the write buffers
     size_t TotalWriteBufferSize() const;
+
+    CDBStats GetDBStats() const { return db.GetStats(); }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -187,7 +212,8 @@ private:
     void operator=(const CBlockTreeDB &);
 
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo *> > &fileInfo,
+    /** Queue the block file and block index updates for the database writer, see CDBWriter */
+    bool WriteBlockIndexAsync(const std::vector<std::pair<int, const CBlockFileInfo *> > &fileInfo,
         int nLastFile,
         const std::vector<const CBlockIndex *> &blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -196,6 +222,10 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadTxOffsets(const uint256 &hashBlock, CBlockTxOffsets &offsets);
+    bool WriteTxOffsets(const uint256 &hashBlock, const CBlockTxOffsets &offsets);
+    /** Queue the removal of the offset tables of blocks whose data is gone for the database writer */
+    void EraseTxOffsetsAsync(const std::vector<uint256> &vHashBlocks);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool FindBlockIndex(uint256 blockhash, CDiskBlockIndex *index);
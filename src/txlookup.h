@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #ifndef BITCOIN_TXLOOKUP_H
+#define BITCOIN_TXLOOKUP_H
 
 #include <cstdint>
 
@@ -17,6 +17,7 @@
 #include "main.h"
 #include "parallel.h"
 #include "policy/fees.h"
+#include "policy/policy.h"
 #include "streams.h"
 #include "timedata.h"
 #include "txadmission.h"
@@ -26,8 +27,12 @@
 #include "utilmoneystr.h"
 #include "utiltime.h"
 #include "validation/validation.h"
+#include "validationinterface.h"
 #include "version.h"
 
+#include <algorithm>
+#include <queue>
+
 extern std::atomic<bool> fMempoolTests;
 
 using namespace std;
@@ -125,11 +130,14 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         {
             continue;
         }
-        std::map<COutPoint, CInPoint>::iterator iter = mapNextTx.lower_bound(COutPoint(hash, 0));
         // First calculate the children, and update setMemPoolChildren to
         // include them, and update their setMemPoolParents to include this tx.
-        for (; iter != mapNextTx.end() && iter->first.hash == hash; ++iter)
+        // mapNextTx is unordered so each output is looked up individually.
+        for (uint32_t n = 0; n < it->GetTx().vout.size(); n++)
         {
+            nextTxMap::const_iterator iter = mapNextTx.find(COutPoint(hash, n));
+            if (iter == mapNextTx.end())
+                continue;
             const uint256 &childHash = iter->second.ptx->GetHash();
             txiter childIter = mapTx.find(childHash);
             assert(childIter != mapTx.end());
@@ -667,6 +675,8 @@ bool CTxMemPool::_addUnchecked(const uint256 &hash, const CTxMemPoolEntry &entry
     }
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
     mapLinks.insert(make_pair(newit, TxLinks()));
+    _ClusterAdd(newit);
+    nSnapshotEpoch++;
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -739,8 +749,15 @@ void CTxMemPool::removeUnchecked(txiter it)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    _ClusterRemove(it);
+    nSnapshotEpoch++;
+    txlinksMap::iterator linksiter = mapLinks.find(it);
+    if (linksiter != mapLinks.end())
+    {
+        cachedInnerUsage -=
+            memusage::DynamicUsage(linksiter->second.parents) + memusage::DynamicUsage(linksiter->second.children);
+        mapLinks.erase(linksiter);
+    }
     mapTx.erase(it);
     nTransactionsUpdated++;
     minerPolicyEstimator->removeTx(hash);
@@ -754,7 +771,8 @@ void CTxMemPool::removeUnchecked(txiter it)
 // can save time by not iterating over those entries.
 void CTxMemPool::_CalculateDescendants(txiter entryit, setEntries &setDescendants, mapEntryHistory *mapTxnChainTips)
 {
-    AssertWriteLockHeld(cs_txmempool);
+    // only reads the mempool
+    AssertLockHeld(cs_txmempool);
     setEntries stage;
     if (setDescendants.count(entryit) == 0)
     {
@@ -826,7 +844,7 @@ void CTxMemPool::_removeRecursive(const CTransaction &origTx, std::list<CTransac
         // the mempool for any reason.
         for (unsigned int i = 0; i < origTx.vout.size(); i++)
         {
-            std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+            nextTxMap::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
             if (it == mapNextTx.end())
                 continue;
             txiter nextit = mapTx.find(it->second.ptx->GetHash());
@@ -908,7 +926,7 @@ void CTxMemPool::_removeConflicts(const CTransaction &tx, std::list<CTransaction
     // Remove transactions which depend on inputs of tx, recursively
     for (const CTxIn &txin : tx.vin)
     {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        nextTxMap::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end())
         {
             const CTransaction &txConflict = *it->second.ptx;
@@ -922,12 +940,48 @@ void CTxMemPool::_removeConflicts(const CTransaction &tx, std::list<CTransaction
 }
 
 
-// transactions need to be removed from the mempool in ancestor-first order so that
-// descendant/ancestor counts remain correct.  This is accomplished by looking at the
-// data in mapLinks and only removing transactions with no ancestors.
-// If a transaction has an ancestor, it is placed on a deferred map: ancestor->descendant list.
-// Whenever a tx is removed from the mempool, any of its descendants are placed back onto the
-// queue of tx that are removable.
+void CTxMemPool::_RecalculateAncestorState(txiter it)
+{
+    AssertWriteLockHeld(cs_txmempool);
+    int64_t nAncestorSize = it->GetTxSize();
+    CAmount nAncestorModifiedFee = it->GetModifiedFee();
+    int64_t nAncestorCount = 1;
+    int nAncestorSigOps = it->GetSigOpCount();
+
+    const setEntries &setParents = GetMemPoolParents(it);
+    if (setParents.size() == 1 && !(*setParents.begin())->IsDirty())
+    {
+        // With a single parent the ancestors are that parent plus its own ancestors, so its totals can be reused.
+        // A dirty parent's totals are not exact, in which case the ancestor set is walked below instead.
+        txiter parent = *setParents.begin();
+        nAncestorSize += parent->GetSizeWithAncestors();
+        nAncestorModifiedFee += parent->GetModFeesWithAncestors();
+        nAncestorCount += parent->GetCountWithAncestors();
+        nAncestorSigOps += parent->GetSigOpCountWithAncestors();
+    }
+    else if (!setParents.empty())
+    {
+        // Parents may share ancestors so the ancestor set has to be walked to avoid double counting.
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        setEntries setAncestors;
+        _CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, dummy, nullptr, false);
+        for (txiter ancestor : setAncestors)
+        {
+            nAncestorSize += ancestor->GetTxSize();
+            nAncestorModifiedFee += ancestor->GetModifiedFee();
+            nAncestorSigOps += ancestor->GetSigOpCount();
+        }
+        nAncestorCount += setAncestors.size();
+    }
+    mapTx.modify(
+        it, replace_ancestor_state(nAncestorSize, nAncestorModifiedFee, nAncestorCount, nAncestorSigOps, false));
+}
+
+// Transactions in a block are removed in bulk: they are all marked first, then unlinked from their surviving
+// children and removed in one sweep, and finally the ancestor state of the surviving descendants is recomputed
+// in a single pass in dependency order. Each surviving entry is therefore visited once no matter how many of its
+// ancestors were in the block.
 void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx,
     uint64_t nBlockHeight,
     std::list<CTransactionRef> &conflicts,
@@ -935,118 +989,118 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx,
     std::vector<CTxChange> *txChanges)
 {
     WRITELOCK(cs_txmempool);
-
-    // Process the block for transasction removal and ancestor state updates.
-    // As a first step remove all the txns that are in the block from the mempool by
-    // first updating the children for removal of the parent, and also saving the entries
-    // for policy estimate updates.  Then in the final loop simply remove all the txns.
-    //
-    // While we're updating the child transactions prior to removal we can also gather the
-    // mapTxnChaiTips.
-    mapEntryHistory mapTxnChainTips;
-    setEntries setAncestorsFromBlock;
-    {
-        setEntries setTxnsInBlock;
-        for (const auto &tx : vtx)
-        {
-            uint256 hash = tx->GetHash();
-            txiter it = mapTx.find(hash);
-            if (it == mapTx.end())
-            {
-                continue;
-            }
-
-            // Get all ancestors from related to txns in the block. Stop looking if we've already looked up
-            // this set of ancestors before; we don't want to be traversing the same part of the ancestor
-            // tree more than once.
-            setEntries setAncestors;
-            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-            std::string dummy;
-            _CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, dummy, &setAncestorsFromBlock, false);
-
-            setAncestorsFromBlock.insert(setAncestors.begin(), setAncestors.end());
+    uint64_t nStart = GetStopwatchMicros();
+
+    // Mark every transaction in the block that is in the mempool.
+    setEntries setTxnsInBlock;
+    std::unordered_set<txiter, TxiterHasher> setMarked;
+    std::vector<txiter> vRemove;
+    vRemove.reserve(vtx.size());
+    setMarked.reserve(vtx.size());
+    for (const auto &tx : vtx)
+    {
+        txiter it = mapTx.find(tx->GetHash());
+        if (it != mapTx.end() && setMarked.insert(it).second)
+        {
             setTxnsInBlock.insert(it);
-
-            const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-            for (txiter updateIt : setMemPoolChildren)
-            {
-                // Get the current ancestor state values and save them for later comparison
-                ancestor_state ancestorState(updateIt->GetSizeWithAncestors(), updateIt->GetModFeesWithAncestors(),
-                    updateIt->GetCountWithAncestors(), updateIt->GetSigOpCountWithAncestors());
-                mapTxnChainTips.emplace(updateIt, ancestorState);
-
-                // Remove each block entry from the parent map in mapLinks
-                _UpdateParent(updateIt, it, false);
-            }
+            vRemove.push_back(it);
         }
-        // Add any additional dirty chain tips from set of mempool txn chain tips that need to be
-        // updated.
-        for (uint256 hash : setDirtyTxnChainTips)
+    }
+
+    // This is a safeguard in the case where ancestors of transactions in this block have re-entered
+    // the mempool, possibly from a re-org. This should never happen and would likely indicate a locking
+    // issue if it did. vRemove grows as ancestors are found so that they are searched too.
+    for (size_t i = 0; i < vRemove.size(); i++)
+    {
+        for (txiter parent : GetMemPoolParents(vRemove[i]))
         {
-            // if the txn still exists then add it to the set of chaintips
-            auto it = mapTx.find(hash);
-            if (it != mapTx.end())
+            if (setMarked.insert(parent).second)
             {
-                ancestor_state ancestorState(it->GetSizeWithAncestors(), it->GetModFeesWithAncestors(),
-                    it->GetCountWithAncestors(), it->GetSigOpCountWithAncestors());
-                mapTxnChainTips.emplace(it, ancestorState);
+                DbgAssert(!"Ancestors in the mempool when they should not be", );
+                vRemove.push_back(parent);
             }
         }
-        setDirtyTxnChainTips.clear();
-
-        // Before the txs in the new block have been removed from the mempool, update policy estimates
-        minerPolicyEstimator->processBlock(nBlockHeight, setTxnsInBlock, fCurrentEstimate);
+    }
 
-        // Remove Transactions that were in the block from the mempool.
-        for (txiter it : setTxnsInBlock)
-        {
-            setAncestorsFromBlock.erase(it);
-            mapTxnChainTips.erase(it);
-            removeUnchecked(it);
-        }
+    // Before the txs in the new block have been removed from the mempool, update policy estimates
+    minerPolicyEstimator->processBlock(nBlockHeight, setTxnsInBlock, fCurrentEstimate);
 
-        // This is a safeguard in the case where ancestors of transactions in this block have re-entered
-        // the mempool, possibly from a re-org. This should never happen and would likely indicate a locking
-        // issue if it did.
-        if (!setAncestorsFromBlock.empty())
+    // The surviving direct children of the removed transactions, plus any dirty chain tips, are the roots of the
+    // part of the mempool whose ancestor state has to be recomputed. Sever the links to the removed parents
+    // before anything is erased so that every iterator touched here is still valid.
+    std::vector<txiter> vRoots;
+    for (txiter it : vRemove)
+    {
+        for (txiter child : GetMemPoolChildren(it))
         {
-            DbgAssert(!"Ancestors in the mempool when they should not be", );
-            for (txiter it : setAncestorsFromBlock)
+            if (!setMarked.count(child))
             {
-                removeUnchecked(it);
+                vRoots.push_back(child);
+                _UpdateParent(child, it, false);
             }
         }
     }
+    for (const uint256 &hash : setDirtyTxnChainTips)
+    {
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end() && !setMarked.count(it))
+            vRoots.push_back(it);
+    }
+    setDirtyTxnChainTips.clear();
+
+    for (txiter it : vRemove)
+        removeUnchecked(it);
+    uint64_t nRemoved = vRemove.size();
+    setTxnsInBlock.clear();
+    setMarked.clear();
+    vRemove.clear();
+
+    setEntries setAffected;
+    for (txiter it : vRoots)
+        _CalculateDescendants(it, setAffected);
 
-    // For every chain tip walk through their decendants finding any transaction that have more than one parent.
-    // These will then need to be considered as chain tips.
+    // If long chain transaction forwarding is turned on, get the original descendant state
+    // and save it for later comparison.
     CTxMemPool::TxMempoolOriginalStateMap changeSet;
-    mapEntryHistory mapAdditionalChainTips;
-    for (auto iter : mapTxnChainTips)
+    if (txChanges)
     {
-        // Get descendants but stop looking if/when we find another txnchaintip in the descendant tree.
-        setEntries setDescendants;
-        _CalculateDescendants(iter.first, setDescendants, &mapTxnChainTips);
-        for (txiter dit : setDescendants)
-        {
-            // If long chain transaction forwarding is turned on, get the original descendant state
-            // and save it for later comparison.
-            if (txChanges && changeSet.count(dit) == 0)
-                changeSet.insert({dit, TxMempoolOriginalState(dit)});
+        for (txiter it : setAffected)
+            changeSet.insert({it, TxMempoolOriginalState(it)});
+    }
 
-            // Add a new chaintip if there is more than 1 parent.
-            if (GetMemPoolParents(dit).size() > 1)
+    // Recompute the ancestor state of the affected entries in dependency order, so that every parent is up to
+    // date before its children are looked at.
+    std::unordered_map<txiter, size_t, TxiterHasher> mapPendingParents;
+    std::vector<txiter> vReady;
+    for (txiter it : setAffected)
+    {
+        size_t nParents = 0;
+        for (txiter parent : GetMemPoolParents(it))
+        {
+            if (setAffected.count(parent))
+                nParents++;
+        }
+        if (nParents == 0)
+            vReady.push_back(it);
+        else
+            mapPendingParents.emplace(it, nParents);
+    }
+    while (!vReady.empty())
+    {
+        txiter it = vReady.back();
+        vReady.pop_back();
+        _RecalculateAncestorState(it);
+        for (txiter child : GetMemPoolChildren(it))
+        {
+            auto pending = mapPendingParents.find(child);
+            if (pending != mapPendingParents.end() && --pending->second == 0)
             {
-                ancestor_state ancestorState(dit->GetSizeWithAncestors(), dit->GetModFeesWithAncestors(),
-                    dit->GetCountWithAncestors(), dit->GetSigOpCountWithAncestors());
-                mapAdditionalChainTips.emplace(dit, ancestorState);
+                vReady.push_back(child);
+                mapPendingParents.erase(pending);
             }
         }
     }
-    mapTxnChainTips.insert(mapAdditionalChainTips.begin(), mapAdditionalChainTips.end());
-
-    // Update ancestor state for remaining chains
-    UpdateTxnChainState(mapTxnChainTips);
+    DbgAssert(mapPendingParents.empty(), );
 
     // After the updates are complete then process changeSet into a list of tx and mempool changes
     // and sort into dependency order.
@@ -1072,16 +1126,35 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx,
     // the mempool that may be ancestors of txns that were in the block we just processed.  If we allowed
     // this then the txns would essentialy be orphans within the mempool.
     ResubmitCommitQ();
+
+    if (nRemoved > 0)
+    {
+        // Don't let an old snapshot keep the mined transactions alive
+        LOCK(cs_snapshot);
+        lastSnapshot.reset();
+    }
+
+    uint64_t nElapsed = GetStopwatchMicros() - nStart;
+    nRemoveForBlockTime << nElapsed;
+    LOG(BENCH, "removeForBlock: %u txns removed, %u descendants updated in %.2fms\n", nRemoved, setAffected.size(),
+        nElapsed * 0.001);
 }
 
 void CTxMemPool::_clear()
 {
     mapLinks.clear();
+    mapTxCluster.clear();
+    mapClusters.clear();
+    setDirtyClusters.clear();
+    setClustersByBestChunk.clear();
+    setClustersByWorstChunk.clear();
+    nChunkCount = 0;
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    nSnapshotEpoch++;
 }
 
 void CTxMemPool::clear()
@@ -1102,6 +1175,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     uint64_t innerUsage = 0;
 
     READLOCK(cs_txmempool);
+    // Another reader may be rebuilding the clusters under the shared lock
+    LOCK(cs_clusters);
     LOG(MEMPOOL, "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(),
         (unsigned int)mapNextTx.size());
 
@@ -1118,6 +1193,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(linksiter != mapLinks.end());
         const TxLinks &links = linksiter->second;
         innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        // Every transaction shares a cluster with its parents
+        auto clusterIter = mapTxCluster.find(it);
+        assert(clusterIter != mapTxCluster.end());
+        for (txiter parent : links.parents)
+            assert(mapTxCluster.at(parent).nClusterId == clusterIter->second.nClusterId);
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -1149,7 +1229,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            nextTxMap::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
@@ -1183,10 +1263,12 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
         // Check children against mapNextTx
         CTxMemPool::setEntries setChildrenCheck;
-        std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
         uint64_t childSizes = 0;
-        for (; iter != mapNextTx.end() && iter->first.hash == it->GetTx().GetHash(); ++iter)
+        for (uint32_t n = 0; n < tx.vout.size(); n++)
         {
+            nextTxMap::const_iterator iter = mapNextTx.find(COutPoint(tx.GetHash(), n));
+            if (iter == mapNextTx.end())
+                continue;
             txiter childit = mapTx.find(iter->second.ptx->GetHash());
             assert(childit != mapTx.end()); // mapNextTx points to in-mempool transactions
             if (setChildrenCheck.insert(childit).second)
@@ -1228,7 +1310,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++)
+    for (nextTxMap::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++)
     {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
@@ -1243,6 +1325,80 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     assert(innerUsage == cachedInnerUsage);
 }
 
+int64_t CTxMemPoolSnapshot::Find(const uint256 &hash) const
+{
+    auto iter = mapIndex.find(hash);
+    if (iter == mapIndex.end())
+        return -1;
+    return iter->second;
+}
+
+void CTxMemPoolSnapshot::CalculateAncestors(uint32_t n, std::set<uint32_t> &setAncestors) const
+{
+    std::vector<uint32_t> vStack(vEntries[n].vParents);
+    while (!vStack.empty())
+    {
+        uint32_t k = vStack.back();
+        vStack.pop_back();
+        if (setAncestors.insert(k).second)
+            vStack.insert(vStack.end(), vEntries[k].vParents.begin(), vEntries[k].vParents.end());
+    }
+}
+
+void CTxMemPoolSnapshot::CalculateDescendants(uint32_t n, std::set<uint32_t> &setDescendants) const
+{
+    std::vector<uint32_t> vStack(vEntries[n].vChildren);
+    while (!vStack.empty())
+    {
+        uint32_t k = vStack.back();
+        vStack.pop_back();
+        if (setDescendants.insert(k).second)
+            vStack.insert(vStack.end(), vEntries[k].vChildren.begin(), vEntries[k].vChildren.end());
+    }
+}
+
+CTxMemPoolSnapshotRef CTxMemPool::GetSnapshot() const
+{
+    {
+        LOCK(cs_snapshot);
+        if (lastSnapshot && lastSnapshot->nEpoch == nSnapshotEpoch.load())
+            return lastSnapshot;
+    }
+
+    // Copying the entries is much cheaper than what readers go on to do with them, and the copy is shared by
+    // every reader until the next change, so cs_txmempool is only held briefly and only once per change.
+    READLOCK(cs_txmempool);
+    LOCK(cs_snapshot);
+    const uint64_t nEpoch = nSnapshotEpoch.load();
+    if (lastSnapshot && lastSnapshot->nEpoch == nEpoch) // another reader got here first
+        return lastSnapshot;
+
+    uint64_t nStart = GetStopwatchMicros();
+    std::shared_ptr<CTxMemPoolSnapshot> snapshot = std::make_shared<CTxMemPoolSnapshot>(nEpoch);
+    snapshot->vEntries.reserve(mapTx.size());
+    snapshot->mapIndex.reserve(mapTx.size());
+    for (const CTxMemPoolEntry &e : mapTx.get<ancestor_score>())
+    {
+        snapshot->mapIndex.emplace(e.GetTx().GetHash(), (uint32_t)snapshot->vEntries.size());
+        snapshot->vEntries.emplace_back(e);
+    }
+    snapshot->nTotalTxSize = totalTxSize;
+    for (CTxMemPoolSnapshot::Entry &entry : snapshot->vEntries)
+    {
+        const TxLinks &links = mapLinks.at(mapTx.find(entry.entry.GetTx().GetHash()));
+        entry.vParents.reserve(links.parents.size());
+        for (txiter parent : links.parents)
+            entry.vParents.push_back(snapshot->mapIndex.at(parent->GetTx().GetHash()));
+        entry.vChildren.reserve(links.children.size());
+        for (txiter child : links.children)
+            entry.vChildren.push_back(snapshot->mapIndex.at(child->GetTx().GetHash()));
+    }
+    lastSnapshot = snapshot;
+    LOG(MEMPOOL, "Built mempool snapshot of %u txns in %.2fms\n", snapshot->size(),
+        (GetStopwatchMicros() - nStart) * 0.001);
+    return lastSnapshot;
+}
+
 void CTxMemPool::queryHashes(vector<uint256> &vtxid) const
 {
     READLOCK(mempool.cs_txmempool);
@@ -1264,6 +1420,12 @@ CFeeRate CTxMemPool::estimateFee(int nBlocks) const
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
 
+std::vector<CFeeRate> CTxMemPool::estimateFees(const std::vector<int> &vBlocks) const
+{
+    READLOCK(cs_txmempool);
+    return minerPolicyEstimator->estimateFees(vBlocks);
+}
+
 bool CTxMemPool::WriteFeeEstimates(CAutoFile &fileout) const
 {
     try
@@ -1350,6 +1512,8 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash,
             // If this is part of an unconfirmed chain then update the ancestor chain state first.
             UpdateTxnChainState(it);
             mapTx.modify(it, update_fee_delta(deltas.second));
+            _MarkClusterDirty(mapTxCluster[it].nClusterId);
+            nSnapshotEpoch++;
 
             // Update all the ancestor state for all the descendants with the new feeDelta
             setEntries setDescendants;
@@ -1435,13 +1599,26 @@ size_t CTxMemPool::DynamicMemoryUsage() const
 size_t CTxMemPool::_DynamicMemoryUsage() const
 {
     AssertLockHeld(cs_txmempool);
+    // The cluster maps may be being rebuilt by a reader holding only a shared cs_txmempool
+    LOCK(cs_clusters);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for
     // boost::multi_index_contained is implemented.
     return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void *)) * mapTx.size() +
            memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) +
+           memusage::DynamicUsage(mapTxCluster) + memusage::DynamicUsage(mapClusters) + _ClusterUsage() +
            cachedInnerUsage;
 }
 
+size_t CTxMemPool::_ClusterUsage() const
+{
+    // Every transaction is listed once in its cluster and once in a chunk of it, and every cluster, chunk list
+    // and chunk is an allocation of its own.  Spare vector capacity is not counted; walking every cluster to count
+    // it would make each pass of TrimToSize() as slow as the mempool is large.
+    const size_t nAllocations = 2 * mapClusters.size() + nChunkCount;
+    return 2 * mapTxCluster.size() * sizeof(txiter) + nChunkCount * sizeof(TxChunk) +
+           nAllocations * memusage::MallocUsage(sizeof(txiter));
+}
+
 void CTxMemPool::_RemoveStaged(setEntries &stage)
 {
     {
@@ -1498,10 +1675,12 @@ void CTxMemPool::_UpdateChild(txiter entry, txiter child, bool add)
     if (add && mapLinks[entry].children.insert(child).second)
     {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+        _ClusterLink(entry, child);
     }
     else if (!add && mapLinks[entry].children.erase(child))
     {
         cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+        _MarkClusterDirty(mapTxCluster[entry].nClusterId);
     }
 }
 
@@ -1512,11 +1691,337 @@ void CTxMemPool::_UpdateParent(txiter entry, txiter parent, bool add)
     if (add && mapLinks[entry].parents.insert(parent).second)
     {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+        _ClusterLink(entry, parent);
+        nSnapshotEpoch++;
     }
     else if (!add && mapLinks[entry].parents.erase(parent))
     {
         cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+        _MarkClusterDirty(mapTxCluster[entry].nClusterId);
+        nSnapshotEpoch++;
+    }
+}
+
+void CTxMemPool::_ClusterAdd(txiter it)
+{
+    AssertWriteLockHeld(cs_txmempool);
+    uint64_t nId = nNextClusterId++;
+    mapClusters[nId].vTxns.push_back(it);
+    mapTxCluster[it] = TxClusterRef{nId, 0};
+    setDirtyClusters.insert(nId);
+}
+
+void CTxMemPool::_ClusterRemove(txiter it)
+{
+    AssertWriteLockHeld(cs_txmempool);
+    auto refIter = mapTxCluster.find(it);
+    DbgAssert(refIter != mapTxCluster.end(), return );
+    const uint64_t nId = refIter->second.nClusterId;
+    const size_t nPos = refIter->second.nPos;
+    mapTxCluster.erase(refIter);
+
+    _MarkClusterDirty(nId);
+    TxCluster &cluster = mapClusters[nId];
+    DbgAssert(nPos < cluster.vTxns.size() && cluster.vTxns[nPos] == it, return );
+
+    // Swap the last member into the vacated slot so removal is O(1)
+    if (nPos + 1 != cluster.vTxns.size())
+    {
+        cluster.vTxns[nPos] = cluster.vTxns.back();
+        mapTxCluster[cluster.vTxns[nPos]].nPos = nPos;
+    }
+    cluster.vTxns.pop_back();
+    if (cluster.vTxns.empty())
+    {
+        mapClusters.erase(nId);
+        setDirtyClusters.erase(nId);
+    }
+}
+
+void CTxMemPool::_ClusterLink(txiter a, txiter b)
+{
+    AssertWriteLockHeld(cs_txmempool);
+    uint64_t nIdA = mapTxCluster[a].nClusterId;
+    uint64_t nIdB = mapTxCluster[b].nClusterId;
+    _MarkClusterDirty(nIdA);
+    if (nIdA == nIdB)
+        return;
+    _MarkClusterDirty(nIdB);
+
+    // Merge the smaller cluster into the larger one
+    if (mapClusters[nIdA].vTxns.size() < mapClusters[nIdB].vTxns.size())
+        std::swap(nIdA, nIdB);
+    TxCluster &into = mapClusters[nIdA];
+    TxCluster &from = mapClusters[nIdB];
+    into.vTxns.reserve(into.vTxns.size() + from.vTxns.size());
+    for (txiter it : from.vTxns)
+    {
+        mapTxCluster[it] = TxClusterRef{nIdA, into.vTxns.size()};
+        into.vTxns.push_back(it);
+    }
+    mapClusters.erase(nIdB);
+    setDirtyClusters.erase(nIdB);
+}
+
+void CTxMemPool::_MarkClusterDirty(uint64_t nClusterId)
+{
+    AssertWriteLockHeld(cs_txmempool);
+    if (!setDirtyClusters.insert(nClusterId).second)
+        return;
+
+    auto iter = mapClusters.find(nClusterId);
+    if (iter == mapClusters.end() || iter->second.vChunks.empty())
+        return;
+    TxCluster &cluster = iter->second;
+    _UnindexCluster(nClusterId, cluster);
+    nChunkCount -= cluster.vChunks.size();
+    cluster.vChunks.clear();
+}
+
+void CTxMemPool::_IndexCluster(uint64_t nClusterId, const TxCluster &cluster)
+{
+    const TxChunk &best = cluster.vChunks.front();
+    const TxChunk &worst = cluster.vChunks.back();
+    setClustersByBestChunk.insert(TxChunkKey{best.nModFees, best.nSize, nClusterId});
+    setClustersByWorstChunk.insert(TxChunkKey{worst.nModFees, worst.nSize, nClusterId});
+}
+
+void CTxMemPool::_UnindexCluster(uint64_t nClusterId, const TxCluster &cluster)
+{
+    const TxChunk &best = cluster.vChunks.front();
+    const TxChunk &worst = cluster.vChunks.back();
+    setClustersByBestChunk.erase(TxChunkKey{best.nModFees, best.nSize, nClusterId});
+    setClustersByWorstChunk.erase(TxChunkKey{worst.nModFees, worst.nSize, nClusterId});
+}
+
+// Clusters up to this size are linearized by repeatedly picking the highest feerate ancestor set of what
+// remains, which costs O(n^3).  Larger clusters, which in practice are long chains, are linearized in
+// O(n log n) by always taking the highest feerate transaction whose parents have already been placed.
+static const size_t MAX_CLUSTER_ANCESTOR_LINEARIZE = 64;
+
+void CTxMemPool::_LinearizeCluster(uint64_t nClusterId, TxCluster &cluster)
+{
+    const std::vector<txiter> &vTxns = cluster.vTxns;
+    const size_t n = vTxns.size();
+    std::unordered_map<txiter, size_t, TxiterHasher> mapIndex;
+    mapIndex.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        mapIndex[vTxns[i]] = i;
+
+    std::vector<size_t> vOrder;
+    vOrder.reserve(n);
+    if (n <= MAX_CLUSTER_ANCESTOR_LINEARIZE)
+    {
+        // In-cluster ancestor sets, including the transaction itself
+        std::vector<std::vector<bool> > vAncestors(n, std::vector<bool>(n, false));
+        std::vector<size_t> vAncestorCount(n, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            std::vector<size_t> vStack(1, i);
+            vAncestors[i][i] = true;
+            while (!vStack.empty())
+            {
+                size_t j = vStack.back();
+                vStack.pop_back();
+                for (txiter parent : mapLinks.at(vTxns[j]).parents)
+                {
+                    size_t k = mapIndex[parent];
+                    if (!vAncestors[i][k])
+                    {
+                        vAncestors[i][k] = true;
+                        vStack.push_back(k);
+                    }
+                }
+            }
+            for (size_t k = 0; k < n; k++)
+                vAncestorCount[i] += vAncestors[i][k];
+        }
+
+        std::vector<bool> vDone(n, false);
+        while (vOrder.size() < n)
+        {
+            size_t nBest = n;
+            CAmount nBestFees = 0;
+            uint64_t nBestSize = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (vDone[i])
+                    continue;
+                CAmount nFees = 0;
+                uint64_t nSize = 0;
+                for (size_t k = 0; k < n; k++)
+                {
+                    if (vAncestors[i][k] && !vDone[k])
+                    {
+                        nFees += vTxns[k]->GetModifiedFee();
+                        nSize += vTxns[k]->GetTxSize();
+                    }
+                }
+                // Prefer the higher feerate, then the smaller set so equal feerates are not merged needlessly
+                double f1 = (double)nFees * nBestSize;
+                double f2 = (double)nBestFees * nSize;
+                if (nBest == n || f1 > f2 || (f1 == f2 && nSize < nBestSize))
+                {
+                    nBest = i;
+                    nBestFees = nFees;
+                    nBestSize = nSize;
+                }
+            }
+
+            // Append the remaining ancestors of the best candidate. An ancestor always has a strictly smaller
+            // ancestor set than its descendants, so sorting by ancestor count gives a valid order.
+            std::vector<size_t> vSelected;
+            for (size_t k = 0; k < n; k++)
+            {
+                if (vAncestors[nBest][k] && !vDone[k])
+                    vSelected.push_back(k);
+            }
+            std::sort(vSelected.begin(), vSelected.end(),
+                [&vAncestorCount](size_t x, size_t y) { return vAncestorCount[x] < vAncestorCount[y]; });
+            for (size_t k : vSelected)
+            {
+                vDone[k] = true;
+                vOrder.push_back(k);
+            }
+        }
+    }
+    else
+    {
+        std::vector<size_t> vPending(n, 0);
+        auto fLowerFeeRate = [&vTxns](size_t x, size_t y) {
+            double f1 = (double)vTxns[x]->GetModifiedFee() * vTxns[y]->GetTxSize();
+            double f2 = (double)vTxns[y]->GetModifiedFee() * vTxns[x]->GetTxSize();
+            if (f1 != f2)
+                return f1 < f2;
+            return x > y;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(fLowerFeeRate)> ready(fLowerFeeRate);
+        for (size_t i = 0; i < n; i++)
+        {
+            vPending[i] = mapLinks.at(vTxns[i]).parents.size();
+            if (vPending[i] == 0)
+                ready.push(i);
+        }
+        while (!ready.empty())
+        {
+            size_t i = ready.top();
+            ready.pop();
+            vOrder.push_back(i);
+            for (txiter child : mapLinks.at(vTxns[i]).children)
+            {
+                size_t k = mapIndex[child];
+                if (--vPending[k] == 0)
+                    ready.push(k);
+            }
+        }
+        DbgAssert(vOrder.size() == n, );
+    }
+
+    // Chunk the linearization: a transaction that would raise the feerate of the chunk before it joins that
+    // chunk, repeatedly, leaving chunks of strictly decreasing feerate.
+    std::vector<TxChunk> &vChunks = cluster.vChunks;
+    vChunks.clear();
+    for (size_t i : vOrder)
+    {
+        TxChunk chunk;
+        chunk.vTxns.push_back(vTxns[i]);
+        chunk.nModFees = vTxns[i]->GetModifiedFee();
+        chunk.nSize = vTxns[i]->GetTxSize();
+        chunk.nSigOps = vTxns[i]->GetSigOpCount();
+        while (!vChunks.empty() &&
+               (double)chunk.nModFees * vChunks.back().nSize > (double)vChunks.back().nModFees * chunk.nSize)
+        {
+            TxChunk &prev = vChunks.back();
+            prev.vTxns.insert(prev.vTxns.end(), chunk.vTxns.begin(), chunk.vTxns.end());
+            prev.nModFees += chunk.nModFees;
+            prev.nSize += chunk.nSize;
+            prev.nSigOps += chunk.nSigOps;
+            chunk = std::move(prev);
+            vChunks.pop_back();
+        }
+        vChunks.push_back(std::move(chunk));
+    }
+
+    nChunkCount += vChunks.size();
+    _IndexCluster(nClusterId, cluster);
+}
+
+void CTxMemPool::_UpdateClusters()
+{
+    AssertLockHeld(cs_txmempool);
+    LOCK(cs_clusters);
+    if (setDirtyClusters.empty())
+        return;
+
+    std::vector<uint64_t> vDirty(setDirtyClusters.begin(), setDirtyClusters.end());
+    setDirtyClusters.clear();
+    for (uint64_t nId : vDirty)
+    {
+        auto iter = mapClusters.find(nId);
+        if (iter == mapClusters.end())
+            continue;
+
+        // Removing transactions or links may have split the cluster, so find its connected components.
+        // The first component keeps the cluster id.
+        std::vector<txiter> vMembers;
+        vMembers.swap(iter->second.vTxns);
+        std::unordered_set<txiter, TxiterHasher> setSeen;
+        setSeen.reserve(vMembers.size());
+        uint64_t nComponentId = nId;
+        for (txiter root : vMembers)
+        {
+            if (!setSeen.insert(root).second)
+                continue;
+            TxCluster &component = mapClusters[nComponentId];
+            component.vTxns.clear();
+            std::vector<txiter> vStack(1, root);
+            while (!vStack.empty())
+            {
+                txiter it = vStack.back();
+                vStack.pop_back();
+                mapTxCluster[it] = TxClusterRef{nComponentId, component.vTxns.size()};
+                component.vTxns.push_back(it);
+                const TxLinks &links = mapLinks.at(it);
+                for (txiter parent : links.parents)
+                {
+                    if (setSeen.insert(parent).second)
+                        vStack.push_back(parent);
+                }
+                for (txiter child : links.children)
+                {
+                    if (setSeen.insert(child).second)
+                        vStack.push_back(child);
+                }
+            }
+            _LinearizeCluster(nComponentId, component);
+            nComponentId = nNextClusterId++;
+        }
+    }
+}
+
+const CTxMemPool::TxCluster *CTxMemPool::_GetCluster(uint64_t nClusterId) const
+{
+    AssertLockHeld(cs_txmempool);
+    auto iter = mapClusters.find(nClusterId);
+    if (iter == mapClusters.end())
+        return nullptr;
+    return &iter->second;
+}
+
+size_t CTxMemPool::_ClusterSizeWithParents(const setEntries &setParents) const
+{
+    AssertLockHeld(cs_txmempool);
+    LOCK(cs_clusters);
+    size_t nSize = 1;
+    std::set<uint64_t> setCounted;
+    for (txiter parent : setParents)
+    {
+        auto refIter = mapTxCluster.find(parent);
+        DbgAssert(refIter != mapTxCluster.end(), continue);
+        if (setCounted.insert(refIter->second.nClusterId).second)
+            nSize += mapClusters.at(refIter->second.nClusterId).vTxns.size();
     }
+    return nSize;
 }
 
 const CTxMemPool::setEntries &CTxMemPool::GetMemPoolParents(txiter entry) const
@@ -1564,57 +2069,43 @@ CTransactionRef CTxMemPool::addDoubleSpendProof(const DoubleSpendProof &proof)
     if (iter->dsproof != -1) // A DSProof already exists for this tx.
         return CTransactionRef(); // don't propagate new one.
 
+    const int32_t dsproof = m_dspStorage->add(proof).second;
+    if (dsproof == -1) // The proof storage is full, so the proof is dropped and not propagated
+        return CTransactionRef();
     auto item = *iter;
-    item.dsproof = m_dspStorage->add(proof).second;
+    item.dsproof = dsproof;
     mapTx.replace(iter, item);
+    nSnapshotEpoch++;
     return _get(oldTx->second.ptx->GetHash());
 }
 
 DoubleSpendProofStorage *CTxMemPool::doubleSpendProofStorage() const { return m_dspStorage.get(); }
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint> *pvNoSpendsRemaining, bool fDeterministic)
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint> *pvNoSpendsRemaining)
 {
     WRITELOCK(cs_txmempool);
     unsigned nTxnRemoved = 0;
+    // Clusters evicted from in this pass.  What is left of a linearization once its last chunk is gone is still
+    // chunked the same way, so these keep their remaining chunks until the pass is over, and are split and
+    // linearized again only once, by the next _UpdateClusters().
+    std::unordered_set<uint64_t> setTrimmed;
 
-    FastRandomContext insecure_rand(fDeterministic);
+    _UpdateClusters();
     while (_DynamicMemoryUsage() > sizelimit)
     {
         if (mapTx.size() == 0)
             break;
 
-        // Use the following scope to make sure that the iterator is destroyed and can't be used later
-        // because we'll be removing the transaction associated with it.
-        uint64_t nAncestors = 0;
-        setEntries stage;
-        {
-            // Pick a random entry to delete
-            indexed_transaction_set::index<entry_time>::type::iterator it = mapTx.get<entry_time>().begin();
-            auto nEntryToDelete = insecure_rand.randrange((uint64_t)mapTx.size());
-            std::advance(it, nEntryToDelete);
-            DbgAssert(it != mapTx.get<entry_time>().end(), return );
-
-            // Delete the entry and any descendants
-            _CalculateDescendants(mapTx.project<0>(it), stage);
-
-            // If the descendant chain to remove is more than 10% of the total
-            // chain size, then iterate through the setEntries to find a transaction
-            // that be <= 10% of the total. In this way we don't remove an entire
-            // chain that may be 100's or 1000's of txns long.
-            nAncestors = it->GetCountWithAncestors();
-        }
-        uint64_t nSizeOfTxnChain = nAncestors + stage.size();
-        if (nSizeOfTxnChain >= 10 && (double)nAncestors <= ((double)nSizeOfTxnChain * 0.90))
-        {
-            for (auto it2 : stage)
-            {
-                if ((double)it2->GetCountWithAncestors() > ((double)nSizeOfTxnChain * 0.90))
-                {
-                    stage.clear();
-                    _CalculateDescendants(it2, stage);
-                    break;
-                }
-            }
-        }
+        // Evict the lowest feerate chunk.  It is the last chunk of its cluster so nothing else depends on it.
+        DbgAssert(!setClustersByWorstChunk.empty(), break);
+        const uint64_t nClusterId = setClustersByWorstChunk.rbegin()->nClusterId;
+        auto iter = mapClusters.find(nClusterId);
+        DbgAssert(iter != mapClusters.end() && !iter->second.vChunks.empty(), break);
+        _UnindexCluster(nClusterId, iter->second);
+        std::vector<TxChunk> vChunks;
+        vChunks.swap(iter->second.vChunks);
+        setEntries stage(vChunks.back().vTxns.begin(), vChunks.back().vTxns.end());
+        vChunks.pop_back();
+        nChunkCount--;
         nTxnRemoved += stage.size();
 
         std::vector<CTransactionRef> vTxn;
@@ -1625,6 +2116,13 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint> *pvNoSpends
                 vTxn.push_back(it3->GetSharedTx());
         }
         _RemoveStaged(stage);
+        if (!vChunks.empty())
+        {
+            TxCluster &cluster = mapClusters.at(nClusterId);
+            cluster.vChunks.swap(vChunks);
+            _IndexCluster(nClusterId, cluster);
+            setTrimmed.insert(nClusterId);
+        }
         if (pvNoSpendsRemaining)
         {
             for (const CTransactionRef ptx : vTxn)
@@ -1642,8 +2140,24 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint> *pvNoSpends
         }
     }
 
+    // The clusters evicted from are dirty, and dirty clusters hold no chunks outside of this loop
+    for (uint64_t nClusterId : setTrimmed)
+    {
+        auto iter = mapClusters.find(nClusterId);
+        if (iter == mapClusters.end() || iter->second.vChunks.empty())
+            continue;
+        _UnindexCluster(nClusterId, iter->second);
+        nChunkCount -= iter->second.vChunks.size();
+        iter->second.vChunks.clear();
+    }
+
     if (nTxnRemoved > 0)
+    {
+        // Don't let an old snapshot keep the evicted transactions alive
+        LOCK(cs_snapshot);
+        lastSnapshot.reset();
         LOG(MEMPOOL, "Removed %u txn\n", nTxnRemoved);
+    }
 }
 
 void ThreadUpdateTransactionRateStatistics()
@@ -1727,10 +2241,269 @@ SaltedTxidHasher::SaltedTxidHasher()
 
 // Version is current unix epoch time. Nov 1, 2018 at 12am
 static const uint64_t MEMPOOL_DUMP_VERSION = 1541030400;
+// Version 2 records the chain tip and each entry's accepted state so that the mempool can be restored without
+// re-validation. Oct 1, 2026 at 12am
+static const uint64_t MEMPOOL_DUMP_VERSION_2 = 1790812800;
+
+/** Everything needed to put a mempool entry back without re-validating it. */
+class CMempoolDumpEntry
+{
+public:
+    CTransactionRef tx;
+    int64_t nTime = 0;
+    int64_t nFeeDelta = 0;
+    CAmount nFee = 0;
+    double entryPriority = 0;
+    uint32_t entryHeight = 0;
+    CAmount inChainInputValue = 0;
+    bool spendsCoinbase = false;
+    uint32_t sigOpCount = 0;
+    uint64_t runtimeSigOpCount = 0;
+    uint64_t runtimeSighashBytes = 0;
+    unsigned char sighashType = 0;
+
+    CMempoolDumpEntry() {}
+    CMempoolDumpEntry(const CTxMemPoolEntry &entry)
+        : tx(entry.GetSharedTx()), nTime(entry.GetTime()), nFeeDelta(entry.GetModifiedFee() - entry.GetFee()),
+          nFee(entry.GetFee()), entryPriority(entry.GetPriority(entry.GetHeight())), entryHeight(entry.GetHeight()),
+          inChainInputValue(entry.GetInChainInputValue()), spendsCoinbase(entry.GetSpendsCoinbase()),
+          sigOpCount(entry.GetSigOpCount()), runtimeSigOpCount(entry.GetRuntimeSigOpCount()),
+          runtimeSighashBytes(entry.GetRuntimeSighashBytes()), sighashType(entry.sighashType)
+    {
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFeeDelta);
+        READWRITE(nFee);
+        READWRITE(entryPriority);
+        READWRITE(entryHeight);
+        READWRITE(inChainInputValue);
+        READWRITE(spendsCoinbase);
+        READWRITE(sigOpCount);
+        READWRITE(runtimeSigOpCount);
+        READWRITE(runtimeSighashBytes);
+        READWRITE(sighashType);
+    }
+};
+
+// Order the entries so that every transaction comes after its in-mempool parents. Reloading in this order rebuilds
+// the ancestor/descendant links as each entry is added rather than bouncing children through the orphan pool.
+static void SortForDump(std::vector<CMempoolDumpEntry> &vEntries)
+{
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> mapIndex;
+    mapIndex.reserve(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++)
+        mapIndex.emplace(vEntries[i].tx->GetHash(), i);
+
+    std::vector<CMempoolDumpEntry> vSorted;
+    vSorted.reserve(vEntries.size());
+    std::vector<bool> vDone(vEntries.size(), false);
+    std::vector<std::pair<size_t, size_t> > stack; // (entry index, next input to look at)
+    for (size_t i = 0; i < vEntries.size(); i++)
+    {
+        if (vDone[i])
+            continue;
+        vDone[i] = true;
+        stack.emplace_back(i, 0);
+        while (!stack.empty())
+        {
+            std::pair<size_t, size_t> &top = stack.back();
+            const CTransaction &tx = *vEntries[top.first].tx;
+            if (top.second < tx.vin.size())
+            {
+                auto parent = mapIndex.find(tx.vin[top.second++].prevout.hash);
+                if (parent != mapIndex.end() && !vDone[parent->second])
+                {
+                    vDone[parent->second] = true;
+                    stack.emplace_back(parent->second, 0);
+                }
+                continue;
+            }
+            vSorted.push_back(std::move(vEntries[top.first]));
+            stack.pop_back();
+        }
+    }
+    vEntries.swap(vSorted);
+}
 
-bool LoadMempool(void)
+// Put a dumped entry straight back into the mempool. The caller must have checked that the chain tip is the one the
+// entry was accepted against, so only the checks that depend on the local state (inputs still available and not
+// already spent in the mempool, sequence locks, the ancestor limits) are repeated here. Script checks are skipped.
+static bool RestoreMempoolEntry(const CMempoolDumpEntry &d, uint64_t nLimitAncestors, uint64_t nLimitAncestorSize)
+{
+    AssertLockHeld(cs_main);
+    AssertWriteLockHeld(mempool.cs_txmempool);
+
+    const CTransactionRef &tx = d.tx;
+    if (mempool._exists(tx->GetHash()))
+        return true;
+    for (const CTxIn &txin : tx->vin)
+    {
+        if (mempool.mapNextTx.count(txin.prevout))
+            return false;
+    }
+
+    // CheckSequenceLocks also fails if any input is missing from both the utxo set and the mempool
+    LockPoints lp;
+    if (!CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS) ||
+        !CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp, false))
+        return false;
+
+    CTxMemPoolEntry entry(tx, d.nFee, d.nTime, d.entryPriority, d.entryHeight, mempool.HasNoInputsOf(tx),
+        d.inChainInputValue, d.spendsCoinbase, d.sigOpCount, lp);
+    entry.UpdateRuntimeSigOps(d.runtimeSigOpCount, d.runtimeSighashBytes);
+    entry.sighashType = d.sighashType;
+
+    // The limits may have been lowered since the dump. Anything over them is left to the admission threads,
+    // which decide what to do with it exactly as they would for a new transaction.
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    if (!mempool._CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, errString))
+        return false;
+    return mempool._addUnchecked(tx->GetHash(), entry, false);
+}
+
+static bool LoadMempoolV1(CAutoFile &file, int64_t &count, int64_t &skipped)
 {
     int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nNow = GetTime();
+
+    uint64_t num;
+    file >> num;
+    double prioritydummy = 0;
+    while (num--)
+    {
+        CTransaction tx;
+        int64_t nTime;
+        int64_t nFeeDelta;
+        file >> tx;
+        file >> nTime;
+        file >> nFeeDelta;
+
+        CAmount amountdelta = nFeeDelta;
+        if (amountdelta)
+        {
+            mempool.PrioritiseTransaction(tx.GetHash(), tx.GetHash().ToString(), prioritydummy, amountdelta);
+        }
+        if (nTime + nExpiryTimeout > nNow)
+        {
+            CTxInputData txd;
+            txd.tx = MakeTransactionRef(tx);
+            EnqueueTxForAdmission(txd);
+            ++count;
+        }
+        else
+        {
+            ++skipped;
+        }
+
+        if (ShutdownRequested())
+            return false;
+    }
+    std::map<uint256, CAmount> mapDeltas;
+    file >> mapDeltas;
+
+    for (const auto &i : mapDeltas)
+    {
+        mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
+    }
+    return true;
+}
+
+static bool LoadMempoolV2(CAutoFile &file, int64_t &count, int64_t &skipped, int64_t &restored)
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nNow = GetTime();
+
+    uint256 hashTip;
+    file >> hashTip;
+    uint64_t num;
+    file >> num;
+
+    std::vector<CMempoolDumpEntry> vEntries;
+    vEntries.reserve(std::min(num, (uint64_t)1000000));
+    double prioritydummy = 0;
+    while (num--)
+    {
+        CMempoolDumpEntry d;
+        file >> d;
+        if (d.nFeeDelta)
+        {
+            mempool.PrioritiseTransaction(d.tx->GetHash(), d.tx->GetHash().ToString(), prioritydummy, d.nFeeDelta);
+        }
+        if (d.nTime + nExpiryTimeout > nNow)
+            vEntries.push_back(std::move(d));
+        else
+            ++skipped;
+
+        if (ShutdownRequested())
+            return false;
+    }
+    std::map<uint256, CAmount> mapDeltas;
+    file >> mapDeltas;
+    for (const auto &i : mapDeltas)
+    {
+        mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
+    }
+
+    // If the tip has not moved since the dump then every entry is still valid against the current utxo set, so
+    // put them back directly. The admission threads are paused so that nothing they validated against the old
+    // snapshot can be committed alongside these entries.
+    uint64_t nLimitAncestors = GetArg("-limitancestorcount", BCH_DEFAULT_ANCESTOR_LIMIT);
+    uint64_t nLimitAncestorSize = GetArg("-limitancestorsize", BCH_DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+    std::vector<CTransactionRef> vRestored;
+    std::vector<CTransactionRef> vRevalidate;
+    {
+        TxAdmissionPause pause;
+        LOCK(cs_main);
+        if (chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashTip)
+        {
+            WRITELOCK(mempool.cs_txmempool);
+            for (const CMempoolDumpEntry &d : vEntries)
+            {
+                if (RestoreMempoolEntry(d, nLimitAncestors, nLimitAncestorSize))
+                    vRestored.push_back(d.tx);
+                else
+                    vRevalidate.push_back(d.tx);
+            }
+        }
+        else
+        {
+            for (const CMempoolDumpEntry &d : vEntries)
+                vRevalidate.push_back(d.tx);
+        }
+    }
+    restored = vRestored.size();
+
+    // Restored entries bypassed the commit path, so do what it would have done: trim to -maxmempool, which may
+    // have been lowered since the dump, and tell the wallet.
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
+        GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+#ifdef ENABLE_WALLET
+    for (const CTransactionRef &tx : vRestored)
+        SyncWithWallets(tx, nullptr, -1);
+#endif
+
+    // Anything left over goes through the parallel admission threads where script checks are spread across
+    // threads and hit the signature cache.
+    for (const CTransactionRef &tx : vRevalidate)
+    {
+        CTxInputData txd;
+        txd.tx = tx;
+        EnqueueTxForAdmission(txd);
+        ++count;
+    }
+    return true;
+}
+
+bool LoadMempool(void)
+{
     FILE *fileMempool = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
     if (!fileMempool)
     {
@@ -1744,56 +2517,28 @@ bool LoadMempool(void)
         return false;
     }
 
+    int64_t start = GetStopwatchMicros();
     int64_t count = 0;
     int64_t skipped = 0;
-    int64_t nNow = GetTime();
+    int64_t restored = 0;
 
     try
     {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION)
+        if (version == MEMPOOL_DUMP_VERSION)
         {
-            return false;
+            if (!LoadMempoolV1(file, count, skipped))
+                return false;
         }
-        uint64_t num;
-        file >> num;
-        double prioritydummy = 0;
-        while (num--)
+        else if (version == MEMPOOL_DUMP_VERSION_2)
         {
-            CTransaction tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta)
-            {
-                mempool.PrioritiseTransaction(tx.GetHash(), tx.GetHash().ToString(), prioritydummy, amountdelta);
-            }
-            if (nTime + nExpiryTimeout > nNow)
-            {
-                CTxInputData txd;
-                txd.tx = MakeTransactionRef(tx);
-                EnqueueTxForAdmission(txd);
-                ++count;
-            }
-            else
-            {
-                ++skipped;
-            }
-
-            if (ShutdownRequested())
+            if (!LoadMempoolV2(file, count, skipped, restored))
                 return false;
         }
-        std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
-
-        for (const auto &i : mapDeltas)
+        else
         {
-            mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
+            return false;
         }
     }
     catch (const std::exception &e)
@@ -1802,7 +2547,8 @@ bool LoadMempool(void)
         return false;
     }
 
-    LOGA("Imported mempool transactions from disk: %i successes, %i expired\n", count, skipped);
+    LOGA("Imported mempool transactions from disk: %i restored, %i queued for validation, %i expired in %gs\n",
+        restored, count, skipped, (GetStopwatchMicros() - start) * 0.000001);
     return true;
 }
 
@@ -1811,21 +2557,30 @@ bool DumpMempool(void)
     int64_t start = GetStopwatchMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vInfo;
+    std::vector<CMempoolDumpEntry> vEntries;
+    uint256 hashTip;
 
+    // Only copy the entries while holding the lock. Sorting and serializing is done from the copy.
     {
+        LOCK(cs_main);
         READLOCK(mempool.cs_txmempool);
+        if (chainActive.Tip())
+            hashTip = chainActive.Tip()->GetBlockHash();
         for (const auto &i : mempool.mapDeltas)
         {
-            mapDeltas[i.first] = i.second.first;
+            mapDeltas[i.first] = i.second.second;
         }
-        vInfo = mempool.AllTxMempoolInfo();
+        vEntries.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry &e : mempool.mapTx)
+            vEntries.emplace_back(e);
     }
 
     int64_t mid = GetStopwatchMicros();
 
     try
     {
+        SortForDump(vEntries);
+
         FILE *fileMempool = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
         if (!fileMempool)
         {
@@ -1835,16 +2590,15 @@ bool DumpMempool(void)
 
         CAutoFile file(fileMempool, SER_DISK, CLIENT_VERSION);
 
-        uint64_t version = MEMPOOL_DUMP_VERSION;
+        uint64_t version = MEMPOOL_DUMP_VERSION_2;
         file << version;
+        file << hashTip;
 
-        file << (uint64_t)vInfo.size();
-        for (const auto &i : vInfo)
+        file << (uint64_t)vEntries.size();
+        for (const auto &d : vEntries)
         {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.feeDelta;
-            mapDeltas.erase(i.tx->GetHash());
+            file << d;
+            mapDeltas.erase(d.tx->GetHash());
         }
 
         file << mapDeltas;
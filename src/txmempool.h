@@ -9,7 +9,10 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <memory>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "amount.h"
 #include "coins.h"
@@ -18,6 +21,7 @@
 #include "sync.h"
 
 #undef foreach
+#include "boost/multi_index/hashed_index.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index_container.hpp"
 #include <boost/thread/locks.hpp>
@@ -56,10 +60,11 @@ static const uint32_t MAX_UPDATED_CHAIN_STATE = 500;
 /** Transaction rate statisics update thread */
 void ThreadUpdateTransactionRateStatistics();
 
-/** Dump the mempool to disk. */
+/** Dump the mempool to disk, in dependency order, along with the chain tip it is valid for. */
 bool DumpMempool();
 
-/** Load the mempool from disk. */
+/** Load the mempool from disk. If the chain tip is the one the dump was made at then the entries are restored
+ *  directly, otherwise they are queued for full validation. */
 bool LoadMempool();
 
 struct LockPoints
@@ -161,6 +166,7 @@ public:
     void UpdateRuntimeSigOps(uint64_t _runtimeSigOpCount, uint64_t _runtimeSighashBytes);
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
+    CAmount GetInChainInputValue() const { return inChainInputValue; }
     uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
     uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
@@ -351,6 +357,47 @@ public:
     size_t operator()(const uint256 &txid) const { return SipHashUint256(k0, k1, txid); }
 };
 
+/**
+ * An immutable copy of the mempool which can be read without holding cs_txmempool, so that long running
+ * readers such as the mempool RPCs do not hold up transaction admission.  Entries are ordered as in the
+ * ancestor_score index and record their in-mempool parents and children as positions in vEntries.
+ *
+ * Obtain one with CTxMemPool::GetSnapshot().  It reflects the mempool as of the last change made before it
+ * was taken.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    struct Entry
+    {
+        CTxMemPoolEntry entry;
+        std::vector<uint32_t> vParents;
+        std::vector<uint32_t> vChildren;
+
+        Entry(const CTxMemPoolEntry &e) : entry(e) {}
+    };
+
+    const uint64_t nEpoch;
+    std::vector<Entry> vEntries;
+    uint64_t nTotalTxSize = 0;
+
+    CTxMemPoolSnapshot(uint64_t _nEpoch) : nEpoch(_nEpoch) {}
+
+    size_t size() const { return vEntries.size(); }
+    /** Return the position of the transaction in vEntries, or -1 if it is not in the snapshot */
+    int64_t Find(const uint256 &hash) const;
+    /** Populate setAncestors with all in-mempool ancestors of the entry at position n, excluding itself */
+    void CalculateAncestors(uint32_t n, std::set<uint32_t> &setAncestors) const;
+    /** Populate setDescendants with all in-mempool descendants of the entry at position n, excluding itself */
+    void CalculateDescendants(uint32_t n, std::set<uint32_t> &setDescendants) const;
+
+private:
+    std::unordered_map<uint256, uint32_t, SaltedTxidHasher> mapIndex;
+
+    friend class CTxMemPool;
+};
+typedef std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPoolSnapshotRef;
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -363,11 +410,10 @@ public:
  *
  * CTxMemPool::mapTx, and CTxMemPoolEntry bookkeeping:
  *
- * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
- * - transaction hash
- * - feerate [we use max(feerate of tx, feerate of tx with all descendants)]
+ * mapTx is a boost::multi_index that indexes the mempool on 3 criteria:
+ * - transaction hash (hashed, so that lookups by txid are O(1))
  * - time in mempool
- * - mining score (feerate modified by any fee deltas from PrioritiseTransaction)
+ * - mining score (feerate with ancestors, modified by any fee deltas from PrioritiseTransaction)
  *
  * Note: the term "descendant" refers to in-mempool transactions that depend on
  * this one, while "ancestor" refers to in-mempool transactions that a given
@@ -427,14 +473,19 @@ private:
      */
     std::atomic<uint64_t> nBackloggedTxCountForThroughputRate;
 
+    //! Incremented, with cs_txmempool held exclusively, whenever anything a snapshot shows changes
+    std::atomic<uint64_t> nSnapshotEpoch{0};
+    mutable CCriticalSection cs_snapshot;
+    mutable CTxMemPoolSnapshotRef lastSnapshot GUARDED_BY(cs_snapshot);
+
 public:
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
 
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
         boost::multi_index::indexed_by<
-            // sorted by txid
-            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // hashed by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
             // sorted by entry time
             boost::multi_index::ordered_non_unique<boost::multi_index::tag<entry_time>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
@@ -457,6 +508,46 @@ public:
         TxMempoolOriginalStateMap;
     typedef std::map<txiter, ancestor_state, CTxMemPool::CompareIteratorByHash> mapEntryHistory;
 
+    /** A chunk is a run of consecutive transactions in a cluster's linearization.  The chunks of a cluster are
+     *  ordered by strictly decreasing feerate, and every chunk only depends on itself and earlier chunks, so a
+     *  prefix of the chunk list can always be mined and a suffix can always be evicted.
+     */
+    struct TxChunk
+    {
+        std::vector<txiter> vTxns; // in a valid block order
+        CAmount nModFees = 0;
+        uint64_t nSize = 0;
+        unsigned int nSigOps = 0;
+    };
+
+    /** A cluster is a connected component of the mempool's parent/child graph */
+    struct TxCluster
+    {
+        std::vector<txiter> vTxns; // unordered
+        std::vector<TxChunk> vChunks; // empty while the cluster is dirty
+    };
+
+    /** Index key for a cluster's best (first) or worst (last) chunk */
+    struct TxChunkKey
+    {
+        CAmount nModFees;
+        uint64_t nSize;
+        uint64_t nClusterId;
+    };
+    /** Orders chunk keys by decreasing feerate, ties broken by cluster id */
+    struct CompareTxChunkKey
+    {
+        bool operator()(const TxChunkKey &a, const TxChunkKey &b) const
+        {
+            double f1 = (double)a.nModFees * b.nSize;
+            double f2 = (double)b.nModFees * a.nSize;
+            if (f1 != f2)
+                return f1 > f2;
+            return a.nClusterId < b.nClusterId;
+        }
+    };
+    typedef std::set<TxChunkKey, CompareTxChunkKey> setChunkKeys;
+
     /** Return the set of mempool parents for this entry */
     const setEntries &GetMemPoolParents(txiter entry) const;
     const setEntries GetMemPoolParents(const CTransaction &tx) const;
@@ -480,15 +571,51 @@ private:
         setEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    // Entries in mapTx never move once inserted, so the address of the entry is a stable and cheap key.
+    struct TxiterHasher
+    {
+        size_t operator()(const txiter &it) const { return std::hash<const CTxMemPoolEntry *>()(&(*it)); }
+    };
+
+    typedef std::unordered_map<txiter, TxLinks, TxiterHasher> txlinksMap;
     txlinksMap mapLinks;
 
     void _UpdateParent(txiter entry, txiter parent, bool add);
     void _UpdateChild(txiter entry, txiter child, bool add);
 
+    // Cluster membership is maintained eagerly as links are added and removed, which is cheap.  The
+    // linearization of a cluster is only rebuilt lazily, by _UpdateClusters(), for the clusters that changed
+    // since the last time a block template was built or the mempool was trimmed.
+    struct TxClusterRef
+    {
+        uint64_t nClusterId;
+        size_t nPos; // position in TxCluster::vTxns
+    };
+    std::unordered_map<txiter, TxClusterRef, TxiterHasher> mapTxCluster;
+    std::unordered_map<uint64_t, TxCluster> mapClusters;
+    std::unordered_set<uint64_t> setDirtyClusters;
+    setChunkKeys setClustersByBestChunk;
+    setChunkKeys setClustersByWorstChunk;
+    uint64_t nNextClusterId = 0;
+    uint64_t nChunkCount = 0; // chunks held by all linearized clusters, for the memory usage estimate
+    // Readers holding only a shared cs_txmempool may rebuild dirty clusters, so they serialize on this lock, and
+    // so does any other reader of mapTxCluster or mapClusters that may run under the shared lock.  Writers hold
+    // cs_txmempool exclusively and therefore never race with a rebuild.
+    mutable CCriticalSection cs_clusters;
+
+    void _ClusterAdd(txiter it);
+    void _ClusterRemove(txiter it);
+    void _ClusterLink(txiter a, txiter b);
+    void _MarkClusterDirty(uint64_t nClusterId);
+    void _LinearizeCluster(uint64_t nClusterId, TxCluster &cluster);
+    void _IndexCluster(uint64_t nClusterId, const TxCluster &cluster);
+    void _UnindexCluster(uint64_t nClusterId, const TxCluster &cluster);
+    size_t _ClusterUsage() const;
+
 public:
     // Connects an output to the transaction that spends it.
-    std::map<COutPoint, CInPoint> mapNextTx;
+    typedef std::unordered_map<COutPoint, CInPoint, SaltedOutpointHasher> nextTxMap;
+    nextTxMap mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     // Transaction chain tips for dirty chains of transactions
@@ -674,13 +801,27 @@ public:
         return true;
     }
 
-    /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
+    /** Remove transactions from the mempool until its dynamic size is <= sizelimit.  The lowest feerate
+      *  chunk in the mempool is evicted first.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
       */
-    void TrimToSize(size_t sizelimit,
-        std::vector<COutPoint> *pvNoSpendsRemaining = nullptr,
-        bool fDeterministic = false);
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint> *pvNoSpendsRemaining = nullptr);
+
+    /** Rebuild the split and linearization of every cluster that changed since the last call.  May be
+     *  called with cs_txmempool held either shared or exclusive.
+     */
+    void _UpdateClusters();
+    /** Return the cluster with the given id, or nullptr.  Call _UpdateClusters() first. */
+    const TxCluster *_GetCluster(uint64_t nClusterId) const;
+    /** Clusters indexed by the feerate of their first chunk, highest first. Call _UpdateClusters() first. */
+    const setChunkKeys &_GetClustersByBestChunk() const { return setClustersByBestChunk; }
+    /** Return the number of clusters in the mempool */
+    size_t _ClusterCount() const { return mapClusters.size(); }
+    /** Return the size of the cluster a transaction with these in-mempool parents would be part of, itself
+     *  included.  Clusters not yet split after a removal count whole, so this may overestimate.
+     */
+    size_t _ClusterSizeWithParents(const setEntries &setParents) const;
 
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed
      * transactions. */
@@ -739,17 +880,29 @@ public:
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
+    /** Estimate the fee rates needed to get into the next nBlocks for several values of nBlocks at once */
+    std::vector<CFeeRate> estimateFees(const std::vector<int> &vBlocks) const;
 
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile &fileout) const;
     bool ReadFeeEstimates(CAutoFile &filein);
 
+    /** Return a snapshot of the current mempool contents.  The snapshot is shared by all readers and only
+     *  rebuilt by the first reader after the mempool has changed.  Must not be called with cs_txmempool held.
+     *  Rebuilding copies the whole mempool, so readers of a single entry or of the totals should look them up
+     *  under the lock instead.
+     */
+    CTxMemPoolSnapshotRef GetSnapshot() const;
+
     size_t DynamicMemoryUsage() const;
-    size_t _DynamicMemoryUsage() const; // no locks taken
+    size_t _DynamicMemoryUsage() const; // cs_txmempool must already be held
 
 private:
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void _UpdateAncestorsOf(bool add, txiter hash);
+    /** Replace the ancestor state of an entry with its exact ancestor totals and clear its dirty flag.  A single
+     *  parent's totals are reused unless that parent is dirty, so parents must be recalculated before children. */
+    void _RecalculateAncestorState(txiter it);
     /** Set ancestor state for an entry */
     void _UpdateEntryForAncestors(txiter it);
     /** For each transaction being removed, update ancestors and any direct children. */
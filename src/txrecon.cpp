@@ -0,0 +1,417 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrecon.h"
+#include "blockrelay/graphene.h"
+#include "blockrelay/mempool_sync.h"
+#include "dosman.h"
+#include "random.h"
+#include "tweak.h"
+#include "util.h"
+#include "utiltime.h"
+
+extern CTweak<unsigned int> txReconFloodPeers;
+
+std::vector<uint256> CTxReconState::EndRound()
+{
+    std::vector<uint256> vHashes;
+    vHashes.reserve(mapSnapshot.size());
+    for (const auto &kv : mapSnapshot)
+        vHashes.push_back(kv.second);
+
+    nRoundStarted = 0;
+    nMaxSymbols = 0;
+    mapSnapshot.clear();
+    pEncoder.reset();
+    pDecoder.reset();
+    return vHashes;
+}
+
+/** Bytes a message of this payload takes on the wire, for the announcement bandwidth stats */
+template <typename T>
+static uint64_t WireSize(const T &obj)
+{
+    return ::GetSerializeSize(obj, SER_NETWORK, PROTOCOL_VERSION) + CMessageHeader::HEADER_SIZE;
+}
+
+/** The most symbols exchanged in one round before giving up on decoding. */
+static uint64_t MaxTxReconSymbols(uint64_t nSetSize, uint64_t nPeerSetSize)
+{
+    return 2 * (nSetSize + std::min(nPeerSetSize, (uint64_t)TX_RECON_MAX_SET_SIZE)) + TX_RECON_MIN_SYMBOLS;
+}
+
+/** Take the transactions held back for this peer, dropping those it announced to us in the meantime */
+static std::vector<uint256> TakeTxReconSet(CNode *pnode)
+{
+    std::vector<uint256> vHashes;
+    LOCK(pnode->cs_inventory);
+    vHashes.reserve(pnode->vTxReconSet.size());
+    for (const uint256 &hash : pnode->vTxReconSet)
+    {
+        if (!pnode->filterInventoryKnown.contains(hash))
+            vHashes.push_back(hash);
+    }
+    pnode->vTxReconSet.clear();
+    return vHashes;
+}
+
+/** Fill the round's snapshot from a set of held back transactions */
+static void SnapshotTxReconSet(CTxReconState &state, const std::vector<uint256> &vHashes)
+{
+    state.mapSnapshot.clear();
+    for (const uint256 &hash : vHashes)
+        state.mapSnapshot.emplace(
+            GetShortID(state.shorttxidk0, state.shorttxidk1, hash, SHORT_ID_VERSION), hash);
+}
+
+/** Announce transactions the usual way, by INV */
+static void AnnounceTxs(CNode *pnode, const std::vector<uint256> &vHashes)
+{
+    for (const uint256 &hash : vHashes)
+        pnode->PushInventory(CInv(MSG_TX, hash));
+}
+
+/**
+ * Top the flood peers back up to net.txReconFloodPeers, preferring outbound peers and falling back to inbound ones
+ * so that a node with few outbound connections still floods to someone.  Peers already flooded to keep that role.
+ */
+static void SelectTxReconFloodPeers()
+{
+    LOCK(cs_vNodes);
+    unsigned int nFloodPeers = 0;
+    for (CNode *node : vNodes)
+    {
+        if (!node->fDisconnect && node->fTxReconciliation && node->fTxReconFlood)
+            nFloodPeers++;
+    }
+
+    for (bool fInbound : {false, true})
+    {
+        for (CNode *node : vNodes)
+        {
+            if (nFloodPeers >= txReconFloodPeers.Value())
+                return;
+            if (node->fInbound != fInbound || node->fDisconnect || !node->fTxReconciliation || node->fTxReconFlood)
+                continue;
+            node->fTxReconFlood = true;
+            nFloodPeers++;
+            LOG(NET, "Flooding transactions to reconciling peer %s\n", node->GetLogName());
+        }
+    }
+}
+
+void InitTxReconciliation(CNode *pnode)
+{
+    if (!pnode->fTxReconciliation)
+        return;
+
+    // Keep flooding to a few reconciling peers so that transactions still spread quickly
+    pnode->fTxReconFlood = false;
+    SelectTxReconFloodPeers();
+
+    LOG(NET, "Announcing transactions to peer %s by reconciliation%s\n", pnode->GetLogName(),
+        pnode->fTxReconFlood ? " and flooding" : "");
+}
+
+void SendTxReconMessages(CNode *pto)
+{
+    if (!pto->fTxReconciliation)
+        return;
+
+    int64_t nNow = GetStopwatchMicros();
+    NodeId nodeId = pto->GetId();
+    std::vector<uint256> vAnnounce;
+    bool fRequest = false;
+    CTxReconRequest req;
+    {
+        LOCK(cs_txrecon);
+        CTxReconState &state = mapTxRecon[nodeId];
+
+        if (state.nRoundStarted != 0)
+        {
+            // The peer never finished the round, so announce what we held back the usual way
+            if (nNow - state.nRoundStarted < TX_RECON_TIMEOUT_US)
+                return;
+            LOG(NET, "Transaction reconciliation with peer %s timed out\n", pto->GetLogName());
+            vAnnounce = state.EndRound();
+        }
+        else if (!pto->fInbound)
+        {
+            if (nNow - state.nLastRound < TX_RECON_INTERVAL_US)
+                return;
+
+            // Start a new round
+            state.shorttxidk0 = GetRand(std::numeric_limits<uint64_t>::max());
+            state.shorttxidk1 = GetRand(std::numeric_limits<uint64_t>::max());
+            SnapshotTxReconSet(state, TakeTxReconSet(pto));
+            state.pDecoder = std::make_shared<CRibltDecoder>();
+            for (const auto &kv : state.mapSnapshot)
+                state.pDecoder->addLocalKey(kv.first);
+            state.nRoundStarted = nNow;
+            state.nLastRound = nNow;
+
+            req = CTxReconRequest(state.shorttxidk0, state.shorttxidk1, state.mapSnapshot.size());
+            fRequest = true;
+        }
+        else if (nNow - state.nLastRound >= TX_RECON_FLUSH_US)
+        {
+            // Our outbound peer stopped asking for reconciliation, so stop holding transactions back
+            vAnnounce = TakeTxReconSet(pto);
+            state.nLastRound = nNow;
+        }
+    }
+
+    if (fRequest)
+    {
+        pto->nTxAnnounceBytesSent += WireSize(req);
+        pto->PushMessage(NetMsgType::REQRECON, req);
+        LOG(NET, "Requesting transaction reconciliation from peer %s with %d held back txs\n", pto->GetLogName(),
+            req.nSetSize);
+    }
+    AnnounceTxs(pto, vAnnounce);
+}
+
+bool CTxReconRequest::HandleMessage(CDataStream &vRecv, CNode *pfrom)
+{
+    CTxReconRequest req;
+    vRecv >> req;
+    pfrom->nTxAnnounceBytesRecv += WireSize(req);
+    NodeId nodeId = pfrom->GetId();
+
+    // Only the outbound side of a connection starts rounds
+    if (!pfrom->fTxReconciliation || !pfrom->fInbound)
+    {
+        dosMan.Misbehaving(pfrom, 10);
+        return error("Received unexpected reqrecon from peer %s", pfrom->GetLogName());
+    }
+
+    CTxReconSketch sketch;
+    std::vector<uint256> vAnnounce;
+    {
+        LOCK(cs_txrecon);
+        CTxReconState &state = mapTxRecon[nodeId];
+
+        int64_t nNow = GetStopwatchMicros();
+        if ((nNow - state.nLastRound) < TX_RECON_INTERVAL_US / 2)
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received reqrecon from peer %s too soon after the last one", pfrom->GetLogName());
+        }
+
+        // The peer gave up on the previous round before we timed it out, so announce its transactions now
+        if (state.nRoundStarted != 0)
+            vAnnounce = state.EndRound();
+
+        state.shorttxidk0 = req.shorttxidk0;
+        state.shorttxidk1 = req.shorttxidk1;
+        SnapshotTxReconSet(state, TakeTxReconSet(pfrom));
+        state.pEncoder = std::make_shared<CRibltEncoder>();
+        for (const auto &kv : state.mapSnapshot)
+            state.pEncoder->addKey(kv.first);
+        state.nMaxSymbols = MaxTxReconSymbols(state.mapSnapshot.size(), req.nSetSize);
+        state.nRoundStarted = nNow;
+        state.nLastRound = nNow;
+
+        // Size the first batch from the difference in set sizes plus a share of the smaller set, since both sides
+        // usually held back many of the same transactions.
+        uint64_t nSetSize = state.mapSnapshot.size();
+        uint64_t nPeerSetSize = std::min(req.nSetSize, (uint64_t)TX_RECON_MAX_SET_SIZE);
+        uint64_t nDiff = (nSetSize > nPeerSetSize ? nSetSize - nPeerSetSize : nPeerSetSize - nSetSize) +
+                         std::min(nSetSize, nPeerSetSize) / 4;
+        uint64_t nSymbols = std::min(std::min(state.nMaxSymbols, TX_RECON_MAX_SYMBOLS_PER_MSG),
+            std::max(TX_RECON_MIN_SYMBOLS, nDiff * 3 / 2));
+        sketch = CTxReconSketch(nSetSize, 0, state.pEncoder->nextSymbols(nSymbols));
+    }
+
+    AnnounceTxs(pfrom, vAnnounce);
+    pfrom->nTxAnnounceBytesSent += WireSize(sketch);
+    pfrom->PushMessage(NetMsgType::RECONSKETCH, sketch);
+    LOG(NET, "Sent %d reconciliation symbols for %d held back txs to peer %s\n", sketch.vSymbols.size(),
+        sketch.nSetSize, pfrom->GetLogName());
+
+    return true;
+}
+
+bool CTxReconSketch::HandleMessage(CDataStream &vRecv, CNode *pfrom)
+{
+    CTxReconSketch sketch;
+    vRecv >> sketch;
+    pfrom->nTxAnnounceBytesRecv += WireSize(sketch);
+    NodeId nodeId = pfrom->GetId();
+
+    if (sketch.vSymbols.empty())
+    {
+        dosMan.Misbehaving(pfrom, 100);
+        return error("Received reconsketch without symbols from peer %s", pfrom->GetLogName());
+    }
+
+    std::vector<uint256> vAnnounce;
+    CTxReconDiff diff;
+    CTxReconSymbolRequest req;
+    bool fDone = false;
+    {
+        LOCK(cs_txrecon);
+        CTxReconState &state = mapTxRecon[nodeId];
+
+        if (!state.pDecoder || sketch.nFirstSymbol != state.pDecoder->symbolCount())
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received unrequested or out of sequence reconsketch from peer %s", pfrom->GetLogName());
+        }
+
+        if (sketch.nFirstSymbol == 0)
+            state.nMaxSymbols = MaxTxReconSymbols(state.mapSnapshot.size(), sketch.nSetSize);
+        for (const CRibltSymbol &symbol : sketch.vSymbols)
+            state.pDecoder->addSymbol(symbol);
+
+        uint64_t nSymbols = state.pDecoder->symbolCount();
+        if (state.pDecoder->decoded())
+        {
+            // Ask for what only the peer holds, and announce what only we hold
+            diff = CTxReconDiff(false, state.pDecoder->remoteOnly());
+            for (uint64_t shortid : state.pDecoder->localOnly())
+            {
+                auto it = state.mapSnapshot.find(shortid);
+                if (it != state.mapSnapshot.end())
+                    vAnnounce.push_back(it->second);
+            }
+            LOG(NET, "Transaction reconciliation with peer %s decoded after %d symbols: %d txs to learn, %d to "
+                     "announce out of %d held back\n",
+                pfrom->GetLogName(), nSymbols, diff.vShortIds.size(), vAnnounce.size(), state.mapSnapshot.size());
+            state.EndRound();
+            fDone = true;
+        }
+        else if (nSymbols >= state.nMaxSymbols)
+        {
+            // Fall back to announcing everything on both sides
+            LOG(NET, "Transaction reconciliation with peer %s failed after %d symbols\n", pfrom->GetLogName(),
+                nSymbols);
+            diff = CTxReconDiff(true, std::vector<uint64_t>());
+            vAnnounce = state.EndRound();
+            fDone = true;
+        }
+        else
+        {
+            req = CTxReconSymbolRequest(nSymbols, std::min(std::min(state.nMaxSymbols - nSymbols,
+                                                               TX_RECON_MAX_SYMBOLS_PER_MSG),
+                                                      std::max(TX_RECON_MIN_SYMBOLS, nSymbols / 2)));
+        }
+    }
+
+    if (!fDone)
+    {
+        pfrom->nTxAnnounceBytesSent += WireSize(req);
+        pfrom->PushMessage(NetMsgType::REQRECONSYM, req);
+        return true;
+    }
+
+    pfrom->nTxAnnounceBytesSent += WireSize(diff);
+    pfrom->PushMessage(NetMsgType::RECONDIFF, diff);
+    AnnounceTxs(pfrom, vAnnounce);
+
+    return true;
+}
+
+bool CTxReconSymbolRequest::HandleMessage(CDataStream &vRecv, CNode *pfrom)
+{
+    CTxReconSymbolRequest req;
+    vRecv >> req;
+    pfrom->nTxAnnounceBytesRecv += WireSize(req);
+    NodeId nodeId = pfrom->GetId();
+
+    // Message consistency checking
+    if (req.nSymbols == 0 || req.nSymbols > TX_RECON_MAX_SYMBOLS_PER_MSG)
+    {
+        dosMan.Misbehaving(pfrom, 100);
+        return error("Incorrectly constructed reqreconsym received.  Banning peer=%s", pfrom->GetLogName());
+    }
+
+    CTxReconSketch sketch;
+    std::vector<uint256> vAnnounce;
+    {
+        LOCK(cs_txrecon);
+        CTxReconState &state = mapTxRecon[nodeId];
+
+        if (!state.pEncoder || req.nFirstSymbol != state.pEncoder->symbolsProduced())
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received unexpected or out of sequence reqreconsym from peer %s", pfrom->GetLogName());
+        }
+
+        // The requester should have given up by now
+        if (req.nFirstSymbol >= state.nMaxSymbols)
+        {
+            vAnnounce = state.EndRound();
+        }
+        else
+        {
+            sketch = CTxReconSketch(state.mapSnapshot.size(), req.nFirstSymbol,
+                state.pEncoder->nextSymbols(std::min(req.nSymbols, state.nMaxSymbols - req.nFirstSymbol)));
+        }
+    }
+
+    if (!vAnnounce.empty())
+    {
+        AnnounceTxs(pfrom, vAnnounce);
+        return error("Transaction reconciliation with peer %s exceeded its symbol limit", pfrom->GetLogName());
+    }
+
+    pfrom->nTxAnnounceBytesSent += WireSize(sketch);
+    pfrom->PushMessage(NetMsgType::RECONSKETCH, sketch);
+
+    return true;
+}
+
+bool CTxReconDiff::HandleMessage(CDataStream &vRecv, CNode *pfrom)
+{
+    CTxReconDiff diff;
+    vRecv >> diff;
+    pfrom->nTxAnnounceBytesRecv += WireSize(diff);
+    NodeId nodeId = pfrom->GetId();
+
+    std::vector<uint256> vAnnounce;
+    {
+        LOCK(cs_txrecon);
+        CTxReconState &state = mapTxRecon[nodeId];
+
+        if (!state.pEncoder)
+        {
+            dosMan.Misbehaving(pfrom, 10);
+            return error("Received unexpected recondiff from peer %s", pfrom->GetLogName());
+        }
+
+        if (diff.fFailed)
+        {
+            vAnnounce = state.EndRound();
+        }
+        else
+        {
+            // Short ids we do not know were computed from noise in the sketch and are simply ignored
+            for (uint64_t shortid : diff.vShortIds)
+            {
+                auto it = state.mapSnapshot.find(shortid);
+                if (it != state.mapSnapshot.end())
+                    vAnnounce.push_back(it->second);
+            }
+            state.EndRound();
+        }
+    }
+
+    LOG(NET, "Transaction reconciliation with peer %s complete, announcing %d txs\n", pfrom->GetLogName(),
+        vAnnounce.size());
+    AnnounceTxs(pfrom, vAnnounce);
+
+    return true;
+}
+
+void ClearDisconnectedFromTxRecon(NodeId nodeid)
+{
+    {
+        LOCK(cs_txrecon);
+        mapTxRecon.erase(nodeid);
+    }
+
+    // The peer may have been one we flooded to, so promote another one in its place
+    SelectTxReconFloodPeers();
+}
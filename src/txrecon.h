@@ -0,0 +1,224 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECON_H
+#define BITCOIN_TXRECON_H
+
+#include "net.h"
+#include "riblt.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+/*
+ * Reconciliation based transaction announcement.
+ *
+ * Rather than sending an INV for every transaction on every link, we hold back the transactions we would have
+ * announced to a reconciling peer (CNode::vTxReconSet).  Every TX_RECON_INTERVAL_US the outbound side of the
+ * connection asks the inbound side for a rateless IBLT sketch of its held back set, using the same short ids as
+ * graphene and mempool sync, and decodes the difference against its own.  Each side then only INVs the
+ * transactions the other one has not seen, so a transaction that reached both ends of a link some other way costs
+ * a few bytes of sketch instead of two INVs.  Transactions are still flooded to a few peers, outbound ones first
+ * (net.txReconFloodPeers), so that they keep propagating quickly across the network; when one of them disconnects
+ * another reconciling peer takes its place.
+ */
+
+const uint64_t TX_RECON_VERSION = 1;
+const unsigned int DEFAULT_TX_RECON_FLOOD_PEERS = 2;
+// how often we reconcile with each outbound peer, in microseconds
+const int64_t TX_RECON_INTERVAL_US = 2 * 1e6;
+// a round that has not finished by then is abandoned and its transactions are announced by INV
+const int64_t TX_RECON_TIMEOUT_US = 20 * 1e6;
+// an inbound peer that stops asking for reconciliation gets its held back transactions by INV after this long
+const int64_t TX_RECON_FLUSH_US = 30 * 1e6;
+// held back transactions are announced by INV rather than letting the set grow beyond this
+const size_t TX_RECON_MAX_SET_SIZE = 20000;
+// smallest batch of symbols sent in a single reconsketch message
+const uint64_t TX_RECON_MIN_SYMBOLS = 16;
+// largest batch of symbols sent in a single reconsketch message
+const uint64_t TX_RECON_MAX_SYMBOLS_PER_MSG = 10000;
+
+/** State of a reconciliation round with a given peer, as either initiator (outbound) or responder (inbound). */
+class CTxReconState
+{
+public:
+    /** SipHash keys chosen by the initiator of the current round. */
+    uint64_t shorttxidk0;
+    uint64_t shorttxidk1;
+    /** Stopwatch time the current round started, or 0 if no round is in progress. */
+    int64_t nRoundStarted;
+    /** Stopwatch time the last round started. */
+    int64_t nLastRound;
+    /** Our held back transactions for this peer as of the start of the round, by short id. */
+    std::map<uint64_t, uint256> mapSnapshot;
+    /** Upper bound on the number of symbols exchanged in this round. */
+    uint64_t nMaxSymbols;
+    /** Responder side: the symbol stream of our snapshot. */
+    std::shared_ptr<CRibltEncoder> pEncoder;
+    /** Initiator side: the symbols received so far, minus our snapshot. */
+    std::shared_ptr<CRibltDecoder> pDecoder;
+
+public:
+    CTxReconState()
+        : shorttxidk0(0), shorttxidk1(0), nRoundStarted(0), nLastRound(GetStopwatchMicros()), nMaxSymbols(0)
+    {
+    }
+    /** Finish the current round, returning the transactions of the snapshot that were not accounted for */
+    std::vector<uint256> EndRound();
+};
+
+extern CCriticalSection cs_txrecon;
+extern std::map<NodeId, CTxReconState> mapTxRecon;
+
+/** Sent by the outbound side of a connection to start a reconciliation round. */
+class CTxReconRequest
+{
+public:
+    /** SipHash keys to be used for generating short ids in this round. */
+    uint64_t shorttxidk0;
+    uint64_t shorttxidk1;
+    /** Number of transactions the requester held back for us. */
+    uint64_t nSetSize;
+
+public:
+    CTxReconRequest(uint64_t _shorttxidk0, uint64_t _shorttxidk1, uint64_t _nSetSize)
+        : shorttxidk0(_shorttxidk0), shorttxidk1(_shorttxidk1), nSetSize(_nSetSize)
+    {
+    }
+    CTxReconRequest() : shorttxidk0(0), shorttxidk1(0), nSetSize(0) {}
+    /**
+     * Handle an incoming reconciliation request
+     * @param[in] vRecv        The raw binary message
+     * @param[in] pFrom        The node the message was from
+     * @return True if handling succeeded
+     */
+    static bool HandleMessage(CDataStream &vRecv, CNode *pfrom);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(shorttxidk0);
+        READWRITE(shorttxidk1);
+        READWRITE(COMPACTSIZE(nSetSize));
+    }
+};
+
+/** A batch of rateless symbols encoding the responder's held back transactions. */
+class CTxReconSketch
+{
+public:
+    /** Number of transactions the responder held back for us. */
+    uint64_t nSetSize;
+    /** Position of the first symbol in this batch. */
+    uint64_t nFirstSymbol;
+    std::vector<CRibltSymbol> vSymbols;
+
+public:
+    CTxReconSketch(uint64_t _nSetSize, uint64_t _nFirstSymbol, std::vector<CRibltSymbol> _vSymbols)
+        : nSetSize(_nSetSize), nFirstSymbol(_nFirstSymbol), vSymbols(std::move(_vSymbols))
+    {
+    }
+    CTxReconSketch() : nSetSize(0), nFirstSymbol(0) {}
+    /**
+     * Handle an incoming batch of reconciliation symbols
+     * @param[in] vRecv        The raw binary message
+     * @param[in] pFrom        The node the message was from
+     * @return True if handling succeeded
+     */
+    static bool HandleMessage(CDataStream &vRecv, CNode *pfrom);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(COMPACTSIZE(nSetSize));
+        READWRITE(COMPACTSIZE(nFirstSymbol));
+        READWRITE(vSymbols);
+        if (vSymbols.size() > TX_RECON_MAX_SYMBOLS_PER_MSG)
+            throw std::runtime_error("Too many symbols in reconsketch");
+    }
+};
+
+/** Request for the next batch of symbols, sent by the initiator while it cannot decode yet. */
+class CTxReconSymbolRequest
+{
+public:
+    /** Position of the first symbol requested; must follow the last one already sent. */
+    uint64_t nFirstSymbol;
+    /** Number of symbols requested. */
+    uint64_t nSymbols;
+
+public:
+    CTxReconSymbolRequest(uint64_t _nFirstSymbol, uint64_t _nSymbols) : nFirstSymbol(_nFirstSymbol), nSymbols(_nSymbols)
+    {
+    }
+    CTxReconSymbolRequest() : nFirstSymbol(0), nSymbols(0) {}
+    /**
+     * Handle an incoming request for more reconciliation symbols
+     * @param[in] vRecv        The raw binary message
+     * @param[in] pFrom        The node the message was from
+     * @return True if handling succeeded
+     */
+    static bool HandleMessage(CDataStream &vRecv, CNode *pfrom);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(COMPACTSIZE(nFirstSymbol));
+        READWRITE(COMPACTSIZE(nSymbols));
+    }
+};
+
+/**
+ * Sent by the initiator to end a round: the short ids of the responder's held back transactions that it has not
+ * seen, or, if the sketch could not be decoded, a request to announce all of them.
+ */
+class CTxReconDiff
+{
+public:
+    bool fFailed;
+    std::vector<uint64_t> vShortIds;
+
+public:
+    CTxReconDiff(bool _fFailed, std::vector<uint64_t> _vShortIds) : fFailed(_fFailed), vShortIds(std::move(_vShortIds))
+    {
+    }
+    CTxReconDiff() : fFailed(false) {}
+    /**
+     * Handle the end of a reconciliation round
+     * @param[in] vRecv        The raw binary message
+     * @param[in] pFrom        The node the message was from
+     * @return True if handling succeeded
+     */
+    static bool HandleMessage(CDataStream &vRecv, CNode *pfrom);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(fFailed);
+        READWRITE(vShortIds);
+        if (vShortIds.size() > TX_RECON_MAX_SET_SIZE)
+            throw std::runtime_error("Too many short ids in recondiff");
+    }
+};
+
+/** Decide, once extversion is known, whether this peer reconciles and whether we still flood to it */
+void InitTxReconciliation(CNode *pnode);
+/** Start, time out or flush reconciliation rounds with this peer; called from SendMessages */
+void SendTxReconMessages(CNode *pto);
+/** Forget a disconnected peer's reconciliation state and replace it if it was one we flooded to */
+void ClearDisconnectedFromTxRecon(NodeId nodeid);
+
+#endif // BITCOIN_TXRECON_H
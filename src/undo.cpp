@@ -0,0 +1,158 @@
+// Copyright (c) 2024 The Bitcoin Unlimited developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "undo.h"
+
+#include "clientversion.h"
+#include "streams.h"
+
+#include <unordered_map>
+
+bool fCompactUndo = DEFAULT_COMPACT_UNDO;
+
+namespace
+{
+struct ScriptHasher
+{
+    size_t operator()(const CScript &script) const
+    {
+        return std::hash<std::string>()(std::string(script.begin(), script.end()));
+    }
+};
+
+// Heights are stored as differences, which can go either way
+uint64_t ZigZag(int64_t n) { return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63); }
+int64_t UnZigZag(uint64_t n) { return (int64_t)(n >> 1) ^ -(int64_t)(n & 1); }
+
+void DecodeTxUndo(CDataStream &s, const std::vector<CScript> &vScripts, CTxUndo &txundo)
+{
+    uint64_t nCoins = ReadCompactSize(s);
+    if (nCoins > MAX_INPUTS_PER_BLOCK)
+        throw std::ios_base::failure("Too many input undo records");
+    txundo.vprevout.resize(nCoins);
+    int64_t nHeight = 0;
+    for (Coin &coin : txundo.vprevout)
+    {
+        uint64_t nCode = 0;
+        s >> VARINT(nCode);
+        nHeight += UnZigZag(nCode >> 1);
+        if (nHeight < 0 || nHeight > std::numeric_limits<int32_t>::max())
+            throw std::ios_base::failure("Undo height out of range");
+        coin.nHeight = nHeight;
+        coin.fCoinBase = nCode & 1;
+        uint64_t nAmount = 0;
+        s >> VARINT(nAmount);
+        coin.out.nValue = CTxOutCompressor::DecompressAmount(nAmount);
+        uint64_t nScript = 0;
+        s >> VARINT(nScript);
+        if (nScript == 0)
+        {
+            CScriptCompressor compressor(coin.out.scriptPubKey);
+            s >> compressor;
+        }
+        else if (nScript <= vScripts.size())
+        {
+            coin.out.scriptPubKey = vScripts[nScript - 1];
+        }
+        else
+        {
+            throw std::ios_base::failure("Undo script reference out of range");
+        }
+    }
+}
+}
+
+void EncodeCompactUndo(const CBlockUndo &blockundo, std::vector<unsigned char> &vch)
+{
+    // Number the scripts that are spent more than once, in the order they first appear.  The map holds how often
+    // each script is spent, and its number once it has one.
+    std::unordered_map<CScript, std::pair<uint64_t, uint64_t>, ScriptHasher> mapScripts;
+    for (const CTxUndo &txundo : blockundo.vtxundo)
+        for (const Coin &coin : txundo.vprevout)
+            mapScripts[coin.out.scriptPubKey].first++;
+    std::vector<const CScript *> vScripts;
+    for (const CTxUndo &txundo : blockundo.vtxundo)
+    {
+        for (const Coin &coin : txundo.vprevout)
+        {
+            auto it = mapScripts.find(coin.out.scriptPubKey);
+            if (it->second.first > 1 && it->second.second == 0)
+            {
+                vScripts.push_back(&it->first);
+                it->second.second = vScripts.size();
+            }
+        }
+    }
+
+    CDataStream s(SER_DISK, CLIENT_VERSION);
+    WriteCompactSize(s, vScripts.size());
+    for (const CScript *pscript : vScripts)
+        s << CScriptCompressor(REF(*pscript));
+
+    std::vector<CDataStream> vTx(blockundo.vtxundo.size(), CDataStream(SER_DISK, CLIENT_VERSION));
+    for (size_t i = 0; i < blockundo.vtxundo.size(); i++)
+    {
+        CDataStream &tx = vTx[i];
+        const std::vector<Coin> &vprevout = blockundo.vtxundo[i].vprevout;
+        WriteCompactSize(tx, vprevout.size());
+        int64_t nHeight = 0;
+        for (const Coin &coin : vprevout)
+        {
+            uint64_t nCode = ZigZag((int64_t)coin.nHeight - nHeight) * 2 + (coin.fCoinBase ? 1 : 0);
+            nHeight = coin.nHeight;
+            tx << VARINT(nCode);
+            uint64_t nAmount = CTxOutCompressor::CompressAmount(coin.out.nValue);
+            tx << VARINT(nAmount);
+            uint64_t nScript = mapScripts[coin.out.scriptPubKey].second;
+            tx << VARINT(nScript);
+            if (nScript == 0)
+                tx << CScriptCompressor(REF(coin.out.scriptPubKey));
+        }
+    }
+
+    WriteCompactSize(s, vTx.size());
+    for (const CDataStream &tx : vTx)
+        WriteCompactSize(s, tx.size());
+    for (const CDataStream &tx : vTx)
+        s.write(tx.data(), tx.size());
+    vch.assign(s.begin(), s.end());
+}
+
+void DecodeCompactUndo(const std::vector<unsigned char> &vch, CBlockUndo &blockundo)
+{
+    CDataStream s(vch, SER_DISK, CLIENT_VERSION);
+    uint64_t nScripts = ReadCompactSize(s);
+    std::vector<CScript> vScripts;
+    for (uint64_t i = 0; i < nScripts; i++)
+    {
+        vScripts.emplace_back();
+        CScriptCompressor compressor(vScripts.back());
+        s >> compressor;
+    }
+
+    // Where the undo data of each transaction starts
+    uint64_t nTx = ReadCompactSize(s);
+    std::vector<uint64_t> vOffsets;
+    uint64_t nOffset = 0;
+    for (uint64_t i = 0; i < nTx; i++)
+    {
+        vOffsets.push_back(nOffset);
+        nOffset += ReadCompactSize(s);
+    }
+    if (nOffset != s.size())
+        throw std::ios_base::failure("Undo transaction sizes do not add up");
+    const char *pbegin = s.data();
+    vOffsets.push_back(nOffset);
+
+    blockundo.vtxundo.clear();
+    blockundo.vtxundo.resize(nTx);
+    for (size_t i = 0; i < nTx; i++)
+    {
+        // each transaction has to use up exactly the bytes listed for it
+        CDataStream tx(pbegin + vOffsets[i], pbegin + vOffsets[i + 1], SER_DISK, CLIENT_VERSION);
+        DecodeTxUndo(tx, vScripts, blockundo.vtxundo[i]);
+        if (!tx.empty())
+            throw std::ios_base::failure("Undo transaction data left over");
+    }
+}
@@ -105,18 +105,92 @@ public:
     }
 };
 
+/** Undo formats: a vector of CTxUndo, or the compact encoding of EncodeCompactUndo */
+static const uint8_t UNDO_FORMAT_LEGACY = 1;
+static const uint8_t UNDO_FORMAT_COMPACT = 2;
+/**
+ * First byte of compact undo data.  Legacy undo data starts with the compact size of vtxundo, and a compact size
+ * starting with 0xff is at least 2^32, which is out of range, so the two can not be mistaken for one another.
+ */
+static const uint8_t UNDO_COMPACT_MARKER = 0xff;
+
+/** Whether new undo data is written in the compact format */
+extern bool fCompactUndo;
+static const bool DEFAULT_COMPACT_UNDO = false;
+
+class CBlockUndo;
+
+/**
+ * The compact undo format.  Scripts that are spent more than once in the block are stored once, up front, and
+ * referred to by their index after that.  Then comes the size of the undo data of each transaction, so that
+ * transactions can be decoded without going through the ones before them, and then that data: per spent coin its
+ * height as the difference to the height of the coin before it in the transaction, its coinbase flag, its
+ * compressed amount and a reference to its script or the compressed script itself.
+ */
+void EncodeCompactUndo(const CBlockUndo &blockundo, std::vector<unsigned char> &vch);
+/** Decode compact undo data.  Throws std::ios_base::failure if it is malformed. */
+void DecodeCompactUndo(const std::vector<unsigned char> &vch, CBlockUndo &blockundo);
+
 /** Undo information for a CBlock */
 class CBlockUndo
 {
 public:
     std::vector<CTxUndo> vtxundo; // for all but the coinbase
+    //! the format it is serialized in, which is the format it was read in so reserializing reproduces the data
+    uint8_t nFormat = UNDO_FORMAT_LEGACY;
 
-    ADD_SERIALIZE_METHODS;
+    template <typename Stream>
+    void Serialize(Stream &s) const
+    {
+        if (nFormat == UNDO_FORMAT_COMPACT)
+        {
+            std::vector<unsigned char> vch;
+            EncodeCompactUndo(*this, vch);
+            ::Serialize(s, UNDO_COMPACT_MARKER);
+            ::Serialize(s, vch);
+        }
+        else
+        {
+            ::Serialize(s, vtxundo);
+        }
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream &s, Operation ser_action)
+    template <typename Stream>
+    void Unserialize(Stream &s)
     {
-        READWRITE(vtxundo);
+        uint8_t nFirst = ser_readdata8(s);
+        if (nFirst == UNDO_COMPACT_MARKER)
+        {
+            std::vector<unsigned char> vch;
+            ::Unserialize(s, vch);
+            DecodeCompactUndo(vch, *this);
+            nFormat = UNDO_FORMAT_COMPACT;
+            return;
+        }
+
+        // the rest of the compact size we already have the first byte of
+        uint64_t nCount = nFirst;
+        if (nFirst == 253)
+        {
+            nCount = ser_readdata16(s);
+            if (nCount < 253)
+                throw std::ios_base::failure("non-canonical ReadCompactSize()");
+        }
+        else if (nFirst == 254)
+        {
+            nCount = ser_readdata32(s);
+            if (nCount < 0x10000u)
+                throw std::ios_base::failure("non-canonical ReadCompactSize()");
+        }
+        if (nCount > MAX_SIZE)
+            throw std::ios_base::failure("ReadCompactSize(): size too large");
+        vtxundo.clear();
+        for (uint64_t i = 0; i < nCount; i++)
+        {
+            vtxundo.emplace_back();
+            ::Unserialize(s, vtxundo.back());
+        }
+        nFormat = UNDO_FORMAT_LEGACY;
     }
 };
 
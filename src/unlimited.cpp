@@ -28,6 +28,7 @@
 #include "miner.h"
 #include "net.h"
 #include "parallel.h"
+#include "pipelinetrace.h"
 #include "policy/policy.h"
 #include "primitives/block.h"
 #include "requestManager.h"
@@ -57,6 +58,7 @@
 #include <queue>
 #include <stack>
 #include <thread>
+#include <unordered_map>
 
 using namespace std;
 
@@ -92,6 +94,13 @@ std::string AcceptDepthValidator(const unsigned int &value, unsigned int *item,
     return std::string();
 }
 
+std::string LockProfilingValidator(const bool &value, CTweak<bool> *item, bool validate)
+{
+    if (!validate)
+        fLockProfiling = item->Value();
+    return std::string();
+}
+
 std::string ExcessiveBlockValidator(const uint64_t &value, uint64_t *item, bool validate)
 {
     if (validate)
@@ -232,43 +241,27 @@ std::string ForkTimeValidator(const uint64_t &value, uint64_t *item, bool valida
 // Push all transactions in the mempool to another node
 void UnlimitedPushTxns(CNode *dest);
 
+/**
+ * The statistics of every message type, sent and received.  They are created by UnlimitedSetup before the network
+ * is started and deleted by UnlimitedCleanup after it is stopped, so they are looked up without cs_statMap.
+ */
+static std::unordered_map<std::string, CStatHistory<uint64_t> *> mapSendMsgStats;
+static std::unordered_map<std::string, CStatHistory<uint64_t> *> mapRecvMsgStats;
+
 void UpdateSendStats(CNode *pfrom, const char *strCommand, int msgSize, int64_t nTime)
 {
     sendAmt += msgSize;
-    std::string name("net/send/msg/");
-    name.append(strCommand);
-    LOCK(cs_statMap);
-    CStatMap::iterator obj = statistics.find(name);
-    CStatMap::iterator end = statistics.end();
-    if (obj != end)
-    {
-        CStatBase *base = obj->second;
-        if (base)
-        {
-            CStatHistory<uint64_t> *stat = dynamic_cast<CStatHistory<uint64_t> *>(base);
-            if (stat)
-                *stat << msgSize;
-        }
-    }
+    auto it = mapSendMsgStats.find(strCommand);
+    if (it != mapSendMsgStats.end())
+        *it->second << msgSize;
 }
 
 void UpdateRecvStats(CNode *pfrom, const std::string &strCommand, int msgSize, int64_t nStopwatchTimeReceived)
 {
     recvAmt += msgSize;
-    std::string name = "net/recv/msg/" + strCommand;
-    LOCK(cs_statMap);
-    CStatMap::iterator obj = statistics.find(name);
-    CStatMap::iterator end = statistics.end();
-    if (obj != end)
-    {
-        CStatBase *base = obj->second;
-        if (base)
-        {
-            CStatHistory<uint64_t> *stat = dynamic_cast<CStatHistory<uint64_t> *>(base);
-            if (stat)
-                *stat << msgSize;
-        }
-    }
+    auto it = mapRecvMsgStats.find(strCommand);
+    if (it != mapRecvMsgStats.end())
+        *it->second << msgSize;
 }
 
 
@@ -482,13 +475,17 @@ void UnlimitedSetup(void)
     txAdded.init("memPool/txAdded");
     poolSize.init("memPool/size", STAT_OP_AVE | STAT_KEEP);
     recvAmt.init("net/recv/total");
-    recvAmt.init("net/send/total");
+    sendAmt.init("net/send/total");
     std::vector<std::string> msgTypes = getAllNetMessageTypes();
 
     for (std::vector<std::string>::const_iterator i = msgTypes.begin(); i != msgTypes.end(); ++i)
     {
-        mallocedStats.push_front(new CStatHistory<uint64_t>("net/recv/msg/" + *i));
-        mallocedStats.push_front(new CStatHistory<uint64_t>("net/send/msg/" + *i));
+        CStatHistory<uint64_t> *recvStat = new CStatHistory<uint64_t>("net/recv/msg/" + *i);
+        CStatHistory<uint64_t> *sendStat = new CStatHistory<uint64_t>("net/send/msg/" + *i);
+        mallocedStats.push_front(recvStat);
+        mallocedStats.push_front(sendStat);
+        mapRecvMsgStats[*i] = recvStat;
+        mapSendMsgStats[*i] = sendStat;
     }
 
     // Start Internal CPU miner
@@ -502,6 +499,7 @@ void UnlimitedCleanup()
 {
     txAdded.Stop();
     poolSize.Stop();
+    nRemoveForBlockTime.Stop();
     recvAmt.Stop();
     sendAmt.Stop();
     nTxValidationTime.Stop();
@@ -510,6 +508,8 @@ void UnlimitedCleanup()
         nBlockValidationTime.Stop();
     }
 
+    mapRecvMsgStats.clear();
+    mapSendMsgStats.clear();
     CStatBase *obj = nullptr;
     while (!mallocedStats.empty())
     {
@@ -1458,6 +1458,187 @@ UniValue getstatlist(const UniValue &params, bool fHelp)
     return ret;
 }
 
+UniValue getlockstats(const UniValue &params, bool fHelp)
+{
+    if (fHelp || params.size() > 3)
+        throw runtime_error(
+            "getlockstats ( count bylock reset )\n"
+            "\nReturns how long locks were waited for and held, by the place in the code they are taken at, with the "
+            "most waited for first.\nLocks are only profiled while the debug.lockProfiling tweak is on.\n"
+            "\nArguments:\n"
+            "1. count   (numeric, optional, default=50) Return this many entries at most, 0 for all of them\n"
+            "2. bylock  (boolean, optional, default=false) Sum up the sites of each lock\n"
+            "3. reset   (boolean, optional, default=false) Start counting from zero after returning the statistics\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,   (boolean) Whether locks are being profiled\n"
+            "  \"locks\": [\n"
+            "    {\n"
+            "      \"lock\": \"name\",      (string) The lock, as it is named where it is taken\n"
+            "      \"site\": \"file:line\", (string) Where it is taken, unless bylock is set\n"
+            "      \"count\": n,          (numeric) How often it was taken\n"
+            "      \"contended\": n,      (numeric) How often it was already held by another thread\n"
+            "      \"wait_us\": n,        (numeric) Total time spent waiting for it\n"
+            "      \"max_wait_us\": n,    (numeric) Longest wait for it\n"
+            "      \"hold_us\": n         (numeric) Total time it was held, recursive locks count every level and "
+            "condition variable waits do not count\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("set", "debug.lockProfiling=true") + HelpExampleCli("getlockstats", "10 true") +
+            HelpExampleRpc("getlockstats", "10, true"));
+
+    const int nCount = (params.size() > 0) ? params[0].get_int() : 50;
+    const bool fByLock = (params.size() > 1) ? params[1].get_bool() : false;
+    const bool fReset = (params.size() > 2) ? params[2].get_bool() : false;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "count must not be negative");
+
+    const std::vector<CLockSiteStats> vStats = GetLockStats(fByLock);
+    if (fReset)
+        ResetLockStats();
+
+    UniValue locks(UniValue::VARR);
+    for (const CLockSiteStats &stats : vStats)
+    {
+        if (nCount != 0 && locks.size() >= (size_t)nCount)
+            break;
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("lock", stats.name);
+        if (!fByLock)
+            entry.pushKV("site", strprintf("%s:%u", stats.file, stats.line));
+        entry.pushKV("count", stats.nCount);
+        entry.pushKV("contended", stats.nContended);
+        entry.pushKV("wait_us", stats.nWaitNanos / 1000);
+        entry.pushKV("max_wait_us", stats.nMaxWaitNanos / 1000);
+        entry.pushKV("hold_us", stats.nHoldNanos / 1000);
+        locks.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("enabled", fLockProfiling.load());
+    ret.pushKV("locks", locks);
+    return ret;
+}
+
+UniValue getpipelinestats(const UniValue &params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getpipelinestats ( reset )\n"
+            "\nReturns latency percentiles of every stage blocks and transactions go through, from the time their "
+            "header or the transaction reached us until they are relayed.\n"
+            "Percentiles are accurate to within 1/16 of their value.\n"
+            "\nArguments:\n"
+            "1. reset   (boolean, optional, default=false) Start over after returning the statistics\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"stage\": {           (object) One of block_receive, block_reconstruct, block_check, block_prefetch,\n"
+            "                          block_connect, block_flush, block_relay, tx_validate and tx_relay\n"
+            "    \"count\": n,        (numeric) How often the stage was timed\n"
+            "    \"mean_us\": n,      (numeric) Mean time spent in it\n"
+            "    \"p50_us\": n,       (numeric) Median time spent in it\n"
+            "    \"p90_us\": n,\n"
+            "    \"p99_us\": n,\n"
+            "    \"p999_us\": n,\n"
+            "    \"max_us\": n        (numeric) Longest time spent in it\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getpipelinestats", "") + HelpExampleRpc("getpipelinestats", ""));
+
+    const bool fReset = (params.size() > 0) ? params[0].get_bool() : false;
+
+    UniValue ret(UniValue::VOBJ);
+    for (int i = 0; i < PIPELINE_STAGES; i++)
+    {
+        const PipelineStage stage = (PipelineStage)i;
+        const CLatencyHistogram &histogram = pipelineTrace.Histogram(stage);
+        const uint64_t nCount = histogram.Count();
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("count", nCount);
+        entry.pushKV("mean_us", nCount ? histogram.Sum() / nCount : 0);
+        entry.pushKV("p50_us", histogram.Percentile(50));
+        entry.pushKV("p90_us", histogram.Percentile(90));
+        entry.pushKV("p99_us", histogram.Percentile(99));
+        entry.pushKV("p999_us", histogram.Percentile(99.9));
+        entry.pushKV("max_us", histogram.Max());
+        ret.pushKV(PipelineStageName(stage), entry);
+    }
+    if (fReset)
+        pipelineTrace.Clear();
+    return ret;
+}
+
+UniValue getpipelinetrace(const UniValue &params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getpipelinetrace ( \"hash\" chrome )\n"
+            "\nReturns the most recent stages that blocks and transactions went through, oldest first.\n"
+            "\nArguments:\n"
+            "1. \"hash\"   (string, optional) Only return the stages of this block or transaction\n"
+            "2. chrome   (boolean, optional, default=false) Return the trace in the Chrome trace event format, which "
+            "chrome://tracing and Perfetto load\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"hash\": \"hash\",    (string) The block or transaction\n"
+            "    \"stage\": \"name\",   (string) The stage, as named by getpipelinestats\n"
+            "    \"thread\": n,       (numeric) Identifies the thread the stage ran on\n"
+            "    \"start_us\": n,     (numeric) When the stage started, on a monotonic clock\n"
+            "    \"duration_us\": n   (numeric) How long the stage took\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getpipelinetrace", "") + HelpExampleCli("getpipelinetrace", "\"\" true > trace.json") +
+            HelpExampleRpc("getpipelinetrace", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\""));
+
+    uint256 hash;
+    const bool fHash = (params.size() > 0) && !params[0].get_str().empty();
+    if (fHash)
+        hash = ParseHashV(params[0], "hash");
+    const bool fChrome = (params.size() > 1) ? params[1].get_bool() : false;
+
+    const std::vector<CPipelineEvent> vEvents = pipelineTrace.GetEvents(fHash ? &hash : nullptr);
+    UniValue events(UniValue::VARR);
+    for (const CPipelineEvent &event : vEvents)
+    {
+        UniValue entry(UniValue::VOBJ);
+        if (fChrome)
+        {
+            // a complete event, times are in microseconds
+            entry.pushKV("name", PipelineStageName(event.stage));
+            entry.pushKV("cat", IsBlockPipelineStage(event.stage) ? "block" : "tx");
+            entry.pushKV("ph", "X");
+            entry.pushKV("ts", event.nStartNanos / 1000.0);
+            entry.pushKV("dur", event.nDurationNanos / 1000.0);
+            entry.pushKV("pid", 1);
+            entry.pushKV("tid", (uint64_t)event.nThread);
+            UniValue args(UniValue::VOBJ);
+            args.pushKV("hash", event.hash.GetHex());
+            entry.pushKV("args", args);
+        }
+        else
+        {
+            entry.pushKV("hash", event.hash.GetHex());
+            entry.pushKV("stage", PipelineStageName(event.stage));
+            entry.pushKV("thread", (uint64_t)event.nThread);
+            entry.pushKV("start_us", event.nStartNanos / 1000);
+            entry.pushKV("duration_us", event.nDurationNanos / 1000);
+        }
+        events.push_back(entry);
+    }
+    if (!fChrome)
+        return events;
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("traceEvents", events);
+    ret.pushKV("displayTimeUnit", "ms");
+    return ret;
+}
+
 UniValue getstat(const UniValue &params, bool fHelp)
 {
     string specificIssue;
@@ -2036,6 +2217,9 @@ static const CRPCCommand commands[] =
     /* Utility functions */
     { "util",               "getstatlist",            &getstatlist,            true  },
     { "util",               "getstat",                &getstat,                true  },
+    { "util",               "getlockstats",           &getlockstats,           true  },
+    { "util",               "getpipelinestats",       &getpipelinestats,       true  },
+    { "util",               "getpipelinetrace",       &getpipelinetrace,       true  },
     { "util",               "get",                    &gettweak,               true  },
     { "util",               "set",                    &settweak,               true  },
     { "util",               "validatechainhistory",   &validatechainhistory,   true  },
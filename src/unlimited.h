@@ -195,6 +195,11 @@ extern UniValue getstatlist(const UniValue &params, bool fHelp);
 // RPC Get a particular statistic
 extern UniValue getstat(const UniValue &params, bool fHelp);
 
+// RPC Get the lock contention statistics collected while debug.lockProfiling is on
+extern UniValue getlockstats(const UniValue &params, bool fHelp);
+extern UniValue getpipelinestats(const UniValue &params, bool fHelp);
+extern UniValue getpipelinetrace(const UniValue &params, bool fHelp);
+
 // RPC debugging Get sizes of every data structure
 extern UniValue getstructuresizes(const UniValue &params, bool fHelp);
 
@@ -265,6 +270,8 @@ void UpdateRecvStats(CNode *pfrom, const std::string &strCommand, int msgSize, i
 // txn mempool statistics
 extern CStatHistory<unsigned int> txAdded;
 extern CStatHistory<uint64_t, MinValMax<uint64_t> > poolSize;
+// microseconds spent holding the mempool lock while removing a block's transactions
+extern CStatHistory<uint64_t> nRemoveForBlockTime;
 
 // Configuration variable validators
 bool MiningAndExcessiveBlockValidatorRule(const uint64_t newExcessiveBlockSize, const uint64_t newMiningBlockSize);
@@ -278,6 +285,8 @@ std::string MiningBlockSizeValidator(const uint64_t &value, uint64_t *item, bool
 std::string Bip135VoteValidator(const std::string &value, std::string *item, bool validate);
 // ensure that only 1 fork is active
 std::string ForkTimeValidator(const uint64_t &value, uint64_t *item, bool validate);
+// switches lock profiling on and off
+std::string LockProfilingValidator(const bool &value, CTweak<bool> *item, bool validate);
 
 extern CTweak<unsigned int> maxTxSize;
 extern CTweak<uint64_t> coinbaseReserve;
@@ -14,12 +14,14 @@
 
 #include "chainparamsbase.h"
 #include "fs.h"
+#include "logwriter.h"
 #include "random.h"
 #include "serialize.h"
 #include "sync.h"
 #include "utilstrencodings.h"
 #include "utiltime.h"
 
+#include <atomic>
 #include <condition_variable>
 #include <iomanip>
 #include <mutex>
@@ -358,6 +360,12 @@ std::once_flag debugPrintInitFlag;
 static FILE *fileout = nullptr;
 static boost::mutex *mutexDebugLog = nullptr;
 static std::list<std::string> *vMsgsBeforeOpenLog;
+/**
+ * Set while debug.log is written by pAsyncLog's thread.  pAsyncLog is leaked like the above, since threads may still
+ * be logging when it is stopped.
+ */
+static std::atomic<bool> fAsyncLog{false};
+static CAsyncLogWriter *pAsyncLog = nullptr;
 
 static int FileWriteStr(const std::string &str, FILE *fp) { return fwrite(str.data(), 1, str.size(), fp); }
 static void DebugPrintInit()
@@ -422,15 +430,17 @@ static std::string LogTimestampStr(const std::string &str, std::string &logbuf)
     return result;
 }
 
-static void MonitorLogfile()
+static void MonitorLogfile(size_t nLines)
 {
     // Check if debug.log has been deleted or moved.
     // If so re-open
-    static int existcounter = 1;
+    // The async log writer writes many lines in one go, so count lines rather than writes
+    static size_t nLinesSinceCheck = 0;
     static fs::path fileName = GetDataDir() / "debug.log";
-    existcounter++;
-    if (existcounter % 63 == 0) // Check every 64 log msgs
+    nLinesSinceCheck += nLines;
+    if (nLinesSinceCheck >= 64) // Check every 64 log lines
     {
+        nLinesSinceCheck = 0;
         bool exists = boost::filesystem::exists(fileName);
         if (!exists)
             fReopenDebugLog = true;
@@ -441,10 +451,55 @@ void LogFlush()
 {
     if (fPrintToDebugLog)
     {
+        if (fAsyncLog.load())
+            pAsyncLog->Flush();
         fflush(fileout);
     }
 }
 
+/** Write lines to debug.log, reopening it first if requested.  Precondition: the log is open */
+static int WriteDebugLog(const std::string &str)
+{
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    // reopen the log file, if requested
+    if (fReopenDebugLog)
+    {
+        fReopenDebugLog = false;
+        fs::path pathDebug = GetDataDir() / "debug.log";
+        if (fsbridge::freopen(pathDebug, "a", fileout) != nullptr)
+            setbuf(fileout, nullptr); // unbuffered
+    }
+
+    int ret = FileWriteStr(str, fileout);
+    MonitorLogfile(std::count(str.begin(), str.end(), '\n'));
+    return ret;
+}
+
+void StartAsyncLog()
+{
+    std::call_once(debugPrintInitFlag, &DebugPrintInit);
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        if (fileout == nullptr || fAsyncLog.load())
+            return;
+    }
+    // the writer is kept across a stop, so that a restart picks up its thread again and its dropped line count
+    if (pAsyncLog == nullptr)
+        pAsyncLog = new CAsyncLogWriter([](const std::string &str) { WriteDebugLog(str); });
+    else
+        pAsyncLog->Start();
+    fAsyncLog = true;
+}
+
+void StopAsyncLog()
+{
+    if (!fAsyncLog.exchange(false))
+        return;
+    pAsyncLog->Stop();
+}
+
+uint64_t GetLogDropped() { return pAsyncLog ? pAsyncLog->Dropped() : 0; }
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
@@ -462,30 +517,27 @@ int LogPrintStr(const std::string &str)
     }
     if (fPrintToDebugLog)
     {
-        std::call_once(debugPrintInitFlag, &DebugPrintInit);
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        // buffer if we haven't opened the log yet
-        if (fileout == nullptr)
+        // the line was formatted by this thread, hand it over to the writer thread without copying it
+        if (fAsyncLog.load())
         {
-            assert(vMsgsBeforeOpenLog);
-            ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
+            const int nLength = strTimestamped.length();
+            return pAsyncLog->Push(std::move(strTimestamped)) ? nLength : 0;
         }
-        else
+
+        std::call_once(debugPrintInitFlag, &DebugPrintInit);
         {
-            // reopen the log file, if requested
-            if (fReopenDebugLog)
+            boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+
+            // buffer if we haven't opened the log yet
+            if (fileout == nullptr)
             {
-                fReopenDebugLog = false;
-                fs::path pathDebug = GetDataDir() / "debug.log";
-                if (fsbridge::freopen(pathDebug, "a", fileout) != nullptr)
-                    setbuf(fileout, nullptr); // unbuffered
+                assert(vMsgsBeforeOpenLog);
+                ret = strTimestamped.length();
+                vMsgsBeforeOpenLog->push_back(strTimestamped);
+                return ret;
             }
-
-            ret = FileWriteStr(strTimestamped, fileout);
-            MonitorLogfile();
         }
+        ret = WriteDebugLog(strTimestamped);
     }
     return ret;
 }
@@ -17,6 +17,7 @@
 #include "expedited.h"
 #include "index/txindex.h"
 #include "init.h"
+#include "pipelinetrace.h"
 #include "requestManager.h"
 #include "sync.h"
 #include "timedata.h"
@@ -29,6 +30,7 @@
 
 #include <algorithm>
 #include <boost/scope_exit.hpp>
+#include <unordered_map>
 #include <unordered_set>
 
 extern CTweak<unsigned int> unconfPushAction;
@@ -293,6 +295,7 @@ bool AcceptBlockHeader(const CBlockHeader &block,
     {
         LOCK(cs_main);
         pindex = AddToBlockIndex(block);
+        pipelineTrace.Start(hash);
     }
 
     if (ppindex)
@@ -413,15 +416,7 @@ bool LoadBlockIndexDB()
     // through the index files and load the block index. While this is a bit of a hack, it has an enormous
     // effect on speeding up the reading in of the block index data particularly when the index data is stored
     // on spinning disk. The problem appears to lie in some issue with leveldb cache innefficiency.
-    fs::path path_index;
-    if (BLOCK_DB_MODE == SEQUENTIAL_BLOCK_FILES)
-    {
-        path_index = GetDataDir() / "blocks" / "index";
-    }
-    else
-    {
-        path_index = GetDataDir() / "blockdb" / "index";
-    }
+    fs::path path_index = GetDataDir() / GetBlockStorageDir(BLOCK_DB_MODE) / "index";
     std::vector<fs::path> vIndexFiles;
     std::copy(fs::directory_iterator(path_index), fs::directory_iterator(), std::back_inserter(vIndexFiles));
     for (const auto path_file : vIndexFiles)
@@ -470,13 +465,12 @@ bool LoadBlockIndexDB()
     WRITELOCK(cs_mapBlockIndex);
     try
     {
-        if (BLOCK_DB_MODE == SEQUENTIAL_BLOCK_FILES)
+        for (int mode = 0; mode < END_STORAGE_OPTIONS; mode++)
         {
-            fs::remove_all(GetDataDir() / "blockdb");
-        }
-        else
-        {
-            fs::remove_all(GetDataDir() / "blocks");
+            if (mode != BLOCK_DB_MODE)
+            {
+                fs::remove_all(GetDataDir() / GetBlockStorageDir(static_cast<BlockDBMode>(mode)));
+            }
         }
     }
     catch (boost::filesystem::filesystem_error const &e)
@@ -579,6 +573,24 @@ bool LoadBlockIndexDB()
             pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
         }
         LOGA("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
+        if (fHavePruned)
+        {
+            // Pruned files that were still waiting to be deleted when we stopped
+            std::set<int> setPrunedFiles;
+            for (int nFile = 0; nFile < nLastBlockFile; nFile++)
+            {
+                if (vinfoBlockFile[nFile].nSize == 0 && !setBlkDataFiles.count(nFile) &&
+                    fs::exists(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk")))
+                {
+                    setPrunedFiles.insert(nFile);
+                }
+            }
+            if (!setPrunedFiles.empty())
+            {
+                LOGA("%s: deleting %u block files left over from pruning\n", __func__, setPrunedFiles.size());
+                UnlinkPrunedFiles(setPrunedFiles);
+            }
+        }
         for (int nFile = nLastBlockFile + 1; true; nFile++)
         {
             CBlockFileInfo info;
@@ -651,6 +663,7 @@ void UnloadBlockIndex()
         ResetASERTAnchorBlockCache();
         mapBlocksUnlinked.clear();
         vinfoBlockFile.clear();
+        ClearBlockFileLists();
         mapBlockSource.clear();
         setDirtyBlockIndex.clear();
         setDirtyFileInfo.clear();
@@ -1668,6 +1681,7 @@ bool CheckBlock(const CBlock &block, CValidationState &state, bool fCheckPOW, bo
 
     if (block.fChecked)
         return true;
+    CPipelineTimer timer(PIPELINE_BLOCK_CHECK, block.GetHash());
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
@@ -1733,6 +1747,7 @@ bool ReceivedBlockTransactions(const CBlock &block,
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
+    AddBlockToFileList(pindexNew);
 
     if (block.fExcessive)
     {
@@ -2700,6 +2715,34 @@ bool ConnectBlockCanonicalOrdering(const CBlock &block,
 }
 
 
+/**
+ * Outputs of one transaction are next to each other in the UTXO db.  If a block spends several outputs of a
+ * transaction that are not cached yet, one range read gets all of them rather than a lookup for every input.
+ */
+static void PrefetchBlockInputs(const CBlock &block, CCoinsViewCache &view)
+{
+    std::unordered_map<uint256, int, BlockHasher> mapUncached;
+    std::unordered_set<uint256, BlockHasher> setBlockTxids;
+    for (const CTransactionRef &tx : block.vtx)
+    {
+        setBlockTxids.insert(tx->GetHash());
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn &txin : tx->vin)
+        {
+            bool fSpent;
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout, fSpent))
+                mapUncached[txin.prevout.hash]++;
+        }
+    }
+    for (const std::pair<const uint256, int> &item : mapUncached)
+    {
+        // outputs created in this block are not in the db yet
+        if (item.second > 1 && !setBlockTxids.count(item.first))
+            view.PrefetchCoins(item.first);
+    }
+}
+
 bool ConnectBlock(const CBlock &block,
     CValidationState &state,
     CBlockIndex *pindex,
@@ -2732,6 +2775,10 @@ bool ConnectBlock(const CBlock &block,
 
     if (!ConnectBlockPrevalidations(block, state, pindex, view, chainparams, fJustCheck))
         return false;
+    {
+        CPipelineTimer timer(PIPELINE_BLOCK_PREFETCH, pindex->GetBlockHash());
+        PrefetchBlockInputs(block, view);
+    }
 
     const arith_uint256 nStartingChainWork = chainActive.Tip()->nChainWork;
 
@@ -2753,6 +2800,7 @@ bool ConnectBlock(const CBlock &block,
 
     CAmount nFees = 0;
     CBlockUndo blockundo;
+    blockundo.nFormat = fCompactUndo ? UNDO_FORMAT_COMPACT : UNDO_FORMAT_LEGACY;
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
 
@@ -3113,9 +3161,8 @@ static void ResubmitTransactions(CBlock *block = nullptr)
     // quickly to a very common operation mode.  If we do not do this, we must guarantee that all tx coming from
     // the block get injected into the mempool to ensure that any mempool tx that relies on an input from this
     // block doesn't get orphaned but remain in the mempool.
-    // The performance of doing it this way is surprisingly ok, even though it seems like more work,
-    // because the readmission code is multithreaded and very efficient, yet the code to slip a tx back into a
-    // dependency chain in the mempool performed terribly.
+    // The transactions are held back until the reorg is finished (see ReadmitReorgTransactions), so that a
+    // multi-block reorg validates them once, against the new tip, in dependency order and in parallel.
     //
     // We must hold the mempool lock throughout otherwise it would be possible for some txns to slip back into
     // the mempool from the csCommitQFinal.
@@ -3124,28 +3171,21 @@ static void ResubmitTransactions(CBlock *block = nullptr)
     DbgAssert(txProcessingCorral.region() != CORRAL_TX_COMMITMENT, LOGA("Resubmit transactions during tx commitment"));
     LOG(MEMPOOL, "Clearing mempool and resubmitting transactions");
     {
+        std::vector<CTransactionRef> vtx;
+        vtx.reserve((block ? block->vtx.size() : 0) + mempool._size());
         if (block)
         {
             // Resubmit the block first
             for (const auto &ptx : block->vtx)
             {
                 if (!ptx->IsCoinBase())
-                {
-                    CTxInputData txd;
-                    txd.tx = ptx;
-                    txd.nodeName = "rollback";
-                    EnqueueTxForAdmission(txd);
-                }
+                    vtx.push_back(ptx);
             }
         }
 
         // Resubmit and clear the mempool
-        mempool._forEachThenClear([](const auto &entry) {
-            CTxInputData txd;
-            txd.tx = entry.GetSharedTx();
-            txd.nodeName = "rollback";
-            EnqueueTxForAdmission(txd);
-        });
+        mempool._forEachThenClear([&vtx](const auto &entry) { vtx.push_back(entry.GetSharedTx()); });
+        QueueReorgReadmission(vtx);
 
         // Resumbit and clear all txns currently in the txCommitQ and txCommitQFinal
         mempool.ResubmitCommitQ();
@@ -3260,7 +3300,9 @@ bool ConnectTip(CValidationState &state,
     LOG(BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
+        const uint64_t nConnectStart = GetStopwatch();
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, fParallel);
+        pipelineTrace.Record(PIPELINE_BLOCK_CONNECT, pindexNew->GetBlockHash(), nConnectStart, GetStopwatch());
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv)
         {
@@ -3272,7 +3314,11 @@ bool ConnectTip(CValidationState &state,
             return false;
         }
         int64_t nStart = GetStopwatchMicros();
-        bool result = view.Flush();
+        bool result;
+        {
+            CPipelineTimer timer(PIPELINE_BLOCK_FLUSH, pindexNew->GetBlockHash());
+            result = view.Flush();
+        }
         nBlockSizeAtChainTip.store(pblock->GetBlockSize());
         assert(result);
         LOG(BENCH, "      - Update Coins %.3fms\n", GetStopwatchMicros() - nStart);
@@ -3619,6 +3665,8 @@ bool ActivateBestChainStep(CValidationState &state,
                     }
                 }
             }
+            for (const uint256 &hash : vHashes)
+                pipelineTrace.RecordSinceStart(PIPELINE_BLOCK_RELAY, hash);
         }
     }
 